@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * bench.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "bench.h"
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#define DEFAULT_RUNS (3)
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void bench_start(bench_t *b)
+{
+	b->start = get_time();
+}
+
+void bench_stop(bench_t *b)
+{
+	b->elapsed += get_time() - b->start;
+}
+
+static unsigned int get_runs(void)
+{
+	const char *str = getenv("BENCH_RUNS");
+	long value;
+
+	if (str == NULL)
+		return DEFAULT_RUNS;
+
+	value = strtol(str, NULL, 10);
+	return value < 1 ? 1 : (value > INT_MAX ? INT_MAX : value);
+}
+
+uint64_t bench_scaled(uint64_t value)
+{
+	const char *str = getenv("BENCH_SCALE");
+	double scale;
+
+	if (str == NULL)
+		return value;
+
+	scale = strtod(str, NULL);
+	if (scale <= 0.0)
+		return value;
+
+	value = (uint64_t)(value * scale);
+	return value < 1 ? 1 : value;
+}
+
+int bench_run(const char *suite, const char *name, const char *variant,
+	      bench_fun_t fun, void *user)
+{
+	unsigned int i, runs = get_runs();
+	bench_t best, b;
+	double seconds;
+
+	memset(&best, 0, sizeof(best));
+
+	for (i = 0; i < runs; ++i) {
+		memset(&b, 0, sizeof(b));
+
+		if (fun(&b, user)) {
+			fprintf(stderr, "%s/%s/%s: benchmark failed.\n",
+				suite, name, variant);
+			return -1;
+		}
+
+		if (i == 0 || b.elapsed < best.elapsed)
+			best = b;
+	}
+
+	seconds = best.elapsed / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	printf("{\"suite\":\"%s\",\"bench\":\"%s\",\"variant\":\"%s\","
+	       "\"runs\":%u,\"ops\":%" PRIu64 ",\"bytes\":%" PRIu64 ","
+	       "\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+	       "\"mib_per_sec\":%.2f}\n",
+	       suite, name, variant, runs, best.ops, best.bytes, seconds,
+	       best.ops / seconds, best.bytes / seconds / (1024.0 * 1024.0));
+	fflush(stdout);
+	return 0;
+}
+
+void bench_rng_init(bench_rng_t *rng, uint64_t seed)
+{
+	rng->state = seed ? seed : 0x9E3779B97F4A7C15UL;
+}
+
+uint64_t bench_rng_next(bench_rng_t *rng)
+{
+	uint64_t x = rng->state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+
+	return x * 0x2545F4914F6CDD1DUL;
+}
+
+uint64_t bench_rng_range(bench_rng_t *rng, uint64_t min, uint64_t max)
+{
+	return min + bench_rng_next(rng) % (max - min + 1);
+}
+
+void bench_rng_fill(bench_rng_t *rng, void *data, size_t size)
+{
+	uint8_t *ptr = data;
+	uint64_t value;
+	size_t diff;
+
+	while (size > 0) {
+		value = bench_rng_next(rng);
+		diff = size < sizeof(value) ? size : sizeof(value);
+
+		memcpy(ptr, &value, diff);
+		ptr += diff;
+		size -= diff;
+	}
+}
+
+int bench_temp_file(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char path[PATH_MAX];
+	int fd;
+
+	if (dir == NULL || *dir == '\0')
+		dir = "/tmp";
+
+	snprintf(path, sizeof(path), "%s/imgtool-bench-XXXXXX", dir);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	unlink(path);
+	return fd;
+}
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * bench.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "config.h"
+#include "predef.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+  A single measurement. The benchmark function does its setup, then
+  brackets the code to measure with bench_start and bench_stop and
+  reports how many operations it did and how many bytes it processed.
+ */
+typedef struct {
+	uint64_t start;
+	uint64_t elapsed;
+
+	uint64_t ops;
+	uint64_t bytes;
+} bench_t;
+
+typedef int (*bench_fun_t)(bench_t *b, void *user);
+
+/* xorshift64* generator, so all runs see the same input */
+typedef struct {
+	uint64_t state;
+} bench_rng_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bench_start(bench_t *b);
+
+void bench_stop(bench_t *b);
+
+/*
+  Run a benchmark function several times (BENCH_RUNS from the environment,
+  default 3) and print the fastest run as a line of JSON to stdout:
+
+    {"suite":...,"bench":...,"variant":...,"runs":...,"ops":...,
+     "bytes":...,"seconds":...,"ops_per_sec":...,"mib_per_sec":...}
+
+  Returns 0 on success, -1 if the benchmark function failed.
+ */
+int bench_run(const char *suite, const char *name, const char *variant,
+	      bench_fun_t fun, void *user);
+
+/*
+  Scale factor for the problem sizes, taken from BENCH_SCALE in the
+  environment (default 1.0). Returns the scaled value, at least 1.
+ */
+uint64_t bench_scaled(uint64_t value);
+
+void bench_rng_init(bench_rng_t *rng, uint64_t seed);
+
+uint64_t bench_rng_next(bench_rng_t *rng);
+
+/* random number in the range [min, max] */
+uint64_t bench_rng_range(bench_rng_t *rng, uint64_t min, uint64_t max);
+
+void bench_rng_fill(bench_rng_t *rng, void *data, size_t size);
+
+/*
+  Create an unlinked temporary file in $TMPDIR, or /tmp.
+  Returns a file descriptor or -1 on failure.
+ */
+int bench_temp_file(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BENCH_H */
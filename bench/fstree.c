@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * fstree.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "bench.h"
+#include "fstree.h"
+#include "volume.h"
+
+#include <inttypes.h>
+#include <unistd.h>
+
+#define MAX_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+	uint64_t data_size;
+	uint64_t file_count;
+	uint64_t gap_count;
+	uint64_t sort_fanout;
+	uint64_t sort_leaves;
+	uint8_t *data;
+} context_t;
+
+static fstree_t *create_fstree(void)
+{
+	volume_t *vol;
+	fstree_t *fs;
+	int fd;
+
+	fd = bench_temp_file();
+	if (fd < 0)
+		return NULL;
+
+	vol = volume_from_fd("bench", fd, 0xFFFFFFFFFFFFFFFFUL);
+	if (vol == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	fs = fstree_create(vol);
+	object_drop(vol);
+	return fs;
+}
+
+/* fill the tree with equally sized files, stored back to back */
+static int add_files(const context_t *ctx, fstree_t *fs)
+{
+	uint64_t i, size = ctx->data_size / ctx->file_count;
+	tree_node_t *n;
+	char name[32];
+
+	for (i = 0; i < ctx->file_count; ++i) {
+		sprintf(name, "file%" PRIu64, i);
+
+		n = fstree_add_file(fs, name);
+		if (n == NULL)
+			return -1;
+
+		if (fstree_file_append(fs, n, ctx->data + i * size, size))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_append(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint64_t i, size, offset, per_file;
+	tree_node_t *n = NULL;
+	bench_rng_t rng;
+	char name[32];
+	fstree_t *fs;
+	int ret = 0;
+
+	fs = create_fstree();
+	if (fs == NULL)
+		return -1;
+
+	bench_rng_init(&rng, 1);
+	per_file = ctx->data_size / ctx->file_count;
+
+	bench_start(b);
+	for (i = 0, offset = 0; offset < ctx->data_size; ++b->ops) {
+		if (n == NULL || n->data.file.size >= per_file) {
+			sprintf(name, "file%" PRIu64, i++);
+
+			n = fstree_add_file(fs, name);
+			if (n == NULL) {
+				ret = -1;
+				break;
+			}
+		}
+
+		size = bench_rng_range(&rng, 1, MAX_CHUNK_SIZE);
+		if (size > ctx->data_size - offset)
+			size = ctx->data_size - offset;
+
+		ret = fstree_file_append(fs, n, ctx->data + offset, size);
+		if (ret != 0)
+			break;
+
+		offset += size;
+	}
+	bench_stop(b);
+
+	b->bytes = offset;
+	object_drop(fs);
+	return ret;
+}
+
+/*
+  Move every file to the end once, always the one that is currently in
+  front, so each move shifts all the data behind it.
+ */
+static int bench_move_to_end(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	tree_node_t *n;
+	fstree_t *fs;
+	int ret = 0;
+
+	fs = create_fstree();
+	if (fs == NULL)
+		return -1;
+
+	if (add_files(ctx, fs)) {
+		object_drop(fs);
+		return -1;
+	}
+
+	bench_start(b);
+	for (n = fs->nodes_by_type[TREE_NODE_FILE]; n != NULL;
+	     n = n->next_by_type) {
+		ret = fstree_file_move_to_end(fs, n);
+		if (ret != 0)
+			break;
+
+		b->ops += 1;
+		b->bytes += ctx->data_size;
+	}
+	bench_stop(b);
+
+	object_drop(fs);
+	return ret;
+}
+
+static int bench_add_gap(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint64_t i, index, size;
+	bench_rng_t rng;
+	fstree_t *fs;
+	int ret = 0;
+
+	fs = create_fstree();
+	if (fs == NULL)
+		return -1;
+
+	if (add_files(ctx, fs)) {
+		object_drop(fs);
+		return -1;
+	}
+
+	bench_rng_init(&rng, 2);
+
+	bench_start(b);
+	for (i = 0; i < ctx->gap_count; ++i) {
+		index = bench_rng_range(&rng, 0, fs->data_offset - 1);
+		size = bench_rng_range(&rng, 1, 4) * fs->volume->blocksize;
+
+		b->bytes += (fs->data_offset - index) * fs->volume->blocksize;
+
+		ret = fstree_add_gap(fs, index, size);
+		if (ret != 0)
+			break;
+	}
+	bench_stop(b);
+
+	b->ops = ctx->gap_count;
+	object_drop(fs);
+	return ret;
+}
+
+/*
+  A three level directory hierarchy, with the files in each directory
+  added under random names. Only the sort itself is measured.
+ */
+static int bench_sort(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint64_t i, j, k;
+	bench_rng_t rng;
+	char path[96];
+	fstree_t *fs;
+	int ret = -1;
+
+	fs = create_fstree();
+	if (fs == NULL)
+		return -1;
+
+	bench_rng_init(&rng, 3);
+
+	for (i = 0; i < ctx->sort_fanout; ++i) {
+		for (j = 0; j < ctx->sort_fanout; ++j) {
+			for (k = 0; k < ctx->sort_leaves; ++k) {
+				sprintf(path, "dir%" PRIu64 "/dir%" PRIu64
+					"/file%016" PRIx64, i, j,
+					bench_rng_next(&rng));
+
+				if (fstree_add_file(fs, path) == NULL)
+					goto out;
+
+				b->ops += 1;
+			}
+		}
+	}
+
+	bench_start(b);
+	fstree_sort(fs);
+	bench_stop(b);
+
+	ret = 0;
+out:
+	object_drop(fs);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	bench_fun_t fun;
+} benchmarks[] = {
+	{ "fstree_file_append", bench_append },
+	{ "fstree_file_move_to_end", bench_move_to_end },
+	{ "fstree_add_gap", bench_add_gap },
+	{ "fstree_sort", bench_sort },
+};
+
+int main(void)
+{
+	bench_rng_t rng;
+	context_t ctx;
+	int ret = 0;
+	size_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.data_size = bench_scaled(16 * 1024 * 1024);
+	ctx.file_count = 64;
+	ctx.gap_count = 64;
+	ctx.sort_fanout = 100;
+	ctx.sort_leaves = bench_scaled(100);
+
+	ctx.data = malloc(ctx.data_size);
+	if (ctx.data == NULL) {
+		perror("allocating benchmark data");
+		return EXIT_FAILURE;
+	}
+
+	bench_rng_init(&rng, 42);
+	bench_rng_fill(&rng, ctx.data, ctx.data_size);
+
+	for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+		if (bench_run("fstree", benchmarks[i].name, "file",
+			      benchmarks[i].fun, &ctx)) {
+			ret = -1;
+		}
+	}
+
+	free(ctx.data);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
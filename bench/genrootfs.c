@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * genrootfs.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "rootfs.h"
+
+#include <time.h>
+
+static struct option long_opts[] = {
+	ROOTFS_LONG_OPTS,
+	{ "tar", required_argument, NULL, 't' },
+	{ "dir", required_argument, NULL, 'd' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = ROOTFS_SHORT_OPTS "t:d:h";
+
+static const char *help_string =
+"Usage: %s [OPTIONS...]\n"
+"\n"
+"Generate a synthetic root filesystem, as a tar archive and/or as a\n"
+"directory tree. Both contain exactly the same files.\n"
+"\n"
+"  --tar, -t <file>        Write a GNU tar archive.\n"
+"  --dir, -d <path>        Create a directory tree. It must not exist.\n"
+"\n"
+ROOTFS_HELP
+"\n";
+
+int main(int argc, char **argv)
+{
+	const char *tar_path = NULL, *dir_path = NULL;
+	struct timespec start, end;
+	rootfs_params_t params;
+	rootfs_stats_t stats;
+	int i;
+
+	rootfs_params_init(&params);
+
+	for (;;) {
+		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 't':
+			tar_path = optarg;
+			break;
+		case 'd':
+			dir_path = optarg;
+			break;
+		case 'h':
+			printf(help_string, argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			if (rootfs_parse_option(&params, i, optarg) != 0)
+				goto fail_arg;
+			break;
+		}
+	}
+
+	if (optind < argc) {
+		fputs("Unknown extra arguments specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (tar_path == NULL && dir_path == NULL) {
+		fputs("Neither a tar archive nor a directory specified.\n",
+		      stderr);
+		goto fail_arg;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (rootfs_generate(&params, tar_path, dir_path, &stats))
+		return EXIT_FAILURE;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	rootfs_print_stats(&params, &stats,
+			   (end.tv_sec - start.tv_sec) +
+			   (end.tv_nsec - start.tv_nsec) / 1e9);
+	return EXIT_SUCCESS;
+fail_arg:
+	fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
+	return EXIT_FAILURE;
+}
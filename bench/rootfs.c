@@ -0,0 +1,562 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * rootfs.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "rootfs.h"
+#include "fstream.h"
+#include "util.h"
+#include "tar.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define SPARSE_CHUNK (4096)
+
+/* 2021-01-01, so the archives are reproducible */
+#define MTIME (1609459200)
+
+typedef struct {
+	const rootfs_params_t *params;
+	rootfs_stats_t *stats;
+	bench_rng_t rng;
+
+	ostream_t *tar;
+	const char *dir_path;
+
+	/* path of each directory relative to the root, dirs[0] is the root */
+	char **dirs;
+	uint64_t dir_count;
+
+	uint8_t *buffer;
+} generator_t;
+
+void rootfs_params_init(rootfs_params_t *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->file_count = 500;
+	params->fanout = 32;
+	params->min_size = 0;
+	params->max_size = 64 * 1024;
+	params->hardlink_ratio = 0.02;
+	params->sparse_ratio = 0.01;
+	params->seed = 1;
+}
+
+static int parse_size(const char *arg, uint64_t *out)
+{
+	uintmax_t value;
+	char *end;
+
+	errno = 0;
+	value = strtoumax(arg, &end, 10);
+	if (errno != 0 || end == arg)
+		goto fail;
+
+	switch (*end) {
+	case 'G':
+		value *= 1024;
+		/* fall-through */
+	case 'M':
+		value *= 1024;
+		/* fall-through */
+	case 'K':
+		value *= 1024;
+		++end;
+		break;
+	default:
+		break;
+	}
+
+	if (*end != '\0')
+		goto fail;
+
+	*out = value;
+	return 0;
+fail:
+	fprintf(stderr, "Invalid number `%s'.\n", arg);
+	return -1;
+}
+
+static int parse_ratio(const char *arg, double *out)
+{
+	char *end;
+
+	*out = strtod(arg, &end);
+
+	if (end == arg || *end != '\0' || *out < 0.0 || *out > 1.0) {
+		fprintf(stderr, "Invalid ratio `%s', expected a value "
+			"between 0 and 1.\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+int rootfs_parse_option(rootfs_params_t *params, int opt, const char *arg)
+{
+	switch (opt) {
+	case 'N':
+		return parse_size(arg, &params->file_count);
+	case 'f':
+		return parse_size(arg, &params->fanout);
+	case 'm':
+		return parse_size(arg, &params->min_size);
+	case 'M':
+		return parse_size(arg, &params->max_size);
+	case 'L':
+		return parse_ratio(arg, &params->hardlink_ratio);
+	case 'S':
+		return parse_ratio(arg, &params->sparse_ratio);
+	case 'r':
+		return parse_size(arg, &params->seed);
+	default:
+		break;
+	}
+
+	return 1;
+}
+
+void rootfs_print_stats(const rootfs_params_t *params,
+			const rootfs_stats_t *stats, double seconds)
+{
+	printf("{\"suite\":\"scale\",\"bench\":\"generate\","
+	       "\"variant\":\"files=%" PRIu64 "\",\"fanout\":%" PRIu64 ","
+	       "\"min_size\":%" PRIu64 ",\"max_size\":%" PRIu64 ","
+	       "\"hardlink_ratio\":%.3f,\"sparse_ratio\":%.3f,"
+	       "\"seed\":%" PRIu64 ",\"dirs\":%" PRIu64 ","
+	       "\"files\":%" PRIu64 ",\"hard_links\":%" PRIu64 ","
+	       "\"sparse_files\":%" PRIu64 ",\"apparent_bytes\":%" PRIu64 ","
+	       "\"data_bytes\":%" PRIu64 ",\"seconds\":%.6f}\n",
+	       params->file_count, params->fanout, params->min_size,
+	       params->max_size, params->hardlink_ratio, params->sparse_ratio,
+	       params->seed, stats->dirs, stats->files, stats->hard_links,
+	       stats->sparse_files, stats->apparent_bytes, stats->data_bytes,
+	       seconds);
+	fflush(stdout);
+}
+
+/*****************************************************************************/
+
+static double random_unit(generator_t *gen)
+{
+	return (bench_rng_next(&gen->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int ilog2(uint64_t value)
+{
+	unsigned int count = 0;
+
+	while (value > 1) {
+		value >>= 1;
+		++count;
+	}
+
+	return count;
+}
+
+/* pick a power of two bucket first, then a size inside the bucket */
+static uint64_t random_size(generator_t *gen)
+{
+	uint64_t min = gen->params->min_size, max = gen->params->max_size;
+	unsigned int lo = ilog2(min), hi = ilog2(max), bucket;
+	uint64_t start, end;
+
+	bucket = bench_rng_range(&gen->rng, lo, hi);
+
+	start = (bucket == lo) ? min : ((uint64_t)1 << bucket);
+	end = (bucket == hi) ? max : (((uint64_t)1 << (bucket + 1)) - 1);
+
+	return bench_rng_range(&gen->rng, start, end);
+}
+
+/*****************************************************************************/
+
+static void write_octal(char *dst, uint64_t value, int digits)
+{
+	char buffer[32];
+
+	sprintf(buffer, "%0*" PRIo64, digits - 1, value);
+	memcpy(dst, buffer, digits - 1);
+	dst[digits - 1] = '\0';
+}
+
+static int tar_write_header(generator_t *gen, const char *path, char type,
+			    uint64_t record_size, uint64_t file_size,
+			    const char *link_target)
+{
+	unsigned int i, sum = 0;
+	tar_header_t hdr;
+
+	if (strlen(path) >= sizeof(hdr.name) ||
+	    (link_target != NULL && strlen(link_target) >= sizeof(hdr.name))) {
+		fprintf(stderr, "%s: path too long for a tar header.\n",
+			path);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	strcpy(hdr.name, path);
+	write_octal(hdr.mode, type == TAR_TYPE_DIR ? 0755 : 0644,
+		    sizeof(hdr.mode));
+	write_octal(hdr.uid, 0, sizeof(hdr.uid));
+	write_octal(hdr.gid, 0, sizeof(hdr.gid));
+	write_octal(hdr.size, record_size, sizeof(hdr.size));
+	write_octal(hdr.mtime, MTIME, sizeof(hdr.mtime));
+	hdr.typeflag = type;
+	memcpy(hdr.magic, TAR_MAGIC_OLD, sizeof(hdr.magic));
+	memcpy(hdr.version, TAR_VERSION_OLD, sizeof(hdr.version));
+	strcpy(hdr.uname, "root");
+	strcpy(hdr.gname, "root");
+
+	if (link_target != NULL)
+		strcpy(hdr.linkname, link_target);
+
+	if (type == TAR_TYPE_GNU_SPARSE) {
+		write_octal(hdr.tail.gnu.sparse[0].offset, 0,
+			    sizeof(hdr.tail.gnu.sparse[0].offset));
+		write_octal(hdr.tail.gnu.sparse[0].numbytes, SPARSE_CHUNK,
+			    sizeof(hdr.tail.gnu.sparse[0].numbytes));
+		write_octal(hdr.tail.gnu.sparse[1].offset,
+			    file_size - SPARSE_CHUNK,
+			    sizeof(hdr.tail.gnu.sparse[1].offset));
+		write_octal(hdr.tail.gnu.sparse[1].numbytes, SPARSE_CHUNK,
+			    sizeof(hdr.tail.gnu.sparse[1].numbytes));
+		write_octal(hdr.tail.gnu.realsize, file_size,
+			    sizeof(hdr.tail.gnu.realsize));
+	}
+
+	memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+	for (i = 0; i < sizeof(hdr); ++i)
+		sum += ((const uint8_t *)&hdr)[i];
+
+	write_octal(hdr.chksum, sum, sizeof(hdr.chksum) - 1);
+	hdr.chksum[sizeof(hdr.chksum) - 1] = ' ';
+
+	return ostream_append(gen->tar, &hdr, sizeof(hdr));
+}
+
+static int tar_write_data(generator_t *gen, const uint8_t *data, size_t size)
+{
+	if (ostream_append(gen->tar, data, size))
+		return -1;
+
+	if (size % TAR_RECORD_SIZE)
+		return ostream_append_sparse(gen->tar, TAR_RECORD_SIZE -
+					     size % TAR_RECORD_SIZE);
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int get_full_path(generator_t *gen, char *buffer, const char *dir,
+			 const char *name)
+{
+	int ret;
+
+	if (*dir == '\0') {
+		ret = snprintf(buffer, PATH_MAX, "%s/%s", gen->dir_path, name);
+	} else {
+		ret = snprintf(buffer, PATH_MAX, "%s/%s/%s",
+			       gen->dir_path, dir, name);
+	}
+
+	if (ret < 0 || ret >= PATH_MAX) {
+		fprintf(stderr, "%s/%s/%s: path too long.\n",
+			gen->dir_path, dir, name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int get_tar_path(char *buffer, size_t size, const char *dir,
+			const char *name, const char *suffix)
+{
+	int ret;
+
+	if (*dir == '\0') {
+		ret = snprintf(buffer, size, "%s%s", name, suffix);
+	} else {
+		ret = snprintf(buffer, size, "%s/%s%s", dir, name, suffix);
+	}
+
+	if (ret < 0 || (size_t)ret >= size) {
+		fprintf(stderr, "%s/%s: path too long.\n", dir, name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int add_directory(generator_t *gen, uint64_t index)
+{
+	uint64_t parent = (index - 1) / gen->params->fanout;
+	char name[32], path[PATH_MAX];
+	const char *pdir;
+
+	sprintf(name, "d%" PRIu64, (index - 1) % gen->params->fanout);
+	pdir = gen->dirs[parent];
+
+	if (get_tar_path(path, sizeof(path), pdir, name, ""))
+		return -1;
+
+	gen->dirs[index] = strdup(path);
+	if (gen->dirs[index] == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (gen->tar != NULL) {
+		if (get_tar_path(path, sizeof(path), pdir, name, "/"))
+			return -1;
+
+		if (tar_write_header(gen, path, TAR_TYPE_DIR, 0, 0, NULL))
+			return -1;
+	}
+
+	if (gen->dir_path != NULL) {
+		if (get_full_path(gen, path, pdir, name))
+			return -1;
+
+		if (mkdir(path, 0755) != 0) {
+			perror(path);
+			return -1;
+		}
+	}
+
+	gen->stats->dirs += 1;
+	return 0;
+}
+
+static int add_hard_link(generator_t *gen, const char *dir,
+			 const char *name, const char *target)
+{
+	char path[PATH_MAX], tgt[PATH_MAX];
+
+	if (get_tar_path(tgt, sizeof(tgt), dir, target, ""))
+		return -1;
+
+	if (gen->tar != NULL) {
+		if (get_tar_path(path, sizeof(path), dir, name, ""))
+			return -1;
+
+		if (tar_write_header(gen, path, TAR_TYPE_LINK, 0, 0, tgt))
+			return -1;
+	}
+
+	if (gen->dir_path != NULL) {
+		if (get_full_path(gen, path, dir, name))
+			return -1;
+
+		if (get_full_path(gen, tgt, dir, target))
+			return -1;
+
+		if (link(tgt, path) != 0) {
+			perror(path);
+			return -1;
+		}
+	}
+
+	gen->stats->hard_links += 1;
+	return 0;
+}
+
+static int add_file(generator_t *gen, const char *dir, const char *name,
+		    uint64_t size, bool sparse)
+{
+	uint64_t data_size = sparse ? 2 * SPARSE_CHUNK : size;
+	const uint8_t *tail = gen->buffer + SPARSE_CHUNK;
+	char path[PATH_MAX];
+	int fd, ret;
+
+	bench_rng_fill(&gen->rng, gen->buffer, data_size);
+
+	if (gen->tar != NULL) {
+		if (get_tar_path(path, sizeof(path), dir, name, ""))
+			return -1;
+
+		if (tar_write_header(gen, path, sparse ? TAR_TYPE_GNU_SPARSE :
+				     TAR_TYPE_FILE, data_size, size, NULL)) {
+			return -1;
+		}
+
+		if (tar_write_data(gen, gen->buffer, data_size))
+			return -1;
+	}
+
+	if (gen->dir_path != NULL) {
+		if (get_full_path(gen, path, dir, name))
+			return -1;
+
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			perror(path);
+			return -1;
+		}
+
+		if (sparse) {
+			ret = write_retry(path, fd, 0, gen->buffer,
+					  SPARSE_CHUNK);
+			if (ret == 0) {
+				ret = write_retry(path, fd, size - SPARSE_CHUNK,
+						  tail, SPARSE_CHUNK);
+			}
+		} else {
+			ret = write_retry(path, fd, 0, gen->buffer, size);
+		}
+
+		close(fd);
+		if (ret != 0)
+			return -1;
+	}
+
+	gen->stats->files += 1;
+	gen->stats->apparent_bytes += size;
+	gen->stats->data_bytes += data_size;
+	if (sparse)
+		gen->stats->sparse_files += 1;
+	return 0;
+}
+
+/* fill a directory with its share of the files */
+static int add_files(generator_t *gen, uint64_t index)
+{
+	uint64_t i, first, count, last_file = 0, size;
+	const char *dir = gen->dirs[index];
+	char name[32], target[32];
+	bool sparse;
+
+	first = (index - 1) * gen->params->fanout;
+	count = gen->params->file_count - first;
+	if (count > gen->params->fanout)
+		count = gen->params->fanout;
+
+	for (i = 0; i < count; ++i) {
+		if (i > 0 && random_unit(gen) < gen->params->hardlink_ratio) {
+			sprintf(name, "h%" PRIu64, i);
+			sprintf(target, "f%" PRIu64, last_file);
+
+			if (add_hard_link(gen, dir, name, target))
+				return -1;
+			continue;
+		}
+
+		size = random_size(gen);
+		sparse = random_unit(gen) < gen->params->sparse_ratio;
+
+		if (sparse && size < 4 * SPARSE_CHUNK)
+			size = 4 * SPARSE_CHUNK;
+
+		sprintf(name, "f%" PRIu64, i);
+
+		if (add_file(gen, dir, name, size, sparse))
+			return -1;
+
+		last_file = i;
+	}
+
+	return 0;
+}
+
+static int check_params(const rootfs_params_t *params)
+{
+	if (params->fanout < 1) {
+		fputs("Directory fan-out must be at least 1.\n", stderr);
+		return -1;
+	}
+
+	if (params->min_size > params->max_size) {
+		fputs("Minimum file size is larger than the maximum.\n",
+		      stderr);
+		return -1;
+	}
+
+	if (params->max_size > SIZE_MAX - 2 * SPARSE_CHUNK) {
+		fputs("Maximum file size is too large.\n", stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+int rootfs_generate(const rootfs_params_t *params, const char *tar_path,
+		    const char *dir_path, rootfs_stats_t *stats)
+{
+	generator_t gen;
+	uint64_t i;
+	int ret = -1;
+
+	if (check_params(params))
+		return -1;
+
+	memset(stats, 0, sizeof(*stats));
+	memset(&gen, 0, sizeof(gen));
+	gen.params = params;
+	gen.stats = stats;
+	gen.dir_path = dir_path;
+	bench_rng_init(&gen.rng, params->seed);
+
+	gen.dir_count = 1 + (params->file_count + params->fanout - 1) /
+		params->fanout;
+
+	gen.dirs = calloc(gen.dir_count, sizeof(gen.dirs[0]));
+	gen.buffer = malloc(params->max_size + 4 * SPARSE_CHUNK);
+
+	if (gen.dirs == NULL || gen.buffer == NULL) {
+		perror("generating root filesystem");
+		goto out;
+	}
+
+	gen.dirs[0] = strdup("");
+	if (gen.dirs[0] == NULL) {
+		perror("generating root filesystem");
+		goto out;
+	}
+
+	if (tar_path != NULL) {
+		gen.tar = ostream_open_file(tar_path, OSTREAM_OPEN_OVERWRITE);
+		if (gen.tar == NULL)
+			goto out;
+	}
+
+	if (dir_path != NULL && mkdir(dir_path, 0755) != 0) {
+		perror(dir_path);
+		goto out;
+	}
+
+	for (i = 1; i < gen.dir_count; ++i) {
+		if (add_directory(&gen, i))
+			goto out;
+
+		if (add_files(&gen, i))
+			goto out;
+	}
+
+	if (gen.tar != NULL) {
+		/* end-of-archive marker */
+		if (ostream_append_sparse(gen.tar, 2 * TAR_RECORD_SIZE))
+			goto out;
+
+		if (ostream_flush(gen.tar))
+			goto out;
+	}
+
+	ret = 0;
+out:
+	if (gen.tar != NULL)
+		object_drop(gen.tar);
+
+	for (i = 0; gen.dirs != NULL && i < gen.dir_count; ++i)
+		free(gen.dirs[i]);
+
+	free(gen.dirs);
+	free(gen.buffer);
+	return ret;
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * rootfs.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef ROOTFS_H
+#define ROOTFS_H
+
+#include "bench.h"
+
+#include <getopt.h>
+
+/*
+  Parameters for a synthetic root filesystem.
+
+  Directories are laid out breadth first, each one holding up to fanout
+  files and fanout sub directories. Directories are named "d<N>", regular
+  files "f<N>" and hard links "h<N>". A hard link always refers to a file
+  in the same directory, so the tree can be split at any directory.
+
+  File sizes are log-uniformly distributed between min_size and max_size,
+  i.e. there are as many files with 1-2 KiB as there are with 1-2 MiB,
+  which roughly resembles a real system. Sparse files have data in their
+  first and last 4 KiB and a hole in between.
+ */
+typedef struct {
+	uint64_t file_count;
+	uint64_t fanout;
+	uint64_t min_size;
+	uint64_t max_size;
+	double hardlink_ratio;
+	double sparse_ratio;
+	uint64_t seed;
+} rootfs_params_t;
+
+typedef struct {
+	uint64_t dirs;
+	uint64_t files;
+	uint64_t hard_links;
+	uint64_t sparse_files;
+
+	/* sum of all file sizes and the bytes actually stored */
+	uint64_t apparent_bytes;
+	uint64_t data_bytes;
+} rootfs_stats_t;
+
+/* command line options shared by all programs that generate a tree */
+#define ROOTFS_SHORT_OPTS "N:f:m:M:L:S:r:"
+
+#define ROOTFS_LONG_OPTS \
+	{ "files", required_argument, NULL, 'N' }, \
+	{ "fanout", required_argument, NULL, 'f' }, \
+	{ "min-size", required_argument, NULL, 'm' }, \
+	{ "max-size", required_argument, NULL, 'M' }, \
+	{ "hardlinks", required_argument, NULL, 'L' }, \
+	{ "sparse", required_argument, NULL, 'S' }, \
+	{ "seed", required_argument, NULL, 'r' }
+
+#define ROOTFS_HELP \
+"  --files, -N <count>     The number of files to generate.\n" \
+"  --fanout, -f <count>    Number of files and sub directories per\n" \
+"                          directory.\n" \
+"  --min-size, -m <size>   Smallest file size. Accepts K, M and G.\n" \
+"  --max-size, -M <size>   Largest file size.\n" \
+"  --hardlinks, -L <frac>  Fraction of files that are hard links.\n" \
+"  --sparse, -S <frac>     Fraction of files that are sparse.\n" \
+"  --seed, -r <value>      Seed for the random number generator.\n"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rootfs_params_init(rootfs_params_t *params);
+
+/*
+  Process one of the ROOTFS_SHORT_OPTS returned by getopt_long.
+
+  Returns 0 on success, -1 if the argument is invalid and
+  1 if the option is not one of ours.
+ */
+int rootfs_parse_option(rootfs_params_t *params, int opt, const char *arg);
+
+/* print the parameters and the resulting stats as a line of JSON */
+void rootfs_print_stats(const rootfs_params_t *params,
+			const rootfs_stats_t *stats, double seconds);
+
+/*
+  Generate the same tree as a GNU tar archive and/or a directory on disk.
+  Either path can be NULL. The directory must not exist yet.
+
+  Returns 0 on success, -1 on failure.
+ */
+int rootfs_generate(const rootfs_params_t *params, const char *tar_path,
+		    const char *dir_path, rootfs_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROOTFS_H */
@@ -0,0 +1,537 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * scale.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "rootfs.h"
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <ftw.h>
+
+#define DEFAULT_FILE_COUNT (500)
+
+/*
+  The configurations that are run on the generated tree. The first %s is
+  replaced with the path of the tar archive or the directory, the FAT
+  configuration additionally gets the maximum image size in MiB.
+
+  FAT cannot store hard links, so those are filtered out.
+ */
+static const char *cfg_tar =
+"tar \"rootfs\"\n"
+"\n"
+"mountgroup {\n"
+"	bind \"/:rootfs\"\n"
+"\n"
+"	tarunpack \"%s\"\n"
+"}\n";
+
+static const char *cfg_cpio =
+"cpio \"rootfs\"\n"
+"\n"
+"mountgroup {\n"
+"	bind \"/:rootfs\"\n"
+"\n"
+"	dirscan \"%s\"\n"
+"}\n";
+
+static const char *cfg_fat_mbr =
+"raw {\n"
+"	maxsize %" PRIu64 "M\n"
+"\n"
+"	dosmbr {\n"
+"		partition {\n"
+"			type Linux\n"
+"			bootable no\n"
+"			fill yes\n"
+"\n"
+"			fat \"rootfs\" {\n"
+"			}\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"mountgroup {\n"
+"	bind \"/:rootfs\"\n"
+"\n"
+"	filter {\n"
+"		discard \"*/h*\"\n"
+"		allow \"*\"\n"
+"\n"
+"		tarunpack \"%s\"\n"
+"	}\n"
+"}\n";
+
+static const char *cfg_nested =
+"tar \"rootfs\" {\n"
+"	volumefile \"/d0.tar\" {\n"
+"		tar \"d0fs\"\n"
+"	}\n"
+"\n"
+"	volumefile \"/d1.cpio\" {\n"
+"		cpio \"d1fs\"\n"
+"	}\n"
+"}\n"
+"\n"
+"mountgroup {\n"
+"	bind \"/:rootfs\"\n"
+"	bind \"/d0:d0fs\"\n"
+"	bind \"/d1:d1fs\"\n"
+"\n"
+"	tarunpack \"%s\"\n"
+"}\n";
+
+enum {
+	CFG_TAR = 0,
+	CFG_CPIO,
+	CFG_FAT_MBR,
+	CFG_NESTED,
+
+	CFG_COUNT,
+};
+
+static const char *cfg_names[CFG_COUNT] = {
+	[CFG_TAR] = "tar",
+	[CFG_CPIO] = "cpio",
+	[CFG_FAT_MBR] = "fat-mbr",
+	[CFG_NESTED] = "nested",
+};
+
+typedef struct {
+	rootfs_params_t params;
+	rootfs_stats_t stats;
+
+	const char *imagebuild;
+	char workdir[PATH_MAX];
+	bool keep;
+	bool run[CFG_COUNT];
+} scale_t;
+
+typedef struct {
+	double seconds;
+	double user_seconds;
+	double sys_seconds;
+	uint64_t peak_rss_kib;
+	uint64_t bytes_written;
+	uint64_t image_size;
+	uint64_t image_allocated;
+} result_t;
+
+static struct option long_opts[] = {
+	ROOTFS_LONG_OPTS,
+	{ "config", required_argument, NULL, 'c' },
+	{ "workdir", required_argument, NULL, 'w' },
+	{ "keep", no_argument, NULL, 'k' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = ROOTFS_SHORT_OPTS "c:w:kh";
+
+static const char *help_string =
+"Usage: %s [OPTIONS...] <imagebuild>\n"
+"\n"
+"Generate a synthetic root filesystem and run the given imagebuild\n"
+"binary on a number of configurations that use it. For each run, a line\n"
+"of JSON with the wall clock and CPU time, the peak resident set size\n"
+"and the number of bytes written is printed.\n"
+"\n"
+"  --config, -c <name>     Only run the given configuration. Can be used\n"
+"                          more than once. Available are tar, cpio,\n"
+"                          fat-mbr and nested.\n"
+"  --workdir, -w <path>    Where to generate the input and output files.\n"
+"                          Must not exist. Default is a new directory\n"
+"                          in $TMPDIR or /tmp.\n"
+"  --keep, -k              Don't delete the working directory.\n"
+"\n"
+ROOTFS_HELP
+"\n"
+"The default number of files (%d) is scaled by BENCH_SCALE.\n"
+"\n";
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int get_config(const char *name)
+{
+	int i;
+
+	for (i = 0; i < CFG_COUNT; ++i) {
+		if (strcmp(cfg_names[i], name) == 0)
+			return i;
+	}
+
+	fprintf(stderr, "Unknown configuration `%s'.\n", name);
+	return -1;
+}
+
+static void process_options(scale_t *scale, int argc, char **argv)
+{
+	bool have_cfg = false;
+	int i;
+
+	memset(scale, 0, sizeof(*scale));
+	rootfs_params_init(&scale->params);
+	scale->params.file_count = bench_scaled(DEFAULT_FILE_COUNT);
+
+	for (;;) {
+		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'c':
+			i = get_config(optarg);
+			if (i < 0)
+				goto fail_arg;
+			scale->run[i] = true;
+			have_cfg = true;
+			break;
+		case 'w':
+			if (strlen(optarg) >= sizeof(scale->workdir)) {
+				fputs("Working directory path too long.\n",
+				      stderr);
+				goto fail_arg;
+			}
+			strcpy(scale->workdir, optarg);
+			break;
+		case 'k':
+			scale->keep = true;
+			break;
+		case 'h':
+			printf(help_string, argv[0], DEFAULT_FILE_COUNT);
+			exit(EXIT_SUCCESS);
+		default:
+			if (rootfs_parse_option(&scale->params, i, optarg) != 0)
+				goto fail_arg;
+			break;
+		}
+	}
+
+	if (optind >= argc) {
+		fputs("No imagebuild binary specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	scale->imagebuild = argv[optind++];
+
+	if (optind < argc) {
+		fputs("Unknown extra arguments specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (!have_cfg) {
+		for (i = 0; i < CFG_COUNT; ++i)
+			scale->run[i] = true;
+	}
+	return;
+fail_arg:
+	fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+
+/*****************************************************************************/
+
+static int remove_entry(const char *path, const struct stat *sb,
+			int type, struct FTW *ftw)
+{
+	(void)sb; (void)type; (void)ftw;
+
+	if (remove(path) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int create_workdir(scale_t *scale)
+{
+	const char *tmpdir = getenv("TMPDIR");
+
+	if (scale->workdir[0] != '\0') {
+		if (mkdir(scale->workdir, 0755) != 0) {
+			perror(scale->workdir);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (tmpdir == NULL || *tmpdir == '\0')
+		tmpdir = "/tmp";
+
+	snprintf(scale->workdir, sizeof(scale->workdir),
+		 "%s/imgtool-scale-XXXXXX", tmpdir);
+
+	if (mkdtemp(scale->workdir) == NULL) {
+		perror(scale->workdir);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int get_path(const scale_t *scale, char *buffer, const char *name,
+		    const char *suffix)
+{
+	int ret = snprintf(buffer, PATH_MAX, "%s/%s%s",
+			   scale->workdir, name, suffix);
+
+	if (ret < 0 || ret >= PATH_MAX) {
+		fprintf(stderr, "%s/%s%s: path too long.\n",
+			scale->workdir, name, suffix);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int generate(scale_t *scale)
+{
+	char tar_path[PATH_MAX], dir_path[PATH_MAX];
+	double start;
+
+	if (get_path(scale, tar_path, "rootfs", ".tar"))
+		return -1;
+
+	if (get_path(scale, dir_path, "rootfs", ""))
+		return -1;
+
+	start = get_time();
+
+	if (rootfs_generate(&scale->params, tar_path, dir_path, &scale->stats))
+		return -1;
+
+	rootfs_print_stats(&scale->params, &scale->stats, get_time() - start);
+	return 0;
+}
+
+/*
+  Leave plenty of room for the FAT metadata and for every file and
+  directory taking up at least one cluster. The image is only as large
+  as it needs to be anyway.
+ */
+static uint64_t fat_max_size_mib(const scale_t *scale)
+{
+	uint64_t size = scale->stats.apparent_bytes;
+
+	size += (scale->stats.files + scale->stats.dirs) * 4096;
+	size += size / 8;
+
+	return size / (1024 * 1024) + 64;
+}
+
+static int write_config(const scale_t *scale, int cfg, const char *path)
+{
+	char input[PATH_MAX];
+	FILE *fp;
+	int ret;
+
+	if (get_path(scale, input, "rootfs", cfg == CFG_CPIO ? "" : ".tar"))
+		return -1;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	switch (cfg) {
+	case CFG_TAR:
+		fprintf(fp, cfg_tar, input);
+		break;
+	case CFG_CPIO:
+		fprintf(fp, cfg_cpio, input);
+		break;
+	case CFG_FAT_MBR:
+		fprintf(fp, cfg_fat_mbr, fat_max_size_mib(scale), input);
+		break;
+	default:
+		fprintf(fp, cfg_nested, input);
+		break;
+	}
+
+	ret = ferror(fp);
+	if (fclose(fp) != 0 || ret != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the number of bytes written through system calls, from procfs */
+static uint64_t get_bytes_written(pid_t pid)
+{
+	uint64_t value, ret = 0;
+	char path[64];
+	FILE *fp;
+
+	sprintf(path, "/proc/%ld/io", (long)pid);
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+
+	while (fscanf(fp, "%63s %" SCNu64, path, &value) == 2) {
+		if (strcmp(path, "wchar:") == 0) {
+			ret = value;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+static int run_imagebuild(const scale_t *scale, const char *cfg_path,
+			  const char *img_path, result_t *result)
+{
+	struct rusage usage;
+	siginfo_t info;
+	double start;
+	struct stat sb;
+	int status;
+	pid_t pid;
+
+	start = get_time();
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		execl(scale->imagebuild, scale->imagebuild,
+		      "-c", cfg_path, "-O", img_path, (char *)NULL);
+		perror(scale->imagebuild);
+		_exit(EXIT_FAILURE);
+	}
+
+	/* wait for it to exit, but keep it around to read its I/O stats */
+	memset(&info, 0, sizeof(info));
+	while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+		if (errno != EINTR) {
+			perror("waitid");
+			return -1;
+		}
+	}
+
+	result->seconds = get_time() - start;
+	result->bytes_written = get_bytes_written(pid);
+
+	while (wait4(pid, &status, 0, &usage) < 0) {
+		if (errno != EINTR) {
+			perror("wait4");
+			return -1;
+		}
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: imagebuild failed.\n", cfg_path);
+		return -1;
+	}
+
+	result->user_seconds = usage.ru_utime.tv_sec +
+		usage.ru_utime.tv_usec / 1e6;
+	result->sys_seconds = usage.ru_stime.tv_sec +
+		usage.ru_stime.tv_usec / 1e6;
+	result->peak_rss_kib = usage.ru_maxrss;
+
+	if (stat(img_path, &sb) != 0) {
+		perror(img_path);
+		return -1;
+	}
+
+	result->image_size = sb.st_size;
+	result->image_allocated = (uint64_t)sb.st_blocks * 512;
+
+	if (result->bytes_written == 0)
+		result->bytes_written = result->image_allocated;
+
+	return 0;
+}
+
+static int run_config(const scale_t *scale, int cfg)
+{
+	char cfg_path[PATH_MAX], img_path[PATH_MAX];
+	result_t result;
+
+	if (get_path(scale, cfg_path, cfg_names[cfg], ".cfg"))
+		return -1;
+
+	if (get_path(scale, img_path, cfg_names[cfg], ".img"))
+		return -1;
+
+	if (write_config(scale, cfg, cfg_path))
+		return -1;
+
+	memset(&result, 0, sizeof(result));
+
+	if (run_imagebuild(scale, cfg_path, img_path, &result))
+		return -1;
+
+	printf("{\"suite\":\"scale\",\"bench\":\"%s\","
+	       "\"variant\":\"files=%" PRIu64 "\",\"seconds\":%.6f,"
+	       "\"user_seconds\":%.6f,\"sys_seconds\":%.6f,"
+	       "\"peak_rss_kib\":%" PRIu64 ",\"bytes_written\":%" PRIu64 ","
+	       "\"image_size\":%" PRIu64 ",\"image_allocated\":%" PRIu64 "}\n",
+	       cfg_names[cfg], scale->params.file_count, result.seconds,
+	       result.user_seconds, result.sys_seconds, result.peak_rss_kib,
+	       result.bytes_written, result.image_size,
+	       result.image_allocated);
+	fflush(stdout);
+
+	/* don't let the outputs pile up */
+	if (!scale->keep && unlink(img_path) != 0) {
+		perror(img_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, ret = EXIT_SUCCESS;
+	scale_t scale;
+
+	process_options(&scale, argc, argv);
+
+	if (create_workdir(&scale))
+		return EXIT_FAILURE;
+
+	if (generate(&scale)) {
+		ret = EXIT_FAILURE;
+	} else {
+		for (i = 0; i < CFG_COUNT; ++i) {
+			if (scale.run[i] && run_config(&scale, i))
+				ret = EXIT_FAILURE;
+		}
+	}
+
+	if (scale.keep) {
+		fprintf(stderr, "Keeping working directory %s\n",
+			scale.workdir);
+	} else if (nftw(scale.workdir, remove_entry, 16,
+			FTW_DEPTH | FTW_PHYS) != 0) {
+		ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
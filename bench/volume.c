@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "bench.h"
+#include "volume.h"
+
+#include <unistd.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_RANDOM_SIZE (16 * 1024)
+
+typedef struct {
+	const char *name;
+
+	/* 0 means using the file volume directly */
+	uint32_t blocksize;
+	uint32_t offset;
+} variant_t;
+
+static const variant_t variants[] = {
+	{ "file", 0, 0 },
+	{ "adapter-512", 512, 0 },
+	{ "adapter-4096-offset-1536", 4096, 1536 },
+};
+
+typedef struct {
+	const variant_t *variant;
+	uint64_t size;
+	uint8_t *data;
+} context_t;
+
+static volume_t *create_volume(const context_t *ctx)
+{
+	volume_t *file, *vol;
+	int fd;
+
+	fd = bench_temp_file();
+	if (fd < 0)
+		return NULL;
+
+	file = volume_from_fd("bench", fd, 0xFFFFFFFFFFFFFFFFUL);
+	if (file == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	if (ctx->variant->blocksize == 0)
+		return file;
+
+	vol = volume_blocksize_adapter_create(file, ctx->variant->blocksize,
+					      ctx->variant->offset);
+	object_drop(file);
+	return vol;
+}
+
+static int fill_volume(const context_t *ctx, volume_t *vol)
+{
+	uint64_t offset;
+
+	for (offset = 0; offset < ctx->size; offset += CHUNK_SIZE) {
+		if (volume_write(vol, offset, ctx->data + offset, CHUNK_SIZE))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_write_seq(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	volume_t *vol;
+	int ret;
+
+	vol = create_volume(ctx);
+	if (vol == NULL)
+		return -1;
+
+	bench_start(b);
+	ret = fill_volume(ctx, vol);
+	bench_stop(b);
+
+	b->ops = ctx->size / CHUNK_SIZE;
+	b->bytes = ctx->size;
+	object_drop(vol);
+	return ret;
+}
+
+static int bench_write_random(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint64_t i, count, offset, size;
+	bench_rng_t rng;
+	volume_t *vol;
+	int ret = 0;
+
+	vol = create_volume(ctx);
+	if (vol == NULL)
+		return -1;
+
+	if (fill_volume(ctx, vol)) {
+		object_drop(vol);
+		return -1;
+	}
+
+	bench_rng_init(&rng, 1);
+	count = ctx->size / (MAX_RANDOM_SIZE / 2);
+
+	bench_start(b);
+	for (i = 0; i < count; ++i) {
+		size = bench_rng_range(&rng, 1, MAX_RANDOM_SIZE);
+		offset = bench_rng_range(&rng, 0, ctx->size - size);
+
+		ret = volume_write(vol, offset, ctx->data + offset, size);
+		if (ret != 0)
+			break;
+
+		b->bytes += size;
+	}
+	bench_stop(b);
+
+	b->ops = count;
+	object_drop(vol);
+	return ret;
+}
+
+static int bench_read_seq(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint8_t buffer[CHUNK_SIZE];
+	uint64_t offset;
+	volume_t *vol;
+	int ret = 0;
+
+	vol = create_volume(ctx);
+	if (vol == NULL)
+		return -1;
+
+	if (fill_volume(ctx, vol)) {
+		object_drop(vol);
+		return -1;
+	}
+
+	bench_start(b);
+	for (offset = 0; offset < ctx->size; offset += CHUNK_SIZE) {
+		ret = volume_read(vol, offset, buffer, CHUNK_SIZE);
+		if (ret != 0)
+			break;
+	}
+	bench_stop(b);
+
+	b->ops = ctx->size / CHUNK_SIZE;
+	b->bytes = ctx->size;
+	object_drop(vol);
+	return ret;
+}
+
+static int bench_read_random(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint8_t buffer[MAX_RANDOM_SIZE];
+	uint64_t i, count, offset, size;
+	bench_rng_t rng;
+	volume_t *vol;
+	int ret = 0;
+
+	vol = create_volume(ctx);
+	if (vol == NULL)
+		return -1;
+
+	if (fill_volume(ctx, vol)) {
+		object_drop(vol);
+		return -1;
+	}
+
+	bench_rng_init(&rng, 2);
+	count = ctx->size / (MAX_RANDOM_SIZE / 2);
+
+	bench_start(b);
+	for (i = 0; i < count; ++i) {
+		size = bench_rng_range(&rng, 1, MAX_RANDOM_SIZE);
+		offset = bench_rng_range(&rng, 0, ctx->size - size);
+
+		ret = volume_read(vol, offset, buffer, size);
+		if (ret != 0)
+			break;
+
+		b->bytes += size;
+	}
+	bench_stop(b);
+
+	b->ops = count;
+	object_drop(vol);
+	return ret;
+}
+
+/*
+  Shift the first half of the volume towards the end, once by an entire
+  (file volume) block and once by an odd amount, as done when files or
+  partitions grow and everything behind them needs to be moved.
+ */
+static int bench_memmove(bench_t *b, void *user)
+{
+	const context_t *ctx = user;
+	uint64_t size = ctx->size / 2;
+	volume_t *vol;
+	int ret;
+
+	vol = create_volume(ctx);
+	if (vol == NULL)
+		return -1;
+
+	if (fill_volume(ctx, vol)) {
+		object_drop(vol);
+		return -1;
+	}
+
+	bench_start(b);
+	ret = volume_memmove(vol, 4096, 0, size);
+	if (ret == 0)
+		ret = volume_memmove(vol, 4096 + 4096 + 123, 4096, size);
+	bench_stop(b);
+
+	b->ops = 2;
+	b->bytes = 2 * size;
+	object_drop(vol);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	bench_fun_t fun;
+} benchmarks[] = {
+	{ "volume_write_seq", bench_write_seq },
+	{ "volume_write_random", bench_write_random },
+	{ "volume_read_seq", bench_read_seq },
+	{ "volume_read_random", bench_read_random },
+	{ "volume_memmove", bench_memmove },
+};
+
+int main(void)
+{
+	bench_rng_t rng;
+	context_t ctx;
+	size_t i, j;
+	int ret = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	ctx.size = bench_scaled(64 * 1024 * 1024);
+	ctx.size = (ctx.size + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+
+	ctx.data = malloc(ctx.size);
+	if (ctx.data == NULL) {
+		perror("allocating benchmark data");
+		return EXIT_FAILURE;
+	}
+
+	bench_rng_init(&rng, 42);
+	bench_rng_fill(&rng, ctx.data, ctx.size);
+
+	for (i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+		ctx.variant = variants + i;
+
+		for (j = 0; j < sizeof(benchmarks) / sizeof(benchmarks[0]);
+		     ++j) {
+			if (bench_run("volume", benchmarks[j].name,
+				      variants[i].name, benchmarks[j].fun,
+				      &ctx)) {
+				ret = -1;
+			}
+		}
+	}
+
+	free(ctx.data);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
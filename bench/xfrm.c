@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * xfrm.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "bench.h"
+#include "xfrm.h"
+
+typedef struct {
+	const char *name;
+	uint32_t level;
+	xfrm_stream_t *(*create_compressor)(const compressor_config_t *cfg);
+	xfrm_stream_t *(*create_decompressor)(void);
+} codec_t;
+
+static const codec_t codecs[] = {
+	{ "gzip", COMP_GZIP_DEFAULT_LEVEL,
+	  compressor_stream_gzip_create, decompressor_stream_gzip_create },
+	{ "xz", COMP_XZ_DEFAULT_LEVEL,
+	  compressor_stream_xz_create, decompressor_stream_xz_create },
+	{ "bzip2", COMP_BZIP2_DEFAULT_LEVEL,
+	  compressor_stream_bzip2_create, decompressor_stream_bzip2_create },
+	{ "zstd", COMP_ZSTD_DEFAULT_LEVEL,
+	  compressor_stream_zstd_create, decompressor_stream_zstd_create },
+};
+
+typedef struct {
+	const codec_t *codec;
+
+	uint8_t *data;
+	uint32_t data_size;
+
+	/* compressed data, produced by the compressor benchmark */
+	uint8_t *packed;
+	uint32_t packed_size;
+	uint32_t packed_max;
+
+	uint8_t *unpacked;
+} context_t;
+
+static const char *words[] = {
+	"volume", "block", "partition", "directory", "file", "cluster",
+	"sector", "image", "the", "a", "of", "and", "to", "in", "is",
+	"filesystem", "inode", "offset", "size", "data", "table", "entry",
+	"header", "checksum", "0x0000", "0xFFFF", "\n", "\t", "/usr/lib/",
+	"libimage.so", "root", "mount", "{", "}", ";",
+};
+
+/*
+  Something resembling text or a file system image with lots of metadata,
+  so it compresses reasonably well, but not absurdly well.
+ */
+static void generate_data(uint8_t *data, size_t size)
+{
+	size_t i, len, count = sizeof(words) / sizeof(words[0]);
+	bench_rng_t rng;
+	uint64_t value;
+
+	bench_rng_init(&rng, 42);
+
+	for (i = 0; i < size; i += len) {
+		value = bench_rng_next(&rng);
+
+		if ((value & 0x0F) == 0) {
+			len = 1;
+			data[i] = (value >> 8) & 0xFF;
+			continue;
+		}
+
+		len = strlen(words[(value >> 8) % count]);
+		if (len > size - i)
+			len = size - i;
+
+		memcpy(data + i, words[(value >> 8) % count], len);
+	}
+}
+
+static void init_config(const codec_t *codec, compressor_config_t *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->level = codec->level;
+
+	cfg->opt.gzip.window_size = COMP_GZIP_DEFAULT_WINDOW;
+
+	if (codec->create_compressor == compressor_stream_xz_create) {
+		cfg->opt.xz.dict_size = 8 * 1024 * 1024;
+		cfg->opt.xz.lc = COMP_XZ_DEFAULT_LC;
+		cfg->opt.xz.lp = COMP_XZ_DEFAULT_LP;
+		cfg->opt.xz.pb = COMP_XZ_DEFAULT_PB;
+	} else if (codec->create_compressor == compressor_stream_bzip2_create) {
+		cfg->opt.bzip2.work_factor = COMP_BZIP2_DEFAULT_WORK_FACTOR;
+	}
+}
+
+/* push the entire input through a stream in one go */
+static int run_stream(xfrm_stream_t *xfrm, const uint8_t *in, uint32_t in_size,
+		      uint8_t *out, uint32_t out_max, uint32_t *out_size)
+{
+	uint32_t in_pos = 0, out_pos = 0, in_read, out_written;
+	int ret;
+
+	for (;;) {
+		in_read = 0;
+		out_written = 0;
+
+		ret = xfrm->process_data(xfrm, in + in_pos, in_size - in_pos,
+					 out + out_pos, out_max - out_pos,
+					 &in_read, &out_written,
+					 XFRM_STREAM_FLUSH_FULL);
+
+		if (ret == XFRM_STREAM_ERROR)
+			return -1;
+
+		in_pos += in_read;
+		out_pos += out_written;
+
+		if (ret == XFRM_STREAM_END)
+			break;
+
+		if (in_read == 0 && out_written == 0)
+			return -1;
+	}
+
+	*out_size = out_pos;
+	return 0;
+}
+
+static int bench_compress(bench_t *b, void *user)
+{
+	context_t *ctx = user;
+	compressor_config_t cfg;
+	xfrm_stream_t *xfrm;
+	int ret;
+
+	init_config(ctx->codec, &cfg);
+
+	xfrm = ctx->codec->create_compressor(&cfg);
+	if (xfrm == NULL)
+		return -1;
+
+	bench_start(b);
+	ret = run_stream(xfrm, ctx->data, ctx->data_size,
+			 ctx->packed, ctx->packed_max, &ctx->packed_size);
+	bench_stop(b);
+
+	b->ops = 1;
+	b->bytes = ctx->data_size;
+	object_drop(xfrm);
+	return ret;
+}
+
+static int bench_uncompress(bench_t *b, void *user)
+{
+	context_t *ctx = user;
+	xfrm_stream_t *xfrm;
+	uint32_t size;
+	int ret;
+
+	xfrm = ctx->codec->create_decompressor();
+	if (xfrm == NULL)
+		return -1;
+
+	bench_start(b);
+	ret = run_stream(xfrm, ctx->packed, ctx->packed_size,
+			 ctx->unpacked, ctx->data_size, &size);
+	bench_stop(b);
+
+	if (ret == 0 && (size != ctx->data_size ||
+			 memcmp(ctx->unpacked, ctx->data, size) != 0)) {
+		fprintf(stderr, "%s: round trip mismatch.\n",
+			ctx->codec->name);
+		ret = -1;
+	}
+
+	b->ops = 1;
+	b->bytes = ctx->data_size;
+	object_drop(xfrm);
+	return ret;
+}
+
+/* zstd support may be compiled in without a streaming API */
+static bool codec_available(const codec_t *codec)
+{
+	compressor_config_t cfg;
+	xfrm_stream_t *xfrm;
+
+	init_config(codec, &cfg);
+
+	xfrm = codec->create_compressor(&cfg);
+	if (xfrm == NULL)
+		return false;
+
+	object_drop(xfrm);
+	return true;
+}
+
+int main(void)
+{
+	context_t ctx;
+	int ret = 0;
+	size_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.data_size = bench_scaled(32 * 1024 * 1024);
+	ctx.packed_max = ctx.data_size + ctx.data_size / 2 + 65536;
+
+	ctx.data = malloc(ctx.data_size);
+	ctx.packed = malloc(ctx.packed_max);
+	ctx.unpacked = malloc(ctx.data_size);
+
+	if (ctx.data == NULL || ctx.packed == NULL || ctx.unpacked == NULL) {
+		perror("allocating benchmark data");
+		ret = -1;
+		goto out;
+	}
+
+	generate_data(ctx.data, ctx.data_size);
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); ++i) {
+		ctx.codec = codecs + i;
+
+		if (!codec_available(ctx.codec)) {
+			fprintf(stderr, "%s: not available, skipping.\n",
+				ctx.codec->name);
+			continue;
+		}
+
+		if (bench_run("xfrm", "compress", ctx.codec->name,
+			      bench_compress, &ctx)) {
+			ret = -1;
+			continue;
+		}
+
+		if (bench_run("xfrm", "uncompress", ctx.codec->name,
+			      bench_uncompress, &ctx)) {
+			ret = -1;
+		}
+	}
+out:
+	free(ctx.unpacked);
+	free(ctx.packed);
+	free(ctx.data);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,4 +21,21 @@ static plugin_t plugin_mbr_part = {
 	},
 };
 
+static partition_mgr_t *create_gptdisk(plugin_t *plugin,
+				       imgtool_state_t *state,
+				       volume_t *parent)
+{
+	(void)plugin; (void)state;
+	return gptdisk_create(parent);
+}
+
+static plugin_t plugin_gpt_part = {
+	.type = PLUGIN_TYPE_PARTITION_MGR,
+	.name = "gptdisk",
+	.create = {
+		.part_mgr = create_gptdisk,
+	},
+};
+
 EXPORT_PLUGIN(plugin_mbr_part)
+EXPORT_PLUGIN(plugin_gpt_part)
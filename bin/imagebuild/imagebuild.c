@@ -16,7 +16,7 @@ int main(int argc, char **argv)
 
 	process_options(&opt, argc, argv);
 
-	state = imgtool_state_create(opt.output_path);
+	state = imgtool_state_create(opt.output_path, opt.format, opt.jobs);
 	if (state == NULL)
 		return EXIT_FAILURE;
 
@@ -31,12 +31,34 @@ int main(int argc, char **argv)
 	if (imgtool_state_init_config(state))
 		goto out;
 
+	if ((opt.stats || opt.trace_path != NULL) &&
+	    imgtool_state_enable_stats(state)) {
+		goto out;
+	}
+
 	if (imgtool_process_config_file(state, opt.config_path))
 		goto out;
 
 	if (imgtool_state_process(state))
 		goto out;
 
+	if (opt.bmap_path != NULL &&
+	    volume_write_bmap(state->out_file, opt.bmap_path,
+			      state->pool)) {
+		goto out;
+	}
+
+	if (opt.dry_run)
+		imgtool_state_print_sizes(state);
+
+	if (opt.stats)
+		imgtool_stats_print(state->stats, stderr);
+
+	if (opt.trace_path != NULL &&
+	    imgtool_stats_write_trace(state->stats, opt.trace_path)) {
+		goto out;
+	}
+
 	status = EXIT_SUCCESS;
 out:
 	object_drop(state);
@@ -17,6 +17,7 @@
 #include "plugin.h"
 #include "fstree.h"
 #include "volume.h"
+#include "stats.h"
 #include "gcfg.h"
 
 #include <stdlib.h>
@@ -32,6 +33,12 @@
 typedef struct {
 	const char *config_path;
 	const char *output_path;
+	const char *bmap_path;
+	const char *trace_path;
+	IMGTOOL_OUTPUT_FORMAT format;
+	size_t jobs;
+	bool dry_run;
+	bool stats;
 } options_t;
 
 extern const char *__progname;
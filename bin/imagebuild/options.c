@@ -9,12 +9,29 @@
 static struct option long_opts[] = {
 	{ "config", required_argument, NULL, 'c' },
 	{ "output", required_argument, NULL, 'O' },
+	{ "format", required_argument, NULL, 'F' },
+	{ "bmap", required_argument, NULL, 'b' },
+	{ "dry-run", no_argument, NULL, 'n' },
+	{ "stats", no_argument, NULL, 's' },
+	{ "trace", required_argument, NULL, 't' },
+	{ "jobs", required_argument, NULL, 'j' },
 	{ "version", no_argument, NULL, 'V' },
 	{ "help", no_argument, NULL, 'h' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "c:O:hV";
+static const char *short_opts = "c:O:F:b:nst:j:hV";
+
+static const struct {
+	const char *name;
+	IMGTOOL_OUTPUT_FORMAT format;
+} formats[] = {
+	{ "raw", IMGTOOL_OUTPUT_RAW },
+	{ "android-sparse", IMGTOOL_OUTPUT_ANDROID_SPARSE },
+	{ "qcow2", IMGTOOL_OUTPUT_QCOW2 },
+	{ "qcow2-zstd", IMGTOOL_OUTPUT_QCOW2_ZSTD },
+	{ "zstd-seekable", IMGTOOL_OUTPUT_ZSTD_SEEKABLE },
+};
 
 static const char *help_string =
 "Usage: %s [OPTIONS...]\n"
@@ -23,10 +40,77 @@ static const char *help_string =
 "\n"
 "  --config, -c <file>  The path to the main configuration file.\n"
 "  --output, -O <file>  The name of the output file to generate.\n"
+"\n"
+"Optional arguments:\n"
+"\n"
+"  --format, -F <name>  The format of the output file. Supported are:\n"
+"\n"
+"                         raw             A plain disk image (default).\n"
+"                         android-sparse  An Android sparse image, e.g.\n"
+"                                         for flashing with fastboot.\n"
+"                         qcow2           A qcow2 image, e.g. for qemu.\n"
+"                         qcow2-zstd      A qcow2 image with zstd\n"
+"                                         compressed clusters.\n"
+"                         zstd-seekable   A raw image, compressed in the\n"
+"                                         seekable zstd format.\n"
+"\n"
+"  --bmap, -b <file>    Also generate a bmaptool compatible block map of\n"
+"                       the output file, listing the blocks that actually\n"
+"                       hold data, along with their checksums. Only\n"
+"                       supported for the raw format.\n"
+"\n"
+"  --dry-run, -n        Only compute the layout of the image, without\n"
+"                       storing any data, and print the sizes of all\n"
+"                       filesystems, partitions and the image itself.\n"
+"                       No output file is needed.\n"
+"\n"
+"  --stats, -s          Print the time spent in each processing phase\n"
+"                       and I/O statistics for each volume to stderr.\n"
+"  --trace, -t <file>   Write the same information to a file in the\n"
+"                       Chrome trace event format, e.g. for viewing\n"
+"                       in Perfetto.\n"
+"\n"
+"  --jobs, -j <count>   The maximum number of threads to use for work\n"
+"                       that can be done in parallel. Defaults to the\n"
+"                       number of online CPUs.\n"
 "\n";
 
+static int get_format(const char *name, IMGTOOL_OUTPUT_FORMAT *out)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if (strcmp(formats[i].name, name) == 0) {
+			*out = formats[i].format;
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "Unknown output format `%s'.\n", name);
+	return -1;
+}
+
+static int get_jobs(const char *str, size_t *out)
+{
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+
+	if (!isdigit(*str) || *end != '\0' || errno != 0 || value == 0 ||
+	    value > 1024) {
+		fprintf(stderr, "Invalid number of jobs `%s'.\n", str);
+		return -1;
+	}
+
+	*out = value;
+	return 0;
+}
+
 void process_options(options_t *opt, int argc, char **argv)
 {
+	long cpus;
 	int i;
 
 	memset(opt, 0, sizeof(*opt));
@@ -43,6 +127,26 @@ void process_options(options_t *opt, int argc, char **argv)
 		case 'O':
 			opt->output_path = optarg;
 			break;
+		case 'F':
+			if (get_format(optarg, &opt->format))
+				goto fail_arg;
+			break;
+		case 'b':
+			opt->bmap_path = optarg;
+			break;
+		case 'n':
+			opt->dry_run = true;
+			break;
+		case 's':
+			opt->stats = true;
+			break;
+		case 't':
+			opt->trace_path = optarg;
+			break;
+		case 'j':
+			if (get_jobs(optarg, &opt->jobs))
+				goto fail_arg;
+			break;
 		case 'h':
 			printf(help_string, __progname);
 			exit(EXIT_SUCCESS);
@@ -59,9 +163,30 @@ void process_options(options_t *opt, int argc, char **argv)
 		goto fail_arg;
 	}
 
-	if (opt->output_path == NULL) {
+	if (opt->dry_run) {
+		if (opt->bmap_path != NULL) {
+			fputs("A block map cannot be generated in dry "
+			      "run mode.\n", stderr);
+			goto fail_arg;
+		}
+
+		opt->format = IMGTOOL_OUTPUT_NULL;
+
+		if (opt->output_path == NULL)
+			opt->output_path = "dry run";
+	} else if (opt->output_path == NULL) {
 		fputs("No output file specified.\n", stderr);
 		goto fail_arg;
+	} else if (opt->bmap_path != NULL &&
+		   opt->format != IMGTOOL_OUTPUT_RAW) {
+		fputs("A block map can only be generated for the raw "
+		      "output format.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (opt->jobs == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		opt->jobs = cpus > 1 ? (size_t)cpus : 1;
 	}
 
 	if (optind < argc) {
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * voltrace.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "voltrace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+extern const char *__progname;
+
+static const char *help_string =
+"Usage: %s <trace file>...\n"
+"\n"
+"Summarize the access pattern recorded in volume trace files, as created\n"
+"by a `trace' node in an imagebuild configuration.\n"
+"\n";
+
+int main(int argc, char **argv)
+{
+	int i, status = EXIT_SUCCESS;
+	voltrace_summary_t sum;
+	FILE *fp;
+
+	if (argc < 2 || strcmp(argv[1], "--help") == 0 ||
+	    strcmp(argv[1], "-h") == 0) {
+		printf(help_string, __progname);
+		return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	for (i = 1; i < argc; ++i) {
+		fp = fopen(argv[i], "rb");
+		if (fp == NULL) {
+			perror(argv[i]);
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		if (voltrace_analyze(fp, argv[i], &sum)) {
+			status = EXIT_FAILURE;
+		} else {
+			if (argc > 2)
+				printf("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+
+			voltrace_print_summary(&sum, stdout);
+		}
+
+		fclose(fp);
+	}
+
+	return status;
+}
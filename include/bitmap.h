@@ -27,6 +27,31 @@ void bitmap_shrink(bitmap_t *bitmap);
 
 size_t bitmap_msb_index(bitmap_t *bitmap);
 
+/*
+  Set or clear count consecutive bits, starting at the given index. Setting
+  bits past the end grows the bitmap, clearing them does nothing.
+ */
+int bitmap_set_range(bitmap_t *bitmap, size_t index, size_t count);
+
+void bitmap_clear_range(bitmap_t *bitmap, size_t index, size_t count);
+
+/*
+  Returns the index of the first set bit at or after the given index,
+  or SIZE_MAX if there is none.
+ */
+size_t bitmap_find_next_set(bitmap_t *bitmap, size_t index);
+
+/*
+  Returns the index of the first clear bit at or after the given index.
+ */
+size_t bitmap_find_next_clear(bitmap_t *bitmap, size_t index);
+
+/*
+  Returns the number of set bits in a range of count bits, starting
+  at the given index.
+ */
+size_t bitmap_count_set(bitmap_t *bitmap, size_t index, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,13 @@
 struct fs_dep_tracker_t {
 	object_t base;
 
+	/*
+	  If set, the time spent on building each filesystem and on
+	  committing each node is recorded here. The tracker holds
+	  a reference.
+	*/
+	imgtool_stats_t *stats;
+
 	/*
 	  Add a volume and the parent that it is derived from (or NULL if it is
 	  at the bottom of the stacking hierarchy).
@@ -51,6 +58,19 @@ struct fs_dep_tracker_t {
 	filesystem_t *(*get_fs_by_name)(fs_dep_tracker_t *dep,
 					const char *name);
 
+	/*
+	  Returns true if populating the two filesystems can touch the same
+	  fstree_t or volume, i.e. if they are the same filesystem, if they
+	  are (maybe nested) inside volume files of a common filesystem, or
+	  if they are stored on a common volume other than through separate
+	  partitions, which can safely be written to concurrently.
+
+	  Filesystems that are not known to the tracker are always
+	  considered to overlap.
+	*/
+	bool (*fs_overlap)(fs_dep_tracker_t *dep, filesystem_t *a,
+			   filesystem_t *b);
+
 	/*
 	  Call build_format() on all filesystems and commit() on
 	  all volumes, in the correct dependency order.
@@ -8,6 +8,18 @@
 #define LIBIMGTOOL_H
 
 #include "predef.h"
+#include "threadpool.h"
+
+typedef enum {
+	IMGTOOL_OUTPUT_RAW = 0,
+	IMGTOOL_OUTPUT_ANDROID_SPARSE,
+	IMGTOOL_OUTPUT_QCOW2,
+	IMGTOOL_OUTPUT_QCOW2_ZSTD,
+	IMGTOOL_OUTPUT_ZSTD_SEEKABLE,
+
+	/* don't store any data, only compute the layout */
+	IMGTOOL_OUTPUT_NULL,
+} IMGTOOL_OUTPUT_FORMAT;
 
 struct imgtool_state_t {
 	object_t base;
@@ -19,8 +31,23 @@ struct imgtool_state_t {
 
 	volume_t *out_file;
 
+	/* filesystems and partitions, in order of creation */
+	size_report_t *reports;
+	size_report_t *reports_last;
+	size_t part_count;
+
+	/*
+	  Worker threads shared by everything that wants to do work in
+	  parallel, e.g. mount group processing or output compression.
+	  Plugins can submit tasks to it as well.
+	 */
+	thread_pool_t *pool;
+
 	plugin_registry_t *registry;
 
+	/* timing and I/O statistics, NULL unless enabled */
+	imgtool_stats_t *stats;
+
 	gcfg_keyword_t *cfg_global;
 	gcfg_keyword_t *cfg_fs_or_volume;
 	gcfg_keyword_t *cfg_fs_common;
@@ -34,14 +61,33 @@ extern "C" {
 
 gcfg_file_t *open_gcfg_file(const char *path);
 
-imgtool_state_t *imgtool_state_create(const char *out_path);
+/*
+  Create the state object, the output volume and a thread pool that uses
+  at most the given number of threads.
+ */
+imgtool_state_t *imgtool_state_create(const char *out_path,
+				      IMGTOOL_OUTPUT_FORMAT format,
+				      size_t num_jobs);
 
 int imgtool_state_init_config(imgtool_state_t *state);
 
+/*
+  Start recording timing and I/O statistics, see stats.h. Must be called
+  before processing any configuration files, so the volumes can be
+  instrumented while the configuration is parsed.
+ */
+int imgtool_state_enable_stats(imgtool_state_t *state);
+
 int imgtool_process_config_file(imgtool_state_t *state, const char *path);
 
 int imgtool_state_process(imgtool_state_t *state);
 
+/*
+  Print the sizes of all filesystems, partitions and the output image
+  to stdout. Intended to be called after imgtool_state_process.
+ */
+void imgtool_state_print_sizes(imgtool_state_t *state);
+
 #ifdef __cplusplus
 }
 #endif
@@ -87,18 +87,21 @@ struct meta_object_t {
 			    property_value_t *value);
 };
 
+/*
+  The reference count is modified atomically, so an object can be shared
+  between threads. Whoever drops the last reference destroys the object.
+ */
 static inline void* object_grab(void *obj)
 {
-	((object_t *)obj)->refcount += 1;
+	__atomic_add_fetch(&((object_t *)obj)->refcount, 1, __ATOMIC_RELAXED);
 	return obj;
 }
 
 static inline void* object_drop(void *obj)
 {
-	if (((object_t *)obj)->refcount == 1) {
+	if (__atomic_sub_fetch(&((object_t *)obj)->refcount, 1,
+			       __ATOMIC_ACQ_REL) == 0) {
 		((object_t *)obj)->destroy(obj);
-	} else {
-		((object_t *)obj)->refcount -= 1;
 	}
 	return NULL;
 }
@@ -149,10 +152,12 @@ typedef struct xfrm_block_t xfrm_block_t;
 typedef struct compressor_config_t compressor_config_t;
 
 typedef struct bitmap_t bitmap_t;
+typedef struct thread_pool_t thread_pool_t;
 
 typedef struct volume_t volume_t;
 typedef struct partition_t partition_t;
 typedef struct partition_mgr_t partition_mgr_t;
+typedef struct volume_io_stats_t volume_io_stats_t;
 
 typedef struct gcfg_number_t gcfg_number_t;
 typedef struct gcfg_enum_t gcfg_enum_t;
@@ -172,6 +177,8 @@ typedef struct file_source_filter_t file_source_filter_t;
 typedef struct file_source_listing_t file_source_listing_t;
 
 typedef struct mount_group_t mount_group_t;
+typedef struct size_report_t size_report_t;
+typedef struct imgtool_stats_t imgtool_stats_t;
 typedef struct imgtool_state_t imgtool_state_t;
 typedef struct plugin_t plugin_t;
 typedef struct plugin_registry_t plugin_registry_t;
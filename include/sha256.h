@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * sha256.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE (32)
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buffer[64];
+} sha256_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sha256_init(sha256_t *ctx);
+
+void sha256_update(sha256_t *ctx, const void *data, size_t size);
+
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/*
+  Convert a digest to a null-terminated, lower case hex string. The string
+  buffer must have room for 2 * SHA256_DIGEST_SIZE + 1 characters.
+ */
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHA256_H */
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * stats.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include "predef.h"
+#include "volume.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+/* Start time of a section that is being measured, in nano seconds. */
+typedef struct {
+	uint64_t wall;
+	uint64_t cpu;
+} stats_span_t;
+
+typedef struct stats_event_t {
+	struct stats_event_t *next;
+
+	const char *category;
+	unsigned int track;
+
+	/* all in micro seconds, start relative to the creation of the stats */
+	uint64_t start;
+	uint64_t wall;
+	uint64_t cpu;
+
+	char name[];
+} stats_event_t;
+
+typedef struct stats_volume_t {
+	struct stats_volume_t *next;
+
+	volume_io_stats_t io;
+
+	char name[];
+} stats_volume_t;
+
+/*
+  Collects timing information about the individual processing phases and
+  I/O statistics for volumes. Recording events is thread safe.
+ */
+struct imgtool_stats_t {
+	object_t base;
+
+	pthread_mutex_t lock;
+	uint64_t epoch;
+
+	stats_event_t *events;
+	stats_event_t *events_last;
+
+	stats_volume_t *volumes;
+	stats_volume_t *volumes_last;
+
+	/* highest track number that an event has been recorded on */
+	unsigned int max_track;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+imgtool_stats_t *imgtool_stats_create(void);
+
+/* Remember the current wall clock and CPU time of the calling thread. */
+void imgtool_stats_begin(stats_span_t *span);
+
+/*
+  Record an event that started with imgtool_stats_begin and ends now. Must
+  be called from the same thread as imgtool_stats_begin. Events are grouped
+  into numbered tracks, track 0 is for work that only the main thread does.
+  The category must be a static string, the name is copied.
+
+  Returns 0 on success, -1 on failure.
+ */
+int imgtool_stats_end(imgtool_stats_t *stats, const stats_span_t *span,
+		      unsigned int track, const char *category,
+		      const char *name);
+
+/*
+  Create a counting volume on top of a volume, that records its
+  statistics under the given name.
+ */
+volume_t *imgtool_stats_wrap_volume(imgtool_stats_t *stats, volume_t *vol,
+				    const char *name);
+
+/* Print a human readable summary. */
+void imgtool_stats_print(imgtool_stats_t *stats, FILE *fp);
+
+/*
+  Write all recorded events to a file in the Chrome trace event format,
+  i.e. JSON that can be loaded into chrome://tracing or Perfetto. Volume
+  statistics are added as counter events at the end of the trace.
+
+  Returns 0 on success, -1 on failure.
+ */
+int imgtool_stats_write_trace(imgtool_stats_t *stats, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H */
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * threadpool.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "predef.h"
+
+/*
+  A fixed set of worker threads that tasks can be submitted to, so that
+  everything that wants to do work in parallel shares the same number of
+  threads, instead of each spawning their own.
+
+  Every worker has its own task queue. Tasks submitted by a worker go onto
+  its own queue, which it processes most recent first. Tasks submitted by
+  any other thread go onto a shared queue. A worker that runs out of work
+  takes tasks from the shared queue or steals the oldest task from the
+  queue of another worker.
+
+  Tasks are submitted as part of a group, that can be waited on. While
+  waiting, the calling thread processes tasks itself, so a task can submit
+  more tasks and wait for them without tying up a worker. For the same
+  reason, a pool with a single thread has no workers at all and all tasks
+  are processed by the thread that waits for them.
+ */
+typedef struct {
+	/* number of submitted tasks that have not finished yet */
+	size_t pending;
+
+	/* first non-zero value returned by a task in the group */
+	int status;
+} thread_pool_group_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Create a thread pool that runs tasks on at most the given number of
+  threads, including the ones waiting for tasks to finish. Zero is
+  treated like one.
+ */
+thread_pool_t *thread_pool_create(size_t num_threads);
+
+/*
+  Returns the number of threads that can process tasks at the same time,
+  i.e. the number of workers, plus one for the thread that waits.
+ */
+size_t thread_pool_get_thread_count(thread_pool_t *pool);
+
+/*
+  Add a task to a group and queue it for processing. The group must be
+  zero initialized before submitting the first task.
+
+  Returns 0 on success, -1 if the task could not be queued.
+ */
+int thread_pool_submit(thread_pool_t *pool, thread_pool_group_t *group,
+		       int (*fn)(void *arg), void *arg);
+
+/*
+  Wait until all tasks in a group have finished, processing queued
+  tasks in the mean time.
+
+  Returns the status of the group, i.e. 0 if all tasks returned 0.
+ */
+int thread_pool_wait(thread_pool_t *pool, thread_pool_group_t *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THREADPOOL_H */
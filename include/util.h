@@ -22,12 +22,25 @@ extern "C" {
  */
 bool is_memory_zero(const void *blob, size_t size);
 
+/*
+  Returns the offset of the first non-zero byte in the given region of
+  memory, or size if the region is filled with zero-bytes only.
+ */
+size_t find_nonzero_byte(const void *blob, size_t size);
+
 int read_retry(const char *filename, int fd, uint64_t offset,
 	       void *data, size_t size);
 
 int write_retry(const char *filename, int fd, uint64_t offset,
 		const void *data, size_t size);
 
+/*
+  Update a CRC32 (IEEE 802.3 polynomial, as used by zlib, GPT, etc...)
+  with the given data. The initial value is 0, the pre and post inversion
+  is done internally, so the result of one call can be fed into the next.
+ */
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
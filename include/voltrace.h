@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * voltrace.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef VOLTRACE_H
+#define VOLTRACE_H
+
+#include "predef.h"
+
+#include <stdio.h>
+
+/*
+  A volume trace file starts with a header, followed by fixed size records,
+  one for each call to the traced volume. All fields are little endian.
+ */
+#define VOLTRACE_MAGIC "VOLTRACE"
+#define VOLTRACE_VERSION (1)
+
+typedef enum {
+	VOLTRACE_OP_READ_BLOCK = 1,
+	VOLTRACE_OP_READ_PARTIAL,
+	VOLTRACE_OP_WRITE_BLOCK,
+	VOLTRACE_OP_WRITE_PARTIAL,
+	VOLTRACE_OP_MOVE_BLOCK,
+	VOLTRACE_OP_MOVE_PARTIAL,
+	VOLTRACE_OP_DISCARD,
+	VOLTRACE_OP_TRUNCATE,
+	VOLTRACE_OP_COMMIT,
+
+	VOLTRACE_OP_COUNT,
+} VOLTRACE_OP;
+
+typedef struct {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t blocksize;
+} voltrace_header_t;
+
+typedef struct {
+	uint8_t op;
+
+	/* non-zero if the call failed */
+	uint8_t status;
+
+	uint16_t pad0;
+
+	/* number of bytes read, written or moved */
+	uint32_t size;
+
+	/* block index, or source block index for moves */
+	uint64_t index;
+
+	/*
+	  Destination block for moves, block count for discards, new size
+	  in bytes for truncate. Writes with a NULL buffer have a size of
+	  0 and store the number of bytes cleared here instead.
+	 */
+	uint64_t arg;
+
+	/* byte offset into the block, or the source block for moves */
+	uint32_t offset;
+
+	/* byte offset into the destination block for moves */
+	uint32_t dst_offset;
+
+	/* time spent in the wrapped volume, in nano seconds */
+	uint64_t latency;
+} voltrace_record_t;
+
+typedef struct {
+	uint32_t blocksize;
+
+	uint64_t count[VOLTRACE_OP_COUNT];
+	uint64_t bytes[VOLTRACE_OP_COUNT];
+	uint64_t latency[VOLTRACE_OP_COUNT];
+	uint64_t max_latency[VOLTRACE_OP_COUNT];
+	uint64_t errors;
+
+	/*
+	  Reads or writes that start exactly where the previous read or
+	  write respectively ended, vs. ones that don't.
+	 */
+	uint64_t seq_reads;
+	uint64_t random_reads;
+	uint64_t seq_writes;
+	uint64_t random_writes;
+
+	/* writes with a NULL buffer, i.e. zero-filling part of a block */
+	uint64_t zero_writes;
+} voltrace_summary_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Read a volume trace from a file and summarize it.
+
+  Returns 0 on success, -1 on failure (after printing an error message).
+ */
+int voltrace_analyze(FILE *fp, const char *filename,
+		     voltrace_summary_t *out);
+
+/* Print a human readable version of a summary. */
+void voltrace_print_summary(const voltrace_summary_t *sum, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VOLTRACE_H */
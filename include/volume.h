@@ -13,6 +13,11 @@
   A "volume" represents what Unix might call a block device. It manages a chunk
   of data that is divided into uniformly sized blocks that can be read,
   overwritten, and so on, but only with block granularity.
+
+  The partitions of a partition manager can be accessed from several threads
+  at once, so different partitions on the same output file can be populated
+  concurrently. Other volume implementations expect to be used by one thread
+  at a time, unless wrapped with volume_locked_create.
  */
 struct volume_t {
 	object_t base;
@@ -123,6 +128,27 @@ struct volume_t {
 	int (*commit)(volume_t *vol);
 };
 
+/*
+  Per volume I/O statistics, gathered by a counting volume. Block sized and
+  partial operations are both counted as a single call. Writes with a NULL
+  buffer are counted as discards.
+ */
+struct volume_io_stats_t {
+	uint64_t read_calls;
+	uint64_t read_bytes;
+
+	uint64_t write_calls;
+	uint64_t write_bytes;
+
+	uint64_t move_calls;
+	uint64_t move_bytes;
+
+	uint64_t discard_calls;
+	uint64_t discard_bytes;
+
+	uint64_t commit_calls;
+};
+
 typedef enum {
 	/*
 	  Interpret the size as a minimum and allow the partition to grow,
@@ -150,6 +176,19 @@ typedef enum {
 	MBR_PARTITION_TYPE_UNIXWARE_DATA = 0x06300000,
 } MBR_PARTITION_FLAGS;
 
+typedef enum {
+	GPT_PARTITION_FLAG_LEGACY_BOOTABLE = 0x00010000,
+
+	GPT_PARTITION_TYPE_LINUX_DATA = 0x00000000,
+	GPT_PARTITION_TYPE_LINUX_SWAP = 0x00100000,
+	GPT_PARTITION_TYPE_LINUX_HOME = 0x00200000,
+	GPT_PARTITION_TYPE_LINUX_LVM = 0x00300000,
+	GPT_PARTITION_TYPE_LINUX_RAID = 0x00400000,
+	GPT_PARTITION_TYPE_EFI_SYSTEM = 0x00500000,
+	GPT_PARTITION_TYPE_BIOS_BOOT = 0x00600000,
+	GPT_PARTITION_TYPE_MICROSOFT_BASIC = 0x00700000,
+} GPT_PARTITION_FLAGS;
+
 struct partition_t {
 	volume_t base;
 
@@ -198,6 +237,82 @@ extern "C" {
  */
 volume_t *volume_from_fd(const char *filename, int fd, uint64_t max_size);
 
+/*
+  Write a bmaptool compatible block map for a volume created through
+  volume_from_fd. Only blocks that hold data are listed, each range with
+  the SHA256 checksum of its contents. Intended to be used after the
+  volume has been committed.
+
+  The checksums are computed in parallel on the given thread pool, which
+  may be NULL.
+
+  Returns 0 on success.
+ */
+int volume_write_bmap(volume_t *vol, const char *path, thread_pool_t *pool);
+
+/*
+  Creates a volume that writes an Android sparse image to a file descriptor.
+  The blocks are written to the file right away, where they would end up
+  if the image consisted of raw chunks only. On commit, the chunks are
+  assembled in place in a single pass over the used blocks. Holes become
+  DONT_CARE chunks and blocks that consist of a repeated 32 bit pattern
+  become FILL chunks. The volume cannot be accessed anymore after that.
+
+  The volume takes ownership of the file descriptor.
+ */
+volume_t *volume_android_sparse_create(const char *filename, int fd,
+				       uint64_t max_size);
+
+/*
+  Creates a volume that writes a qcow2 (version 3) image with 64 KiB
+  clusters to a file descriptor. Data clusters are allocated in the file
+  as blocks are written to them, clusters that hold no data are left
+  unallocated. On commit, the data clusters are packed together and the
+  L2 tables, L1 table and refcount structures are written after them.
+
+  If a compressor stream is given, it is used on commit to compress each
+  data cluster into a separate zstd frame, where it saves space. The
+  compressed clusters cannot be read back, so the volume must not be
+  modified anymore after that. The volume grabs a reference to the
+  compressor.
+
+  The volume takes ownership of the file descriptor.
+ */
+volume_t *volume_qcow2_create(const char *filename, int fd,
+			      uint64_t max_size, xfrm_stream_t *compressor);
+
+/*
+  Creates a volume that writes a file in the seekable zstd format when
+  committed, i.e. a sequence of independent zstd frames that each cover
+  frame_size bytes of the volume, followed by a seek table in a skippable
+  frame. Until then, the data is kept in an unlinked temporary file.
+
+  The frames are compressed in parallel on the given thread pool, which
+  may be NULL. If the pool has worker threads, frames are already
+  compressed while the volume is written to, as soon as the writes have
+  moved on past them. Frames that are modified again afterwards are
+  compressed again on commit. The callback is used to create a separate
+  compressor stream for each task processing frames.
+
+  The volume takes ownership of the file descriptor.
+ */
+volume_t *volume_zstd_seekable_create(const char *filename, int fd,
+				      uint64_t max_size, uint32_t frame_size,
+				      xfrm_stream_t *(*create_compressor)(void),
+				      thread_pool_t *pool);
+
+/*
+  Creates a volume that behaves like a file volume with the given block
+  size, but only keeps track of its size and which blocks are used. All
+  written data is dropped and reading always returns zero bytes. Useful
+  to figure out the size of an image without actually generating it.
+  The exact size in bytes can be read through the "size" property.
+
+  The name is copied internally and used to print error messages.
+ */
+volume_t *volume_null_create(const char *name, uint32_t blocksize,
+			     uint64_t max_size);
+
 /*
   Creates a volume that internally wrapps another volume and emulates having
   a different blocksize. It can also be set to start at an arbitrary byte
@@ -207,8 +322,48 @@ volume_t *volume_from_fd(const char *filename, int fd, uint64_t max_size);
 volume_t *volume_blocksize_adapter_create(volume_t *vol, uint32_t blocksize,
 					  uint32_t offset);
 
+/*
+  Creates a volume that passes everything through to another volume and
+  makes it safe to use from several threads at once. Reading blocks and
+  querying the block counts can run concurrently, since they must not
+  modify the wrapped volume. All other calls are serialized.
+ */
+volume_t *volume_locked_create(volume_t *vol);
+
+/*
+  Creates a volume that passes everything through to another volume and
+  records the number of calls and bytes processed in a statistics block
+  owned by the caller, which must outlive the volume. The counters are
+  updated atomically, so the volume can be used from several threads.
+ */
+volume_t *volume_counting_create(volume_t *vol, volume_io_stats_t *stats);
+
+/*
+  Creates a volume that passes everything through to another volume and
+  logs every call along with its arguments and latency, see voltrace.h
+  for the file format. The records are collected in a buffer that is
+  appended to the file when it fills up, on commit and when the volume
+  is destroyed. The buffer is protected by a lock, so the volume can be
+  used from several threads. Records are added in the order in which the
+  operations complete.
+
+  The volume takes ownership of the file descriptor. The filename is only
+  used for error messages.
+ */
+volume_t *volume_trace_create(volume_t *vol, const char *filename, int fd);
+
 partition_mgr_t *mbrdisk_create(volume_t *base);
 
+/*
+  Creates a partition manager for a GUID partition table. Up to 128
+  partitions are supported, aligned to 1 MiB and with 64 bit sector
+  indices. On commit, a protective MBR, the primary GPT at the start of
+  the disk and the backup GPT at the end of the disk are written.
+  If no partition has the fill flag set, the disk ends right after
+  the last partition.
+ */
+partition_mgr_t *gptdisk_create(volume_t *base);
+
 /*
   Helper function that allows reading arbitrary byte sized chunks of data at
   arbitrary byte offsets from a volume. It internally calls read_partial_block
@@ -133,8 +133,8 @@ static void convert(FAT_SHORTNAME *conv,
 		*conv = FAT_SHORTNAME_SUFFIXED;
 }
 
-FAT_SHORTNAME fatfs_mk_shortname(const uint8_t *name, uint8_t shortname[11],
-				 size_t len, unsigned int gen)
+FAT_SHORTNAME fatfs_mk_shortname_basis(const uint8_t *name,
+				       uint8_t shortname[11], size_t len)
 {
 	const uint8_t *ext = NULL, *ext_candidate = NULL;
 	FAT_SHORTNAME conv = FAT_SHORTNAME_SAME;
@@ -187,9 +187,25 @@ FAT_SHORTNAME fatfs_mk_shortname(const uint8_t *name, uint8_t shortname[11],
 		convert(&conv, name, len, shortname, 8);
 	}
 
-	/* Append the generation number if necessary */
+	return conv;
+}
+
+FAT_SHORTNAME fatfs_shortname_add_gen(uint8_t shortname[11],
+				      FAT_SHORTNAME conv, unsigned int gen)
+{
 	if (conv == FAT_SHORTNAME_SUFFIXED || gen > 1)
 		conv = append_generation(shortname, gen);
 
 	return conv;
 }
+
+FAT_SHORTNAME fatfs_mk_shortname(const uint8_t *name, uint8_t shortname[11],
+				 size_t len, unsigned int gen)
+{
+	FAT_SHORTNAME conv = fatfs_mk_shortname_basis(name, shortname, len);
+
+	if (conv == FAT_SHORTNAME_ERROR)
+		return conv;
+
+	return fatfs_shortname_add_gen(shortname, conv, gen);
+}
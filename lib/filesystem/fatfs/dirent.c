@@ -6,62 +6,127 @@
  */
 #include "fatfs.h"
 
-struct short_list_t {
-	struct short_list_t *next;
-	uint16_t used;
-	uint8_t name[11 * 10];
-};
-
-static bool is_in_short_name_list(struct short_list_t *list,
-				  const uint8_t name[11])
+/*
+  Short names are tracked per directory in an open addressing hash table.
+  The same table type is also used to remember the next generation number
+  to try for a given short name basis, so that a directory full of similar
+  long names doesn't have to walk through all previous generations again
+  for every single entry.
+
+  A key is the 11 byte short name plus a flag byte, a value of 0 marks an
+  unused slot.
+ */
+typedef struct {
+	uint8_t key[12];
+	uint32_t value;
+} short_slot_t;
+
+typedef struct {
+	short_slot_t *slots;
+	size_t count;
+	size_t capacity;
+} short_table_t;
+
+static uint32_t short_key_hash(const uint8_t key[12])
 {
-	struct short_list_t *it = list;
+	uint32_t hash = 0x811C9DC5;
 	size_t i;
 
-	for (it = list; it != NULL; it = it->next) {
-		for (i = 0; i < (size_t)it->used; ++i) {
-			if (memcmp(it->name + i * 11, name, 11) == 0)
-				return true;
-		}
+	for (i = 0; i < 12; ++i) {
+		hash ^= key[i];
+		hash *= 0x01000193;
 	}
 
-	return false;
+	return hash;
 }
 
-static int add_to_short_name_list(struct short_list_t **list,
-				  const uint8_t name[11])
+static short_slot_t *short_table_find(const short_table_t *table,
+				      const uint8_t key[12])
 {
-	struct short_list_t *ent, *it;
+	size_t i = short_key_hash(key) & (table->capacity - 1);
+	short_slot_t *slot;
 
-	for (it = *list; it != NULL; it = it->next) {
-		if ((size_t)it->used < (sizeof(it->name) / 11)) {
-			memcpy(it->name + it->used * 11, name, 11);
-			it->used += 1;
-			return 0;
-		}
+	for (;;) {
+		slot = table->slots + i;
+
+		if (slot->value == 0 || memcmp(slot->key, key, 12) == 0)
+			return slot;
+
+		i = (i + 1) & (table->capacity - 1);
+	}
+}
+
+static int short_table_init(short_table_t *table, size_t count)
+{
+	table->count = 0;
+	table->capacity = 16;
+
+	while (table->capacity < 2 * count)
+		table->capacity *= 2;
+
+	table->slots = calloc(table->capacity, sizeof(table->slots[0]));
+	if (table->slots == NULL) {
+		perror("memorizing FAT short names");
+		return -1;
 	}
 
-	ent = calloc(1, sizeof(*ent));
-	if (ent == NULL) {
-		perror("memorizing FAT short name");
+	return 0;
+}
+
+static int short_table_grow(short_table_t *table)
+{
+	short_table_t new;
+	size_t i;
+
+	new.count = table->count;
+	new.capacity = table->capacity * 2;
+	new.slots = calloc(new.capacity, sizeof(new.slots[0]));
+
+	if (new.slots == NULL) {
+		perror("memorizing FAT short names");
 		return -1;
 	}
 
-	memcpy(ent->name, name, 11);
-	ent->next = *list;
-	ent->used = 1;
+	for (i = 0; i < table->capacity; ++i) {
+		if (table->slots[i].value != 0)
+			*short_table_find(&new, table->slots[i].key) =
+				table->slots[i];
+	}
 
-	*list = ent;
+	free(table->slots);
+	*table = new;
 	return 0;
 }
 
-static void cleanup_short_name_list(struct short_list_t *list)
+static uint32_t short_table_get(const short_table_t *table,
+				const uint8_t key[12])
+{
+	return short_table_find(table, key)->value;
+}
+
+static int short_table_set(short_table_t *table, const uint8_t key[12],
+			   uint32_t value)
 {
-	while (list != NULL) {
-		struct short_list_t *ent = list;
-		list = list->next;
-		free(ent);
+	short_slot_t *slot = short_table_find(table, key);
+
+	if (slot->value == 0) {
+		if (2 * (table->count + 1) > table->capacity) {
+			if (short_table_grow(table))
+				return -1;
+			slot = short_table_find(table, key);
+		}
+
+		memcpy(slot->key, key, 12);
+		table->count += 1;
 	}
+
+	slot->value = value;
+	return 0;
+}
+
+static void short_table_cleanup(short_table_t *table)
+{
+	free(table->slots);
 }
 
 /*****************************************************************************/
@@ -94,12 +159,41 @@ static uint32_t get_cluster_index(fatfs_filesystem_t *fs, uint64_t location)
 	return (uint32_t)(index + CLUSTER_OFFSET);
 }
 
+static int dir_append(fatfs_dir_t *dir, const void *data, size_t size)
+{
+	size_t new_sz = dir->capacity ? dir->capacity : 1024;
+	uint8_t *new;
+
+	while (new_sz < dir->size + size)
+		new_sz *= 2;
+
+	if (new_sz > dir->capacity) {
+		new = realloc(dir->data, new_sz);
+		if (new == NULL) {
+			perror(dir->node->name);
+			return -1;
+		}
+
+		dir->data = new;
+		dir->capacity = new_sz;
+	}
+
+	memcpy(dir->data + dir->size, data, size);
+	dir->size += size;
+	return 0;
+}
+
 /*****************************************************************************/
 
-static int write_short_entry(fatfs_filesystem_t *fs, tree_node_t *n,
-			     ostream_t *ostrm, uint8_t shortname[11])
+/*
+  Directory entries are generated before the data is laid out, so the
+  cluster index and, for sub directories, the size are filled in later
+  by fatfs_patch_directory.
+ */
+static int write_short_entry(tree_node_t *n, fatfs_dir_t *dir,
+			     uint8_t shortname[11])
 {
-	uint32_t location, size, ctime, mtime;
+	uint32_t ctime, mtime;
 	fatfs_dir_ent_t ent;
 	char *path;
 
@@ -109,14 +203,10 @@ static int write_short_entry(fatfs_filesystem_t *fs, tree_node_t *n,
 
 	switch (n->type) {
 	case TREE_NODE_DIR:
-		location = get_cluster_index(fs, n->data.dir.start);
-		size = (uint32_t)n->data.dir.size;
-
 		ent.flags |= DIR_ENT_DIRECTORY;
 		break;
 	case TREE_NODE_FILE:
-		location = (uint32_t)n->data.file.start_index + CLUSTER_OFFSET;
-		size = (uint32_t)n->data.file.size;
+		ent.size = htole32((uint32_t)n->data.file.size);
 		break;
 	default:
 		path = fstree_get_path(n);
@@ -129,10 +219,6 @@ static int write_short_entry(fatfs_filesystem_t *fs, tree_node_t *n,
 		return -1;
 	}
 
-	ent.cluster_index_high = htole16((uint16_t)(location >> 16));
-	ent.cluster_index_low = htole16((uint16_t)location);
-	ent.size = htole32(size);
-
 	ctime = fatfs_convert_timestamp(n->ctime);
 	mtime = fatfs_convert_timestamp(n->mtime);
 
@@ -142,10 +228,10 @@ static int write_short_entry(fatfs_filesystem_t *fs, tree_node_t *n,
 	ent.mtime_ymd = htole16((mtime >> 16) & 0x0FFFF);
 	ent.atime_ymd = ent.mtime_ymd;
 
-	return ostream_append(ostrm, &ent, sizeof(ent));
+	return dir_append(dir, &ent, sizeof(ent));
 }
 
-static int write_long_entry(ostream_t *ostrm, const uint8_t *name,
+static int write_long_entry(fatfs_dir_t *dir, const uint8_t *name,
 			    const uint8_t shortname[11])
 {
 	size_t i, count, len = strlen((const char *)name) + 1;
@@ -196,18 +282,16 @@ static int write_long_entry(ostream_t *ostrm, const uint8_t *name,
 			lent.name_part3[idx] = wchar;
 		}
 
-		if (ostream_append(ostrm, &lent, sizeof(lent)))
+		if (dir_append(dir, &lent, sizeof(lent)))
 			return -1;
 	}
 
 	return 0;
 }
 
-static int init_directory(fatfs_filesystem_t *fatfs, tree_node_t *n,
-			  ostream_t *ostrm)
+static int init_directory(tree_node_t *n, fatfs_dir_t *dir)
 {
 	fatfs_dir_ent_t ent;
-	uint32_t location;
 
 	if (n->parent == NULL)
 		return 0;
@@ -220,77 +304,171 @@ static int init_directory(fatfs_filesystem_t *fatfs, tree_node_t *n,
 	/* dot entry */
 	ent.name[0] = '.';
 
-	location = get_cluster_index(fatfs, n->data.dir.start);
-	ent.cluster_index_high = htole16((uint16_t)(location >> 16));
-	ent.cluster_index_low = htole16((uint16_t)location);
-
-	if (ostream_append(ostrm, &ent, sizeof(ent)))
+	if (dir_append(dir, &ent, sizeof(ent)))
 		return -1;
 
 	/* dot-dot entry */
 	ent.name[1] = '.';
 
-	if (n->parent->parent == NULL) {
-		location = 0;
-	} else {
-		location = get_cluster_index(fatfs, n->parent->data.dir.start);
-	}
+	return dir_append(dir, &ent, sizeof(ent));
+}
 
-	ent.cluster_index_high = htole16((uint16_t)(location >> 16));
-	ent.cluster_index_low = htole16((uint16_t)location);
+/*
+  Generate a unique short name for a directory entry. Picks the smallest
+  generation number that produces a name not already in use, starting from
+  where the last entry with the same basis left off. Since names are never
+  removed from the set, every generation below that is still taken.
+ */
+static FAT_SHORTNAME unique_short_name(short_table_t *names,
+				       short_table_t *counters,
+				       const char *name, uint8_t key[12])
+{
+	uint8_t basis[12];
+	FAT_SHORTNAME conv, ret;
+	uint32_t gen;
+
+	conv = fatfs_mk_shortname_basis((const uint8_t *)name, basis,
+					strlen(name));
+	if (conv == FAT_SHORTNAME_ERROR)
+		return conv;
+
+	/* names that always need a suffix have a separate sequence */
+	basis[11] = (conv == FAT_SHORTNAME_SUFFIXED);
+	key[11] = 0;
+
+	gen = short_table_get(counters, basis);
+	if (gen == 0)
+		gen = 1;
 
-	return ostream_append(ostrm, &ent, sizeof(ent));
+	do {
+		memcpy(key, basis, 11);
+
+		ret = fatfs_shortname_add_gen(key, conv, gen);
+		if (ret == FAT_SHORTNAME_ERROR)
+			return ret;
+
+		gen += 1;
+	} while (short_table_get(names, key) != 0);
+
+	if (short_table_set(names, key, 1))
+		return FAT_SHORTNAME_ERROR;
+
+	if (short_table_set(counters, basis, gen))
+		return FAT_SHORTNAME_ERROR;
+
+	return ret;
 }
 
-int fatfs_serialize_directory(fatfs_filesystem_t *fatfs, tree_node_t *root,
-			      ostream_t *ostrm)
+int fatfs_serialize_directory(tree_node_t *root, fatfs_dir_t *dir)
 {
-	struct short_list_t *list = NULL;
-	uint8_t shortname[11];
+	short_table_t names, counters;
+	uint8_t shortname[12];
 	FAT_SHORTNAME conv;
-	unsigned int gen;
+	size_t count = 0;
 	tree_node_t *it;
 	int ret;
 
-	if (init_directory(fatfs, root, ostrm))
+	dir->node = root;
+	dir->size = 0;
+
+	if (init_directory(root, dir))
 		return -1;
 
-	for (it = root->data.dir.children; it != NULL; it = it->next) {
-		if (is_non_ascii((const uint8_t *)it->name))
-			goto fail_conv;
+	for (it = root->data.dir.children; it != NULL; it = it->next)
+		++count;
 
-		gen = 1;
+	if (short_table_init(&names, count))
+		return -1;
 
-		do {
-			conv = fatfs_mk_shortname((const uint8_t *)it->name,
-						  shortname, strlen(it->name),
-						  gen);
-			if (conv == FAT_SHORTNAME_ERROR)
-				goto fail_conv;
+	if (short_table_init(&counters, count)) {
+		short_table_cleanup(&names);
+		return -1;
+	}
 
-			gen += 1;
-		} while (is_in_short_name_list(list, shortname));
+	for (it = root->data.dir.children; it != NULL; it = it->next) {
+		if (is_non_ascii((const uint8_t *)it->name))
+			goto fail_conv;
 
-		if (add_to_short_name_list(&list, shortname))
-			goto fail;
+		conv = unique_short_name(&names, &counters, it->name,
+					 shortname);
+		if (conv == FAT_SHORTNAME_ERROR)
+			goto fail_conv;
 
 		if (conv == FAT_SHORTNAME_OK ||
 		    conv == FAT_SHORTNAME_SUFFIXED) {
-			ret = write_long_entry(ostrm, (const uint8_t *)it->name,
+			ret = write_long_entry(dir, (const uint8_t *)it->name,
 					       shortname);
 			if (ret)
 				goto fail;
 		}
 
-		if (write_short_entry(fatfs, it, ostrm, shortname))
+		if (write_short_entry(it, dir, shortname))
 			goto fail;
 	}
 
-	cleanup_short_name_list(list);
+	short_table_cleanup(&counters);
+	short_table_cleanup(&names);
 	return 0;
 fail_conv:
 	fprintf(stderr, "%s: cannot convert to a FAT filename\n", it->name);
 fail:
-	cleanup_short_name_list(list);
+	short_table_cleanup(&counters);
+	short_table_cleanup(&names);
 	return -1;
 }
+
+static void patch_entry(fatfs_dir_t *dir, size_t offset, tree_node_t *n,
+			uint32_t location)
+{
+	fatfs_dir_ent_t ent;
+
+	memcpy(&ent, dir->data + offset, sizeof(ent));
+
+	ent.cluster_index_high = htole16((uint16_t)(location >> 16));
+	ent.cluster_index_low = htole16((uint16_t)location);
+
+	if (n != NULL)
+		ent.size = htole32((uint32_t)n->data.dir.size);
+
+	memcpy(dir->data + offset, &ent, sizeof(ent));
+}
+
+void fatfs_patch_directory(fatfs_filesystem_t *fatfs, fatfs_dir_t *dir)
+{
+	tree_node_t *n = dir->node, *it;
+	uint32_t location;
+	size_t offset = 0;
+
+	/* dot and dot-dot entries */
+	if (n->parent != NULL) {
+		location = get_cluster_index(fatfs, n->data.dir.start);
+		patch_entry(dir, 0, NULL, location);
+
+		if (n->parent->parent == NULL) {
+			location = 0;
+		} else {
+			location = get_cluster_index(fatfs,
+						     n->parent->data.dir.start);
+		}
+
+		patch_entry(dir, sizeof(fatfs_dir_ent_t), NULL, location);
+		offset = 2 * sizeof(fatfs_dir_ent_t);
+	}
+
+	/* each child has a short entry, preceded by its long name entries */
+	for (it = n->data.dir.children; it != NULL; it = it->next) {
+		while (dir->data[offset + 11] == DIR_ENT_LFN)
+			offset += sizeof(fatfs_long_dir_ent_t);
+
+		if (it->type == TREE_NODE_DIR) {
+			location = get_cluster_index(fatfs, it->data.dir.start);
+			patch_entry(dir, offset, it, location);
+		} else {
+			location = (uint32_t)it->data.file.start_index +
+				CLUSTER_OFFSET;
+			patch_entry(dir, offset, NULL, location);
+		}
+
+		offset += sizeof(fatfs_dir_ent_t);
+	}
+}
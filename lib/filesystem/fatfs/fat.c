@@ -6,7 +6,30 @@
  */
 #include "fatfs.h"
 
-#define FAT_WINDOW_SIZE (4096)
+/* number of FAT entries that are generated in memory at once */
+#define FAT_BUFFER_ENTRIES (256 * 1024)
+
+#define FAT32_END_OF_CHAIN (0x0FFFFFFF)
+
+/*
+  A window into the FAT. Cluster chains are generated into the buffer and
+  whenever a chain runs past the end, the window is written out to both
+  copies of the FAT and moved ahead.
+ */
+typedef struct {
+	fatfs_filesystem_t *fs;
+
+	uint32_t *buffer;
+
+	/* index of the first FAT entry in the buffer */
+	uint32_t start;
+
+	/* number of entries in the buffer that are in use */
+	uint32_t used;
+
+	/* number of entries that fit into the buffer */
+	uint32_t size;
+} fat_window_t;
 
 static int dir_compare_location(const tree_node_t *lhs, const tree_node_t *rhs)
 {
@@ -27,73 +50,75 @@ static int file_compare_location(const tree_node_t *lhs, const tree_node_t *rhs)
 
 /*****************************************************************************/
 
-static int slide_window(fatfs_filesystem_t *fs, unsigned char *window,
-			size_t *window_offset, size_t *next_wr_offset)
+static int flush_window(fat_window_t *wnd)
 {
-	size_t offset, diff;
+	fatfs_filesystem_t *fs = wnd->fs;
+	uint64_t offset;
+	size_t size;
 
-	if (fs->fatsize <= FAT_WINDOW_SIZE)
+	if (wnd->used == 0)
 		return 0;
 
-	if ((*next_wr_offset) <= (FAT_WINDOW_SIZE / 2))
-		return 0;
-
-	offset = FAT32_FAT_START + *window_offset;
-	diff = FAT_WINDOW_SIZE / 2;
+	offset = fs->reserved_secs * SECTOR_SIZE + (uint64_t)wnd->start * 4;
+	size = (size_t)wnd->used * 4;
 
-	if (volume_write(fs->orig_volume, offset, window, diff))
+	if (volume_write(fs->orig_volume, offset, wnd->buffer, size))
 		return -1;
 
-	offset += fs->fatsize;
+	return volume_write(fs->orig_volume, offset + fs->fatsize,
+			    wnd->buffer, size);
+}
 
-	if (volume_write(fs->orig_volume, offset, window, diff))
+/*
+  Move the window so that it starts at the given entry, after writing out
+  what it currently holds. Entries in between are never touched and stay
+  zero, i.e. free.
+ */
+static int move_window(fat_window_t *wnd, uint32_t index)
+{
+	if (flush_window(wnd))
 		return -1;
 
-	memmove(window, window + diff, *next_wr_offset - diff);
-
-	*window_offset += diff;
-	*next_wr_offset -= diff;
-
-	memset(window + *next_wr_offset, 0, FAT_WINDOW_SIZE - *next_wr_offset);
+	memset(wnd->buffer, 0, wnd->used * sizeof(wnd->buffer[0]));
+	wnd->start = index;
+	wnd->used = 0;
 	return 0;
 }
 
-static int flush_window(fatfs_filesystem_t *fs, unsigned char *window,
-			size_t window_offset)
+static int write_cluster_chain(fat_window_t *wnd, uint32_t index,
+			       uint32_t count)
 {
-	size_t offset = FAT32_FAT_START + window_offset;
-	size_t size = fs->fatsize - window_offset;
+	uint32_t i, diff, *ptr;
 
-	size = size > FAT_WINDOW_SIZE ? FAT_WINDOW_SIZE : size;
-
-	if (volume_write(fs->orig_volume, offset, window, size))
+	if (count > (wnd->fs->fatsize / 4) ||
+	    index > (wnd->fs->fatsize / 4 - count)) {
+		fputs("FAT cluster chain out of bounds.\n", stderr);
 		return -1;
+	}
 
-	offset += fs->fatsize;
+	while (count > 0) {
+		if (index < wnd->start || index >= (wnd->start + wnd->size)) {
+			if (move_window(wnd, index))
+				return -1;
+		}
 
-	return volume_write(fs->orig_volume, offset, window, size);
-}
+		diff = wnd->start + wnd->size - index;
+		if (diff > count)
+			diff = count;
 
-/*****************************************************************************/
+		ptr = wnd->buffer + (index - wnd->start);
 
-static int write_cluster_chain_32(fatfs_filesystem_t *fs,
-				  unsigned char *window, size_t *window_offset,
-				  size_t index, size_t count)
-{
-	size_t i, fat_offset = index * 4 - *window_offset;
-	uint32_t next;
+		for (i = 0; i < diff; ++i)
+			ptr[i] = htole32(index + i + 1);
 
-	for (i = 0; i < count; ++i) {
-		if (slide_window(fs, window, window_offset, &fat_offset))
-			return -1;
+		if (diff == count)
+			ptr[diff - 1] = htole32(FAT32_END_OF_CHAIN);
 
-		next = (i + 1) < count ? (index + i + 1) : 0xFFFFFFFF;
-		next &= 0x0FFFFFFF;
+		if ((index - wnd->start + diff) > wnd->used)
+			wnd->used = index - wnd->start + diff;
 
-		window[fat_offset++] =  next        & 0xFF;
-		window[fat_offset++] = (next >>  8) & 0xFF;
-		window[fat_offset++] = (next >> 16) & 0xFF;
-		window[fat_offset++] = (next >> 24) & 0xFF;
+		index += diff;
+		count -= diff;
 	}
 
 	return 0;
@@ -104,25 +129,35 @@ static int write_cluster_chain_32(fatfs_filesystem_t *fs,
 int fatfs_build_fats(fatfs_filesystem_t *fs)
 {
 	filesystem_t *base = (filesystem_t *)fs;
-	size_t window_offset, clustersize;
-	unsigned char *window = NULL;
 	tree_node_t *list, *it;
+	size_t clustersize;
+	fat_window_t wnd;
+	int ret = -1;
 
 	clustersize = fs->secs_per_cluster * SECTOR_SIZE;
 
-	if (volume_write(fs->orig_volume, FAT32_FAT_START, NULL, fs->fatsize))
+	if (volume_write(fs->orig_volume, fs->reserved_secs * SECTOR_SIZE,
+			 NULL, 2 * fs->fatsize)) {
 		return -1;
+	}
+
+	/* initialize the window and the reserved entries */
+	memset(&wnd, 0, sizeof(wnd));
+	wnd.fs = fs;
+	wnd.size = fs->fatsize / 4;
 
-	/* initialize the sliding window and FAT */
-	window_offset = 0;
-	window = calloc(1, fs->fatsize < FAT_WINDOW_SIZE ?
-			FAT_WINDOW_SIZE : fs->fatsize);
-	if (window == NULL) {
+	if (wnd.size > FAT_BUFFER_ENTRIES)
+		wnd.size = FAT_BUFFER_ENTRIES;
+
+	wnd.buffer = calloc(wnd.size, sizeof(wnd.buffer[0]));
+	if (wnd.buffer == NULL) {
 		perror("creating FAT buffer");
 		return -1;
 	}
 
-	memcpy(window, "\xF0\xFF\xFF\x0F\xFF\xFF\xFF\x0F", 8);
+	wnd.buffer[0] = htole32(0x0FFFFFF0);
+	wnd.buffer[1] = htole32(FAT32_END_OF_CHAIN);
+	wnd.used = CLUSTER_OFFSET;
 
 	/* handle directory entries */
 	list = base->fstree->nodes_by_type[TREE_NODE_DIR];
@@ -136,13 +171,8 @@ int fatfs_build_fats(fatfs_filesystem_t *fs)
 		if ((it->data.dir.size % clustersize) || it->data.dir.size == 0)
 			count += 1;
 
-		index += CLUSTER_OFFSET;
-
-		if (write_cluster_chain_32(fs, window, &window_offset,
-					   index, count)) {
-			free(window);
-			return -1;
-		}
+		if (write_cluster_chain(&wnd, index + CLUSTER_OFFSET, count))
+			goto out;
 	}
 
 	/* handle files */
@@ -157,19 +187,12 @@ int fatfs_build_fats(fatfs_filesystem_t *fs)
 		if (it->data.file.size % clustersize)
 			count += 1;
 
-		if (write_cluster_chain_32(fs, window, &window_offset,
-					   index, count)) {
-			free(window);
-			return -1;
-		}
-	}
-
-	/* cleanup */
-	if (flush_window(fs, window, window_offset)) {
-		free(window);
-		return -1;
+		if (write_cluster_chain(&wnd, index, count))
+			goto out;
 	}
 
-	free(window);
-	return 0;
+	ret = flush_window(&wnd);
+out:
+	free(wnd.buffer);
+	return ret;
 }
@@ -6,38 +6,134 @@
  */
 #include "fatfs.h"
 
-static void compute_fs_parameters(uint64_t disk_size, fatfs_filesystem_t *fatfs)
+/* smallest size for which the cluster count is high enough for FAT32 */
+static uint64_t min_disk_size(uint32_t cluster_size)
+{
+	return (uint64_t)FAT32_MIN_SECTORS *
+		(cluster_size ? cluster_size : SECTOR_SIZE);
+}
+
+static uint32_t compute_cluster_count(uint64_t disk_size, uint32_t cluster_size,
+				      uint32_t *secs_per_cluster)
 {
 	uint32_t i, sectors = disk_size / SECTOR_SIZE;
-	uint32_t secs_per_cluster = 1;
 	uint32_t clusters = sectors;
 
+	if (cluster_size != 0) {
+		*secs_per_cluster = cluster_size / SECTOR_SIZE;
+		return sectors / *secs_per_cluster;
+	}
+
+	*secs_per_cluster = 1;
+
 	for (i = 1; i <= (CLUSTER_SIZE_PREFERRED / SECTOR_SIZE); ++i) {
 		uint32_t new = sectors / i;
 
 		if (new < FAT32_MIN_SECTORS)
 			break;
 
-		secs_per_cluster = i;
+		*secs_per_cluster = i;
 		clusters = new;
 	}
 
-	fatfs->secs_per_cluster = secs_per_cluster;
-	fatfs->secs_per_fat = clusters / FAT32_ENTRIES_PER_SECTOR;
+	return clusters;
+}
+
+static uint32_t fat_sector_count(uint32_t clusters)
+{
+	uint32_t count = clusters / FAT32_ENTRIES_PER_SECTOR;
 
 	if (clusters % FAT32_ENTRIES_PER_SECTOR)
-		fatfs->secs_per_fat += 1;
+		count += 1;
+
+	return count;
+}
+
+static void compute_fs_parameters(uint64_t disk_size, fatfs_filesystem_t *fatfs)
+{
+	uint32_t clusters;
 
+	clusters = compute_cluster_count(disk_size, fatfs->cluster_size,
+					 &fatfs->secs_per_cluster);
+
+	fatfs->secs_per_fat = fat_sector_count(clusters);
 	fatfs->fatsize = fatfs->secs_per_fat * SECTOR_SIZE;
 }
 
+static uint64_t fat_area_size(uint64_t size, uint32_t cluster_size)
+{
+	uint32_t secs_per_cluster, clusters;
+
+	if (size > MAX_DISK_SIZE)
+		size = MAX_DISK_SIZE;
+
+	if (size < min_disk_size(cluster_size))
+		size = min_disk_size(cluster_size);
+
+	clusters = compute_cluster_count(size, cluster_size, &secs_per_cluster);
+
+	return 2 * (uint64_t)fat_sector_count(clusters) * SECTOR_SIZE;
+}
+
+/*
+  The file data is written directly behind the FATs, so space for them has
+  to be set aside before anything is known about the size of the data.
+  If the volume has a maximum size, reserve enough for that, but not more
+  than can later be turned into reserved sectors. In any case, reserve at
+  least enough for the minimum size of the volume.
+
+  A data size slightly above the FAT32 minimum may still need more clusters
+  than the maximum size, if it ends up with smaller clusters. That is rare
+  and cheap enough to simply fall back to moving the data.
+ */
+static uint64_t compute_data_start(volume_t *volume, uint32_t cluster_size)
+{
+	uint64_t min_size, max_size, area;
+
+	if (MUL64_OV(volume->blocksize, volume->get_min_block_count(volume),
+		     &min_size)) {
+		min_size = MAX_DISK_SIZE;
+	}
+
+	if (MUL64_OV(volume->blocksize, volume->get_max_block_count(volume),
+		     &max_size)) {
+		max_size = MAX_DISK_SIZE;
+	}
+
+	area = 0;
+
+	if (max_size < MAX_DISK_SIZE) {
+		area = fat_area_size(max_size, cluster_size);
+		if (area > FAT_RESERVE_MAX)
+			area = FAT_RESERVE_MAX;
+	}
+
+	if (area < fat_area_size(min_size, cluster_size))
+		area = fat_area_size(min_size, cluster_size);
+
+	return FAT32_FAT_START + area;
+}
+
+static void free_dir_buffers(fatfs_filesystem_t *fatfs)
+{
+	size_t i;
+
+	for (i = 0; i < fatfs->num_dirs; ++i)
+		free(fatfs->dirs[i].data);
+
+	free(fatfs->dirs);
+	fatfs->dirs = NULL;
+	fatfs->num_dirs = 0;
+}
+
 static int compute_dir_sizes(fatfs_filesystem_t *fatfs, uint64_t *total)
 {
 	filesystem_t *fs = (filesystem_t *)fatfs;
 	tree_node_t *it = fs->fstree->nodes_by_type[TREE_NODE_DIR];
-	uint32_t cluster_size = CLUSTER_SIZE_PREFERRED;
-	null_ostream_t *ostrm;
+	uint32_t cluster_size = fs->fstree->volume->blocksize;
+	fatfs_dir_t *dir;
 	uint64_t offset = 0;
+	size_t count = 0;
 
 	/* XXX: empty root requires special treatment because it
 	   contains no . or .. entries */
@@ -48,28 +144,35 @@ static int compute_dir_sizes(fatfs_filesystem_t *fatfs, uint64_t *total)
 		return 0;
 	}
 
-	/* compute size of each directory + total required size */
-	ostrm = null_ostream_create();
+	/* serialize each directory + compute total required size, the
+	   list always contains at least the root */
+	do {
+		++count;
+		it = it->next_by_type;
+	} while (it != NULL);
 
-	if (ostrm == NULL)
+	fatfs->dirs = calloc(count, sizeof(fatfs->dirs[0]));
+	if (fatfs->dirs == NULL) {
+		perror("serializing FAT directories");
 		return -1;
+	}
 
 	*total = 0;
+	it = fs->fstree->nodes_by_type[TREE_NODE_DIR];
 
 	for (; it != NULL; it = it->next_by_type) {
-		ostrm->bytes_written = 0;
+		dir = fatfs->dirs + fatfs->num_dirs++;
 
-		if (fatfs_serialize_directory(fatfs, it, (ostream_t *)ostrm))
-			goto fail;
+		if (fatfs_serialize_directory(it, dir))
+			return -1;
 
-		it->data.dir.size = ostrm->bytes_written;
+		it->data.dir.size = dir->size;
 
 		(*total) += it->data.dir.size / cluster_size;
 		if (it->data.dir.size % cluster_size)
 			(*total) += 1;
 	}
 
-	ostrm = object_drop(ostrm);
 	(*total) *= cluster_size;
 
 	/* compute cluster aligned locations of each directory */
@@ -93,33 +196,29 @@ static int compute_dir_sizes(fatfs_filesystem_t *fatfs, uint64_t *total)
 	}
 
 	return 0;
-fail:
-	object_drop(ostrm);
-	return -1;
 }
 
 static int write_directory_contents(fatfs_filesystem_t *fatfs)
 {
 	filesystem_t *fs = (filesystem_t *)fatfs;
-	tree_node_t *it = fs->fstree->nodes_by_type[TREE_NODE_DIR];
+	fatfs_dir_t *dir;
+	size_t i;
 
-	for (; it != NULL; it = it->next_by_type) {
-		ostream_t *ostrm;
+	for (i = 0; i < fatfs->num_dirs; ++i) {
+		dir = fatfs->dirs + i;
 
-		ostrm = volume_ostream_create(fs->fstree->volume, it->name,
-					      it->data.dir.start,
-					      it->data.dir.size);
-		if (ostrm == NULL)
-			return -1;
+		if (dir->size == 0)
+			continue;
+
+		fatfs_patch_directory(fatfs, dir);
 
-		if (fatfs_serialize_directory(fatfs, it, ostrm)) {
-			object_drop(ostrm);
+		if (volume_write(fs->fstree->volume, dir->node->data.dir.start,
+				 dir->data, dir->size)) {
 			return -1;
 		}
-
-		object_drop(ostrm);
 	}
 
+	free_dir_buffers(fatfs);
 	return 0;
 }
 
@@ -131,8 +230,8 @@ static int enforce_min_size(fatfs_filesystem_t *fat)
 	if (MUL64_OV(fat->orig_volume->blocksize, size, &size))
 		size = MAX_DISK_SIZE;
 
-	if (size < (FAT32_MIN_SECTORS * SECTOR_SIZE)) {
-		size = FAT32_MIN_SECTORS * SECTOR_SIZE;
+	if (size < min_disk_size(fat->cluster_size)) {
+		size = min_disk_size(fat->cluster_size);
 
 		if (fat->orig_volume->truncate(fat->orig_volume, size))
 			goto fail_resize;
@@ -141,7 +240,9 @@ static int enforce_min_size(fatfs_filesystem_t *fat)
 	return 0;
 fail_resize:
 	fprintf(stderr, "Error resizing volume to minimum required "
-		"size for FAT32 (~%d MiB).\n", FAT32_MIN_SECTORS / (2 * 1024));
+		"size for FAT32 (~%u MiB).\n",
+		(unsigned int)(min_disk_size(fat->cluster_size) /
+			       (1024 * 1024)));
 	return -1;
 }
 
@@ -149,7 +250,11 @@ static void adjust_file_indices(fatfs_filesystem_t *fat)
 {
 	filesystem_t *fs = (filesystem_t *)fat;
 	tree_node_t *it = fs->fstree->nodes_by_type[TREE_NODE_FILE];
-	uint32_t old_secs_per_cluster = CLUSTER_SIZE_PREFERRED / SECTOR_SIZE;
+	uint32_t old_secs_per_cluster = fs->fstree->volume->blocksize /
+		SECTOR_SIZE;
+
+	if (old_secs_per_cluster == fat->secs_per_cluster)
+		return;
 
 	for (; it != NULL; it = it->next_by_type) {
 		uint32_t sector;
@@ -159,11 +264,53 @@ static void adjust_file_indices(fatfs_filesystem_t *fat)
 	}
 }
 
+/*
+  If the FATs turned out smaller than the space set aside, the rest is
+  turned into reserved sectors, as long as that only adds a few percent to
+  the image size. Otherwise there is little enough data that moving it is
+  preferable. If the FATs are larger, the data has to be moved after all.
+ */
+static int place_fats(fatfs_filesystem_t *fat)
+{
+	filesystem_t *fs = (filesystem_t *)fat;
+	uint64_t header, data_size, slack;
+
+	header = FAT32_FAT_START + 2 * fat->fatsize;
+	data_size = fs->fstree->data_offset * fs->fstree->volume->blocksize;
+	fat->reserved_secs = FAT32_RESERVED_COUNT;
+
+	if (header == fat->data_start)
+		goto out;
+
+	if (header < fat->data_start) {
+		slack = fat->data_start - header;
+
+		if (slack <= FAT_RESERVE_MAX && slack <= data_size / 32) {
+			fat->reserved_secs += slack / SECTOR_SIZE;
+			header = fat->data_start;
+			goto out;
+		}
+	}
+
+	if (volume_memmove(fat->orig_volume, header, fat->data_start,
+			   data_size)) {
+		return -1;
+	}
+
+	if (header < fat->data_start) {
+		if (volume_write(fat->orig_volume, header + data_size, NULL,
+				 fat->data_start - header)) {
+			return -1;
+		}
+	}
+out:
+	return volume_write(fat->orig_volume, 0, NULL, header);
+}
+
 static int build_format(filesystem_t *fs)
 {
 	fatfs_filesystem_t *fat = (fatfs_filesystem_t *)fs;
-	uint64_t dir_size, size;
-	int ret;
+	uint64_t dir_size, data_size, size;
 
 	fstree_sort(fs->fstree);
 
@@ -176,27 +323,30 @@ static int build_format(filesystem_t *fs)
 	if (enforce_min_size(fat))
 		return -1;
 
+	/*
+	  If the volume is larger than the data, the FATs cover all of it.
+	  Otherwise, only the data area behind the space set aside up front.
+	 */
+	data_size = fs->fstree->data_offset * fs->fstree->volume->blocksize;
+
 	size = fat->orig_volume->get_block_count(fat->orig_volume);
 	if (MUL64_OV(fat->orig_volume->blocksize, size, &size))
 		size = MAX_DISK_SIZE;
 
+	if (size <= fat->data_start + data_size) {
+		size = size > fat->data_start ? (size - fat->data_start) : 0;
+
+		if (size < min_disk_size(fat->cluster_size))
+			size = min_disk_size(fat->cluster_size);
+	}
+
 	compute_fs_parameters(size, fat);
 	adjust_file_indices(fat);
 
 	if (write_directory_contents(fat))
 		goto fail_serialize;
 
-	/* move the data out of the way */
-	ret = volume_memmove(fat->orig_volume,
-			     FAT32_FAT_START + 2 * fat->fatsize, 0,
-			     fs->fstree->data_offset *
-			     fs->fstree->volume->blocksize);
-	if (ret)
-		goto fail_fat;
-
-	ret = volume_write(fat->orig_volume, 0, NULL,
-			   FAT32_FAT_START + 2 * fat->fatsize);
-	if (ret)
+	if (place_fats(fat))
 		goto fail_fat;
 
 	if (fatfs_write_super_block(fat))
@@ -214,11 +364,60 @@ fail_fat:
 	return -1;
 }
 
+int fatfs_set_cluster_size(fatfs_filesystem_t *fatfs, uint32_t size)
+{
+	filesystem_t *fs = (filesystem_t *)fatfs;
+	volume_t *vol = fatfs->orig_volume;
+	uint64_t max_size, data_start;
+	volume_t *adapter;
+
+	if (size < SECTOR_SIZE || size > CLUSTER_SIZE_MAX ||
+	    (size & (size - 1)) != 0) {
+		fprintf(stderr, "FAT cluster size must be a power of two "
+			"between %d and %d.\n", SECTOR_SIZE, CLUSTER_SIZE_MAX);
+		return -1;
+	}
+
+	if (fs->fstree->data_offset != 0 ||
+	    fs->fstree->root->data.dir.children != NULL) {
+		fputs("FAT cluster size must be set before "
+		      "adding any files.\n", stderr);
+		return -1;
+	}
+
+	if (MUL64_OV(vol->blocksize, vol->get_max_block_count(vol),
+		     &max_size)) {
+		max_size = MAX_DISK_SIZE;
+	}
+
+	if (max_size < min_disk_size(size)) {
+		fprintf(stderr, "Volume too small for FAT 32 with %u byte "
+			"clusters.\n", (unsigned int)size);
+		return -1;
+	}
+
+	/* the fstree block size is the cluster size, no remapping needed */
+	data_start = compute_data_start(vol, size);
+
+	adapter = volume_blocksize_adapter_create(vol, size, data_start);
+	if (adapter == NULL)
+		return -1;
+
+	object_drop(fs->fstree->volume);
+	fs->fstree->volume = adapter;
+
+	fatfs->cluster_size = size;
+	fatfs->secs_per_cluster = size / SECTOR_SIZE;
+	fatfs->data_start = data_start;
+	return 0;
+}
+
 static void destroy(object_t *obj)
 {
 	fatfs_filesystem_t *fatfs = (fatfs_filesystem_t *)obj;
 	filesystem_t *fs = (filesystem_t *)fatfs;
 
+	free_dir_buffers(fatfs);
 	object_drop(fatfs->orig_volume);
 	object_drop(fs->fstree);
 	free(fs);
@@ -247,8 +446,11 @@ filesystem_t *filesystem_fatfs_create(volume_t *volume)
 		goto fail;
 	}
 
+	fatfs->data_start = compute_data_start(volume, 0);
+
 	adapter = volume_blocksize_adapter_create(volume,
-						  CLUSTER_SIZE_PREFERRED, 0);
+						  CLUSTER_SIZE_PREFERRED,
+						  fatfs->data_start);
 	if (adapter == NULL)
 		goto fail;
 
@@ -264,6 +466,7 @@ filesystem_t *filesystem_fatfs_create(volume_t *volume)
 	strcpy((char *)fatfs->fs_label, "NO NAME");
 
 	fatfs->secs_per_cluster = CLUSTER_SIZE_PREFERRED / SECTOR_SIZE;
+	fatfs->reserved_secs = FAT32_RESERVED_COUNT;
 	fatfs->orig_volume = object_grab(volume);
 	fs->build_format = build_format;
 	obj->refcount = 1;
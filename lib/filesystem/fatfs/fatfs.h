@@ -22,9 +22,13 @@
 #define FAT32_RESERVED_COUNT (32)
 
 #define FAT32_FAT_START (FAT32_RESERVED_COUNT * SECTOR_SIZE)
+
+/* the most padding that can be turned into additional reserved sectors */
+#define FAT_RESERVE_MAX ((0xFFFFUL - FAT32_RESERVED_COUNT) * SECTOR_SIZE)
 #define FAT32_ENTRIES_PER_SECTOR (SECTOR_SIZE / 4)
 
 #define CLUSTER_SIZE_PREFERRED (4096)
+#define CLUSTER_SIZE_MAX (65536)
 
 #define MAX_DISK_SIZE (1024UL * 1024UL * 1024UL * 1024UL)
 #define FAT32_MIN_SECTORS (66000)
@@ -147,6 +151,17 @@ typedef struct {
 	uint32_t magic3;
 } fat32_info_sector_t;
 
+/*
+  The encoded entries of a directory. Generated once while computing the
+  directory sizes and written out after the layout is known.
+ */
+typedef struct {
+	tree_node_t *node;
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+} fatfs_dir_t;
+
 typedef struct {
 	filesystem_t base;
 
@@ -154,9 +169,19 @@ typedef struct {
 
 	uint32_t secs_per_cluster;
 	uint32_t secs_per_fat;
+	uint32_t reserved_secs;
+
+	/* fixed cluster size in bytes, 0 if picked automatically */
+	uint32_t cluster_size;
 
 	size_t fatsize;
 
+	/* byte offset of the cluster data on the original volume */
+	uint64_t data_start;
+
+	fatfs_dir_t *dirs;
+	size_t num_dirs;
+
 	uint8_t fs_oem[9];
 	uint8_t fs_label[12];
 } fatfs_filesystem_t;
@@ -172,11 +197,34 @@ uint32_t fatfs_convert_timestamp(int64_t timestamp);
 FAT_SHORTNAME fatfs_mk_shortname(const uint8_t *name, uint8_t shortname[11],
 				 size_t len, unsigned int gen);
 
-int fatfs_serialize_directory(fatfs_filesystem_t *fs, tree_node_t *root,
-			      ostream_t *ostrm);
+/*
+  The two halves of fatfs_mk_shortname. The basis is the short name without
+  a generation number. If FAT_SHORTNAME_SUFFIXED is returned for the basis,
+  a generation number is always required. Appending a generation number
+  modifies the short name in place.
+ */
+FAT_SHORTNAME fatfs_mk_shortname_basis(const uint8_t *name,
+				       uint8_t shortname[11], size_t len);
+
+FAT_SHORTNAME fatfs_shortname_add_gen(uint8_t shortname[11],
+				      FAT_SHORTNAME conv, unsigned int gen);
+
+int fatfs_serialize_directory(tree_node_t *root, fatfs_dir_t *dir);
+
+/*
+  Fill in the cluster indices of a serialized directory, as well as the
+  sizes of sub directories, once the locations are known.
+ */
+void fatfs_patch_directory(fatfs_filesystem_t *fs, fatfs_dir_t *dir);
 
 int fatfs_write_super_block(fatfs_filesystem_t *fs);
 
+/*
+  Use a fixed cluster size instead of picking one based on the volume size.
+  This has to be done before any files are added.
+ */
+int fatfs_set_cluster_size(fatfs_filesystem_t *fs, uint32_t size);
+
 int fatfs_build_fats(fatfs_filesystem_t *fs);
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@
 enum {
 	FS_OEM = 0,
 	FS_LABEL,
+	FS_CLUSTER_SIZE,
 };
 
 static const property_desc_t fatfs_prop[] = {
@@ -20,6 +21,10 @@ static const property_desc_t fatfs_prop[] = {
 		.type = PROPERTY_TYPE_STRING,
 		.name = "label",
 	},
+	[FS_CLUSTER_SIZE] = {
+		.type = PROPERTY_TYPE_U64_SIZE,
+		.name = "clustersize",
+	},
 };
 
 static size_t fatfs_get_property_count(const meta_object_t *meta)
@@ -80,6 +85,17 @@ static int fatfs_set_property(const meta_object_t *meta, size_t i,
 		memcpy(fatfs->fs_label, value->value.string, len);
 		fatfs->fs_label[len] = '\0';
 		break;
+	case FS_CLUSTER_SIZE:
+		if (value->type != PROPERTY_TYPE_U64_SIZE)
+			return -1;
+
+		if (value->value.u64 > CLUSTER_SIZE_MAX) {
+			fprintf(stderr, "FAT cluster size can be at most "
+				"%d bytes.\n", CLUSTER_SIZE_MAX);
+			return -1;
+		}
+
+		return fatfs_set_cluster_size(fatfs, value->value.u64);
 	default:
 		return -1;
 	}
@@ -91,6 +107,7 @@ static int fatfs_get_property(const meta_object_t *meta, size_t i,
 			      const object_t *obj, property_value_t *value)
 {
 	fatfs_filesystem_t *fatfs = (fatfs_filesystem_t *)obj;
+	const filesystem_t *fs = (const filesystem_t *)obj;
 	(void)meta;
 
 	switch (i) {
@@ -102,6 +119,10 @@ static int fatfs_get_property(const meta_object_t *meta, size_t i,
 		value->type = PROPERTY_TYPE_STRING;
 		value->value.string = (const char *)fatfs->fs_label;
 		break;
+	case FS_CLUSTER_SIZE:
+		value->type = PROPERTY_TYPE_U64_SIZE;
+		value->value.u64 = fs->fstree->volume->blocksize;
+		break;
 	default:
 		return -1;
 	}
@@ -31,7 +31,7 @@ static int write_super_block_fat32(fatfs_filesystem_t *fatfs,
 	super.boot_signature       = htole16(IBM_BOOT_MAGIC);
 	super.volume_id            = htole32(MAGIC_VOLUME_ID);
 	super.bytes_per_sector     = htole16(SECTOR_SIZE);
-	super.num_reserved_sectors = htole16(FAT32_RESERVED_COUNT);
+	super.num_reserved_sectors = htole16(fatfs->reserved_secs);
 	super.phys_drive_num       = FAT_DRIVE_NUMBER;
 	super.ext_boot_signature   = FAT_BOOT_SIG_MAGIC;
 	super.sectors_per_cluster  = fatfs->secs_per_cluster;
@@ -65,7 +65,7 @@ static int write_fs_info_block(fatfs_filesystem_t *fatfs,
 	filesystem_t *fs = (filesystem_t *)fatfs;
 	fat32_info_sector_t info;
 
-	cluster_count = sector_count - (FAT32_FAT_START / SECTOR_SIZE);
+	cluster_count = sector_count - fatfs->reserved_secs;
 	cluster_count -= fatfs->secs_per_fat * 2;
 	cluster_count /= fatfs->secs_per_cluster;
 
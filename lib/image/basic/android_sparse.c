@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * android_sparse.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mapped_volume.h"
+
+#define SPARSE_MAGIC (0xed26ff3a)
+#define SPARSE_MAJOR (1)
+#define SPARSE_MINOR (0)
+#define SPARSE_HEADER_SIZE (28)
+#define SPARSE_CHUNK_HEADER_SIZE (12)
+
+#define CHUNK_TYPE_RAW (0xCAC1)
+#define CHUNK_TYPE_FILL (0xCAC2)
+#define CHUNK_TYPE_DONT_CARE (0xCAC3)
+
+#define BLOCK_SIZE MAPPED_BLOCK_SIZE
+
+/* how many blocks to read from the output file at once on commit */
+#define READ_BLOCKS (256)
+
+/* upper bound for the number of blocks in a raw chunk (256 MiB) */
+#define MAX_RAW_BLOCKS (65536)
+
+/*
+  While the image is being built, the blocks are stored in the output file
+  at the location where they would end up if the entire image was a single
+  sequence of raw chunks, i.e. after the file header, the first chunk header
+  and one more chunk header every MAX_RAW_BLOCKS blocks. Blocks that were
+  never written are holes in the file.
+
+  On commit, the chunks are assembled in place, front to back. Every hole
+  or FILL chunk takes up less space than the blocks it replaces, so the
+  data only ever moves towards the start of the file and never overwrites
+  blocks that have not been processed yet. Data in front of the first hole
+  or FILL chunk is already where it belongs and is not touched at all.
+ */
+#define BLOCK_OFFSET(index) (SPARSE_HEADER_SIZE + SPARSE_CHUNK_HEADER_SIZE + \
+			     (index) * BLOCK_SIZE + \
+			     ((index) / MAX_RAW_BLOCKS) * \
+			     SPARSE_CHUNK_HEADER_SIZE)
+
+typedef struct {
+	mapped_volume_t base;
+
+	/* current output offset and number of chunks written so far */
+	uint64_t offset;
+	uint32_t chunk_count;
+
+	/* the chunk that is currently being assembled */
+	uint16_t chunk_type;
+	uint32_t chunk_blocks;
+	uint32_t fill_value;
+	uint64_t chunk_offset;
+
+	uint8_t buffer[READ_BLOCKS * BLOCK_SIZE];
+} sparse_volume_t;
+
+static void put_le16(uint8_t *ptr, uint16_t value)
+{
+	ptr[0] = value & 0xFF;
+	ptr[1] = (value >> 8) & 0xFF;
+}
+
+static void put_le32(uint8_t *ptr, uint32_t value)
+{
+	ptr[0] = value & 0xFF;
+	ptr[1] = (value >> 8) & 0xFF;
+	ptr[2] = (value >> 16) & 0xFF;
+	ptr[3] = (value >> 24) & 0xFF;
+}
+
+static int write_out(sparse_volume_t *svol, uint64_t offset,
+		     const void *data, size_t size)
+{
+	return mapped_volume_write((mapped_volume_t *)svol, offset, data, size);
+}
+
+/*****************************************************************************/
+
+static int write_chunk_header(sparse_volume_t *svol, uint64_t offset,
+			      uint16_t type, uint32_t blocks, uint32_t size)
+{
+	uint8_t hdr[SPARSE_CHUNK_HEADER_SIZE];
+
+	put_le16(hdr, type);
+	put_le16(hdr + 2, 0);
+	put_le32(hdr + 4, blocks);
+	put_le32(hdr + 8, size);
+
+	return write_out(svol, offset, hdr, sizeof(hdr));
+}
+
+static int flush_chunk(sparse_volume_t *svol)
+{
+	uint8_t fill[4];
+	int ret = 0;
+
+	if (svol->chunk_blocks == 0)
+		return 0;
+
+	switch (svol->chunk_type) {
+	case CHUNK_TYPE_RAW:
+		/* the data is already written, fill in the header */
+		ret = write_chunk_header(svol, svol->chunk_offset,
+					 CHUNK_TYPE_RAW, svol->chunk_blocks,
+					 SPARSE_CHUNK_HEADER_SIZE +
+					 svol->chunk_blocks * BLOCK_SIZE);
+		break;
+	case CHUNK_TYPE_FILL:
+		ret = write_chunk_header(svol, svol->offset, CHUNK_TYPE_FILL,
+					 svol->chunk_blocks,
+					 SPARSE_CHUNK_HEADER_SIZE + 4);
+		if (ret)
+			break;
+
+		memcpy(fill, &svol->fill_value, sizeof(fill));
+		ret = write_out(svol, svol->offset + SPARSE_CHUNK_HEADER_SIZE,
+				fill, sizeof(fill));
+		svol->offset += SPARSE_CHUNK_HEADER_SIZE + 4;
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+		ret = write_chunk_header(svol, svol->offset,
+					 CHUNK_TYPE_DONT_CARE,
+					 svol->chunk_blocks,
+					 SPARSE_CHUNK_HEADER_SIZE);
+		svol->offset += SPARSE_CHUNK_HEADER_SIZE;
+		break;
+	default:
+		break;
+	}
+
+	svol->chunk_count += 1;
+	svol->chunk_blocks = 0;
+	return ret;
+}
+
+/*
+  A block can be stored as a FILL chunk if it consists of the same
+  32 bit pattern repeated over and over.
+ */
+static bool is_fill_block(const uint8_t *data, uint32_t *value)
+{
+	uint32_t i;
+
+	for (i = 4; i < BLOCK_SIZE; i += 4) {
+		if (memcmp(data, data + i, 4) != 0)
+			return false;
+	}
+
+	memcpy(value, data, sizeof(*value));
+	return true;
+}
+
+static int add_fill_block(sparse_volume_t *svol, uint32_t value)
+{
+	if (svol->chunk_type != CHUNK_TYPE_FILL ||
+	    svol->fill_value != value) {
+		if (flush_chunk(svol))
+			return -1;
+
+		svol->chunk_type = CHUNK_TYPE_FILL;
+		svol->fill_value = value;
+	}
+
+	svol->chunk_blocks += 1;
+	return 0;
+}
+
+/*
+  Append a sequence of blocks, that have been read from the given block
+  index, to raw chunks. Blocks that are already at the right location in
+  the output file are not written again.
+ */
+static int add_raw_blocks(sparse_volume_t *svol, const uint8_t *data,
+			  uint64_t index, uint32_t count)
+{
+	uint32_t diff;
+
+	while (count > 0) {
+		if (svol->chunk_type != CHUNK_TYPE_RAW ||
+		    svol->chunk_blocks >= MAX_RAW_BLOCKS) {
+			if (flush_chunk(svol))
+				return -1;
+
+			/* leave room for the header, it is written later */
+			svol->chunk_type = CHUNK_TYPE_RAW;
+			svol->chunk_offset = svol->offset;
+			svol->offset += SPARSE_CHUNK_HEADER_SIZE;
+		}
+
+		diff = MAX_RAW_BLOCKS - svol->chunk_blocks;
+		if (diff > count)
+			diff = count;
+
+		if (svol->offset != BLOCK_OFFSET(index) &&
+		    write_out(svol, svol->offset, data, diff * BLOCK_SIZE)) {
+			return -1;
+		}
+
+		svol->offset += diff * BLOCK_SIZE;
+		svol->chunk_blocks += diff;
+		data += diff * BLOCK_SIZE;
+		index += diff;
+		count -= diff;
+	}
+
+	return 0;
+}
+
+static int add_hole(sparse_volume_t *svol, uint64_t count)
+{
+	if (svol->chunk_type != CHUNK_TYPE_DONT_CARE) {
+		if (flush_chunk(svol))
+			return -1;
+
+		svol->chunk_type = CHUNK_TYPE_DONT_CARE;
+	}
+
+	svol->chunk_blocks += count;
+	return 0;
+}
+
+static int add_data_blocks(sparse_volume_t *svol, uint64_t index,
+			   uint64_t count)
+{
+	uint32_t i, j, diff, value;
+
+	while (count > 0) {
+		/* don't read across the gaps left for raw chunk headers */
+		diff = MAX_RAW_BLOCKS - (index % MAX_RAW_BLOCKS);
+		if (diff > READ_BLOCKS)
+			diff = READ_BLOCKS;
+		if (diff > count)
+			diff = count;
+
+		if (mapped_volume_read((mapped_volume_t *)svol,
+				       BLOCK_OFFSET(index), svol->buffer,
+				       diff * BLOCK_SIZE)) {
+			return -1;
+		}
+
+		for (i = 0; i < diff; i = j) {
+			if (is_fill_block(svol->buffer + i * BLOCK_SIZE,
+					  &value)) {
+				if (add_fill_block(svol, value))
+					return -1;
+				j = i + 1;
+				continue;
+			}
+
+			for (j = i + 1; j < diff; ++j) {
+				if (is_fill_block(svol->buffer + j * BLOCK_SIZE,
+						  &value)) {
+					break;
+				}
+			}
+
+			if (add_raw_blocks(svol, svol->buffer + i * BLOCK_SIZE,
+					   index + i, j - i)) {
+				return -1;
+			}
+		}
+
+		index += diff;
+		count -= diff;
+	}
+
+	return 0;
+}
+
+static int write_header(sparse_volume_t *svol, uint64_t total_blocks)
+{
+	uint8_t hdr[SPARSE_HEADER_SIZE];
+
+	put_le32(hdr, SPARSE_MAGIC);
+	put_le16(hdr + 4, SPARSE_MAJOR);
+	put_le16(hdr + 6, SPARSE_MINOR);
+	put_le16(hdr + 8, SPARSE_HEADER_SIZE);
+	put_le16(hdr + 10, SPARSE_CHUNK_HEADER_SIZE);
+	put_le32(hdr + 12, BLOCK_SIZE);
+	put_le32(hdr + 16, total_blocks);
+	put_le32(hdr + 20, svol->chunk_count);
+	put_le32(hdr + 24, 0);
+
+	return write_out(svol, 0, hdr, sizeof(hdr));
+}
+
+static int assemble_image(sparse_volume_t *svol, uint64_t total)
+{
+	bitmap_t *bitmap = ((mapped_volume_t *)svol)->map->bitmap;
+	uint64_t index, next;
+
+	svol->offset = SPARSE_HEADER_SIZE;
+	svol->chunk_count = 0;
+	svol->chunk_blocks = 0;
+	svol->chunk_type = 0;
+
+	for (index = 0; index < total; index = next) {
+		next = bitmap_find_next_set(bitmap, index);
+		if (next > total)
+			next = total;
+
+		if (next > index) {
+			if (add_hole(svol, next - index))
+				return -1;
+			continue;
+		}
+
+		next = bitmap_find_next_clear(bitmap, index);
+		if (next > total)
+			next = total;
+
+		if (add_data_blocks(svol, index, next - index))
+			return -1;
+	}
+
+	if (flush_chunk(svol))
+		return -1;
+
+	if (ftruncate(((mapped_volume_t *)svol)->fd, svol->offset) != 0) {
+		perror(((mapped_volume_t *)svol)->filename);
+		return -1;
+	}
+
+	return write_header(svol, total);
+}
+
+/*****************************************************************************/
+
+static int read_data(mapped_volume_t *vol, uint64_t index, void *buffer,
+		     uint32_t offset, uint32_t size)
+{
+	/* the blocks are not at their staging locations anymore */
+	if (vol->sealed) {
+		fprintf(stderr, "%s: sparse image cannot be accessed after "
+			"commit.\n", vol->filename);
+		return -1;
+	}
+
+	return mapped_volume_read(vol, BLOCK_OFFSET(index) + offset,
+				  buffer, size);
+}
+
+static int write_data(mapped_volume_t *vol, uint64_t index,
+		      const void *buffer, uint32_t offset, uint32_t size)
+{
+	return mapped_volume_write(vol, BLOCK_OFFSET(index) + offset,
+				   buffer, size);
+}
+
+static int finish(mapped_volume_t *vol)
+{
+	uint64_t total = ((volume_t *)vol)->get_block_count((volume_t *)vol);
+
+	if (total > 0xFFFFFFFF) {
+		fprintf(stderr, "%s: too many blocks for an Android sparse "
+			"image.\n", vol->filename);
+		return -1;
+	}
+
+	/*
+	  Once the image has been assembled, the blocks are not at their
+	  staging locations anymore and cannot be accessed.
+	 */
+	vol->sealed = true;
+
+	return assemble_image((sparse_volume_t *)vol, total);
+}
+
+/*****************************************************************************/
+
+volume_t *volume_android_sparse_create(const char *filename, int fd,
+				       uint64_t max_size)
+{
+	sparse_volume_t *svol;
+
+	svol = calloc(1, sizeof(*svol));
+	if (svol == NULL) {
+		perror(filename);
+		close(fd);
+		return NULL;
+	}
+
+	if (mapped_volume_init((mapped_volume_t *)svol, filename, fd,
+			       max_size)) {
+		free(svol);
+		return NULL;
+	}
+
+	((mapped_volume_t *)svol)->finish = finish;
+	((mapped_volume_t *)svol)->read_data = read_data;
+	((mapped_volume_t *)svol)->write_data = write_data;
+	return (volume_t *)svol;
+}
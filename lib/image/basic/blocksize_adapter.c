@@ -17,8 +17,6 @@ typedef struct {
 
 	volume_t *wrapped;
 	uint32_t offset;
-
-	uint8_t scratch[];
 } adapter_t;
 
 static uint64_t conv_blk_count(adapter_t *adapter, uint64_t count)
@@ -71,7 +69,7 @@ static int adapter_truncate(volume_t *vol, uint64_t size)
 	if (count <= get_min_block_count(vol))
 		return 0;
 
-	if (SZ_MUL_OV(count, adapter->wrapped->blocksize, &size))
+	if (SZ_MUL_OV(count, vol->blocksize, &size))
 		size = 0xFFFFFFFFFFFFFFFF;
 
 	if (SZ_ADD_OV(size, adapter->offset, &size))
@@ -165,13 +163,18 @@ static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
 {
 	adapter_t *adapter = (adapter_t *)vol;
 
-	if (read_partial_block(vol, src, adapter->scratch,
-			       src_offset, size)) {
+	if (check_bounds(vol, src, src_offset, size))
 		return -1;
-	}
 
-	return write_partial_block(vol, dst, adapter->scratch,
-				   dst_offset, size);
+	if (check_bounds(vol, dst, dst_offset, size))
+		return -1;
+
+	/* no scratch buffer, the adapter has no state that needs locking */
+	return volume_memmove(adapter->wrapped,
+			      adapter->offset + dst * vol->blocksize +
+			      dst_offset,
+			      adapter->offset + src * vol->blocksize +
+			      src_offset, size);
 }
 
 static int commit(volume_t *vol)
@@ -194,7 +197,7 @@ volume_t *volume_blocksize_adapter_create(volume_t *vol, uint32_t blocksize,
 {
 	adapter_t *adapter;
 
-	adapter = calloc(1, sizeof(*adapter) + blocksize);
+	adapter = calloc(1, sizeof(*adapter));
 	if (adapter == NULL) {
 		perror("creating block size adapter volume");
 		return NULL;
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * counting_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "volume.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+	volume_t base;
+
+	volume_t *wrapped;
+	volume_io_stats_t *stats;
+} counting_volume_t;
+
+/* the volume can be shared by several threads, e.g. through a partition */
+static void add_call(uint64_t *calls, uint64_t *bytes, uint64_t size)
+{
+	__atomic_add_fetch(calls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(bytes, size, __ATOMIC_RELAXED);
+}
+
+static uint64_t get_min_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((counting_volume_t *)vol)->wrapped;
+
+	return wrapped->get_min_block_count(wrapped);
+}
+
+static uint64_t get_max_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((counting_volume_t *)vol)->wrapped;
+
+	return wrapped->get_max_block_count(wrapped);
+}
+
+static uint64_t get_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((counting_volume_t *)vol)->wrapped;
+
+	return wrapped->get_block_count(wrapped);
+}
+
+static int counting_truncate(volume_t *vol, uint64_t size)
+{
+	volume_t *wrapped = ((counting_volume_t *)vol)->wrapped;
+
+	return wrapped->truncate(wrapped, size);
+}
+
+static int read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	add_call(&cvol->stats->read_calls,
+		 &cvol->stats->read_bytes, vol->blocksize);
+
+	return cvol->wrapped->read_block(cvol->wrapped, index, buffer);
+}
+
+static int read_partial_block(volume_t *vol, uint64_t index,
+			      void *buffer, uint32_t offset, uint32_t size)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	add_call(&cvol->stats->read_calls, &cvol->stats->read_bytes, size);
+
+	return cvol->wrapped->read_partial_block(cvol->wrapped, index,
+						 buffer, offset, size);
+}
+
+static int write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	if (buffer == NULL) {
+		add_call(&cvol->stats->discard_calls,
+			 &cvol->stats->discard_bytes, vol->blocksize);
+	} else {
+		add_call(&cvol->stats->write_calls,
+			 &cvol->stats->write_bytes, vol->blocksize);
+	}
+
+	return cvol->wrapped->write_block(cvol->wrapped, index, buffer);
+}
+
+static int write_partial_block(volume_t *vol, uint64_t index,
+			       const void *buffer, uint32_t offset,
+			       uint32_t size)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	if (buffer == NULL) {
+		add_call(&cvol->stats->discard_calls,
+			 &cvol->stats->discard_bytes, size);
+	} else {
+		add_call(&cvol->stats->write_calls,
+			 &cvol->stats->write_bytes, size);
+	}
+
+	return cvol->wrapped->write_partial_block(cvol->wrapped, index,
+						  buffer, offset, size);
+}
+
+static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	add_call(&cvol->stats->move_calls,
+		 &cvol->stats->move_bytes, vol->blocksize);
+
+	return cvol->wrapped->move_block(cvol->wrapped, src, dst);
+}
+
+static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	add_call(&cvol->stats->move_calls, &cvol->stats->move_bytes, size);
+
+	return cvol->wrapped->move_block_partial(cvol->wrapped, src, dst,
+						 src_offset, dst_offset, size);
+}
+
+static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	add_call(&cvol->stats->discard_calls,
+		 &cvol->stats->discard_bytes, count * vol->blocksize);
+
+	return cvol->wrapped->discard_blocks(cvol->wrapped, index, count);
+}
+
+static int commit(volume_t *vol)
+{
+	counting_volume_t *cvol = (counting_volume_t *)vol;
+
+	__atomic_add_fetch(&cvol->stats->commit_calls, 1, __ATOMIC_RELAXED);
+
+	return cvol->wrapped->commit(cvol->wrapped);
+}
+
+static void destroy(object_t *base)
+{
+	counting_volume_t *cvol = (counting_volume_t *)base;
+
+	object_drop(cvol->wrapped);
+	free(cvol);
+}
+
+volume_t *volume_counting_create(volume_t *vol, volume_io_stats_t *stats)
+{
+	counting_volume_t *cvol = calloc(1, sizeof(*cvol));
+
+	if (cvol == NULL) {
+		perror("creating counting volume");
+		return NULL;
+	}
+
+	cvol->wrapped = object_grab(vol);
+	cvol->stats = stats;
+
+	((object_t *)cvol)->refcount = 1;
+	((object_t *)cvol)->destroy = destroy;
+	((volume_t *)cvol)->blocksize = vol->blocksize;
+	((volume_t *)cvol)->get_min_block_count = get_min_block_count;
+	((volume_t *)cvol)->get_max_block_count = get_max_block_count;
+	((volume_t *)cvol)->get_block_count = get_block_count;
+	((volume_t *)cvol)->truncate = counting_truncate;
+	((volume_t *)cvol)->read_block = read_block;
+	((volume_t *)cvol)->read_partial_block = read_partial_block;
+	((volume_t *)cvol)->write_block = write_block;
+	((volume_t *)cvol)->write_partial_block = write_partial_block;
+	((volume_t *)cvol)->move_block = move_block;
+	((volume_t *)cvol)->move_block_partial = move_block_partial;
+	((volume_t *)cvol)->discard_blocks = discard_blocks;
+	((volume_t *)cvol)->commit = commit;
+	return (volume_t *)cvol;
+}
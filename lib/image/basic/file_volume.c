@@ -4,34 +4,7 @@
  *
  * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
  */
-#include "config.h"
-#include "volume.h"
-#include "bitmap.h"
-#include "util.h"
-
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <string.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <errno.h>
-
-typedef struct {
-	volume_t base;
-
-	char *filename;
-	int fd;
-
-	bitmap_t *bitmap;
-	uint64_t bytes_used;
-
-	uint64_t min_block_count;
-	uint64_t max_block_count;
-
-	uint8_t scratch[];
-} file_volume_t;
+#include "file_volume.h"
 
 /*****************************************************************************/
 
@@ -127,7 +100,7 @@ static int get_property(const meta_object_t *meta, size_t i,
 	return 0;
 }
 
-static const meta_object_t file_volume_meta = {
+const meta_object_t file_volume_meta = {
 	.name = "file_volume_t",
 	.parent = NULL,
 
@@ -241,6 +214,49 @@ static int punch_hole(int fd, uint64_t offset, uint64_t size)
 #endif
 }
 
+static int mark_used_blocks(file_volume_t *fvol, uint64_t used)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	off_t start, end, size, blocksize = ((volume_t *)fvol)->blocksize;
+
+	/* only mark the blocks that actually have data in them */
+	size = used * blocksize;
+
+	for (start = 0; start < size; start = end) {
+		start = lseek(fvol->fd, start, SEEK_DATA);
+		if (start < 0) {
+			if (errno == ENXIO)
+				break;
+			goto fallback;
+		}
+
+		end = lseek(fvol->fd, start, SEEK_HOLE);
+		if (end < 0)
+			goto fallback;
+
+		if (end > size)
+			end = size;
+
+		start /= blocksize;
+
+		if (bitmap_set_range(fvol->bitmap, start,
+				     (end + blocksize - 1) / blocksize - start))
+			return -1;
+	}
+
+	/*
+	  The trailing hole is still part of the file. Keep the last block
+	  marked, so discarding blocks does not truncate the file.
+	*/
+	if (used > 0)
+		return bitmap_set(fvol->bitmap, used - 1);
+
+	return 0;
+fallback:
+#endif
+	return bitmap_set_range(fvol->bitmap, 0, used);
+}
+
 /*****************************************************************************/
 
 static void destroy(object_t *base)
@@ -249,7 +265,8 @@ static void destroy(object_t *base)
 
 	object_drop(fvol->bitmap);
 
-	close(fvol->fd);
+	if (fvol->fd >= 0)
+		close(fvol->fd);
 	free(fvol->filename);
 	free(fvol);
 }
@@ -266,7 +283,7 @@ static int read_partial_block(volume_t *vol, uint64_t index,
 	if (size == 0)
 		return 0;
 
-	if (!bitmap_is_set(fvol->bitmap, index)) {
+	if (fvol->fd < 0 || !bitmap_is_set(fvol->bitmap, index)) {
 		memset(buffer, 0, size);
 		return 0;
 	}
@@ -301,15 +318,18 @@ static int write_partial_block(volume_t *vol, uint64_t index,
 	if (bitmap_set(fvol->bitmap, index))
 		goto fail_flag;
 
+	last = index * vol->blocksize + offset + size;
+	if (last > fvol->bytes_used)
+		fvol->bytes_used = last;
+
+	if (fvol->fd < 0)
+		return 0;
+
 	if (buffer == NULL) {
 		memset(fvol->scratch, 0, size);
 		buffer = fvol->scratch;
 	}
 
-	last = index * vol->blocksize + offset + size;
-	if (last > fvol->bytes_used)
-		fvol->bytes_used = last;
-
 	return write_retry(fvol->filename, fvol->fd,
 			   index * vol->blocksize + offset,
 			   buffer, size);
@@ -321,7 +341,7 @@ fail_flag:
 static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
 {
 	file_volume_t *fvol = (file_volume_t *)vol;
-	uint64_t last_index, total_size;
+	uint64_t last_index, total_size, end;
 	int ret;
 
 	/* sanity check */
@@ -334,8 +354,14 @@ static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
 	if (count == 0)
 		return 0;
 
+	/* nothing to do if the entire range is already sparse */
+	if (bitmap_find_next_set(fvol->bitmap, index) >= (index + count))
+		return 0;
+
 	/* fast-path */
-	if (count == (fvol->max_block_count - index)) {
+	if (fvol->fd < 0) {
+		ret = 0;
+	} else if (count == (fvol->max_block_count - index)) {
 		ret = truncate_file(fvol->fd, index * vol->blocksize);
 	} else {
 		ret = punch_hole(fvol->fd, index * vol->blocksize,
@@ -343,20 +369,19 @@ static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
 	}
 
 	if (ret == 0) {
-		while (count--)
-			bitmap_clear(fvol->bitmap, index++);
-
+		bitmap_clear_range(fvol->bitmap, index, count);
 		goto out;
 	}
 
 	/* fallback: manually write block of 0 bytes */
 	memset(fvol->scratch, 0, vol->blocksize);
 
-	while (count--) {
-		if (!bitmap_is_set(fvol->bitmap, index)) {
-			++index;
-			continue;
-		}
+	end = index + count;
+
+	for (;;) {
+		index = bitmap_find_next_set(fvol->bitmap, index);
+		if (index >= end)
+			break;
 
 		ret = write_retry(fvol->filename, fvol->fd,
 				  index * vol->blocksize,
@@ -412,7 +437,7 @@ static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
 	if (!src_set)
 		return discard_blocks(vol, dst, 1);
 
-	if (transfer_blocks(fvol, src, dst, 1))
+	if (fvol->fd >= 0 && transfer_blocks(fvol, src, dst, 1))
 		return -1;
 
 	size = (dst + 1) * vol->blocksize;
@@ -442,16 +467,23 @@ static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
 	if (check_bounds(fvol, dst, dst_offset, size))
 		return -1;
 
-	if (read_retry(fvol->filename, fvol->fd,
-		       src * vol->blocksize + src_offset,
-		       fvol->scratch, size)) {
+	/* source may be sparse or partially past the end of the file */
+	if (read_partial_block(vol, src, fvol->scratch, src_offset, size))
 		return -1;
-	}
 
 	maxsz = dst * vol->blocksize + dst_offset + size;
 	if (maxsz > fvol->bytes_used)
 		fvol->bytes_used = maxsz;
 
+	if (bitmap_set(fvol->bitmap, dst)) {
+		fprintf(stderr, "%s: failed to mark block as used after "
+			"move.\n", fvol->filename);
+		return -1;
+	}
+
+	if (fvol->fd < 0)
+		return 0;
+
 	return write_retry(fvol->filename, fvol->fd,
 			   dst * vol->blocksize + dst_offset,
 			   fvol->scratch, size);
@@ -461,6 +493,9 @@ static int commit(volume_t *vol)
 {
 	file_volume_t *fvol = (file_volume_t *)vol;
 
+	if (fvol->fd < 0)
+		return 0;
+
 	if (truncate_file(fvol->fd, fvol->bytes_used) != 0) {
 		perror(fvol->filename);
 		return -1;
@@ -509,7 +544,7 @@ static int file_volume_truncate(volume_t *vol, uint64_t size)
 	if (count <= fvol->min_block_count)
 		return 0;
 
-	if (truncate_file(fvol->fd, size) != 0) {
+	if (fvol->fd >= 0 && truncate_file(fvol->fd, size) != 0) {
 		perror(fvol->filename);
 		return -1;
 	}
@@ -518,10 +553,8 @@ static int file_volume_truncate(volume_t *vol, uint64_t size)
 		uint64_t end = count;
 		uint64_t idx = fvol->bytes_used / vol->blocksize;
 
-		while (idx <= end) {
-			if (bitmap_set(fvol->bitmap, idx++))
-				goto fail_flag;
-		}
+		if (bitmap_set_range(fvol->bitmap, idx, end - idx + 1))
+			goto fail_flag;
 	} else if (size < fvol->bytes_used) {
 		uint64_t end = fvol->bytes_used / vol->blocksize;
 		uint64_t idx = size / vol->blocksize;
@@ -529,8 +562,7 @@ static int file_volume_truncate(volume_t *vol, uint64_t size)
 		if (fvol->bytes_used % vol->blocksize)
 			end += 1;
 
-		while (end > idx)
-			bitmap_clear(fvol->bitmap, end--);
+		bitmap_clear_range(fvol->bitmap, idx + 1, end - idx);
 	}
 
 	fvol->bytes_used = size;
@@ -541,45 +573,17 @@ fail_flag:
 	return -1;
 }
 
-volume_t *volume_from_fd(const char *filename, int fd, uint64_t max_size)
-{
-	uint64_t i, used, max_count;
-	file_volume_t *fvol = NULL;
-	size_t blocksize;
-	struct stat sb;
-
-	/* determine block size, current block count, maximum block count */
-	if (fstat(fd, &sb) != 0)
-		goto fail;
-
-	if (S_ISBLK(sb.st_mode)) {
-		blocksize = sb.st_blksize;
-		if (blocksize == 0)
-			blocksize = 512;
-
-		used = sb.st_size / blocksize;
-		max_count = sb.st_size / blocksize;
-	} else {
-		blocksize = 4096;
-
-		used = sb.st_size / blocksize;
-
-		if (sb.st_size % blocksize) {
-			used += 1;
-
-			if (ftruncate(fd, used * blocksize) != 0)
-				goto fail;
-		}
+/*****************************************************************************/
 
-		max_count = max_size / blocksize;
-		if (max_size % blocksize)
-			max_count += 1;
-	}
+file_volume_t *file_volume_create(const char *filename, int fd,
+				  uint32_t blocksize, uint64_t used,
+				  uint64_t max_count)
+{
+	file_volume_t *fvol;
 
-	/* create wrapper */
 	fvol = calloc(1, sizeof(*fvol) + 2 * blocksize);
 	if (fvol == NULL)
-		goto fail;
+		return NULL;
 
 	fvol->filename = strdup(filename);
 	if (fvol->filename == NULL)
@@ -611,20 +615,60 @@ volume_t *volume_from_fd(const char *filename, int fd, uint64_t max_size)
 	((volume_t *)fvol)->commit = commit;
 
 	/* fill the used block bitmap */
-	for (i = 0; i < used; ++i) {
-		bitmap_set(fvol->bitmap, i);
-	}
+	if (fd >= 0 && mark_used_blocks(fvol, used))
+		goto fail;
 
-	return (volume_t *)fvol;
+	return fvol;
 fail:
-	perror(filename);
+	if (fvol->bitmap != NULL)
+		object_drop(fvol->bitmap);
+
+	free(fvol->filename);
+	free(fvol);
+	return NULL;
+}
+
+volume_t *volume_from_fd(const char *filename, int fd, uint64_t max_size)
+{
+	uint64_t used, max_count;
+	file_volume_t *fvol;
+	size_t blocksize;
+	struct stat sb;
+
+	/* determine block size, current block count, maximum block count */
+	if (fstat(fd, &sb) != 0)
+		goto fail;
+
+	if (S_ISBLK(sb.st_mode)) {
+		blocksize = sb.st_blksize;
+		if (blocksize == 0)
+			blocksize = 512;
 
-	if (fvol != NULL) {
-		if (fvol->bitmap != NULL)
-			object_drop(fvol->bitmap);
+		used = sb.st_size / blocksize;
+		max_count = sb.st_size / blocksize;
+	} else {
+		blocksize = 4096;
 
-		free(fvol->filename);
-		free(fvol);
+		used = sb.st_size / blocksize;
+
+		if (sb.st_size % blocksize) {
+			used += 1;
+
+			if (ftruncate(fd, used * blocksize) != 0)
+				goto fail;
+		}
+
+		max_count = max_size / blocksize;
+		if (max_size % blocksize)
+			max_count += 1;
 	}
+
+	fvol = file_volume_create(filename, fd, blocksize, used, max_count);
+	if (fvol == NULL)
+		goto fail;
+
+	return (volume_t *)fvol;
+fail:
+	perror(filename);
 	return NULL;
 }
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * file_volume.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef FILE_VOLUME_H
+#define FILE_VOLUME_H
+
+#include "config.h"
+#include "volume.h"
+#include "bitmap.h"
+#include "util.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+
+typedef struct {
+	volume_t base;
+
+	char *filename;
+
+	/*
+	  If negative, there is no file behind the volume. Only the block
+	  usage is tracked, written data is dropped and reads return zeros.
+	 */
+	int fd;
+
+	bitmap_t *bitmap;
+	uint64_t bytes_used;
+
+	uint64_t min_block_count;
+	uint64_t max_block_count;
+
+	uint8_t scratch[];
+} file_volume_t;
+
+extern const meta_object_t file_volume_meta;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Create a file volume on an open file descriptor that already holds the
+  given number of blocks, or on no file at all if the descriptor is
+  negative. The volume takes ownership of the descriptor.
+
+  Returns NULL on failure and sets errno.
+ */
+file_volume_t *file_volume_create(const char *filename, int fd,
+				  uint32_t blocksize, uint64_t used,
+				  uint64_t max_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILE_VOLUME_H */
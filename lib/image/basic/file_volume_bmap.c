@@ -0,0 +1,308 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * file_volume_bmap.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "file_volume.h"
+#include "sha256.h"
+#include "threadpool.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#define HASH_BUFFER_SIZE (1024 * 1024)
+#define CHKSUM_LEN (2 * SHA256_DIGEST_SIZE)
+
+typedef struct {
+	/* first and last mapped block, inclusive */
+	uint64_t first;
+	uint64_t last;
+
+	char chksum[CHKSUM_LEN + 1];
+} bmap_range_t;
+
+typedef struct {
+	file_volume_t *fvol;
+	uint64_t image_size;
+
+	bmap_range_t *ranges;
+	size_t count;
+
+	pthread_mutex_t lock;
+	size_t next;
+	int status;
+} bmap_job_t;
+
+static int hash_range(bmap_job_t *job, bmap_range_t *range, uint8_t *buffer)
+{
+	uint64_t blocksize = ((volume_t *)job->fvol)->blocksize;
+	uint64_t offset = range->first * blocksize;
+	uint64_t end = (range->last + 1) * blocksize;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_t ctx;
+	size_t diff;
+
+	if (end > job->image_size)
+		end = job->image_size;
+
+	sha256_init(&ctx);
+
+	while (offset < end) {
+		diff = HASH_BUFFER_SIZE;
+		if ((uint64_t)diff > (end - offset))
+			diff = end - offset;
+
+		if (read_retry(job->fvol->filename, job->fvol->fd,
+			       offset, buffer, diff)) {
+			return -1;
+		}
+
+		sha256_update(&ctx, buffer, diff);
+		offset += diff;
+	}
+
+	sha256_final(&ctx, digest);
+	sha256_to_hex(digest, range->chksum);
+	return 0;
+}
+
+static int hash_worker(void *arg)
+{
+	bmap_job_t *job = arg;
+	bmap_range_t *range;
+	uint8_t *buffer;
+
+	buffer = malloc(HASH_BUFFER_SIZE);
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		if (buffer == NULL) {
+			job->status = -1;
+			range = NULL;
+		} else if (job->status != 0 || job->next >= job->count) {
+			range = NULL;
+		} else {
+			range = job->ranges + job->next++;
+		}
+		pthread_mutex_unlock(&job->lock);
+
+		if (range == NULL)
+			break;
+
+		if (hash_range(job, range, buffer)) {
+			pthread_mutex_lock(&job->lock);
+			job->status = -1;
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+	}
+
+	free(buffer);
+	return 0;
+}
+
+static int hash_ranges(bmap_job_t *job, thread_pool_t *pool)
+{
+	thread_pool_group_t group;
+	size_t i, num_tasks = 1;
+
+	if (pool != NULL)
+		num_tasks = thread_pool_get_thread_count(pool);
+	if (num_tasks > job->count)
+		num_tasks = job->count;
+
+	if (num_tasks <= 1) {
+		hash_worker(job);
+		return job->status;
+	}
+
+	memset(&group, 0, sizeof(group));
+
+	/* if nothing could be queued, the waiting thread below does the work */
+	for (i = 1; i < num_tasks; ++i) {
+		if (thread_pool_submit(pool, &group, hash_worker, job))
+			break;
+	}
+
+	hash_worker(job);
+	thread_pool_wait(pool, &group);
+	return job->status;
+}
+
+static int collect_ranges(bmap_job_t *job, uint64_t block_count)
+{
+	bitmap_t *bitmap = job->fvol->bitmap;
+	uint64_t start, end;
+	size_t max = 0;
+	void *new;
+
+	start = bitmap_find_next_set(bitmap, 0);
+
+	while (start < block_count) {
+		end = bitmap_find_next_clear(bitmap, start);
+		if (end > block_count)
+			end = block_count;
+
+		if (job->count == max) {
+			max = max ? max * 2 : 64;
+			new = realloc(job->ranges, max * sizeof(job->ranges[0]));
+			if (new == NULL) {
+				perror("generating block map");
+				return -1;
+			}
+			job->ranges = new;
+		}
+
+		job->ranges[job->count].first = start;
+		job->ranges[job->count].last = end - 1;
+		job->count += 1;
+
+		start = bitmap_find_next_set(bitmap, end);
+	}
+
+	return 0;
+}
+
+static void print_header(FILE *fp, uint64_t image_size, uint64_t blocksize,
+			 uint64_t block_count, uint64_t mapped)
+{
+	fputs("<?xml version=\"1.0\" ?>\n"
+	      "<!-- This file contains the block map for an image file, i.e. "
+	      "a list of the\n"
+	      "     blocks that actually hold data and need to be copied to "
+	      "the target\n"
+	      "     device. All other blocks are holes. -->\n\n", fp);
+
+	fputs("<bmap version=\"2.0\">\n", fp);
+	fprintf(fp, "    <!-- Image size in bytes -->\n"
+		"    <ImageSize> %" PRIu64 " </ImageSize>\n\n", image_size);
+	fprintf(fp, "    <!-- Size of a block in bytes -->\n"
+		"    <BlockSize> %" PRIu64 " </BlockSize>\n\n", blocksize);
+	fprintf(fp, "    <!-- Count of blocks in the image file -->\n"
+		"    <BlocksCount> %" PRIu64 " </BlocksCount>\n\n",
+		block_count);
+	fprintf(fp, "    <!-- Count of mapped blocks -->\n"
+		"    <MappedBlocksCount> %" PRIu64 " </MappedBlocksCount>\n\n",
+		mapped);
+	fputs("    <!-- Type of checksum used in this file -->\n"
+	      "    <ChecksumType> sha256 </ChecksumType>\n\n", fp);
+	fputs("    <!-- The checksum of this bmap file. When it is "
+	      "calculated, the value of\n"
+	      "         the checksum has to be zero (all ASCII \"0\" "
+	      "symbols). -->\n", fp);
+}
+
+static int write_bmap_file(bmap_job_t *job, const char *path,
+			   uint64_t block_count)
+{
+	uint64_t blocksize = ((volume_t *)job->fvol)->blocksize;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char zero[CHKSUM_LEN + 1], *text = NULL, *chksum;
+	uint64_t mapped = 0;
+	size_t i, size = 0;
+	sha256_t ctx;
+	FILE *fp;
+	int ret;
+
+	for (i = 0; i < job->count; ++i)
+		mapped += job->ranges[i].last - job->ranges[i].first + 1;
+
+	memset(zero, '0', CHKSUM_LEN);
+	zero[CHKSUM_LEN] = '\0';
+
+	fp = open_memstream(&text, &size);
+	if (fp == NULL)
+		goto fail_errno;
+
+	print_header(fp, job->image_size, blocksize, block_count, mapped);
+	fprintf(fp, "    <BmapFileChecksum> %s </BmapFileChecksum>\n\n", zero);
+	fputs("    <!-- The block map, consisting of single blocks or ranges "
+	      "of blocks, each\n"
+	      "         with the checksum of its data. -->\n"
+	      "    <BlockMap>\n", fp);
+
+	for (i = 0; i < job->count; ++i) {
+		fprintf(fp, "        <Range chksum=\"%s\"> ",
+			job->ranges[i].chksum);
+
+		if (job->ranges[i].first == job->ranges[i].last) {
+			fprintf(fp, "%" PRIu64, job->ranges[i].first);
+		} else {
+			fprintf(fp, "%" PRIu64 "-%" PRIu64,
+				job->ranges[i].first, job->ranges[i].last);
+		}
+
+		fputs(" </Range>\n", fp);
+	}
+
+	fputs("    </BlockMap>\n</bmap>\n", fp);
+
+	if (fclose(fp) != 0)
+		goto fail_errno;
+
+	/* fill in the checksum of the file itself */
+	sha256_init(&ctx);
+	sha256_update(&ctx, text, size);
+	sha256_final(&ctx, digest);
+
+	chksum = strstr(text, zero);
+	sha256_to_hex(digest, zero);
+	memcpy(chksum, zero, CHKSUM_LEN);
+
+	/* write it out */
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		goto fail_errno;
+
+	ret = fwrite(text, 1, size, fp) == size ? 0 : -1;
+
+	if (fclose(fp) != 0 || ret != 0)
+		goto fail_errno;
+
+	free(text);
+	return 0;
+fail_errno:
+	perror(path);
+	free(text);
+	return -1;
+}
+
+int volume_write_bmap(volume_t *vol, const char *path, thread_pool_t *pool)
+{
+	file_volume_t *fvol = (file_volume_t *)vol;
+	uint64_t block_count;
+	bmap_job_t job;
+	int ret = -1;
+
+	if (((object_t *)vol)->meta != &file_volume_meta) {
+		fprintf(stderr, "%s: block maps can only be generated for "
+			"output files.\n", path);
+		return -1;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.fvol = fvol;
+	job.image_size = fvol->bytes_used;
+
+	block_count = job.image_size / vol->blocksize;
+	if (job.image_size % vol->blocksize)
+		block_count += 1;
+
+	if (pthread_mutex_init(&job.lock, NULL) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (collect_ranges(&job, block_count))
+		goto out;
+
+	if (hash_ranges(&job, pool))
+		goto out;
+
+	ret = write_bmap_file(&job, path, block_count);
+out:
+	pthread_mutex_destroy(&job.lock);
+	free(job.ranges);
+	return ret;
+}
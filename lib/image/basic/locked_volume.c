@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * locked_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "volume.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef struct {
+	volume_t base;
+
+	/*
+	  Reading and querying the size only look at the state of the
+	  wrapped volume, so they share the lock. Everything that can
+	  modify the volume holds it exclusively.
+	 */
+	pthread_rwlock_t lock;
+
+	volume_t *wrapped;
+} locked_volume_t;
+
+static uint64_t get_min_block_count(volume_t *vol)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&lvol->lock);
+	ret = lvol->wrapped->get_min_block_count(lvol->wrapped);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static uint64_t get_max_block_count(volume_t *vol)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&lvol->lock);
+	ret = lvol->wrapped->get_max_block_count(lvol->wrapped);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static uint64_t get_block_count(volume_t *vol)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&lvol->lock);
+	ret = lvol->wrapped->get_block_count(lvol->wrapped);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int locked_truncate(volume_t *vol, uint64_t size)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->truncate(lvol->wrapped, size);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_rdlock(&lvol->lock);
+	ret = lvol->wrapped->read_block(lvol->wrapped, index, buffer);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int read_partial_block(volume_t *vol, uint64_t index,
+			      void *buffer, uint32_t offset, uint32_t size)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_rdlock(&lvol->lock);
+	ret = lvol->wrapped->read_partial_block(lvol->wrapped, index,
+						buffer, offset, size);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->write_block(lvol->wrapped, index, buffer);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int write_partial_block(volume_t *vol, uint64_t index,
+			       const void *buffer, uint32_t offset,
+			       uint32_t size)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->write_partial_block(lvol->wrapped, index,
+						 buffer, offset, size);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->move_block(lvol->wrapped, src, dst);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->move_block_partial(lvol->wrapped, src, dst,
+						src_offset, dst_offset, size);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->discard_blocks(lvol->wrapped, index, count);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static int commit(volume_t *vol)
+{
+	locked_volume_t *lvol = (locked_volume_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&lvol->lock);
+	ret = lvol->wrapped->commit(lvol->wrapped);
+	pthread_rwlock_unlock(&lvol->lock);
+	return ret;
+}
+
+static void destroy(object_t *base)
+{
+	locked_volume_t *lvol = (locked_volume_t *)base;
+
+	pthread_rwlock_destroy(&lvol->lock);
+	object_drop(lvol->wrapped);
+	free(lvol);
+}
+
+volume_t *volume_locked_create(volume_t *vol)
+{
+	locked_volume_t *lvol = calloc(1, sizeof(*lvol));
+	int ret;
+
+	if (lvol == NULL) {
+		perror("creating locked volume");
+		return NULL;
+	}
+
+	ret = pthread_rwlock_init(&lvol->lock, NULL);
+	if (ret != 0) {
+		fprintf(stderr, "creating locked volume: %s\n",
+			strerror(ret));
+		free(lvol);
+		return NULL;
+	}
+
+	lvol->wrapped = object_grab(vol);
+
+	((object_t *)lvol)->refcount = 1;
+	((object_t *)lvol)->destroy = destroy;
+	((volume_t *)lvol)->blocksize = vol->blocksize;
+	((volume_t *)lvol)->get_min_block_count = get_min_block_count;
+	((volume_t *)lvol)->get_max_block_count = get_max_block_count;
+	((volume_t *)lvol)->get_block_count = get_block_count;
+	((volume_t *)lvol)->truncate = locked_truncate;
+	((volume_t *)lvol)->read_block = read_block;
+	((volume_t *)lvol)->read_partial_block = read_partial_block;
+	((volume_t *)lvol)->write_block = write_block;
+	((volume_t *)lvol)->write_partial_block = write_partial_block;
+	((volume_t *)lvol)->move_block = move_block;
+	((volume_t *)lvol)->move_block_partial = move_block_partial;
+	((volume_t *)lvol)->discard_blocks = discard_blocks;
+	((volume_t *)lvol)->commit = commit;
+	return (volume_t *)lvol;
+}
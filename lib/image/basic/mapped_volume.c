@@ -0,0 +1,368 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mapped_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mapped_volume.h"
+
+/*****************************************************************************/
+
+static size_t get_property_count(const meta_object_t *meta)
+{
+	(void)meta;
+	return file_volume_meta.get_property_count(&file_volume_meta);
+}
+
+static int get_property_desc(const meta_object_t *meta, size_t i,
+			     property_desc_t *desc)
+{
+	(void)meta;
+	return file_volume_meta.get_property_desc(&file_volume_meta, i, desc);
+}
+
+static int set_property(const meta_object_t *meta, size_t i,
+			object_t *obj, const property_value_t *value)
+{
+	mapped_volume_t *vol = (mapped_volume_t *)obj;
+	(void)meta;
+
+	return file_volume_meta.set_property(&file_volume_meta, i,
+					     (object_t *)vol->map, value);
+}
+
+static int get_property(const meta_object_t *meta, size_t i,
+			const object_t *obj, property_value_t *value)
+{
+	const mapped_volume_t *vol = (const mapped_volume_t *)obj;
+	(void)meta;
+
+	return file_volume_meta.get_property(&file_volume_meta, i,
+					     (const object_t *)vol->map,
+					     value);
+}
+
+static const meta_object_t mapped_volume_meta = {
+	.name = "mapped_volume_t",
+	.parent = NULL,
+
+	.get_property_count = get_property_count,
+	.get_property_desc = get_property_desc,
+	.set_property = set_property,
+	.get_property = get_property,
+};
+
+/*****************************************************************************/
+
+static volume_t *get_map(volume_t *vol)
+{
+	return (volume_t *)((mapped_volume_t *)vol)->map;
+}
+
+static int check_sealed(mapped_volume_t *mvol)
+{
+	if (!mvol->sealed)
+		return 0;
+
+	fprintf(stderr, "%s: image cannot be modified after commit.\n",
+		mvol->filename);
+	return -1;
+}
+
+static void destroy(object_t *base)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)base;
+
+	if (mvol->cleanup != NULL)
+		mvol->cleanup(mvol);
+
+	object_drop(mvol->map);
+	close(mvol->fd);
+	free(mvol->filename);
+	free(mvol);
+}
+
+static uint64_t get_min_block_count(volume_t *vol)
+{
+	return get_map(vol)->get_min_block_count(get_map(vol));
+}
+
+static uint64_t get_max_block_count(volume_t *vol)
+{
+	return get_map(vol)->get_max_block_count(get_map(vol));
+}
+
+static uint64_t get_block_count(volume_t *vol)
+{
+	return get_map(vol)->get_block_count(get_map(vol));
+}
+
+static int read_partial_block(volume_t *vol, uint64_t index,
+			      void *buffer, uint32_t offset, uint32_t size)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+
+	/* checks the bounds and fills in zeros */
+	if (get_map(vol)->read_partial_block(get_map(vol), index, buffer,
+					     offset, size)) {
+		return -1;
+	}
+
+	if (size == 0 || !bitmap_is_set(mvol->map->bitmap, index))
+		return 0;
+
+	return mvol->read_data(mvol, index, buffer, offset, size);
+}
+
+static int read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	return read_partial_block(vol, index, buffer, 0, vol->blocksize);
+}
+
+static int write_partial_block(volume_t *vol, uint64_t index,
+			       const void *buffer, uint32_t offset,
+			       uint32_t size)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+	bool was_used;
+
+	if (check_sealed(mvol))
+		return -1;
+
+	was_used = bitmap_is_set(mvol->map->bitmap, index);
+
+	/* checks the bounds and marks the block as used */
+	if (get_map(vol)->write_partial_block(get_map(vol), index, NULL,
+					      offset, size)) {
+		return -1;
+	}
+
+	mvol->dirty = true;
+
+	/*
+	  The output file can still hold stale data of a discarded block,
+	  so the first write to a block always writes all of it.
+	 */
+	if (!was_used &&
+	    (offset > 0 || size < vol->blocksize || buffer == NULL)) {
+		memset(mvol->scratch, 0, vol->blocksize);
+		if (buffer != NULL)
+			memcpy(mvol->scratch + offset, buffer, size);
+
+		buffer = mvol->scratch;
+		offset = 0;
+		size = vol->blocksize;
+	} else if (buffer == NULL) {
+		memset(mvol->scratch, 0, size);
+		buffer = mvol->scratch;
+	}
+
+	return mvol->write_data(mvol, index, buffer, offset, size);
+}
+
+static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+	uint64_t max = mvol->map->max_block_count;
+
+	if (check_sealed(mvol))
+		return -1;
+
+	if (index >= max)
+		return 0;
+
+	if (count > (max - index))
+		count = max - index;
+
+	if (get_map(vol)->discard_blocks(get_map(vol), index, count))
+		return -1;
+
+	mvol->dirty = true;
+
+	if (mvol->discard_data == NULL)
+		return 0;
+
+	return mvol->discard_data(mvol, index, count);
+}
+
+static int write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	if (buffer == NULL)
+		return discard_blocks(vol, index, 1);
+
+	return write_partial_block(vol, index, buffer, 0, vol->blocksize);
+}
+
+static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+
+	if (read_partial_block(vol, src, mvol->block, src_offset, size))
+		return -1;
+
+	return write_partial_block(vol, dst, mvol->block, dst_offset, size);
+}
+
+static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	return move_block_partial(vol, src, dst, 0, 0, vol->blocksize);
+}
+
+static int truncate_volume(volume_t *vol, uint64_t size)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+	uint64_t used, old_count, index;
+	uint32_t tail;
+
+	if (check_sealed(mvol))
+		return -1;
+
+	used = mvol->map->bytes_used;
+	old_count = get_block_count(vol);
+
+	if (get_map(vol)->truncate(get_map(vol), size))
+		return -1;
+
+	mvol->dirty = true;
+
+	/*
+	  Growing marks the new blocks as used, but the output file can
+	  still hold stale data of discarded blocks there. Turn them into
+	  holes instead.
+	 */
+	if (mvol->map->bytes_used > used) {
+		index = (used + vol->blocksize - 1) / vol->blocksize;
+
+		bitmap_clear_range(mvol->map->bitmap, index,
+				   mvol->map->max_block_count - index);
+		return 0;
+	}
+
+	if (mvol->map->bytes_used == used)
+		return 0;
+
+	/* the cut off part of the last block has to read back as zero */
+	index = mvol->map->bytes_used / vol->blocksize;
+	tail = mvol->map->bytes_used % vol->blocksize;
+
+	if (tail > 0) {
+		if (bitmap_is_set(mvol->map->bitmap, index)) {
+			memset(mvol->scratch, 0, vol->blocksize - tail);
+
+			if (mvol->write_data(mvol, index, mvol->scratch,
+					     tail, vol->blocksize - tail)) {
+				return -1;
+			}
+		}
+
+		index += 1;
+	}
+
+	if (mvol->discard_data == NULL || index >= old_count)
+		return 0;
+
+	return mvol->discard_data(mvol, index, old_count - index);
+}
+
+static int commit(volume_t *vol)
+{
+	mapped_volume_t *mvol = (mapped_volume_t *)vol;
+
+	/*
+	  Stacked volumes commit their underlying volume as well, don't
+	  redo the work if nothing changed in between.
+	 */
+	if (!mvol->dirty)
+		return 0;
+
+	if (mvol->finish(mvol))
+		return -1;
+
+	mvol->dirty = false;
+
+	if (fsync(mvol->fd) != 0) {
+		perror(mvol->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+int mapped_volume_read(mapped_volume_t *vol, uint64_t offset,
+		       void *data, size_t size)
+{
+	return read_retry(vol->filename, vol->fd, offset, data, size);
+}
+
+int mapped_volume_write(mapped_volume_t *vol, uint64_t offset,
+			const void *data, size_t size)
+{
+	return write_retry(vol->filename, vol->fd, offset, data, size);
+}
+
+int mapped_volume_init_map(mapped_volume_t *vol, const char *filename, int fd,
+			   file_volume_t *map)
+{
+	vol->fd = fd;
+	vol->map = map;
+
+	if (((volume_t *)map)->blocksize != MAPPED_BLOCK_SIZE) {
+		fprintf(stderr, "%s: unexpected block size.\n", filename);
+		goto fail;
+	}
+
+	vol->filename = strdup(filename);
+	if (vol->filename == NULL)
+		goto fail_errno;
+
+	/* anything left over in the file must not leak into the image */
+	if (ftruncate(fd, 0) != 0)
+		goto fail_errno;
+
+	vol->dirty = true;
+
+	((object_t *)vol)->meta = &mapped_volume_meta;
+	((object_t *)vol)->refcount = 1;
+	((object_t *)vol)->destroy = destroy;
+	((volume_t *)vol)->blocksize = MAPPED_BLOCK_SIZE;
+	((volume_t *)vol)->get_min_block_count = get_min_block_count;
+	((volume_t *)vol)->get_max_block_count = get_max_block_count;
+	((volume_t *)vol)->get_block_count = get_block_count;
+	((volume_t *)vol)->truncate = truncate_volume;
+	((volume_t *)vol)->read_block = read_block;
+	((volume_t *)vol)->read_partial_block = read_partial_block;
+	((volume_t *)vol)->write_block = write_block;
+	((volume_t *)vol)->write_partial_block = write_partial_block;
+	((volume_t *)vol)->move_block = move_block;
+	((volume_t *)vol)->move_block_partial = move_block_partial;
+	((volume_t *)vol)->discard_blocks = discard_blocks;
+	((volume_t *)vol)->commit = commit;
+	return 0;
+fail_errno:
+	perror(filename);
+fail:
+	free(vol->filename);
+	object_drop(map);
+	close(fd);
+	return -1;
+}
+
+int mapped_volume_init(mapped_volume_t *vol, const char *filename, int fd,
+		       uint64_t max_size)
+{
+	file_volume_t *map;
+
+	map = file_volume_create(filename, -1, MAPPED_BLOCK_SIZE, 0,
+				 max_size / MAPPED_BLOCK_SIZE);
+	if (map == NULL) {
+		perror(filename);
+		close(fd);
+		return -1;
+	}
+
+	return mapped_volume_init_map(vol, filename, fd, map);
+}
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mapped_volume.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef MAPPED_VOLUME_H
+#define MAPPED_VOLUME_H
+
+#include "file_volume.h"
+
+/* block size of the map, the derived volumes use the same one */
+#define MAPPED_BLOCK_SIZE (4096)
+
+/*
+  Common part of the output volumes that need a format of their own. A file
+  volume, the map, keeps track of the size and of which blocks are used.
+
+  By default, the map has no file of its own and the block data is stored
+  in the output file, wherever the read_data and write_data callbacks of
+  the derived volume put it. Derived volumes that keep the data somewhere
+  else can replace the block operations entirely.
+
+  On commit, the finish callback writes out the final image, followed by
+  a sync of the output file. It is skipped if nothing has changed since the
+  last commit.
+ */
+typedef struct mapped_volume_t {
+	volume_t base;
+
+	file_volume_t *map;
+
+	char *filename;
+	int fd;
+
+	/* set if anything has changed since the last commit */
+	bool dirty;
+
+	/* set by the derived volume once the image cannot be modified */
+	bool sealed;
+
+	int (*finish)(struct mapped_volume_t *vol);
+
+	/* optional, releases resources of the derived volume on destroy */
+	void (*cleanup)(struct mapped_volume_t *vol);
+
+	/*
+	  Read or write data of a block that is marked as used in the map.
+	  The range has already been checked. When writing to a block that
+	  was not used before, the entire block is written.
+	 */
+	int (*read_data)(struct mapped_volume_t *vol, uint64_t index,
+			 void *buffer, uint32_t offset, uint32_t size);
+
+	int (*write_data)(struct mapped_volume_t *vol, uint64_t index,
+			  const void *buffer, uint32_t offset, uint32_t size);
+
+	/*
+	  Optional, called after a range of blocks has been discarded or
+	  cut off, so they read back as zero if they are used again.
+	 */
+	int (*discard_data)(struct mapped_volume_t *vol, uint64_t index,
+			    uint64_t count);
+
+	uint8_t scratch[MAPPED_BLOCK_SIZE];
+	uint8_t block[MAPPED_BLOCK_SIZE];
+} mapped_volume_t;
+
+/*
+  Initialize the common part of a mapped volume, using a file volume
+  without a file as map. Takes over ownership of the file descriptor,
+  which is closed if this fails. The output file is truncated.
+ */
+int mapped_volume_init(mapped_volume_t *vol, const char *filename, int fd,
+		       uint64_t max_size);
+
+/*
+  Same as above, but takes over ownership of an existing map as well,
+  which is released if this fails.
+ */
+int mapped_volume_init_map(mapped_volume_t *vol, const char *filename, int fd,
+			   file_volume_t *map);
+
+/* read from or write to the output file, reporting errors */
+int mapped_volume_read(mapped_volume_t *vol, uint64_t offset,
+		       void *data, size_t size);
+
+int mapped_volume_write(mapped_volume_t *vol, uint64_t offset,
+			const void *data, size_t size);
+
+#endif /* MAPPED_VOLUME_H */
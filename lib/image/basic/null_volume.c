@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * null_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "file_volume.h"
+
+/*
+  The null volume is a file volume without a file, see file_volume_create.
+  It keeps the size and block usage bookkeeping exactly like the real
+  thing, so layouts come out the same, but it drops all data.
+ */
+
+/*
+  On top of the file volume properties, the exact size in bytes can be
+  read back, i.e. the size the output file would have.
+ */
+static const property_desc_t size_property = {
+	.type = PROPERTY_TYPE_U64_SIZE,
+	.name = "size",
+};
+
+static size_t get_property_count(const meta_object_t *meta)
+{
+	(void)meta;
+	return 1;
+}
+
+static int get_property_desc(const meta_object_t *meta, size_t i,
+			     property_desc_t *desc)
+{
+	(void)meta;
+	if (i != 0)
+		return -1;
+
+	*desc = size_property;
+	return 0;
+}
+
+static int set_property(const meta_object_t *meta, size_t i,
+			object_t *obj, const property_value_t *value)
+{
+	(void)meta; (void)i; (void)obj; (void)value;
+	return -1;
+}
+
+static int get_property(const meta_object_t *meta, size_t i,
+			const object_t *obj, property_value_t *value)
+{
+	(void)meta;
+	if (i != 0)
+		return -1;
+
+	value->type = PROPERTY_TYPE_U64_SIZE;
+	value->value.u64 = ((const file_volume_t *)obj)->bytes_used;
+	return 0;
+}
+
+static const meta_object_t null_volume_meta = {
+	.name = "null_volume_t",
+	.parent = &file_volume_meta,
+
+	.get_property_count = get_property_count,
+	.get_property_desc = get_property_desc,
+	.set_property = set_property,
+	.get_property = get_property,
+};
+
+/*****************************************************************************/
+
+volume_t *volume_null_create(const char *name, uint32_t blocksize,
+			     uint64_t max_size)
+{
+	uint64_t max_count = max_size / blocksize;
+	file_volume_t *fvol;
+
+	if (max_size % blocksize)
+		max_count += 1;
+
+	fvol = file_volume_create(name, -1, blocksize, 0, max_count);
+	if (fvol == NULL) {
+		perror(name);
+		return NULL;
+	}
+
+	((object_t *)fvol)->meta = &null_volume_meta;
+	return (volume_t *)fvol;
+}
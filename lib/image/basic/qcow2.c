@@ -0,0 +1,792 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * qcow2.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mapped_volume.h"
+#include "xfrm.h"
+
+#define QCOW2_MAGIC (0x514649fb)
+#define QCOW2_VERSION (3)
+
+/* version 3 header, including the compression type field */
+#define QCOW2_HEADER_SIZE (112)
+
+#define QCOW2_INCOMPAT_COMPRESSION (1 << 3)
+#define QCOW2_COMPRESSION_ZSTD (1)
+
+#define BLOCK_SIZE MAPPED_BLOCK_SIZE
+
+#define CLUSTER_BITS (16)
+#define CLUSTER_SIZE (1 << CLUSTER_BITS)
+#define BLOCKS_PER_CLUSTER (CLUSTER_SIZE / BLOCK_SIZE)
+
+/* L1 and L2 tables have 64 bit entries, refcounts are 16 bit wide */
+#define L2_ENTRIES (CLUSTER_SIZE / 8)
+#define REFCOUNT_ORDER (4)
+#define REFCOUNTS_PER_BLOCK (CLUSTER_SIZE / 2)
+
+#define QCOW2_OFLAG_COPIED ((uint64_t)1 << 63)
+#define QCOW2_OFLAG_COMPRESSED ((uint64_t)1 << 62)
+#define QCOW2_CSIZE_SHIFT (62 - (CLUSTER_BITS - 8))
+
+/*
+  Only store a compressed cluster if it saves at least one sector,
+  otherwise the raw cluster is cheaper to read back.
+ */
+#define MAX_COMPRESSED_SIZE (CLUSTER_SIZE - 512)
+
+typedef struct {
+	mapped_volume_t base;
+
+	xfrm_stream_t *compressor;
+
+	/*
+	  Host offset of the data cluster for every guest cluster, or 0 if
+	  none has been allocated yet. Cluster 0 always holds the header.
+	  On commit, entries can turn into compressed cluster descriptors.
+	 */
+	uint64_t *l2;
+	uint64_t l2_count;
+
+	/* released data clusters, handed out again before growing the file */
+	uint64_t *free_list;
+	size_t free_count;
+	size_t free_max;
+
+	/* end of the data clusters and the current size of the output file */
+	uint64_t data_end;
+	uint64_t file_size;
+
+	/* the tables that are only needed while committing */
+	uint64_t *l1;
+	uint64_t l1_size;
+
+	uint16_t *refcount;
+	uint64_t refcount_max;
+
+	/* end of the clusters allocated while committing */
+	uint64_t offset;
+
+	uint8_t cluster[CLUSTER_SIZE];
+	uint8_t packed[2 * CLUSTER_SIZE];
+} qcow2_volume_t;
+
+static void put_be16(uint8_t *ptr, uint16_t value)
+{
+	ptr[0] = (value >> 8) & 0xFF;
+	ptr[1] = value & 0xFF;
+}
+
+static void put_be32(uint8_t *ptr, uint32_t value)
+{
+	put_be16(ptr, value >> 16);
+	put_be16(ptr + 2, value & 0xFFFF);
+}
+
+static void put_be64(uint8_t *ptr, uint64_t value)
+{
+	put_be32(ptr, value >> 32);
+	put_be32(ptr + 4, value & 0xFFFFFFFF);
+}
+
+static int write_out(qcow2_volume_t *qvol, uint64_t offset,
+		     const void *data, size_t size)
+{
+	return mapped_volume_write((mapped_volume_t *)qvol, offset, data, size);
+}
+
+static int read_in(qcow2_volume_t *qvol, uint64_t offset,
+		   void *data, size_t size)
+{
+	return mapped_volume_read((mapped_volume_t *)qvol, offset, data, size);
+}
+
+/*****************************************************************************/
+
+static uint64_t get_cluster(qcow2_volume_t *qvol, uint64_t index)
+{
+	return index < qvol->l2_count ? qvol->l2[index] : 0;
+}
+
+static int grow_l2(qcow2_volume_t *qvol, uint64_t count)
+{
+	uint64_t new_count;
+	uint64_t *new;
+
+	if (count <= qvol->l2_count)
+		return 0;
+
+	new_count = qvol->l2_count ? qvol->l2_count : L2_ENTRIES;
+
+	while (new_count < count)
+		new_count *= 2;
+
+	if (new_count > (SIZE_MAX / sizeof(new[0])))
+		goto fail;
+
+	new = realloc(qvol->l2, new_count * sizeof(new[0]));
+	if (new == NULL)
+		goto fail;
+
+	memset(new + qvol->l2_count, 0,
+	       (new_count - qvol->l2_count) * sizeof(new[0]));
+
+	qvol->l2 = new;
+	qvol->l2_count = new_count;
+	return 0;
+fail:
+	fprintf(stderr, "%s: out of memory for the cluster map.\n",
+		((mapped_volume_t *)qvol)->filename);
+	return -1;
+}
+
+/*
+  Allocate a data cluster in the output file and make sure it reads back
+  as zero, since only parts of it may be written. Returns 0 on failure,
+  which is the header cluster and never handed out.
+ */
+static uint64_t alloc_data_cluster(qcow2_volume_t *qvol)
+{
+	uint64_t offset;
+
+	if (qvol->free_count > 0) {
+		offset = qvol->free_list[--qvol->free_count];
+	} else {
+		offset = qvol->data_end;
+		qvol->data_end += CLUSTER_SIZE;
+	}
+
+	/* released clusters or left over tables from a previous commit */
+	if (offset < qvol->file_size) {
+		memset(qvol->cluster, 0, CLUSTER_SIZE);
+
+		if (write_out(qvol, offset, qvol->cluster, CLUSTER_SIZE))
+			return 0;
+
+		return offset;
+	}
+
+	if (ftruncate(((mapped_volume_t *)qvol)->fd,
+		      offset + CLUSTER_SIZE) != 0) {
+		perror(((mapped_volume_t *)qvol)->filename);
+		return 0;
+	}
+
+	qvol->file_size = offset + CLUSTER_SIZE;
+	return offset;
+}
+
+static int release_cluster(qcow2_volume_t *qvol, uint64_t index)
+{
+	size_t new_max;
+	uint64_t *new;
+
+	if (qvol->free_count == qvol->free_max) {
+		new_max = qvol->free_max ? qvol->free_max * 2 : 64;
+
+		new = realloc(qvol->free_list, new_max * sizeof(new[0]));
+		if (new == NULL) {
+			perror(((mapped_volume_t *)qvol)->filename);
+			return -1;
+		}
+
+		qvol->free_list = new;
+		qvol->free_max = new_max;
+	}
+
+	qvol->free_list[qvol->free_count++] = qvol->l2[index];
+	qvol->l2[index] = 0;
+	return 0;
+}
+
+/*
+  Called after blocks have been marked as unused in the map. Clusters that
+  have no used blocks left are released, in the others the blocks are
+  overwritten with zeros, so they cannot show up in the image.
+ */
+static int clear_blocks(qcow2_volume_t *qvol, uint64_t index, uint64_t count)
+{
+	file_volume_t *map = ((mapped_volume_t *)qvol)->map;
+	uint64_t i, first, last, start, end;
+
+	if (count == 0)
+		return 0;
+
+	first = index / BLOCKS_PER_CLUSTER;
+	last = (index + count - 1) / BLOCKS_PER_CLUSTER;
+
+	memset(qvol->cluster, 0, CLUSTER_SIZE);
+
+	for (i = first; i <= last && i < qvol->l2_count; ++i) {
+		if (qvol->l2[i] == 0)
+			continue;
+
+		start = i * BLOCKS_PER_CLUSTER;
+		end = start + BLOCKS_PER_CLUSTER;
+
+		if (bitmap_find_next_set(map->bitmap, start) >= end) {
+			if (release_cluster(qvol, i))
+				return -1;
+			continue;
+		}
+
+		if (start < index)
+			start = index;
+		if (end > (index + count))
+			end = index + count;
+
+		if (write_out(qvol, qvol->l2[i] +
+			      (start % BLOCKS_PER_CLUSTER) * BLOCK_SIZE,
+			      qvol->cluster, (end - start) * BLOCK_SIZE)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int add_ref(qcow2_volume_t *qvol, uint64_t cluster)
+{
+	uint64_t new_max;
+	uint16_t *new;
+
+	if (cluster >= qvol->refcount_max) {
+		new_max = qvol->refcount_max ? qvol->refcount_max : 1024;
+
+		while (new_max <= cluster)
+			new_max *= 2;
+
+		new = realloc(qvol->refcount, new_max * sizeof(new[0]));
+		if (new == NULL) {
+			perror(((mapped_volume_t *)qvol)->filename);
+			return -1;
+		}
+
+		memset(new + qvol->refcount_max, 0,
+		       (new_max - qvol->refcount_max) * sizeof(new[0]));
+
+		qvol->refcount = new;
+		qvol->refcount_max = new_max;
+	}
+
+	qvol->refcount[cluster] += 1;
+	return 0;
+}
+
+static uint64_t alloc_clusters(qcow2_volume_t *qvol, uint64_t count)
+{
+	uint64_t i, offset;
+
+	offset = qvol->offset + CLUSTER_SIZE - 1;
+	offset -= offset % CLUSTER_SIZE;
+
+	for (i = 0; i < count; ++i) {
+		if (add_ref(qvol, offset / CLUSTER_SIZE + i))
+			return 0;
+	}
+
+	qvol->offset = offset + count * CLUSTER_SIZE;
+	return offset;
+}
+
+static int compress_cluster(qcow2_volume_t *qvol, uint32_t *size)
+{
+	uint32_t in_read = 0, out_written = 0;
+	int ret;
+
+	ret = qvol->compressor->process_data(qvol->compressor, qvol->cluster,
+					     CLUSTER_SIZE, qvol->packed,
+					     sizeof(qvol->packed), &in_read,
+					     &out_written,
+					     XFRM_STREAM_FLUSH_FULL);
+
+	/*
+	  The output buffer is larger than the worst case expansion, so
+	  anything short of a completely flushed block is a real error.
+	 */
+	if (ret != XFRM_STREAM_END || in_read != CLUSTER_SIZE ||
+	    out_written >= sizeof(qvol->packed)) {
+		fprintf(stderr, "%s: error compressing cluster.\n",
+			((mapped_volume_t *)qvol)->filename);
+		return -1;
+	}
+
+	*size = out_written;
+	return 0;
+}
+
+/*
+  Move a data cluster from its host offset down to the packing position,
+  compressing it on the way if possible. The clusters are processed in the
+  order they are stored, so the packing position never overtakes a cluster
+  that has not been processed yet.
+ */
+static int pack_cluster(qcow2_volume_t *qvol, uint64_t index, uint64_t *pos)
+{
+	uint64_t i, src = qvol->l2[index], dst = *pos, sectors;
+	uint32_t size;
+
+	if (qvol->compressor == NULL) {
+		if (dst != src) {
+			if (read_in(qvol, src, qvol->cluster, CLUSTER_SIZE) ||
+			    write_out(qvol, dst, qvol->cluster,
+				      CLUSTER_SIZE)) {
+				return -1;
+			}
+		}
+
+		qvol->l2[index] = dst;
+		*pos = dst + CLUSTER_SIZE;
+		return add_ref(qvol, dst / CLUSTER_SIZE);
+	}
+
+	if (read_in(qvol, src, qvol->cluster, CLUSTER_SIZE))
+		return -1;
+
+	/* blocks that were overwritten with zeros later on */
+	if (is_memory_zero(qvol->cluster, CLUSTER_SIZE)) {
+		qvol->l2[index] = 0;
+		return 0;
+	}
+
+	if (compress_cluster(qvol, &size))
+		return -1;
+
+	/*
+	  Compressed clusters are packed back to back and may cross host
+	  cluster boundaries. Every host cluster they touch gets a reference.
+	 */
+	if (size <= MAX_COMPRESSED_SIZE) {
+		if (write_out(qvol, dst, qvol->packed, size))
+			return -1;
+
+		for (i = dst / CLUSTER_SIZE;
+		     i <= (dst + size - 1) / CLUSTER_SIZE; ++i) {
+			if (add_ref(qvol, i))
+				return -1;
+		}
+
+		sectors = ((dst + size - 1) >> 9) - (dst >> 9);
+
+		qvol->l2[index] = QCOW2_OFLAG_COMPRESSED |
+			(sectors << QCOW2_CSIZE_SHIFT) | dst;
+		*pos = dst + size;
+		return 0;
+	}
+
+	dst += CLUSTER_SIZE - 1;
+	dst -= dst % CLUSTER_SIZE;
+
+	if (dst != src && write_out(qvol, dst, qvol->cluster, CLUSTER_SIZE))
+		return -1;
+
+	qvol->l2[index] = dst;
+	*pos = dst + CLUSTER_SIZE;
+	return add_ref(qvol, dst / CLUSTER_SIZE);
+}
+
+/*
+  Pack the data clusters together right after the header, removing the
+  gaps left by released clusters, and recompute the reference counts.
+ */
+static int pack_clusters(qcow2_volume_t *qvol)
+{
+	uint64_t i, host_count, pos, *owner;
+
+	host_count = qvol->data_end / CLUSTER_SIZE;
+
+	owner = calloc(host_count, sizeof(owner[0]));
+	if (owner == NULL) {
+		perror(((mapped_volume_t *)qvol)->filename);
+		return -1;
+	}
+
+	for (i = 0; i < qvol->l2_count; ++i) {
+		if (qvol->l2[i] != 0)
+			owner[qvol->l2[i] / CLUSTER_SIZE] = i + 1;
+	}
+
+	/* cluster 0 holds the header */
+	qvol->offset = 0;
+	if (add_ref(qvol, 0))
+		goto fail;
+
+	pos = CLUSTER_SIZE;
+
+	for (i = 1; i < host_count; ++i) {
+		if (owner[i] == 0)
+			continue;
+
+		if (pack_cluster(qvol, owner[i] - 1, &pos))
+			goto fail;
+	}
+
+	free(owner);
+
+	qvol->offset = pos;
+	qvol->data_end = pos + CLUSTER_SIZE - 1;
+	qvol->data_end -= qvol->data_end % CLUSTER_SIZE;
+	return 0;
+fail:
+	free(owner);
+	return -1;
+}
+
+/*****************************************************************************/
+
+/*
+  Write a table with big endian 64 bit entries. In L1 and L2 tables, the
+  entries that point to a cluster with a reference count of exactly one
+  need the copied flag, i.e. everything except holes and compressed data.
+
+  The table clusters may have held data before packing, so the unused
+  tail of the last cluster is written as well, filled with zeros.
+ */
+static int write_table64(qcow2_volume_t *qvol, uint64_t offset,
+			 const uint64_t *table, uint64_t count)
+{
+	uint64_t i, diff, value;
+
+	while (count > 0) {
+		diff = count > L2_ENTRIES ? L2_ENTRIES : count;
+
+		for (i = 0; i < diff; ++i) {
+			value = table[i];
+
+			if (value != 0 && !(value & QCOW2_OFLAG_COMPRESSED))
+				value |= QCOW2_OFLAG_COPIED;
+
+			put_be64(qvol->cluster + i * 8, value);
+		}
+
+		memset(qvol->cluster + diff * 8, 0, CLUSTER_SIZE - diff * 8);
+
+		if (write_out(qvol, offset, qvol->cluster, CLUSTER_SIZE))
+			return -1;
+
+		table += diff;
+		count -= diff;
+		offset += diff * 8;
+	}
+
+	return 0;
+}
+
+/* same as above, every table and refcount block is a whole cluster */
+static int write_refcounts(qcow2_volume_t *qvol, uint64_t rc_table,
+			   uint64_t rc_table_clusters, uint64_t rc_blocks)
+{
+	uint64_t i, j, index, total = qvol->offset / CLUSTER_SIZE;
+	uint64_t rc_block = rc_table + rc_table_clusters * CLUSTER_SIZE;
+
+	for (i = 0; i < rc_table_clusters; ++i) {
+		memset(qvol->cluster, 0, CLUSTER_SIZE);
+
+		for (j = 0; j < L2_ENTRIES; ++j) {
+			index = i * L2_ENTRIES + j;
+			if (index >= rc_blocks)
+				break;
+
+			put_be64(qvol->cluster + j * 8,
+				 rc_block + index * CLUSTER_SIZE);
+		}
+
+		if (write_out(qvol, rc_table + i * CLUSTER_SIZE,
+			      qvol->cluster, CLUSTER_SIZE)) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < rc_blocks; ++i) {
+		memset(qvol->cluster, 0, CLUSTER_SIZE);
+
+		for (j = 0; j < REFCOUNTS_PER_BLOCK; ++j) {
+			index = i * REFCOUNTS_PER_BLOCK + j;
+			if (index >= total)
+				break;
+
+			put_be16(qvol->cluster + j * 2, qvol->refcount[index]);
+		}
+
+		if (write_out(qvol, rc_block + i * CLUSTER_SIZE,
+			      qvol->cluster, CLUSTER_SIZE)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int write_header(qcow2_volume_t *qvol, uint64_t size,
+			uint64_t l1_table, uint64_t rc_table,
+			uint64_t rc_table_clusters)
+{
+	uint8_t hdr[QCOW2_HEADER_SIZE + 8];
+
+	memset(hdr, 0, sizeof(hdr));
+	put_be32(hdr, QCOW2_MAGIC);
+	put_be32(hdr + 4, QCOW2_VERSION);
+	put_be32(hdr + 20, CLUSTER_BITS);
+	put_be64(hdr + 24, size);
+	put_be32(hdr + 36, qvol->l1_size);
+	put_be64(hdr + 40, l1_table);
+	put_be64(hdr + 48, rc_table);
+	put_be32(hdr + 56, rc_table_clusters);
+	put_be32(hdr + 96, REFCOUNT_ORDER);
+	put_be32(hdr + 100, QCOW2_HEADER_SIZE);
+
+	if (qvol->compressor != NULL) {
+		put_be64(hdr + 72, QCOW2_INCOMPAT_COMPRESSION);
+		hdr[104] = QCOW2_COMPRESSION_ZSTD;
+	}
+
+	/* the trailing 8 zero bytes are the header extension end marker */
+	return write_out(qvol, 0, hdr, sizeof(hdr));
+}
+
+/*
+  The data clusters are already in the output file. Pack them together and
+  append the L2 tables, the L1 table and the refcount structures.
+ */
+static int write_tables(qcow2_volume_t *qvol, uint64_t total)
+{
+	uint64_t i, first, end, l1_table, count, cluster_count;
+	uint64_t rc_table, rc_table_clusters, rc_blocks;
+
+	cluster_count = (total + BLOCKS_PER_CLUSTER - 1) / BLOCKS_PER_CLUSTER;
+
+	if (grow_l2(qvol, qvol->l1_size * L2_ENTRIES))
+		return -1;
+
+	if (pack_clusters(qvol))
+		return -1;
+
+	/* L2 tables only for the regions that hold any data at all */
+	for (i = 0; i < qvol->l1_size; ++i) {
+		first = i * L2_ENTRIES;
+		end = first + L2_ENTRIES;
+
+		while (first < end && qvol->l2[first] == 0)
+			++first;
+
+		if (first == end)
+			continue;
+
+		qvol->l1[i] = alloc_clusters(qvol, 1);
+		if (qvol->l1[i] == 0)
+			return -1;
+
+		first = i * L2_ENTRIES;
+		count = cluster_count - first;
+		if (count > L2_ENTRIES)
+			count = L2_ENTRIES;
+
+		if (write_table64(qvol, qvol->l1[i], qvol->l2 + first, count))
+			return -1;
+	}
+
+	l1_table = alloc_clusters(qvol, (qvol->l1_size * 8 +
+					 CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+	if (l1_table == 0)
+		return -1;
+
+	if (write_table64(qvol, l1_table, qvol->l1, qvol->l1_size))
+		return -1;
+
+	/*
+	  The refcount structures go last and have to cover themselves,
+	  so grow them until the numbers settle.
+	 */
+	count = (qvol->offset + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	rc_table_clusters = 1;
+	rc_blocks = 1;
+
+	for (;;) {
+		i = count + rc_table_clusters + rc_blocks;
+		i = (i + REFCOUNTS_PER_BLOCK - 1) / REFCOUNTS_PER_BLOCK;
+		first = (i * 8 + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+
+		if (i == rc_blocks && first == rc_table_clusters)
+			break;
+
+		rc_blocks = i > rc_blocks ? i : rc_blocks;
+		rc_table_clusters = first > rc_table_clusters ?
+			first : rc_table_clusters;
+	}
+
+	rc_table = alloc_clusters(qvol, rc_table_clusters + rc_blocks);
+	if (rc_table == 0)
+		return -1;
+
+	if (write_refcounts(qvol, rc_table, rc_table_clusters, rc_blocks))
+		return -1;
+
+	if (ftruncate(((mapped_volume_t *)qvol)->fd, qvol->offset) != 0) {
+		perror(((mapped_volume_t *)qvol)->filename);
+		return -1;
+	}
+
+	qvol->file_size = qvol->offset;
+
+	return write_header(qvol, total * BLOCK_SIZE,
+			    l1_table, rc_table, rc_table_clusters);
+}
+
+static void free_tables(qcow2_volume_t *qvol)
+{
+	free(qvol->l1);
+	free(qvol->refcount);
+	qvol->l1 = NULL;
+	qvol->refcount = NULL;
+	qvol->refcount_max = 0;
+}
+
+/*****************************************************************************/
+
+static void cleanup(mapped_volume_t *vol)
+{
+	qcow2_volume_t *qvol = (qcow2_volume_t *)vol;
+
+	free_tables(qvol);
+
+	if (qvol->compressor != NULL)
+		object_drop(qvol->compressor);
+
+	free(qvol->free_list);
+	free(qvol->l2);
+}
+
+static int read_data(mapped_volume_t *vol, uint64_t index, void *buffer,
+		     uint32_t offset, uint32_t size)
+{
+	qcow2_volume_t *qvol = (qcow2_volume_t *)vol;
+	uint64_t host = get_cluster(qvol, index / BLOCKS_PER_CLUSTER);
+
+	if (host == 0)
+		return 0;
+
+	if (host & QCOW2_OFLAG_COMPRESSED) {
+		fprintf(stderr, "%s: cannot read back compressed cluster.\n",
+			vol->filename);
+		return -1;
+	}
+
+	return read_in(qvol, host + (index % BLOCKS_PER_CLUSTER) * BLOCK_SIZE +
+		       offset, buffer, size);
+}
+
+static int write_data(mapped_volume_t *vol, uint64_t index,
+		      const void *buffer, uint32_t offset, uint32_t size)
+{
+	qcow2_volume_t *qvol = (qcow2_volume_t *)vol;
+	uint64_t cluster = index / BLOCKS_PER_CLUSTER;
+	uint64_t host = get_cluster(qvol, cluster);
+
+	/* unallocated clusters read back as zero */
+	if (host == 0) {
+		if (is_memory_zero(buffer, size))
+			return 0;
+
+		if (grow_l2(qvol, cluster + 1))
+			return -1;
+
+		host = alloc_data_cluster(qvol);
+		if (host == 0)
+			return -1;
+
+		qvol->l2[cluster] = host;
+	}
+
+	return write_out(qvol, host + (index % BLOCKS_PER_CLUSTER) *
+			 BLOCK_SIZE + offset, buffer, size);
+}
+
+static int discard_data(mapped_volume_t *vol, uint64_t index, uint64_t count)
+{
+	return clear_blocks((qcow2_volume_t *)vol, index, count);
+}
+
+static int finish(mapped_volume_t *vol)
+{
+	qcow2_volume_t *qvol = (qcow2_volume_t *)vol;
+	uint64_t total, cluster_count;
+	int ret;
+
+	total = ((volume_t *)vol)->get_block_count((volume_t *)vol);
+	cluster_count = (total + BLOCKS_PER_CLUSTER - 1) / BLOCKS_PER_CLUSTER;
+
+	qvol->l1_size = (cluster_count + L2_ENTRIES - 1) / L2_ENTRIES;
+	if (qvol->l1_size == 0)
+		qvol->l1_size = 1;
+
+	if (qvol->l1_size > 0xFFFFFFFF ||
+	    qvol->l1_size > (SIZE_MAX / (L2_ENTRIES * sizeof(uint64_t)))) {
+		fprintf(stderr, "%s: too large for a qcow2 image.\n",
+			vol->filename);
+		return -1;
+	}
+
+	free_tables(qvol);
+	qvol->l1 = calloc(qvol->l1_size, sizeof(qvol->l1[0]));
+
+	if (qvol->l1 == NULL) {
+		perror(vol->filename);
+		return -1;
+	}
+
+	ret = write_tables(qvol, total);
+	free_tables(qvol);
+
+	if (ret)
+		return -1;
+
+	/*
+	  The packed data ends where the tables start. New clusters can
+	  simply be allocated over them, they are rewritten on commit.
+	 */
+	qvol->free_count = 0;
+
+	/*
+	  Without a matching decompressor, compressed clusters cannot be
+	  read back or modified anymore.
+	 */
+	vol->sealed = (qvol->compressor != NULL);
+	return 0;
+}
+
+/*****************************************************************************/
+
+volume_t *volume_qcow2_create(const char *filename, int fd,
+			      uint64_t max_size, xfrm_stream_t *compressor)
+{
+	qcow2_volume_t *qvol;
+
+	qvol = calloc(1, sizeof(*qvol));
+	if (qvol == NULL) {
+		perror(filename);
+		close(fd);
+		return NULL;
+	}
+
+	if (mapped_volume_init((mapped_volume_t *)qvol, filename, fd,
+			       max_size)) {
+		free(qvol);
+		return NULL;
+	}
+
+	if (compressor != NULL)
+		qvol->compressor = object_grab(compressor);
+
+	qvol->data_end = CLUSTER_SIZE;
+
+	((mapped_volume_t *)qvol)->finish = finish;
+	((mapped_volume_t *)qvol)->cleanup = cleanup;
+	((mapped_volume_t *)qvol)->read_data = read_data;
+	((mapped_volume_t *)qvol)->write_data = write_data;
+	((mapped_volume_t *)qvol)->discard_data = discard_data;
+	return (volume_t *)qvol;
+}
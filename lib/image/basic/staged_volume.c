@@ -0,0 +1,265 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * staged_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "staged_volume.h"
+
+/*****************************************************************************/
+
+static int open_staging_dir(const char *dir)
+{
+	char *path;
+	int fd;
+
+#ifdef O_TMPFILE
+	fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+	if (fd >= 0)
+		return fd;
+#endif
+
+	path = malloc(strlen(dir) + 32);
+	if (path == NULL)
+		return -1;
+
+	sprintf(path, "%s/.imgtool-staging-XXXXXX", dir);
+
+	fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+
+	free(path);
+	return fd;
+}
+
+int staged_volume_open_temp(const char *filename)
+{
+	char *dir, *slash;
+	int fd;
+
+	dir = strdup(filename);
+	if (dir == NULL)
+		return -1;
+
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else if (slash == dir) {
+		slash[1] = '\0';
+	} else {
+		*slash = '\0';
+	}
+
+	fd = open_staging_dir(dir);
+	free(dir);
+	return fd;
+}
+
+/*****************************************************************************/
+
+static volume_t *staging(volume_t *vol)
+{
+	return (volume_t *)((mapped_volume_t *)vol)->map;
+}
+
+static void mark_dirty(volume_t *vol)
+{
+	((mapped_volume_t *)vol)->dirty = true;
+}
+
+static int modified(volume_t *vol, int ret, uint64_t index, uint64_t offset,
+		    uint64_t size)
+{
+	staged_volume_t *svol = (staged_volume_t *)vol;
+
+	if (ret == 0 && svol->modified != NULL)
+		svol->modified(svol, index * vol->blocksize + offset, size);
+
+	return ret;
+}
+
+static int truncate_volume(volume_t *vol, uint64_t size)
+{
+	uint64_t old_size = ((mapped_volume_t *)vol)->map->bytes_used;
+	uint64_t new_size;
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->truncate(staging(vol), size);
+
+	/* the part between the old and the new end now reads as zero */
+	new_size = ((mapped_volume_t *)vol)->map->bytes_used;
+	if (new_size > old_size) {
+		size = new_size;
+		new_size = old_size;
+		old_size = size;
+	}
+
+	return modified(vol, ret, 0, new_size, old_size - new_size);
+}
+
+static int read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	return staging(vol)->read_block(staging(vol), index, buffer);
+}
+
+static int read_partial_block(volume_t *vol, uint64_t index,
+			      void *buffer, uint32_t offset, uint32_t size)
+{
+	return staging(vol)->read_partial_block(staging(vol), index, buffer,
+						offset, size);
+}
+
+static int write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->write_block(staging(vol), index, buffer);
+	return modified(vol, ret, index, 0, vol->blocksize);
+}
+
+static int write_partial_block(volume_t *vol, uint64_t index,
+			       const void *buffer, uint32_t offset,
+			       uint32_t size)
+{
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->write_partial_block(staging(vol), index, buffer,
+						offset, size);
+	return modified(vol, ret, index, offset, size);
+}
+
+static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->move_block(staging(vol), src, dst);
+	return modified(vol, ret, dst, 0, vol->blocksize);
+}
+
+static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->move_block_partial(staging(vol), src, dst,
+					       src_offset, dst_offset, size);
+	return modified(vol, ret, dst, dst_offset, size);
+}
+
+static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	uint64_t total = vol->get_block_count(vol);
+	int ret;
+
+	mark_dirty(vol);
+	ret = staging(vol)->discard_blocks(staging(vol), index, count);
+
+	/* blocks past the end don't matter, don't overflow the range */
+	if (index >= total)
+		return ret;
+
+	if (count > (total - index))
+		count = total - index;
+
+	return modified(vol, ret, index, 0, count * vol->blocksize);
+}
+
+/*****************************************************************************/
+
+uint64_t staged_volume_next_used(staged_volume_t *vol, uint64_t index)
+{
+	uint64_t count = ((volume_t *)vol)->get_block_count((volume_t *)vol);
+	bitmap_t *bitmap = ((mapped_volume_t *)vol)->map->bitmap;
+	size_t next;
+
+	if (index >= count || index > SIZE_MAX)
+		return count;
+
+	next = bitmap_find_next_set(bitmap, index);
+
+	return next > count ? count : next;
+}
+
+uint64_t staged_volume_next_unused(staged_volume_t *vol, uint64_t index)
+{
+	bitmap_t *bitmap = ((mapped_volume_t *)vol)->map->bitmap;
+
+	if (index > SIZE_MAX)
+		return index;
+
+	return bitmap_find_next_clear(bitmap, index);
+}
+
+int staged_volume_read(staged_volume_t *vol, uint64_t offset,
+		       void *data, size_t size)
+{
+	file_volume_t *map = ((mapped_volume_t *)vol)->map;
+	uint64_t avail = map->bytes_used;
+
+	if (offset >= avail) {
+		memset(data, 0, size);
+		return 0;
+	}
+
+	if (size > (avail - offset)) {
+		memset((char *)data + (avail - offset), 0,
+		       size - (avail - offset));
+		size = avail - offset;
+	}
+
+	return read_retry(map->filename, map->fd, offset, data, size);
+}
+
+int staged_volume_init(staged_volume_t *vol, const char *filename, int fd,
+		       uint64_t max_size)
+{
+	volume_t *map;
+	char *name;
+	int tmpfd;
+
+	tmpfd = staged_volume_open_temp(filename);
+	if (tmpfd < 0)
+		goto fail_errno;
+
+	name = malloc(strlen(filename) + 16);
+	if (name == NULL) {
+		close(tmpfd);
+		goto fail_errno;
+	}
+
+	sprintf(name, "%s (staging)", filename);
+	map = volume_from_fd(name, tmpfd, max_size);
+	free(name);
+
+	if (map == NULL) {
+		close(tmpfd);
+		goto fail;
+	}
+
+	if (mapped_volume_init_map((mapped_volume_t *)vol, filename, fd,
+				   (file_volume_t *)map)) {
+		return -1;
+	}
+
+	((volume_t *)vol)->truncate = truncate_volume;
+	((volume_t *)vol)->read_block = read_block;
+	((volume_t *)vol)->read_partial_block = read_partial_block;
+	((volume_t *)vol)->write_block = write_block;
+	((volume_t *)vol)->write_partial_block = write_partial_block;
+	((volume_t *)vol)->move_block = move_block;
+	((volume_t *)vol)->move_block_partial = move_block_partial;
+	((volume_t *)vol)->discard_blocks = discard_blocks;
+	return 0;
+fail_errno:
+	perror(filename);
+fail:
+	close(fd);
+	return -1;
+}
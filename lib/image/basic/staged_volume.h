@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * staged_volume.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef STAGED_VOLUME_H
+#define STAGED_VOLUME_H
+
+#include "mapped_volume.h"
+
+/*
+  A volume for output formats that cannot be modified in place. The map
+  is a file volume on an unlinked, sparse temporary file next to the output
+  and all block operations go there. On commit, the finish callback of the
+  derived volume converts the staging data into the final format, written
+  to the output file descriptor.
+ */
+typedef struct staged_volume_t {
+	mapped_volume_t base;
+
+	/*
+	  Optional, called after the data in a range of bytes has been
+	  changed. The range can extend past the end of the volume.
+	 */
+	void (*modified)(struct staged_volume_t *vol, uint64_t offset,
+			 uint64_t size);
+} staged_volume_t;
+
+/*
+  Initialize the common part of a staged volume. Takes over ownership of
+  the file descriptor, which is closed if this fails.
+ */
+int staged_volume_init(staged_volume_t *vol, const char *filename, int fd,
+		       uint64_t max_size);
+
+/*
+  Open an unlinked temporary file next to the output file. Returns -1 on
+  failure and sets errno.
+ */
+int staged_volume_open_temp(const char *filename);
+
+/*
+  Returns the index of the first block at or after the given one that is
+  used in the staging volume, or the total block count if there is none.
+ */
+uint64_t staged_volume_next_used(staged_volume_t *vol, uint64_t index);
+
+/*
+  Returns the index of the first unused block at or after the given one.
+ */
+uint64_t staged_volume_next_unused(staged_volume_t *vol, uint64_t index);
+
+/* read from the staging file, with zero padding past the end */
+int staged_volume_read(staged_volume_t *vol, uint64_t offset,
+		       void *data, size_t size);
+
+#endif /* STAGED_VOLUME_H */
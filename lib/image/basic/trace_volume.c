@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * trace_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "voltrace.h"
+#include "volume.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+/* number of records collected before writing them out */
+#define TRACE_BUFFER_RECORDS (4096)
+
+typedef struct {
+	volume_t base;
+
+	volume_t *wrapped;
+	char *filename;
+	int fd;
+
+	/* write position in the trace file */
+	uint64_t offset;
+
+	/* set if writing the trace failed, reported on commit */
+	bool failed;
+
+	/*
+	  Protects the record buffer and the file position. The volume can
+	  be accessed by several threads, e.g. if it sits on a partition.
+	 */
+	pthread_mutex_t lock;
+
+	size_t used;
+	voltrace_record_t records[];
+} trace_volume_t;
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* must be called with the lock held */
+static int flush_records(trace_volume_t *tvol)
+{
+	size_t i, size = tvol->used * sizeof(tvol->records[0]);
+	voltrace_record_t *rec;
+
+	if (tvol->used == 0 || tvol->failed)
+		return tvol->failed ? -1 : 0;
+
+	for (i = 0; i < tvol->used; ++i) {
+		rec = tvol->records + i;
+
+		rec->size = htole32(rec->size);
+		rec->index = htole64(rec->index);
+		rec->arg = htole64(rec->arg);
+		rec->offset = htole32(rec->offset);
+		rec->dst_offset = htole32(rec->dst_offset);
+		rec->latency = htole64(rec->latency);
+	}
+
+	tvol->used = 0;
+
+	if (write_retry(tvol->filename, tvol->fd, tvol->offset,
+			tvol->records, size)) {
+		tvol->failed = true;
+		return -1;
+	}
+
+	tvol->offset += size;
+	return 0;
+}
+
+static void begin_record(voltrace_record_t *rec, VOLTRACE_OP op)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->op = op;
+	rec->latency = get_time();
+}
+
+/*
+  Records are assembled on the stack and only added to the buffer once
+  the operation is done, so a flush never writes out a half filled one.
+ */
+static int end_record(trace_volume_t *tvol, voltrace_record_t *rec, int ret)
+{
+	rec->latency = get_time() - rec->latency;
+	rec->status = (ret != 0);
+
+	pthread_mutex_lock(&tvol->lock);
+	if (tvol->used == TRACE_BUFFER_RECORDS)
+		flush_records(tvol);
+
+	tvol->records[tvol->used++] = *rec;
+	pthread_mutex_unlock(&tvol->lock);
+	return ret;
+}
+
+static uint64_t get_min_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((trace_volume_t *)vol)->wrapped;
+
+	return wrapped->get_min_block_count(wrapped);
+}
+
+static uint64_t get_max_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((trace_volume_t *)vol)->wrapped;
+
+	return wrapped->get_max_block_count(wrapped);
+}
+
+static uint64_t get_block_count(volume_t *vol)
+{
+	volume_t *wrapped = ((trace_volume_t *)vol)->wrapped;
+
+	return wrapped->get_block_count(wrapped);
+}
+
+static int trace_truncate(volume_t *vol, uint64_t size)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_TRUNCATE);
+	rec.arg = size;
+
+	ret = tvol->wrapped->truncate(tvol->wrapped, size);
+	return end_record(tvol, &rec, ret);
+}
+
+static int read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_READ_BLOCK);
+	rec.index = index;
+	rec.size = vol->blocksize;
+
+	ret = tvol->wrapped->read_block(tvol->wrapped, index, buffer);
+	return end_record(tvol, &rec, ret);
+}
+
+static int read_partial_block(volume_t *vol, uint64_t index,
+			      void *buffer, uint32_t offset, uint32_t size)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_READ_PARTIAL);
+	rec.index = index;
+	rec.offset = offset;
+	rec.size = size;
+
+	ret = tvol->wrapped->read_partial_block(tvol->wrapped, index,
+						buffer, offset, size);
+	return end_record(tvol, &rec, ret);
+}
+
+static int write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_WRITE_BLOCK);
+	rec.index = index;
+	rec.size = buffer == NULL ? 0 : vol->blocksize;
+
+	if (buffer == NULL)
+		rec.arg = vol->blocksize;
+
+	ret = tvol->wrapped->write_block(tvol->wrapped, index, buffer);
+	return end_record(tvol, &rec, ret);
+}
+
+static int write_partial_block(volume_t *vol, uint64_t index,
+			       const void *buffer, uint32_t offset,
+			       uint32_t size)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_WRITE_PARTIAL);
+	rec.index = index;
+	rec.offset = offset;
+	rec.size = buffer == NULL ? 0 : size;
+
+	if (buffer == NULL)
+		rec.arg = size;
+
+	ret = tvol->wrapped->write_partial_block(tvol->wrapped, index,
+						 buffer, offset, size);
+	return end_record(tvol, &rec, ret);
+}
+
+static int move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_MOVE_BLOCK);
+	rec.index = src;
+	rec.arg = dst;
+	rec.size = vol->blocksize;
+
+	ret = tvol->wrapped->move_block(tvol->wrapped, src, dst);
+	return end_record(tvol, &rec, ret);
+}
+
+static int move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_MOVE_PARTIAL);
+	rec.index = src;
+	rec.arg = dst;
+	rec.offset = src_offset;
+	rec.dst_offset = dst_offset;
+	rec.size = size;
+
+	ret = tvol->wrapped->move_block_partial(tvol->wrapped, src, dst,
+						src_offset, dst_offset, size);
+	return end_record(tvol, &rec, ret);
+}
+
+static int discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_DISCARD);
+	rec.index = index;
+	rec.arg = count;
+
+	ret = tvol->wrapped->discard_blocks(tvol->wrapped, index, count);
+	return end_record(tvol, &rec, ret);
+}
+
+static int commit(volume_t *vol)
+{
+	trace_volume_t *tvol = (trace_volume_t *)vol;
+	voltrace_record_t rec;
+	int ret;
+
+	begin_record(&rec, VOLTRACE_OP_COMMIT);
+	ret = end_record(tvol, &rec, tvol->wrapped->commit(tvol->wrapped));
+
+	pthread_mutex_lock(&tvol->lock);
+	if (flush_records(tvol))
+		ret = -1;
+	pthread_mutex_unlock(&tvol->lock);
+
+	return ret;
+}
+
+static void destroy(object_t *base)
+{
+	trace_volume_t *tvol = (trace_volume_t *)base;
+
+	flush_records(tvol);
+	pthread_mutex_destroy(&tvol->lock);
+	close(tvol->fd);
+	object_drop(tvol->wrapped);
+	free(tvol->filename);
+	free(tvol);
+}
+
+volume_t *volume_trace_create(volume_t *vol, const char *filename, int fd)
+{
+	voltrace_header_t header;
+	trace_volume_t *tvol;
+
+	tvol = calloc(1, sizeof(*tvol) +
+		      TRACE_BUFFER_RECORDS * sizeof(tvol->records[0]));
+	if (tvol == NULL)
+		goto fail_errno;
+
+	tvol->filename = strdup(filename);
+	if (tvol->filename == NULL)
+		goto fail_errno;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VOLTRACE_MAGIC, sizeof(header.magic));
+	header.version = htole32(VOLTRACE_VERSION);
+	header.blocksize = htole32(vol->blocksize);
+
+	if (write_retry(filename, fd, 0, &header, sizeof(header)))
+		goto fail;
+
+	if (pthread_mutex_init(&tvol->lock, NULL) != 0) {
+		fprintf(stderr, "%s: error initializing trace lock.\n",
+			filename);
+		goto fail;
+	}
+
+	tvol->offset = sizeof(header);
+	tvol->fd = fd;
+	tvol->wrapped = object_grab(vol);
+
+	((object_t *)tvol)->refcount = 1;
+	((object_t *)tvol)->destroy = destroy;
+	((volume_t *)tvol)->blocksize = vol->blocksize;
+	((volume_t *)tvol)->get_min_block_count = get_min_block_count;
+	((volume_t *)tvol)->get_max_block_count = get_max_block_count;
+	((volume_t *)tvol)->get_block_count = get_block_count;
+	((volume_t *)tvol)->truncate = trace_truncate;
+	((volume_t *)tvol)->read_block = read_block;
+	((volume_t *)tvol)->read_partial_block = read_partial_block;
+	((volume_t *)tvol)->write_block = write_block;
+	((volume_t *)tvol)->write_partial_block = write_partial_block;
+	((volume_t *)tvol)->move_block = move_block;
+	((volume_t *)tvol)->move_block_partial = move_block_partial;
+	((volume_t *)tvol)->discard_blocks = discard_blocks;
+	((volume_t *)tvol)->commit = commit;
+	return (volume_t *)tvol;
+fail_errno:
+	perror(filename);
+fail:
+	if (tvol != NULL)
+		free(tvol->filename);
+	free(tvol);
+	close(fd);
+	return NULL;
+}
@@ -0,0 +1,829 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * zstd_seekable.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "staged_volume.h"
+#include "threadpool.h"
+#include "xfrm.h"
+
+#include <pthread.h>
+
+#define SKIPPABLE_MAGIC (0x184D2A5E)
+#define SEEKABLE_MAGIC (0x8F92EAB1)
+
+#define SEEK_ENTRY_SIZE (8)
+#define SEEK_FOOTER_SIZE (9)
+
+/* the seek table stores 32 bit sizes */
+#define MAX_FRAME_SIZE (1024 * 1024 * 1024)
+
+/*
+  Upper bound for the size of a compressed frame, with some slack on top
+  of the worst case expansion of zstd.
+ */
+#define OUT_BUFFER_SIZE(frame_size) ((frame_size) + (frame_size) / 128 + 1024)
+
+enum {
+	/* the frame has to be compressed on commit */
+	FRAME_DIRTY = 0,
+
+	/* a task for compressing the frame ahead of time is pending */
+	FRAME_QUEUED,
+
+	/* the compressed frame is stored in the cache file */
+	FRAME_CACHED,
+};
+
+typedef struct {
+	/* incremented whenever the data covered by the frame changes */
+	uint32_t generation;
+	uint32_t state;
+
+	/* location of the compressed frame in the cache file */
+	uint32_t size;
+	uint64_t offset;
+} zstd_frame_t;
+
+typedef struct zstd_worker_t {
+	struct zstd_worker_t *next;
+
+	xfrm_stream_t *compressor;
+	uint8_t *buffer;
+
+	/* only used for compressing ahead of time */
+	uint8_t *out;
+} zstd_worker_t;
+
+typedef struct {
+	staged_volume_t base;
+
+	xfrm_stream_t *(*create_compressor)(void);
+	uint32_t frame_size;
+
+	thread_pool_t *pool;
+
+	/*
+	  Full frames are compressed on the thread pool ahead of time, once
+	  the writes to the volume have moved on past them, and kept in an
+	  unlinked cache file. If a frame is modified again afterwards, the
+	  cached copy is dropped and it is compressed again on commit.
+
+	  The lock protects everything below, except for the group.
+	 */
+	pthread_mutex_t lock;
+	thread_pool_group_t group;
+
+	zstd_frame_t *frames;
+	uint64_t frame_max;
+
+	/* frames below this can be compressed, and the first one to check */
+	uint64_t ready;
+	uint64_t scan;
+
+	size_t in_flight;
+	size_t max_in_flight;
+	zstd_worker_t *idle;
+
+	int cache_fd;
+	uint64_t cache_end;
+} zstd_volume_t;
+
+typedef struct {
+	zstd_volume_t *zvol;
+	uint64_t index;
+	uint32_t generation;
+} zstd_task_t;
+
+typedef struct {
+	uint8_t *data;
+	uint32_t size;
+	bool done;
+} zstd_slot_t;
+
+typedef struct {
+	zstd_volume_t *zvol;
+	uint64_t image_size;
+	uint64_t frame_count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* next frame to compress and number of frames written out */
+	uint64_t next;
+	uint64_t written;
+	int status;
+
+	/* compressed frames waiting to be written, indexed by frame % count */
+	zstd_slot_t *slots;
+	size_t slot_count;
+} zstd_job_t;
+
+static void put_le32(uint8_t *ptr, uint32_t value)
+{
+	ptr[0] = value & 0xFF;
+	ptr[1] = (value >> 8) & 0xFF;
+	ptr[2] = (value >> 16) & 0xFF;
+	ptr[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t frame_input_size(const zstd_job_t *job, uint64_t index)
+{
+	uint64_t offset = index * job->zvol->frame_size;
+	uint64_t size = job->image_size - offset;
+
+	return size > job->zvol->frame_size ? job->zvol->frame_size : size;
+}
+
+static int worker_init(zstd_volume_t *zvol, zstd_worker_t *worker,
+		       bool ahead)
+{
+	memset(worker, 0, sizeof(*worker));
+
+	worker->buffer = malloc(zvol->frame_size);
+	if (worker->buffer == NULL)
+		goto fail_errno;
+
+	if (ahead) {
+		worker->out = malloc(OUT_BUFFER_SIZE(zvol->frame_size));
+		if (worker->out == NULL)
+			goto fail_errno;
+	}
+
+	worker->compressor = zvol->create_compressor();
+	if (worker->compressor == NULL)
+		goto fail;
+
+	return 0;
+fail_errno:
+	perror(((mapped_volume_t *)zvol)->filename);
+fail:
+	free(worker->buffer);
+	free(worker->out);
+	return -1;
+}
+
+static void worker_cleanup(zstd_worker_t *worker)
+{
+	object_drop(worker->compressor);
+	free(worker->buffer);
+	free(worker->out);
+}
+
+static int compress_data(zstd_volume_t *zvol, zstd_worker_t *worker,
+			 uint32_t size, uint8_t *out, uint32_t *out_size)
+{
+	uint32_t max_out = OUT_BUFFER_SIZE(zvol->frame_size);
+	uint32_t in_read = 0, out_written = 0;
+	int ret;
+
+	ret = worker->compressor->process_data(worker->compressor,
+					       worker->buffer, size,
+					       out, max_out,
+					       &in_read, &out_written,
+					       XFRM_STREAM_FLUSH_FULL);
+
+	if (ret != XFRM_STREAM_END || in_read != size ||
+	    out_written >= max_out) {
+		return -1;
+	}
+
+	*out_size = out_written;
+	return 0;
+}
+
+/*
+  Returns the compressed frame from the cache file, if it is there and
+  still covers the given amount of data. Only called on commit, after all
+  tasks compressing ahead of time have finished.
+ */
+static const zstd_frame_t *get_cached(zstd_volume_t *zvol, uint64_t index,
+				      uint32_t size)
+{
+	if (index >= zvol->frame_max || size != zvol->frame_size)
+		return NULL;
+
+	if (zvol->frames[index].state != FRAME_CACHED)
+		return NULL;
+
+	return zvol->frames + index;
+}
+
+/* compress a frame into a slot, each frame is an independent zstd frame */
+static int compress_frame(zstd_job_t *job, zstd_worker_t *worker,
+			  uint64_t index, zstd_slot_t *slot)
+{
+	staged_volume_t *vol = (staged_volume_t *)job->zvol;
+	const char *filename = ((mapped_volume_t *)vol)->filename;
+	uint32_t size = frame_input_size(job, index);
+	const zstd_frame_t *frame;
+
+	frame = get_cached(job->zvol, index, size);
+	if (frame != NULL) {
+		slot->size = frame->size;
+		return read_retry(filename, job->zvol->cache_fd,
+				  frame->offset, slot->data, frame->size);
+	}
+
+	if (staged_volume_read(vol, index * job->zvol->frame_size,
+			       worker->buffer, size)) {
+		return -1;
+	}
+
+	if (compress_data(job->zvol, worker, size, slot->data, &slot->size)) {
+		fprintf(stderr, "%s: error compressing frame.\n", filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void set_error(zstd_job_t *job)
+{
+	pthread_mutex_lock(&job->lock);
+	job->status = -1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static int compress_worker(void *arg)
+{
+	zstd_job_t *job = arg;
+	zstd_worker_t worker;
+	zstd_slot_t *slot;
+	uint64_t index;
+	int ret;
+
+	/* don't bother setting up if the other threads already did it all */
+	pthread_mutex_lock(&job->lock);
+	ret = job->status != 0 || job->next >= job->frame_count;
+	pthread_mutex_unlock(&job->lock);
+
+	if (ret)
+		return 0;
+
+	if (worker_init(job->zvol, &worker, false)) {
+		set_error(job);
+		return 0;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		while (job->status == 0 && job->next < job->frame_count &&
+		       (job->next - job->written) >= job->slot_count) {
+			pthread_cond_wait(&job->cond, &job->lock);
+		}
+
+		if (job->status != 0 || job->next >= job->frame_count) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+
+		index = job->next++;
+		slot = job->slots + (index % job->slot_count);
+		pthread_mutex_unlock(&job->lock);
+
+		ret = compress_frame(job, &worker, index, slot);
+
+		pthread_mutex_lock(&job->lock);
+		if (ret != 0) {
+			job->status = -1;
+		} else {
+			slot->done = true;
+		}
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+
+		if (ret != 0)
+			break;
+	}
+
+	worker_cleanup(&worker);
+	return 0;
+}
+
+static int write_frame(zstd_job_t *job, uint64_t *offset, uint8_t *entry,
+		       uint64_t index, const zstd_slot_t *slot)
+{
+	if (mapped_volume_write((mapped_volume_t *)job->zvol, *offset,
+				slot->data, slot->size)) {
+		return -1;
+	}
+
+	put_le32(entry, slot->size);
+	put_le32(entry + 4, frame_input_size(job, index));
+	*offset += slot->size;
+	return 0;
+}
+
+static int compress_serial(zstd_job_t *job, uint64_t *offset, uint8_t *table)
+{
+	zstd_worker_t worker;
+	uint64_t i;
+	int ret = 0;
+
+	if (worker_init(job->zvol, &worker, false))
+		return -1;
+
+	for (i = 0; i < job->frame_count; ++i) {
+		ret = compress_frame(job, &worker, i, job->slots);
+		if (ret != 0)
+			break;
+
+		ret = write_frame(job, offset, table + i * SEEK_ENTRY_SIZE,
+				  i, job->slots);
+		if (ret != 0)
+			break;
+	}
+
+	worker_cleanup(&worker);
+	return ret;
+}
+
+/*
+  The tasks on the thread pool compress frames out of order, the calling
+  thread writes them out in order as they complete. The number of slots
+  limits how far the tasks can run ahead. If the next frame has not been
+  picked up by a task yet, e.g. because the pool is busy with something
+  else, the calling thread compresses it itself.
+ */
+static int compress_parallel(zstd_job_t *job, size_t num_tasks,
+			     uint64_t *offset, uint8_t *table)
+{
+	thread_pool_group_t group;
+	zstd_worker_t worker;
+	zstd_slot_t *slot;
+	uint64_t index;
+	bool claimed;
+	size_t i;
+	int ret;
+
+	if (worker_init(job->zvol, &worker, false))
+		return -1;
+
+	memset(&group, 0, sizeof(group));
+
+	for (i = 0; i < num_tasks; ++i) {
+		if (thread_pool_submit(job->zvol->pool, &group,
+				       compress_worker, job)) {
+			break;
+		}
+	}
+
+	for (index = 0; index < job->frame_count; ++index) {
+		slot = job->slots + (index % job->slot_count);
+
+		pthread_mutex_lock(&job->lock);
+		while (job->status == 0 && !slot->done && job->next > index)
+			pthread_cond_wait(&job->cond, &job->lock);
+
+		claimed = (job->status == 0 && !slot->done);
+		if (claimed)
+			job->next += 1;
+
+		ret = job->status;
+		pthread_mutex_unlock(&job->lock);
+
+		if (ret != 0)
+			break;
+
+		if (claimed) {
+			ret = compress_frame(job, &worker, index, slot);
+			if (ret != 0) {
+				set_error(job);
+				break;
+			}
+		}
+
+		ret = write_frame(job, offset,
+				  table + index * SEEK_ENTRY_SIZE,
+				  index, slot);
+		if (ret != 0) {
+			set_error(job);
+			break;
+		}
+
+		pthread_mutex_lock(&job->lock);
+		slot->done = false;
+		job->written += 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	thread_pool_wait(job->zvol->pool, &group);
+	worker_cleanup(&worker);
+	return ret;
+}
+
+static int write_seek_table(zstd_job_t *job, uint64_t offset, uint8_t *table)
+{
+	uint8_t *hdr = table - 8;
+	uint8_t *footer = table + job->frame_count * SEEK_ENTRY_SIZE;
+	uint64_t size = job->frame_count * SEEK_ENTRY_SIZE + SEEK_FOOTER_SIZE;
+
+	put_le32(hdr, SKIPPABLE_MAGIC);
+	put_le32(hdr + 4, size);
+
+	put_le32(footer, job->frame_count);
+	footer[4] = 0;
+	put_le32(footer + 5, SEEKABLE_MAGIC);
+
+	if (mapped_volume_write((mapped_volume_t *)job->zvol, offset,
+				hdr, size + 8)) {
+		return -1;
+	}
+
+	if (ftruncate(((mapped_volume_t *)job->zvol)->fd,
+		      offset + size + 8) != 0) {
+		perror(((mapped_volume_t *)job->zvol)->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int compress_ahead(void *arg);
+
+/* must be called with the lock held */
+static void schedule_frames(zstd_volume_t *zvol)
+{
+	zstd_frame_t *frame;
+	zstd_task_t *task;
+
+	while (zvol->scan < zvol->ready &&
+	       zvol->in_flight < zvol->max_in_flight) {
+		frame = zvol->frames + zvol->scan;
+
+		if (frame->state == FRAME_DIRTY) {
+			task = calloc(1, sizeof(*task));
+			if (task == NULL)
+				break;
+
+			task->zvol = zvol;
+			task->index = zvol->scan;
+			task->generation = frame->generation;
+
+			if (thread_pool_submit(zvol->pool, &zvol->group,
+					       compress_ahead, task)) {
+				free(task);
+				break;
+			}
+
+			frame->state = FRAME_QUEUED;
+			zvol->in_flight += 1;
+		}
+
+		zvol->scan += 1;
+	}
+}
+
+/* a short read means the data past the end of the staging file is zero */
+static int read_ahead(int fd, uint64_t offset, uint8_t *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pread(fd, data, size, offset);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (ret == 0) {
+			memset(data, 0, size);
+			break;
+		}
+
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+/*
+  The data is read from the staging file while the volume may be modified
+  at the same time. If that happens, the frame generation changes after
+  the data has been written and the result is thrown away. Any failure
+  simply leaves the frame to be compressed on commit.
+ */
+static int compress_ahead(void *arg)
+{
+	zstd_task_t *task = arg;
+	zstd_volume_t *zvol = task->zvol;
+	int fd = ((mapped_volume_t *)zvol)->map->fd;
+	zstd_worker_t *worker;
+	zstd_frame_t *frame;
+	uint64_t offset = 0;
+	uint32_t size = 0;
+	bool valid;
+	int ret;
+
+	pthread_mutex_lock(&zvol->lock);
+	worker = zvol->idle;
+	if (worker != NULL)
+		zvol->idle = worker->next;
+	pthread_mutex_unlock(&zvol->lock);
+
+	if (worker == NULL) {
+		worker = calloc(1, sizeof(*worker));
+
+		if (worker != NULL && worker_init(zvol, worker, true)) {
+			free(worker);
+			worker = NULL;
+		}
+	}
+
+	ret = -1;
+	if (worker != NULL &&
+	    read_ahead(fd, task->index * zvol->frame_size,
+		       worker->buffer, zvol->frame_size) == 0) {
+		ret = compress_data(zvol, worker, zvol->frame_size,
+				    worker->out, &size);
+	}
+
+	pthread_mutex_lock(&zvol->lock);
+	frame = zvol->frames + task->index;
+	valid = (ret == 0 && frame->generation == task->generation);
+
+	if (valid) {
+		offset = zvol->cache_end;
+		zvol->cache_end += size;
+	}
+	pthread_mutex_unlock(&zvol->lock);
+
+	if (valid) {
+		valid = write_retry(((mapped_volume_t *)zvol)->filename,
+				    zvol->cache_fd, offset,
+				    worker->out, size) == 0;
+	}
+
+	pthread_mutex_lock(&zvol->lock);
+	frame = zvol->frames + task->index;
+
+	if (frame->generation == task->generation) {
+		if (valid) {
+			frame->state = FRAME_CACHED;
+			frame->offset = offset;
+			frame->size = size;
+		} else {
+			frame->state = FRAME_DIRTY;
+		}
+	}
+
+	if (worker != NULL) {
+		worker->next = zvol->idle;
+		zvol->idle = worker;
+	}
+
+	zvol->in_flight -= 1;
+	schedule_frames(zvol);
+	pthread_mutex_unlock(&zvol->lock);
+
+	free(task);
+	return 0;
+}
+
+/* must be called with the lock held */
+static int grow_frames(zstd_volume_t *zvol, uint64_t count)
+{
+	uint64_t new_max = zvol->frame_max ? zvol->frame_max : 64;
+	zstd_frame_t *new;
+
+	if (count <= zvol->frame_max)
+		return 0;
+
+	while (new_max < count)
+		new_max *= 2;
+
+	if (new_max > (SIZE_MAX / sizeof(new[0])))
+		return -1;
+
+	new = realloc(zvol->frames, new_max * sizeof(new[0]));
+	if (new == NULL)
+		return -1;
+
+	memset(new + zvol->frame_max, 0,
+	       (new_max - zvol->frame_max) * sizeof(new[0]));
+
+	zvol->frames = new;
+	zvol->frame_max = new_max;
+	return 0;
+}
+
+/*
+  Every full frame in front of the one that was just written to can be
+  compressed. A frame that is modified again later on is dropped from
+  the cache and has to be compressed again.
+ */
+static void frames_modified(staged_volume_t *vol, uint64_t offset,
+			    uint64_t size)
+{
+	zstd_volume_t *zvol = (zstd_volume_t *)vol;
+	uint64_t first, last, full;
+	volume_t *base = (volume_t *)vol;
+
+	first = offset / zvol->frame_size;
+	last = first;
+
+	if (size > 0 && size <= (UINT64_MAX - offset))
+		last = (offset + size - 1) / zvol->frame_size;
+
+	full = base->get_block_count(base) * base->blocksize /
+		zvol->frame_size;
+
+	pthread_mutex_lock(&zvol->lock);
+
+	for (; first <= last && first < zvol->frame_max; ++first) {
+		zvol->frames[first].generation += 1;
+		zvol->frames[first].state = FRAME_DIRTY;
+
+		if (first < zvol->scan)
+			zvol->scan = first;
+	}
+
+	zvol->ready = offset / zvol->frame_size;
+	if (zvol->ready > full)
+		zvol->ready = full;
+
+	if (grow_frames(zvol, zvol->ready))
+		zvol->ready = zvol->frame_max;
+
+	schedule_frames(zvol);
+	pthread_mutex_unlock(&zvol->lock);
+}
+
+/* stop compressing ahead of time and wait for the pending tasks */
+static void stop_ahead(zstd_volume_t *zvol)
+{
+	if (zvol->max_in_flight == 0)
+		return;
+
+	pthread_mutex_lock(&zvol->lock);
+	zvol->ready = 0;
+	pthread_mutex_unlock(&zvol->lock);
+
+	thread_pool_wait(zvol->pool, &zvol->group);
+}
+
+/*****************************************************************************/
+
+static int export_seekable(mapped_volume_t *vol)
+{
+	zstd_volume_t *zvol = (zstd_volume_t *)vol;
+	size_t i, num_threads = 1;
+	uint8_t *table = NULL;
+	uint64_t offset = 0;
+	zstd_job_t job;
+	int ret = -1;
+
+	stop_ahead(zvol);
+
+	memset(&job, 0, sizeof(job));
+	job.zvol = zvol;
+	job.image_size = ((volume_t *)vol)->get_block_count((volume_t *)vol) *
+		((volume_t *)vol)->blocksize;
+	job.frame_count = (job.image_size + zvol->frame_size - 1) /
+		zvol->frame_size;
+
+	if (job.frame_count > 0xFFFFFFFF ||
+	    job.frame_count > (SIZE_MAX - 32) / SEEK_ENTRY_SIZE) {
+		fprintf(stderr, "%s: too many frames for a seek table.\n",
+			vol->filename);
+		return -1;
+	}
+
+	if (zvol->pool != NULL)
+		num_threads = thread_pool_get_thread_count(zvol->pool);
+	if (num_threads > job.frame_count && job.frame_count > 0)
+		num_threads = job.frame_count;
+
+	job.slot_count = num_threads > 1 ? 2 * num_threads : 1;
+
+	/* skippable frame header, seek table entries and footer */
+	table = calloc(1, 8 + job.frame_count * SEEK_ENTRY_SIZE +
+		       SEEK_FOOTER_SIZE);
+	job.slots = calloc(job.slot_count, sizeof(job.slots[0]));
+
+	if (table == NULL || job.slots == NULL)
+		goto fail_errno;
+
+	for (i = 0; i < job.slot_count; ++i) {
+		job.slots[i].data = malloc(OUT_BUFFER_SIZE(zvol->frame_size));
+		if (job.slots[i].data == NULL)
+			goto fail_errno;
+	}
+
+	if (ftruncate(vol->fd, 0) != 0)
+		goto fail_errno;
+
+	if (num_threads > 1) {
+		pthread_mutex_init(&job.lock, NULL);
+		pthread_cond_init(&job.cond, NULL);
+
+		/* the calling thread does its share of the work as well */
+		ret = compress_parallel(&job, num_threads - 1,
+					&offset, table + 8);
+
+		pthread_cond_destroy(&job.cond);
+		pthread_mutex_destroy(&job.lock);
+	} else {
+		ret = compress_serial(&job, &offset, table + 8);
+	}
+
+	if (ret == 0)
+		ret = write_seek_table(&job, offset, table + 8);
+out:
+	for (i = 0; job.slots != NULL && i < job.slot_count; ++i)
+		free(job.slots[i].data);
+	free(job.slots);
+	free(table);
+	return ret;
+fail_errno:
+	perror(vol->filename);
+	ret = -1;
+	goto out;
+}
+
+static void cleanup_zstd(mapped_volume_t *vol)
+{
+	zstd_volume_t *zvol = (zstd_volume_t *)vol;
+	zstd_worker_t *worker;
+
+	stop_ahead(zvol);
+
+	while (zvol->idle != NULL) {
+		worker = zvol->idle;
+		zvol->idle = worker->next;
+
+		worker_cleanup(worker);
+		free(worker);
+	}
+
+	if (zvol->cache_fd >= 0)
+		close(zvol->cache_fd);
+
+	if (zvol->pool != NULL)
+		object_drop(zvol->pool);
+
+	pthread_mutex_destroy(&zvol->lock);
+	free(zvol->frames);
+}
+
+volume_t *volume_zstd_seekable_create(const char *filename, int fd,
+				      uint64_t max_size, uint32_t frame_size,
+				      xfrm_stream_t *(*create_compressor)(void),
+				      thread_pool_t *pool)
+{
+	zstd_volume_t *zvol;
+
+	if (frame_size == 0 || frame_size > MAX_FRAME_SIZE) {
+		fprintf(stderr, "%s: invalid zstd frame size.\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	zvol = calloc(1, sizeof(*zvol));
+	if (zvol == NULL) {
+		perror(filename);
+		close(fd);
+		return NULL;
+	}
+
+	if (staged_volume_init((staged_volume_t *)zvol, filename,
+			       fd, max_size)) {
+		free(zvol);
+		return NULL;
+	}
+
+	pthread_mutex_init(&zvol->lock, NULL);
+	zvol->cache_fd = -1;
+	zvol->frame_size = frame_size;
+	zvol->create_compressor = create_compressor;
+	zvol->pool = pool == NULL ? NULL : object_grab(pool);
+	((mapped_volume_t *)zvol)->finish = export_seekable;
+	((mapped_volume_t *)zvol)->cleanup = cleanup_zstd;
+
+	/* without worker threads, nothing can be done ahead of time */
+	if (pool != NULL)
+		zvol->max_in_flight = thread_pool_get_thread_count(pool) - 1;
+
+	if (zvol->max_in_flight > 0) {
+		zvol->cache_fd = staged_volume_open_temp(filename);
+		if (zvol->cache_fd < 0) {
+			perror(filename);
+			object_drop(zvol);
+			return NULL;
+		}
+
+		((staged_volume_t *)zvol)->modified = frames_modified;
+	}
+
+	return (volume_t *)zvol;
+}
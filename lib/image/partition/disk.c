@@ -0,0 +1,481 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * disk.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "partition.h"
+
+/*
+  Make sure that at least the given number of blocks are reserved for a
+  partition on the underlying volume. If the gap to the next partition is
+  too small, the following partitions are moved out of the way with a
+  single memmove. The gap is then made larger than required, so that
+  growing the partition further does not immediately cause another move.
+ */
+static int reserve_blocks(part_disk_t *disk, size_t index, uint64_t count)
+{
+	uint64_t start, reserved, end, limit, want, slack, tail;
+	size_t i;
+
+	if (count <= disk->partitions[index].blk_reserved)
+		return 0;
+
+	limit = disk->volume->get_max_block_count(disk->volume);
+	end = part_disk_get_reserved_end(disk);
+	want = count - disk->partitions[index].blk_reserved;
+
+	if (want > limit || end > (limit - want)) {
+		if (part_disk_compact(disk))
+			return -1;
+
+		if (count <= disk->partitions[index].blk_reserved)
+			return 0;
+
+		end = part_disk_get_reserved_end(disk);
+		want = count - disk->partitions[index].blk_reserved;
+	}
+
+	start = disk->partitions[index].index;
+	reserved = disk->partitions[index].blk_reserved;
+
+	slack = reserved;
+	if (end < limit && slack > (limit - end - want))
+		slack = limit - end - want;
+	slack -= slack % PART_ALIGN;
+
+	tail = start + reserved;
+
+	if (end > tail) {
+		if (volume_memmove(disk->volume,
+				   (tail + want + slack) * SECTOR_SIZE,
+				   tail * SECTOR_SIZE,
+				   (end - tail) * SECTOR_SIZE)) {
+			return -1;
+		}
+
+		if (disk->volume->discard_blocks(disk->volume, tail,
+						 want + slack)) {
+			return -1;
+		}
+
+		for (i = 0; i < disk->part_used; ++i) {
+			if (disk->partitions[i].index > start)
+				disk->partitions[i].index += want + slack;
+		}
+	}
+
+	disk->partitions[index].blk_reserved += want + slack;
+	return 0;
+}
+
+static int move_partition(part_disk_t *disk, size_t index, uint64_t dst)
+{
+	uint64_t src = disk->partitions[index].index;
+	uint64_t used = disk->partitions[index].blk_used;
+
+	if (src == dst)
+		return 0;
+
+	if (used > 0) {
+		if (volume_memmove(disk->volume, dst * SECTOR_SIZE,
+				   src * SECTOR_SIZE, used * SECTOR_SIZE)) {
+			return -1;
+		}
+	}
+
+	disk->partitions[index].index = dst;
+	return 0;
+}
+
+uint64_t part_disk_get_usable_end(part_disk_t *disk)
+{
+	uint64_t end = disk->volume->get_max_block_count(disk->volume);
+
+	if (end > disk->max_sectors)
+		end = disk->max_sectors;
+
+	end = end > disk->tail_sectors ? (end - disk->tail_sectors) : 0;
+
+	return end - (end % PART_ALIGN);
+}
+
+uint64_t part_disk_get_free_space(part_disk_t *disk)
+{
+	uint64_t end = part_disk_get_usable_end(disk);
+	uint64_t used = PART_RESERVED;
+	size_t i;
+
+	for (i = 0; i < disk->part_used; ++i)
+		used += disk->partitions[i].blk_count;
+
+	return used < end ? (end - used) : 0;
+}
+
+bool part_disk_is_unbounded(part_disk_t *disk)
+{
+	return disk->volume->get_max_block_count(disk->volume) >=
+		disk->max_sectors;
+}
+
+uint64_t part_disk_get_reserved_end(part_disk_t *disk)
+{
+	uint64_t end = PART_RESERVED;
+	size_t i;
+
+	for (i = 0; i < disk->part_used; ++i) {
+		uint64_t current = disk->partitions[i].index;
+		current += disk->partitions[i].blk_reserved;
+
+		if (current > end)
+			end = current;
+	}
+
+	return end;
+}
+
+int part_disk_grow(part_disk_t *disk, size_t index, uint64_t diff)
+{
+	uint64_t start = disk->partitions[index].index;
+	uint64_t count = disk->partitions[index].blk_count;
+	size_t i;
+
+	for (i = 0; i < disk->part_used; ++i) {
+		if (disk->partitions[i].index > start) {
+			if (part_disk_shrink_to_fit(disk, i))
+				return -1;
+		}
+	}
+
+	if (diff % PART_ALIGN || diff == 0)
+		diff += PART_ALIGN - (diff % PART_ALIGN);
+
+	if (diff > part_disk_get_free_space(disk)) {
+		fprintf(stderr, "Not enough space on %s disk to grow "
+			"partition %zu.\n", disk->name, index);
+		return -1;
+	}
+
+	if (reserve_blocks(disk, index, count + diff))
+		return -1;
+
+	start = disk->partitions[index].index;
+
+	if (disk->volume->discard_blocks(disk->volume, start + count, diff))
+		return -1;
+
+	disk->partitions[index].blk_count += diff;
+	return 0;
+}
+
+int part_disk_shrink(part_disk_t *disk, size_t index, uint64_t diff)
+{
+	uint64_t start = disk->partitions[index].index;
+	uint64_t count = disk->partitions[index].blk_count;
+
+	if (diff % PART_ALIGN)
+		diff -= diff % PART_ALIGN;
+
+	if (diff > count)
+		diff = count;
+
+	if ((count - diff) < PART_ALIGN)
+		diff = (count - PART_ALIGN);
+
+	if ((count - diff) < disk->partitions[index].blk_count_min)
+		diff = count - disk->partitions[index].blk_count_min;
+
+	if (diff == 0)
+		return 0;
+
+	/* the space stays reserved, the gap is removed on commit */
+	if (disk->volume->discard_blocks(disk->volume,
+					 start + count - diff, diff)) {
+		return -1;
+	}
+
+	disk->partitions[index].blk_count -= diff;
+	return 0;
+}
+
+int part_disk_shrink_to_fit(part_disk_t *disk, size_t index)
+{
+	uint64_t diff;
+
+	if (disk->partitions[index].blk_used >=
+	    disk->partitions[index].blk_count) {
+		return 0;
+	}
+
+	diff = disk->partitions[index].blk_count -
+		disk->partitions[index].blk_used;
+
+	return part_disk_shrink(disk, index, diff);
+}
+
+int part_disk_apply_expand_policy(part_disk_t *disk, size_t index)
+{
+	uint64_t avail;
+
+	if (!(disk->partitions[index].flags & COMMON_PARTITION_FLAG_FILL))
+		return 0;
+
+	/* filling an unbounded disk makes no sense */
+	if (part_disk_is_unbounded(disk))
+		return 0;
+
+	/* only the size changes, part_disk_compact puts everything in place */
+	avail = part_disk_get_free_space(disk);
+
+	if (!disk->fill_to_free_space) {
+		disk->partitions[index].blk_count += avail;
+	} else if (disk->partitions[index].blk_count < avail) {
+		disk->partitions[index].blk_count = avail;
+	}
+	return 0;
+}
+
+int part_disk_compact(part_disk_t *disk)
+{
+	uint64_t dst[PART_MAX_PARTITIONS], index, end, old_end;
+	bool moved[PART_MAX_PARTITIONS];
+	size_t i;
+
+	old_end = part_disk_get_reserved_end(disk);
+	index = PART_RESERVED;
+
+	for (i = 0; i < disk->part_used; ++i) {
+		dst[i] = index;
+		moved[i] = (dst[i] != disk->partitions[i].index);
+		index += disk->partitions[i].blk_count;
+	}
+
+	/*
+	  The partitions are in order, so a partition that moves up only has
+	  to wait for the ones after it and a partition that moves down only
+	  for the ones before it.
+	 */
+	for (i = disk->part_used; i-- > 0; ) {
+		if (dst[i] > disk->partitions[i].index) {
+			if (move_partition(disk, i, dst[i]))
+				return -1;
+		}
+	}
+
+	for (i = 0; i < disk->part_used; ++i) {
+		if (dst[i] < disk->partitions[i].index) {
+			if (move_partition(disk, i, dst[i]))
+				return -1;
+		}
+	}
+
+	/*
+	  Clear out stale data that a moved partition may now overlap.
+	  Past the old end, nothing was ever written.
+	 */
+	for (i = 0; i < disk->part_used; ++i) {
+		uint64_t start = dst[i] + disk->partitions[i].blk_used;
+		uint64_t stop = dst[i] + disk->partitions[i].blk_count;
+
+		disk->partitions[i].blk_reserved =
+			disk->partitions[i].blk_count;
+
+		if (stop > old_end)
+			stop = old_end;
+
+		if (moved[i] && stop > start) {
+			if (disk->volume->discard_blocks(disk->volume, start,
+							 stop - start)) {
+				return -1;
+			}
+		}
+	}
+
+	end = part_disk_get_reserved_end(disk);
+
+	if (old_end > end) {
+		if (disk->volume->discard_blocks(disk->volume, end,
+						 old_end - end)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static partition_t *create_parition(part_disk_t *disk, uint64_t blk_count,
+				    uint64_t flags)
+{
+	uint64_t index, used, limit, slack, end;
+	part_t *part;
+	size_t i;
+
+	if (disk->part_used == disk->part_max) {
+		fprintf(stderr, "Cannot create more than %zu partitions "
+			"on %s disk.\n", disk->part_max, disk->name);
+		return NULL;
+	}
+
+	if (blk_count == 0)
+		blk_count = PART_ALIGN;
+
+	if (blk_count % PART_ALIGN)
+		blk_count += PART_ALIGN - (blk_count % PART_ALIGN);
+
+	used = PART_RESERVED;
+
+	for (i = 0; i < disk->part_used; ++i)
+		used += disk->partitions[i].blk_count;
+
+	end = part_disk_get_usable_end(disk);
+
+	if (used >= end || blk_count > (end - used)) {
+		fprintf(stderr, "Not enough space on %s disk for another "
+			"partition.\n", disk->name);
+		return NULL;
+	}
+
+	limit = disk->volume->get_max_block_count(disk->volume);
+	index = part_disk_get_reserved_end(disk);
+
+	if (blk_count > limit || index > (limit - blk_count)) {
+		if (part_disk_compact(disk))
+			return NULL;
+
+		index = part_disk_get_reserved_end(disk);
+	}
+
+	/*
+	  Leave a gap after a growable partition, so it can grow without
+	  having to move the next one, but only take up half the space
+	  that is left to leave room for the partitions that come after.
+	 */
+	slack = 0;
+
+	if ((flags & COMMON_PARTITION_FLAG_GROW) &&
+	    blk_count <= limit && index <= (limit - blk_count)) {
+		slack = (limit - index - blk_count) / 2;
+
+		if (slack > PART_GROW_SLACK)
+			slack = PART_GROW_SLACK;
+
+		slack -= slack % PART_ALIGN;
+	}
+
+	disk->partitions[disk->part_used].index = index;
+	disk->partitions[disk->part_used].blk_count = blk_count;
+	disk->partitions[disk->part_used].blk_count_min = blk_count;
+	disk->partitions[disk->part_used].blk_used = 0;
+	disk->partitions[disk->part_used].blk_reserved = blk_count + slack;
+	disk->partitions[disk->part_used].flags = flags;
+
+	if (disk->volume->discard_blocks(disk->volume, index, blk_count))
+		return NULL;
+
+	part = part_create(disk, disk->part_used);
+	if (part == NULL)
+		return NULL;
+
+	if (flags & COMMON_PARTITION_FLAG_FILL) {
+		for (i = 0; i < disk->part_used; ++i) {
+			disk->partitions[i].flags &=
+				~COMMON_PARTITION_FLAG_FILL;
+		}
+	}
+
+	disk->part_used += 1;
+	return (partition_t *)part;
+}
+
+static int commit(part_disk_t *disk)
+{
+	size_t i;
+
+	for (i = 0; i < disk->part_used; ++i) {
+		if (part_disk_shrink_to_fit(disk, i))
+			return -1;
+	}
+
+	for (i = 0; i < disk->part_used; ++i) {
+		if (part_disk_apply_expand_policy(disk, i))
+			return -1;
+	}
+
+	if (part_disk_compact(disk))
+		return -1;
+
+	return disk->write_table(disk);
+}
+
+static partition_t *locked_create_parition(partition_mgr_t *mgr,
+					   uint64_t blk_count,
+					   uint64_t flags)
+{
+	part_disk_t *disk = (part_disk_t *)mgr;
+	partition_t *part;
+
+	pthread_rwlock_wrlock(&disk->lock);
+	part = create_parition(disk, blk_count, flags);
+	pthread_rwlock_unlock(&disk->lock);
+	return part;
+}
+
+static int locked_commit(partition_mgr_t *mgr)
+{
+	part_disk_t *disk = (part_disk_t *)mgr;
+	int ret;
+
+	pthread_rwlock_wrlock(&disk->lock);
+	ret = commit(disk);
+	pthread_rwlock_unlock(&disk->lock);
+	return ret;
+}
+
+static void destroy(object_t *obj)
+{
+	part_disk_t *disk = (part_disk_t *)obj;
+
+	pthread_rwlock_destroy(&disk->lock);
+	object_drop(disk->volume);
+	free(disk);
+}
+
+int part_disk_init(part_disk_t *disk, volume_t *base)
+{
+	volume_t *vol;
+
+	if (pthread_rwlock_init(&disk->lock, NULL) != 0) {
+		fprintf(stderr, "Error initializing %s disk lock.\n",
+			disk->name);
+		return -1;
+	}
+
+	if (base->blocksize == SECTOR_SIZE) {
+		vol = object_grab(base);
+	} else {
+		vol = volume_blocksize_adapter_create(base, SECTOR_SIZE, 0);
+		if (vol == NULL) {
+			fprintf(stderr, "Error creating blocksize adapter "
+				"for %s disk.\n", disk->name);
+			goto fail_lock;
+		}
+	}
+
+	/* the partitions access it concurrently while sharing the lock */
+	disk->volume = volume_locked_create(vol);
+	object_drop(vol);
+
+	if (disk->volume == NULL)
+		goto fail_lock;
+
+	((partition_mgr_t *)disk)->commit = locked_commit;
+	((partition_mgr_t *)disk)->create_parition = locked_create_parition;
+	((object_t *)disk)->refcount = 1;
+	((object_t *)disk)->destroy = destroy;
+	return 0;
+fail_lock:
+	pthread_rwlock_destroy(&disk->lock);
+	return -1;
+}
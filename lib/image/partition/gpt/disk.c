@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * disk.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gpt.h"
+#include "sha256.h"
+
+static int hex_value(char c)
+{
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return c - '0';
+}
+
+/*
+  Convert a GUID from the usual text representation to the on-disk
+  representation, where the first three groups are little endian.
+ */
+static void guid_from_string(const char *str, uint8_t guid[16])
+{
+	static const uint8_t order[16] = {
+		3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15,
+	};
+	uint8_t raw[16];
+	size_t i = 0;
+
+	while (*str != '\0' && i < sizeof(raw)) {
+		if (*str == '-') {
+			++str;
+			continue;
+		}
+
+		raw[i++] = (hex_value(str[0]) << 4) | hex_value(str[1]);
+		str += 2;
+	}
+
+	for (i = 0; i < sizeof(raw); ++i)
+		guid[i] = raw[order[i]];
+}
+
+/*
+  To get reproducible images, GUIDs are not random, but derived from a hash
+  of the data they are supposed to identify. The version and variant bits
+  are set like for a random GUID.
+ */
+static void generate_guid(const void *data, size_t size, uint8_t guid[16])
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	sha256_t ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, size);
+	sha256_final(&ctx, digest);
+
+	memcpy(guid, digest, 16);
+	guid[7] = (guid[7] & 0x0F) | 0x40;
+	guid[8] = (guid[8] & 0x3F) | 0x80;
+}
+
+static void fill_entry(gpt_disk_t *gpt, size_t i, gpt_entry_t *ent)
+{
+	part_disk_t *disk = (part_disk_t *)gpt;
+	uint64_t flags = disk->partitions[i].flags;
+	size_t j, type;
+
+	type = (flags & GPT_PART_TYPE_MASK) >> GPT_PART_TYPE_SHIFT;
+	if (type >= gpt_part_type_count)
+		type = 0;
+
+	guid_from_string(gpt_part_types[type].guid, ent->type_guid);
+
+	ent->first_lba = htole64(disk->partitions[i].index);
+	ent->last_lba = htole64(disk->partitions[i].index +
+				disk->partitions[i].blk_count - 1);
+
+	if (flags & GPT_PARTITION_FLAG_LEGACY_BOOTABLE)
+		ent->attributes = htole64(0x04);
+
+	for (j = 0; gpt->names[i][j] != '\0'; ++j)
+		ent->name[j] = htole16((uint8_t)gpt->names[i][j]);
+
+	generate_guid(ent, sizeof(*ent), ent->part_guid);
+}
+
+static void write_protective_mbr(uint64_t disk_size, uint8_t *sector)
+{
+	gpt_protective_mbr_t mbr;
+
+	memset(&mbr, 0, sizeof(mbr));
+
+	mbr.partitions[0].first_sector_chs[1] = 0x02;
+	mbr.partitions[0].type = 0xEE;
+	memset(mbr.partitions[0].last_sector_chs, 0xFF, 3);
+	mbr.partitions[0].first_sector_lba = htole32(1);
+
+	if ((disk_size - 1) > 0xFFFFFFFF) {
+		mbr.partitions[0].num_sectors = htole32(0xFFFFFFFF);
+	} else {
+		mbr.partitions[0].num_sectors = htole32(disk_size - 1);
+	}
+
+	mbr.boot_magic = htole16(IBM_BOOT_MAGIC);
+
+	memset(sector, 0, SECTOR_SIZE);
+	memcpy(sector, &mbr, sizeof(mbr));
+}
+
+static void write_header(const gpt_header_t *header, uint8_t *sector)
+{
+	gpt_header_t temp = *header;
+
+	temp.header_crc32 = 0;
+	temp.header_crc32 = htole32(crc32_ieee(0, &temp, sizeof(temp)));
+
+	memset(sector, 0, SECTOR_SIZE);
+	memcpy(sector, &temp, sizeof(temp));
+}
+
+static uint64_t get_disk_size(part_disk_t *disk)
+{
+	uint64_t max = disk->volume->get_max_block_count(disk->volume);
+	uint64_t size, end = PART_RESERVED;
+	bool fill = false;
+	size_t i;
+
+	for (i = 0; i < disk->part_used; ++i) {
+		uint64_t current = disk->partitions[i].index;
+		current += disk->partitions[i].blk_count;
+
+		if (current > end)
+			end = current;
+
+		if (disk->partitions[i].flags & COMMON_PARTITION_FLAG_FILL)
+			fill = true;
+	}
+
+	size = end + GPT_BACKUP_SECTORS;
+
+	if (fill && max < GPT_MAX_SECTORS)
+		size = max;
+
+	if (size < (end + GPT_BACKUP_SECTORS) || size > max) {
+		fputs("GPT disk is too small to hold all partitions.\n",
+		      stderr);
+		return 0;
+	}
+
+	return size;
+}
+
+static int gpt_disk_write_table(part_disk_t *disk)
+{
+	uint8_t sector[SECTOR_SIZE];
+	gpt_header_t header;
+	gpt_entry_t *entries;
+	uint64_t disk_size;
+	size_t i, size;
+	int ret = -1;
+
+	disk_size = get_disk_size(disk);
+	if (disk_size == 0)
+		return -1;
+
+	/* partition entry array */
+	size = GPT_MAX_PARTITIONS * sizeof(entries[0]);
+
+	entries = calloc(1, size);
+	if (entries == NULL) {
+		perror("creating GPT partition entry array");
+		return -1;
+	}
+
+	for (i = 0; i < disk->part_used; ++i)
+		fill_entry((gpt_disk_t *)disk, i, entries + i);
+
+	/* primary header */
+	memset(&header, 0, sizeof(header));
+	memcpy(header.signature, GPT_SIGNATURE, sizeof(header.signature));
+	header.revision = htole32(GPT_REVISION);
+	header.header_size = htole32(GPT_HEADER_SIZE);
+	header.current_lba = htole64(1);
+	header.backup_lba = htole64(disk_size - 1);
+	header.first_usable_lba = htole64(GPT_FIRST_USABLE);
+	header.last_usable_lba = htole64(disk_size - GPT_BACKUP_SECTORS - 1);
+	generate_guid(entries, size, header.disk_guid);
+	header.entries_lba = htole64(2);
+	header.entry_count = htole32(GPT_MAX_PARTITIONS);
+	header.entry_size = htole32(GPT_ENTRY_SIZE);
+	header.entries_crc32 = htole32(crc32_ieee(0, entries, size));
+
+	write_protective_mbr(disk_size, sector);
+	if (disk->volume->write_block(disk->volume, 0, sector))
+		goto out;
+
+	write_header(&header, sector);
+	if (disk->volume->write_block(disk->volume, 1, sector))
+		goto out;
+
+	if (volume_write(disk->volume, 2 * SECTOR_SIZE, entries, size))
+		goto out;
+
+	/* backup entry array and header at the end of the disk */
+	header.current_lba = htole64(disk_size - 1);
+	header.backup_lba = htole64(1);
+	header.entries_lba = htole64(disk_size - GPT_BACKUP_SECTORS);
+
+	if (volume_write(disk->volume,
+			 (disk_size - GPT_BACKUP_SECTORS) * SECTOR_SIZE,
+			 entries, size)) {
+		goto out;
+	}
+
+	write_header(&header, sector);
+	if (disk->volume->write_block(disk->volume, disk_size - 1, sector))
+		goto out;
+
+	ret = disk->volume->commit(disk->volume);
+out:
+	free(entries);
+	return ret;
+}
+
+partition_mgr_t *gptdisk_create(volume_t *base)
+{
+	gpt_disk_t *gpt = calloc(1, sizeof(*gpt));
+	part_disk_t *disk = (part_disk_t *)gpt;
+
+	if (gpt == NULL) {
+		perror("creating GPT disk");
+		return NULL;
+	}
+
+	disk->name = "GPT";
+	disk->part_meta = &gpt_part_meta;
+	disk->part_max = GPT_MAX_PARTITIONS;
+	disk->max_sectors = GPT_MAX_SECTORS;
+	disk->tail_sectors = GPT_BACKUP_SECTORS;
+	disk->write_table = gpt_disk_write_table;
+
+	if (part_disk_init(disk, base)) {
+		free(gpt);
+		return NULL;
+	}
+
+	if (part_disk_get_usable_end(disk) <= PART_RESERVED) {
+		fputs("Volume is too small for a GPT disk.\n", stderr);
+		object_drop(gpt);
+		return NULL;
+	}
+
+	return (partition_mgr_t *)gpt;
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * gpt.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef GPT_H
+#define GPT_H
+
+#include "../partition.h"
+#include "util.h"
+
+#define IBM_BOOT_MAGIC (0xAA55)
+
+#define GPT_SIGNATURE "EFI PART"
+#define GPT_REVISION (0x00010000)
+#define GPT_HEADER_SIZE (92)
+
+#define GPT_MAX_PARTITIONS (128)
+#define GPT_ENTRY_SIZE (128)
+#define GPT_NAME_LENGTH (36)
+
+/* number of sectors occupied by the partition entry array */
+#define GPT_ENTRY_SECTORS (GPT_MAX_PARTITIONS * GPT_ENTRY_SIZE / SECTOR_SIZE)
+
+/* protective MBR, primary header and entry array at the start of the disk */
+#define GPT_FIRST_USABLE (2 + GPT_ENTRY_SECTORS)
+
+/* backup entry array and backup header at the end of the disk */
+#define GPT_BACKUP_SECTORS (GPT_ENTRY_SECTORS + 1)
+
+/* upper bound for the disk size in sectors */
+#define GPT_MAX_SECTORS (0x0000FFFFFFFFFFFFUL)
+
+#define GPT_PART_TYPE_MASK (0x0FF00000)
+#define GPT_PART_TYPE_SHIFT (20)
+
+typedef struct {
+	part_disk_t base;
+
+	char names[GPT_MAX_PARTITIONS][GPT_NAME_LENGTH + 1];
+} gpt_disk_t;
+
+typedef struct {
+	uint8_t signature[8];
+	uint32_t revision;
+	uint32_t header_size;
+	uint32_t header_crc32;
+	uint32_t reserved;
+	uint64_t current_lba;
+	uint64_t backup_lba;
+	uint64_t first_usable_lba;
+	uint64_t last_usable_lba;
+	uint8_t disk_guid[16];
+	uint64_t entries_lba;
+	uint32_t entry_count;
+	uint32_t entry_size;
+	uint32_t entries_crc32;
+} __attribute__((packed)) gpt_header_t;
+
+typedef struct {
+	uint8_t type_guid[16];
+	uint8_t part_guid[16];
+	uint64_t first_lba;
+	uint64_t last_lba;
+	uint64_t attributes;
+	uint16_t name[GPT_NAME_LENGTH];
+} gpt_entry_t;
+
+typedef struct {
+	uint8_t boot_code[446];
+
+	struct {
+		uint8_t flags;
+		uint8_t first_sector_chs[3];
+		uint8_t type;
+		uint8_t last_sector_chs[3];
+		uint32_t first_sector_lba;
+		uint32_t num_sectors;
+	} partitions[4];
+
+	uint16_t boot_magic;
+} __attribute__((packed)) gpt_protective_mbr_t;
+
+typedef struct {
+	const char *name;
+	const char *guid;
+} gpt_part_type_t;
+
+extern const meta_object_t gpt_part_meta;
+
+extern const gpt_part_type_t gpt_part_types[];
+
+extern const size_t gpt_part_type_count;
+
+#endif /* GPT_H */
@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gpt.h"
+
+enum {
+	GPT_TYPE = 0,
+	GPT_BOOTABLE,
+	GPT_NAME,
+};
+
+/* indexed by the type field in the partition flags */
+const gpt_part_type_t gpt_part_types[] = {
+	{ "Linux", "0FC63DAF-8483-4772-8E79-3D69D8477DE4" },
+	{ "LinuxSwap", "0657FD6D-A4AB-43C4-84E5-0933C84B4F4F" },
+	{ "LinuxHome", "933AC7E1-2EB4-4F13-B844-0E14E2AEF915" },
+	{ "LinuxLVM", "E6D6D379-F507-44C2-A23C-238F2A3DF928" },
+	{ "LinuxRAID", "A19D880F-05FC-4D3B-A006-743F0F84911E" },
+	{ "EFI", "C12A7328-F81F-11D2-BA4B-00A0C93EC93B" },
+	{ "BIOSBoot", "21686148-6449-6E6F-744E-656564454649" },
+	{ "MicrosoftBasic", "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7" },
+};
+
+const size_t gpt_part_type_count =
+	sizeof(gpt_part_types) / sizeof(gpt_part_types[0]);
+
+static const property_enum_t gpt_types[] = {
+	{ .name = "Linux", .value = 0, },
+	{ .name = "LinuxSwap", .value = 1, },
+	{ .name = "LinuxHome", .value = 2, },
+	{ .name = "LinuxLVM", .value = 3, },
+	{ .name = "LinuxRAID", .value = 4, },
+	{ .name = "EFI", .value = 5, },
+	{ .name = "BIOSBoot", .value = 6, },
+	{ .name = "MicrosoftBasic", .value = 7, },
+};
+
+static const property_desc_t gpt_part_prop[] = {
+	[GPT_TYPE] = {
+		.type = PROPERTY_TYPE_ENUM,
+		.name = "type",
+		.enum_ent = gpt_types,
+		.enum_count = sizeof(gpt_types) / sizeof(gpt_types[0]),
+	},
+	[GPT_BOOTABLE] = {
+		.type = PROPERTY_TYPE_BOOL,
+		.name = "bootable",
+	},
+	[GPT_NAME] = {
+		.type = PROPERTY_TYPE_STRING,
+		.name = "name",
+	},
+};
+
+static int set_name(part_t *part, const char *name)
+{
+	size_t i, len = strlen(name);
+
+	if (len > GPT_NAME_LENGTH) {
+		fprintf(stderr, "GPT partition name '%s' is too long, "
+			"at most %d characters are allowed.\n",
+			name, GPT_NAME_LENGTH);
+		return -1;
+	}
+
+	for (i = 0; i < len; ++i) {
+		if (name[i] < 0x20 || name[i] > 0x7E) {
+			fprintf(stderr, "GPT partition name '%s' must only "
+				"contain printable ASCII characters.\n", name);
+			return -1;
+		}
+	}
+
+	pthread_rwlock_wrlock(&part->parent->lock);
+	memcpy(((gpt_disk_t *)part->parent)->names[part->index], name,
+	       len + 1);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return 0;
+}
+
+static size_t gpt_part_get_property_count(const meta_object_t *meta)
+{
+	(void)meta;
+	return sizeof(gpt_part_prop) / sizeof(gpt_part_prop[0]);
+}
+
+static int gpt_part_get_property_desc(const meta_object_t *meta, size_t i,
+				      property_desc_t *desc)
+{
+	(void)meta;
+
+	if (i >= (sizeof(gpt_part_prop) / sizeof(gpt_part_prop[0])))
+		return -1;
+
+	*desc = gpt_part_prop[i];
+	return 0;
+}
+
+static int gpt_part_set_property(const meta_object_t *meta, size_t i,
+				 object_t *obj, const property_value_t *value)
+{
+	partition_t *part = (partition_t *)obj;
+	uint64_t flags = part->get_flags(part);
+	(void)meta;
+
+	switch (i) {
+	case GPT_TYPE:
+		if (value->type != PROPERTY_TYPE_ENUM)
+			return -1;
+		if (value->value.ival < 0 ||
+		    (size_t)value->value.ival >= gpt_part_type_count)
+			return -1;
+
+		flags &= ~GPT_PART_TYPE_MASK;
+		flags |= (uint64_t)value->value.ival << GPT_PART_TYPE_SHIFT;
+
+		return part->set_flags(part, flags);
+	case GPT_BOOTABLE:
+		if (value->value.boolean) {
+			flags |= GPT_PARTITION_FLAG_LEGACY_BOOTABLE;
+		} else {
+			flags &= ~GPT_PARTITION_FLAG_LEGACY_BOOTABLE;
+		}
+		return part->set_flags(part, flags);
+	case GPT_NAME:
+		if (value->type != PROPERTY_TYPE_STRING)
+			return -1;
+		return set_name((part_t *)obj, value->value.string);
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int gpt_part_get_property(const meta_object_t *meta, size_t i,
+				 const object_t *obj,
+				 property_value_t *value)
+{
+	partition_t *part = (partition_t *)obj;
+	uint64_t flags = part->get_flags(part);
+	const part_t *gpt = (const part_t *)obj;
+	(void)meta;
+
+	switch (i) {
+	case GPT_TYPE:
+		value->type = PROPERTY_TYPE_ENUM;
+		value->value.ival = (flags & GPT_PART_TYPE_MASK) >>
+			GPT_PART_TYPE_SHIFT;
+		break;
+	case GPT_BOOTABLE:
+		value->type = PROPERTY_TYPE_BOOL;
+		value->value.boolean =
+			!!(flags & GPT_PARTITION_FLAG_LEGACY_BOOTABLE);
+		break;
+	case GPT_NAME:
+		value->type = PROPERTY_TYPE_STRING;
+		value->value.string =
+			((gpt_disk_t *)gpt->parent)->names[gpt->index];
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+const meta_object_t gpt_part_meta = {
+	.name = "gpt_part_t",
+	.parent = &partition_meta,
+
+	.get_property_count = gpt_part_get_property_count,
+	.get_property_desc = gpt_part_get_property_desc,
+	.set_property = gpt_part_set_property,
+	.get_property = gpt_part_get_property,
+};
@@ -29,91 +29,18 @@ static void lba_to_chs(uint32_t lba, uint8_t *chs)
 	chs[2] = c & 0xFF;
 }
 
-static partition_t *mbr_disk_create_parition(partition_mgr_t *parent,
-					     uint64_t blk_count,
-					     uint64_t flags)
+static int mbr_disk_write_table(part_disk_t *disk)
 {
-	mbr_disk_t *disk = (mbr_disk_t *)parent;
-	uint32_t min_count, max_count;
-	mbr_part_t *part;
-	uint64_t index;
-	size_t i;
-	int ret;
-
-	if (disk->part_used == MAX_MBR_PARTITIONS) {
-		fprintf(stderr, "Cannot create more than %d "
-			"partitions on an MBR disk.\n", MAX_MBR_PARTITIONS);
-		return NULL;
-	}
-
-	if (blk_count == 0)
-		blk_count = MBR_PART_ALIGN;
-
-	if (blk_count % MBR_PART_ALIGN)
-		blk_count += MBR_PART_ALIGN - (blk_count % MBR_PART_ALIGN);
-
-	index = MBR_RESERVED;
-
-	for (i = 0; i < disk->part_used; ++i) {
-		uint64_t next_free = disk->partitions[i].index;
-		next_free += disk->partitions[i].blk_count;
-
-		if (next_free > index)
-			index = next_free;
-	}
-
-	disk->partitions[disk->part_used].index = index;
-	disk->partitions[disk->part_used].blk_count = blk_count;
-	disk->partitions[disk->part_used].blk_count_min = blk_count;
-	disk->partitions[disk->part_used].flags = flags;
-
-	if (blk_count > 0) {
-		while (blk_count--) {
-			ret = disk->volume->write_block(disk->volume,
-							index++, NULL);
-			if (ret)
-				return NULL;
-		}
-	}
-
-	min_count = disk->partitions[disk->part_used].blk_count;
-
-	if (flags & COMMON_PARTITION_FLAG_GROW) {
-		max_count = disk->volume->get_max_block_count(disk->volume);
-		max_count -= index;
-	} else {
-		max_count = min_count;
-	}
-
-	part = mbr_part_create(disk, disk->part_used);
-	if (part == NULL)
-		return NULL;
-
-	if (flags & COMMON_PARTITION_FLAG_FILL) {
-		for (i = 0; i < disk->part_used; ++i) {
-			disk->partitions[i].flags &=
-				~COMMON_PARTITION_FLAG_FILL;
-		}
-	}
-
-	disk->part_used += 1;
-	return (partition_t *)part;
-}
-
-static int mbr_disk_commit(partition_mgr_t *mgr)
-{
-	mbr_disk_t *disk = (mbr_disk_t *)mgr;
 	mbr_header_t header;
 	uint32_t lba, count;
+	uint64_t end;
 	size_t i;
 
-	for (i = 0; i < disk->part_used; ++i) {
-		if (mbr_shrink_to_fit(disk, i))
-			return -1;
-	}
+	/* the disk must cover all partitions, even if their tail is sparse */
+	end = part_disk_get_reserved_end(disk);
 
-	for (i = 0; i < disk->part_used; ++i) {
-		if (mbr_apply_expand_policy(disk, i))
+	if (disk->volume->get_block_count(disk->volume) < end) {
+		if (disk->volume->truncate(disk->volume, end * SECTOR_SIZE))
 			return -1;
 	}
 
@@ -149,39 +76,27 @@ static int mbr_disk_commit(partition_mgr_t *mgr)
 	return disk->volume->commit(disk->volume);
 }
 
-static void mbr_disk_destroy(object_t *obj)
-{
-	object_drop(((mbr_disk_t *)obj)->volume);
-	free(obj);
-}
-
 partition_mgr_t *mbrdisk_create(volume_t *base)
 {
-	mbr_disk_t *disk = calloc(1, sizeof(*disk));
-	partition_mgr_t *mgr = (partition_mgr_t *)disk;
-	object_t *obj = (object_t *)disk;
+	part_disk_t *disk = calloc(1, sizeof(*disk));
 
 	if (disk == NULL) {
 		perror("creating MBR disk");
 		return NULL;
 	}
 
-	if (base->blocksize == SECTOR_SIZE) {
-		disk->volume = object_grab(base);
-	} else {
-		disk->volume = volume_blocksize_adapter_create(base,
-							       SECTOR_SIZE, 0);
-		if (disk->volume == NULL) {
-			fputs("Error creating blocksize adapter "
-			      "for MBR disk.\n",stderr);
-			object_drop(disk);
-			return NULL;
-		}
+	disk->name = "MBR";
+	disk->part_meta = &mbr_part_meta;
+	disk->part_max = MAX_MBR_PARTITIONS;
+	disk->max_sectors = MAX_LBA;
+	disk->tail_sectors = 0;
+	disk->fill_to_free_space = true;
+	disk->write_table = mbr_disk_write_table;
+
+	if (part_disk_init(disk, base)) {
+		free(disk);
+		return NULL;
 	}
 
-	mgr->commit = mbr_disk_commit;
-	mgr->create_parition = mbr_disk_create_parition;
-	obj->destroy = mbr_disk_destroy;
-	obj->refcount = 1;
-	return mgr;
+	return (partition_mgr_t *)disk;
 }
@@ -7,17 +7,10 @@
 #ifndef MBR_H
 #define MBR_H
 
-#include "volume.h"
+#include "../partition.h"
 
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-
-#define SECTOR_SIZE (512)
 #define MAX_MBR_PARTITIONS (4)
 #define IBM_BOOT_MAGIC (0xAA55)
-#define MBR_PART_ALIGN (1024 * 1024 / SECTOR_SIZE)
-#define MBR_RESERVED MBR_PART_ALIGN
 
 /* (63 sectors) * (254 heads) * (1023 cylinders) */
 #define MAX_CHS (63 * 254 * 1023)
@@ -25,29 +18,6 @@
 /* maximum sector index for 28-bit LBA */
 #define MAX_LBA (0x0FFFFFFF)
 
-typedef struct {
-	partition_mgr_t base;
-
-	volume_t *volume;
-
-	size_t part_used;
-
-	struct {
-		uint64_t index;
-		uint64_t blk_count_min;
-		uint64_t blk_count;
-		uint64_t blk_used;
-		uint64_t flags;
-	} partitions[MAX_MBR_PARTITIONS];
-} mbr_disk_t;
-
-typedef struct {
-	partition_t base;
-
-	mbr_disk_t *parent;
-	size_t index;
-} mbr_part_t;
-
 typedef struct {
 	uint8_t boot_code[446];
 
@@ -65,18 +35,4 @@ typedef struct {
 
 extern const meta_object_t mbr_part_meta;
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-mbr_part_t *mbr_part_create(mbr_disk_t *parent, size_t index);
-
-int mbr_shrink_to_fit(mbr_disk_t *disk, size_t index);
-
-int mbr_apply_expand_policy(mbr_disk_t *disk, size_t index);
-
-#ifdef __cplusplus
-}
-#endif
-
 #endif /* MBR_H */
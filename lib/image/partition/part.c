@@ -0,0 +1,439 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * part.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "partition.h"
+
+/*
+  Everything that does not change the layout only takes the disk lock
+  shared, so the partitions can be written to in parallel. Raising the used
+  block count then has to be atomic. Growing a partition can move the others
+  around and is done with the lock held exclusively.
+ */
+static void mark_used(part_disk_t *disk, size_t index, uint64_t count)
+{
+	uint64_t *used = &disk->partitions[index].blk_used;
+	uint64_t old = __atomic_load_n(used, __ATOMIC_RELAXED);
+
+	while (old < count) {
+		if (__atomic_compare_exchange_n(used, &old, count, true,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+}
+
+static uint64_t get_used(part_disk_t *disk, size_t index)
+{
+	return __atomic_load_n(&disk->partitions[index].blk_used,
+			       __ATOMIC_RELAXED);
+}
+
+/*
+  Take the disk lock for accessing the given block index, exclusively if
+  the partition has to grow for it.
+ */
+static void lock_for_index(part_t *part, uint64_t index)
+{
+	part_disk_t *disk = part->parent;
+
+	pthread_rwlock_rdlock(&disk->lock);
+
+	if (index >= disk->partitions[part->index].blk_count) {
+		pthread_rwlock_unlock(&disk->lock);
+		pthread_rwlock_wrlock(&disk->lock);
+	}
+}
+
+/*
+  Make sure the partition has at least the given number of blocks. Must be
+  called with the disk lock held exclusively if it is not large enough.
+ */
+static int ensure_size(part_t *part, uint64_t count, const char *what)
+{
+	part_disk_t *disk = part->parent;
+	uint64_t current = disk->partitions[part->index].blk_count;
+
+	if (count <= current)
+		return 0;
+
+	if (!(disk->partitions[part->index].flags &
+	      COMMON_PARTITION_FLAG_GROW)) {
+		fprintf(stderr, "Out-of-bounds %s on %s partition %zu.\n",
+			what, disk->name, part->index);
+		return -1;
+	}
+
+	return part_disk_grow(disk, part->index, count - current);
+}
+
+static int discard_blocks(part_t *part, uint64_t index, uint64_t count)
+{
+	uint64_t blk_start = part->parent->partitions[part->index].index;
+	uint64_t blk_used = get_used(part->parent, part->index);
+	volume_t *volume = part->parent->volume;
+
+	if (index >= blk_used)
+		return 0;
+
+	if (count > (blk_used - index))
+		count = blk_used - index;
+
+	if (count == 0)
+		return 0;
+
+	/*
+	  The blocks still count as used. The filesystem on top may rely
+	  on the partition covering them, only a truncate shrinks it.
+	 */
+	return volume->discard_blocks(volume, blk_start + index, count);
+}
+
+static int move_block_partial(part_t *part, uint64_t src, uint64_t dst,
+			      size_t src_offset, size_t dst_offset,
+			      size_t size)
+{
+	uint64_t blk_count = part->parent->partitions[part->index].blk_count;
+	uint64_t blk_used = get_used(part->parent, part->index);
+	uint64_t flags = part->parent->partitions[part->index].flags;
+	volume_t *volume = part->parent->volume;
+	uint64_t blk_start;
+
+	if (src >= blk_count || dst >= blk_count) {
+		if (!(flags & COMMON_PARTITION_FLAG_GROW)) {
+			fprintf(stderr, "Out-of-bounds block move on "
+				"%s partition %zu.\n", part->parent->name,
+				part->index);
+			return -1;
+		}
+	}
+
+	if (src >= blk_used && dst >= blk_used)
+		return 0;
+
+	if (src >= blk_used)
+		return discard_blocks(part, dst, 1);
+
+	if (ensure_size(part, dst + 1, "block move"))
+		return -1;
+
+	mark_used(part->parent, part->index, dst + 1);
+
+	blk_start = part->parent->partitions[part->index].index;
+
+	if (src_offset == 0 && dst_offset == 0 &&
+	    size == ((volume_t *)part)->blocksize) {
+		return volume->move_block(volume, blk_start + src,
+					  blk_start + dst);
+	}
+
+	return volume->move_block_partial(volume, blk_start + src,
+					  blk_start + dst, src_offset,
+					  dst_offset, size);
+}
+
+static uint64_t get_max_count(part_t *part)
+{
+	uint64_t count;
+
+	count = part->parent->partitions[part->index].blk_count;
+
+	if (part->parent->partitions[part->index].flags &
+	    COMMON_PARTITION_FLAG_GROW) {
+		count += part_disk_get_free_space(part->parent);
+	}
+
+	return count;
+}
+
+static int set_base_block_count(part_t *part, uint64_t size)
+{
+	part_disk_t *disk = part->parent;
+	uint64_t count = disk->partitions[part->index].blk_count;
+	uint64_t used = disk->partitions[part->index].blk_used;
+
+	disk->partitions[part->index].blk_count_min = size;
+
+	if (size > count)
+		return part_disk_grow(disk, part->index, size - count);
+
+	if (size < count && size >= used)
+		return part_disk_shrink(disk, part->index, count - size);
+
+	return 0;
+}
+
+static int truncate_partition(part_t *part, uint64_t size)
+{
+	uint64_t current = part->parent->partitions[part->index].blk_count;
+	uint64_t count = size / ((volume_t *)part)->blocksize;
+	int ret;
+
+	if (size % ((volume_t *)part)->blocksize)
+		count += 1;
+
+	if (count % PART_ALIGN)
+		count += PART_ALIGN - count % PART_ALIGN;
+
+	if (count <= part->parent->partitions[part->index].blk_count_min)
+		return 0;
+
+	if (count == current)
+		return 0;
+
+	if (count < current) {
+		ret = part_disk_shrink(part->parent, part->index,
+				       current - count);
+	} else {
+		ret = part_disk_grow(part->parent, part->index,
+				     count - current);
+	}
+
+	if (ret)
+		return -1;
+
+	part->parent->partitions[part->index].blk_used = count;
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int part_read_partial_block(volume_t *vol, uint64_t index,
+				   void *buffer, uint32_t offset,
+				   uint32_t size)
+{
+	part_t *part = (part_t *)vol;
+	part_disk_t *disk = part->parent;
+	uint64_t start, count, flags;
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&disk->lock);
+	start = disk->partitions[part->index].index;
+	count = disk->partitions[part->index].blk_count;
+	flags = disk->partitions[part->index].flags;
+
+	if (index < count) {
+		ret = disk->volume->read_partial_block(disk->volume,
+						       start + index, buffer,
+						       offset, size);
+	} else if (flags & COMMON_PARTITION_FLAG_GROW) {
+		memset(buffer, 0, size);
+	} else {
+		fprintf(stderr, "Out-of-bounds read on %s partition %zu.\n",
+			disk->name, part->index);
+		ret = -1;
+	}
+
+	pthread_rwlock_unlock(&disk->lock);
+	return ret;
+}
+
+static int part_write_partial_block(volume_t *vol, uint64_t index,
+				    const void *buffer, uint32_t offset,
+				    uint32_t size)
+{
+	part_t *part = (part_t *)vol;
+	part_disk_t *disk = part->parent;
+	int ret = -1;
+
+	lock_for_index(part, index);
+
+	if (ensure_size(part, index + 1, "write"))
+		goto out;
+
+	mark_used(disk, part->index, index + 1);
+
+	ret = disk->volume->write_partial_block(disk->volume,
+					disk->partitions[part->index].index +
+					index, buffer, offset, size);
+out:
+	pthread_rwlock_unlock(&disk->lock);
+	return ret;
+}
+
+static int part_discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	part_t *part = (part_t *)vol;
+	int ret;
+
+	pthread_rwlock_rdlock(&part->parent->lock);
+	ret = discard_blocks(part, index, count);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static int part_move_block_partial(volume_t *vol, uint64_t src, uint64_t dst,
+				   size_t src_offset, size_t dst_offset,
+				   size_t size)
+{
+	part_t *part = (part_t *)vol;
+	int ret;
+
+	lock_for_index(part, dst);
+	ret = move_block_partial(part, src, dst, src_offset, dst_offset, size);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static int part_read_block(volume_t *vol, uint64_t index, void *buffer)
+{
+	return part_read_partial_block(vol, index, buffer, 0, vol->blocksize);
+}
+
+static int part_write_block(volume_t *vol, uint64_t index, const void *buffer)
+{
+	if (buffer == NULL)
+		return part_discard_blocks(vol, index, 1);
+
+	return part_write_partial_block(vol, index, buffer, 0, vol->blocksize);
+}
+
+static int part_move_block(volume_t *vol, uint64_t src, uint64_t dst)
+{
+	return part_move_block_partial(vol, src, dst, 0, 0, vol->blocksize);
+}
+
+static int part_commit(volume_t *vol)
+{
+	(void)vol;
+	return 0;
+}
+
+static uint64_t part_get_min_count(volume_t *vol)
+{
+	part_t *part = (part_t *)vol;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&part->parent->lock);
+	ret = part->parent->partitions[part->index].blk_count_min;
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static uint64_t part_get_max_count(volume_t *vol)
+{
+	part_t *part = (part_t *)vol;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&part->parent->lock);
+	ret = get_max_count(part);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static uint64_t part_get_blk_count(volume_t *vol)
+{
+	part_t *part = (part_t *)vol;
+	part_disk_t *disk = part->parent;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&disk->lock);
+	ret = disk->partitions[part->index].blk_count;
+
+	if ((disk->partitions[part->index].flags &
+	     COMMON_PARTITION_FLAG_FILL) && !part_disk_is_unbounded(disk)) {
+		ret = get_max_count(part);
+	}
+
+	pthread_rwlock_unlock(&disk->lock);
+	return ret;
+}
+
+static int part_truncate(volume_t *vol, uint64_t size)
+{
+	part_t *part = (part_t *)vol;
+	int ret;
+
+	pthread_rwlock_wrlock(&part->parent->lock);
+	ret = truncate_partition(part, size);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static int part_set_base_block_count(partition_t *base, uint64_t size)
+{
+	part_t *part = (part_t *)base;
+	int ret;
+
+	pthread_rwlock_wrlock(&part->parent->lock);
+	ret = set_base_block_count(part, size);
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static uint64_t part_get_flags(partition_t *base)
+{
+	part_t *part = (part_t *)base;
+	uint64_t ret;
+
+	pthread_rwlock_rdlock(&part->parent->lock);
+	ret = part->parent->partitions[part->index].flags;
+	pthread_rwlock_unlock(&part->parent->lock);
+	return ret;
+}
+
+static int part_set_flags(partition_t *base, uint64_t flags)
+{
+	part_t *part = (part_t *)base;
+	size_t i;
+
+	pthread_rwlock_wrlock(&part->parent->lock);
+
+	if (flags & COMMON_PARTITION_FLAG_FILL) {
+		for (i = 0; i < part->parent->part_used; ++i) {
+			part->parent->partitions[i].flags &=
+				~COMMON_PARTITION_FLAG_FILL;
+		}
+	}
+
+	part->parent->partitions[part->index].flags = flags;
+	pthread_rwlock_unlock(&part->parent->lock);
+	return 0;
+}
+
+static void part_destroy(object_t *obj)
+{
+	part_t *part = (part_t *)obj;
+
+	object_drop(part->parent);
+	free(part);
+}
+
+part_t *part_create(part_disk_t *parent, size_t index)
+{
+	part_t *part = calloc(1, sizeof(*part));
+	volume_t *vol = (volume_t *)part;
+	object_t *obj = (object_t *)part;
+
+	if (part == NULL) {
+		perror("creating partition");
+		return NULL;
+	}
+
+	part->parent = object_grab(parent);
+	part->index = index;
+	((partition_t *)part)->get_flags = part_get_flags;
+	((partition_t *)part)->set_flags = part_set_flags;
+	((partition_t *)part)->set_base_block_count =
+		part_set_base_block_count;
+	vol->get_min_block_count = part_get_min_count;
+	vol->get_max_block_count = part_get_max_count;
+	vol->get_block_count = part_get_blk_count;
+	vol->truncate = part_truncate;
+	vol->blocksize = parent->volume->blocksize;
+	vol->read_partial_block = part_read_partial_block;
+	vol->write_partial_block = part_write_partial_block;
+	vol->move_block_partial = part_move_block_partial;
+	vol->discard_blocks = part_discard_blocks;
+	vol->read_block = part_read_block;
+	vol->write_block = part_write_block;
+	vol->move_block = part_move_block;
+	vol->commit = part_commit;
+	obj->refcount = 1;
+	obj->destroy = part_destroy;
+	obj->meta = parent->part_meta;
+	return part;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * partition.h
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "volume.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define SECTOR_SIZE (512)
+#define PART_ALIGN (1024 * 1024 / SECTOR_SIZE)
+#define PART_RESERVED PART_ALIGN
+
+/* upper bound for the gap initially left after a growable partition */
+#define PART_GROW_SLACK (1024 * 1024 * 1024 / SECTOR_SIZE)
+
+/* upper bound for the number of partitions of all table formats */
+#define PART_MAX_PARTITIONS (128)
+
+typedef struct part_disk_t part_disk_t;
+
+/*
+  Keeps track of where the partitions are while building the image. The
+  table formats derive from this and only fill in the limits below and
+  the function that writes the actual partition table.
+ */
+struct part_disk_t {
+	partition_mgr_t base;
+
+	/*
+	  Held shared by the partitions while accessing the disk and
+	  exclusively while changing the layout, since growing one
+	  partition can move the data of all the others around.
+	 */
+	pthread_rwlock_t lock;
+
+	/* the underlying volume, wrapped with volume_locked_create */
+	volume_t *volume;
+
+	/* name of the table format, used in error messages */
+	const char *name;
+
+	const meta_object_t *part_meta;
+
+	size_t part_max;
+
+	/*
+	  Number of sectors the table format can address. If the underlying
+	  volume can grow beyond this, it is considered unbounded and a
+	  partition with the fill flag set is not expanded.
+	 */
+	uint64_t max_sectors;
+
+	/* sectors needed at the end of the disk, e.g. for a backup table */
+	uint64_t tail_sectors;
+
+	/*
+	  If set, a partition with the fill flag is resized to the free
+	  space left next to it, instead of having the free space added to
+	  it. This is how MBR disks have always been laid out and existing
+	  images are expected to come out the same.
+	 */
+	bool fill_to_free_space;
+
+	/*
+	  Called on commit, after the partitions have been packed together,
+	  to write the partition table and commit the underlying volume.
+	 */
+	int (*write_table)(part_disk_t *disk);
+
+	size_t part_used;
+
+	struct {
+		/*
+		  Start of the partition on the underlying volume. While the
+		  image is being built, this is a temporary location. The
+		  partitions are only packed together on commit.
+		 */
+		uint64_t index;
+		uint64_t blk_count_min;
+		uint64_t blk_count;
+		uint64_t blk_used;
+		uint64_t flags;
+
+		/*
+		  Number of blocks reserved for the partition on the
+		  underlying volume. Can be more than blk_count, leaving a
+		  gap to the next partition that this one can grow into
+		  without having to move the others out of the way.
+		 */
+		uint64_t blk_reserved;
+	} partitions[PART_MAX_PARTITIONS];
+};
+
+typedef struct {
+	partition_t base;
+
+	part_disk_t *parent;
+	size_t index;
+} part_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Initialize the partition manager part of a freshly allocated disk. The
+  limits and the write_table callback have to be set by the caller. Once
+  this succeeded, the disk is freed when the last reference is dropped.
+
+  Returns 0 on success, prints an error message and returns -1 on failure.
+ */
+int part_disk_init(part_disk_t *disk, volume_t *base);
+
+part_t *part_create(part_disk_t *parent, size_t index);
+
+/*
+  Returns the sector index where the area available for partitions ends,
+  i.e. the maximum disk size minus the tail sectors, aligned down.
+ */
+uint64_t part_disk_get_usable_end(part_disk_t *disk);
+
+/*
+  Returns the number of sectors not yet taken up by any partition, up to
+  the usable end.
+ */
+uint64_t part_disk_get_free_space(part_disk_t *disk);
+
+bool part_disk_is_unbounded(part_disk_t *disk);
+
+/*
+  Returns the end of the last partition on the underlying volume,
+  including the space reserved for growing it.
+ */
+uint64_t part_disk_get_reserved_end(part_disk_t *disk);
+
+int part_disk_grow(part_disk_t *disk, size_t index, uint64_t diff);
+
+int part_disk_shrink(part_disk_t *disk, size_t index, uint64_t diff);
+
+int part_disk_shrink_to_fit(part_disk_t *disk, size_t index);
+
+/*
+  Expand a partition with the fill flag set to take up all the remaining
+  space. Only the size is adjusted, part_disk_compact has to be called
+  afterwards to get the partitions to their final location.
+ */
+int part_disk_apply_expand_policy(part_disk_t *disk, size_t index);
+
+/*
+  Pack all partitions together, starting at PART_RESERVED, with each data
+  range moved at most once. Called on commit to get the final layout and
+  while building the image, if the gaps between the partitions would not
+  fit on the underlying volume anymore.
+ */
+int part_disk_compact(part_disk_t *disk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARTITION_H */
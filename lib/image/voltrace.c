@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * voltrace.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "voltrace.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define READ_RECORDS (1024)
+
+static const char *op_names[VOLTRACE_OP_COUNT] = {
+	[VOLTRACE_OP_READ_BLOCK] = "read block",
+	[VOLTRACE_OP_READ_PARTIAL] = "read partial",
+	[VOLTRACE_OP_WRITE_BLOCK] = "write block",
+	[VOLTRACE_OP_WRITE_PARTIAL] = "write partial",
+	[VOLTRACE_OP_MOVE_BLOCK] = "move block",
+	[VOLTRACE_OP_MOVE_PARTIAL] = "move partial",
+	[VOLTRACE_OP_DISCARD] = "discard",
+	[VOLTRACE_OP_TRUNCATE] = "truncate",
+	[VOLTRACE_OP_COMMIT] = "commit",
+};
+
+typedef struct {
+	voltrace_summary_t *sum;
+
+	/* byte position right after the previous read and write */
+	uint64_t read_end;
+	uint64_t write_end;
+} analyze_state_t;
+
+static void account_access(uint64_t pos, uint64_t size, uint64_t *end,
+			   uint64_t *seq, uint64_t *random)
+{
+	if (pos == *end) {
+		*seq += 1;
+	} else {
+		*random += 1;
+	}
+
+	*end = pos + size;
+}
+
+static void analyze_record(analyze_state_t *state, voltrace_record_t *rec)
+{
+	voltrace_summary_t *sum = state->sum;
+	uint64_t pos, size;
+
+	rec->size = le32toh(rec->size);
+	rec->index = le64toh(rec->index);
+	rec->arg = le64toh(rec->arg);
+	rec->offset = le32toh(rec->offset);
+	rec->dst_offset = le32toh(rec->dst_offset);
+	rec->latency = le64toh(rec->latency);
+
+	sum->count[rec->op] += 1;
+	sum->latency[rec->op] += rec->latency;
+
+	if (rec->latency > sum->max_latency[rec->op])
+		sum->max_latency[rec->op] = rec->latency;
+
+	if (rec->status != 0)
+		sum->errors += 1;
+
+	pos = rec->index * sum->blocksize + rec->offset;
+
+	switch (rec->op) {
+	case VOLTRACE_OP_READ_BLOCK:
+	case VOLTRACE_OP_READ_PARTIAL:
+		sum->bytes[rec->op] += rec->size;
+		account_access(pos, rec->size, &state->read_end,
+			       &sum->seq_reads, &sum->random_reads);
+		break;
+	case VOLTRACE_OP_WRITE_BLOCK:
+	case VOLTRACE_OP_WRITE_PARTIAL:
+		size = rec->size;
+
+		if (size == 0) {
+			size = rec->arg;
+			sum->zero_writes += 1;
+		}
+
+		sum->bytes[rec->op] += size;
+		account_access(pos, size, &state->write_end,
+			       &sum->seq_writes, &sum->random_writes);
+		break;
+	case VOLTRACE_OP_MOVE_BLOCK:
+	case VOLTRACE_OP_MOVE_PARTIAL:
+		sum->bytes[rec->op] += rec->size;
+		break;
+	case VOLTRACE_OP_DISCARD:
+		sum->bytes[rec->op] += rec->arg * sum->blocksize;
+		break;
+	default:
+		break;
+	}
+}
+
+int voltrace_analyze(FILE *fp, const char *filename,
+		     voltrace_summary_t *out)
+{
+	voltrace_record_t records[READ_RECORDS];
+	voltrace_header_t header;
+	analyze_state_t state;
+	size_t i, count;
+
+	memset(out, 0, sizeof(*out));
+	memset(&state, 0, sizeof(state));
+	state.sum = out;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1)
+		goto fail_format;
+
+	if (memcmp(header.magic, VOLTRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	    le32toh(header.version) != VOLTRACE_VERSION) {
+		goto fail_format;
+	}
+
+	out->blocksize = le32toh(header.blocksize);
+
+	do {
+		count = fread(records, sizeof(records[0]), READ_RECORDS, fp);
+
+		for (i = 0; i < count; ++i) {
+			if (records[i].op == 0 ||
+			    records[i].op >= VOLTRACE_OP_COUNT) {
+				goto fail_format;
+			}
+
+			analyze_record(&state, records + i);
+		}
+	} while (count == READ_RECORDS);
+
+	if (ferror(fp)) {
+		perror(filename);
+		return -1;
+	}
+
+	return 0;
+fail_format:
+	if (ferror(fp)) {
+		perror(filename);
+	} else {
+		fprintf(stderr, "%s: not a valid volume trace.\n", filename);
+	}
+	return -1;
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+	return total == 0 ? 0.0 : (100.0 * part) / total;
+}
+
+void voltrace_print_summary(const voltrace_summary_t *sum, FILE *fp)
+{
+	uint64_t writes, partial, written, moved;
+	size_t i;
+
+	fprintf(fp, "block size: %u\n\n", (unsigned int)sum->blocksize);
+
+	fprintf(fp, "%-14s %12s %16s %14s %14s\n", "operation", "calls",
+		"bytes", "avg [ns]", "max [ns]");
+
+	for (i = 1; i < VOLTRACE_OP_COUNT; ++i) {
+		fprintf(fp, "%-14s %12" PRIu64 " %16" PRIu64 " %14" PRIu64
+			" %14" PRIu64 "\n", op_names[i], sum->count[i],
+			sum->bytes[i],
+			sum->count[i] ? sum->latency[i] / sum->count[i] : 0,
+			sum->max_latency[i]);
+	}
+
+	writes = sum->count[VOLTRACE_OP_WRITE_BLOCK] +
+		sum->count[VOLTRACE_OP_WRITE_PARTIAL];
+	partial = sum->count[VOLTRACE_OP_WRITE_PARTIAL];
+	written = sum->bytes[VOLTRACE_OP_WRITE_BLOCK] +
+		sum->bytes[VOLTRACE_OP_WRITE_PARTIAL];
+	moved = sum->bytes[VOLTRACE_OP_MOVE_BLOCK] +
+		sum->bytes[VOLTRACE_OP_MOVE_PARTIAL];
+
+	fprintf(fp, "\nfailed calls: %" PRIu64 "\n", sum->errors);
+
+	fprintf(fp, "sequential reads: %" PRIu64 " of %" PRIu64 " (%.1f%%)\n",
+		sum->seq_reads, sum->seq_reads + sum->random_reads,
+		percent(sum->seq_reads, sum->seq_reads + sum->random_reads));
+
+	fprintf(fp, "sequential writes: %" PRIu64 " of %" PRIu64
+		" (%.1f%%)\n", sum->seq_writes,
+		sum->seq_writes + sum->random_writes,
+		percent(sum->seq_writes,
+			sum->seq_writes + sum->random_writes));
+
+	fprintf(fp, "partial writes: %" PRIu64 " of %" PRIu64 " (%.1f%%)\n",
+		partial, writes, percent(partial, writes));
+
+	fprintf(fp, "zero-fill writes: %" PRIu64 " of %" PRIu64
+		" (%.1f%%)\n", sum->zero_writes, writes,
+		percent(sum->zero_writes, writes));
+
+	fprintf(fp, "move amplification: %.3f (bytes moved per byte "
+		"written)\n", written == 0 ? 0.0 : (double)moved / written);
+}
@@ -12,15 +12,34 @@ int volume_write(volume_t *vol, uint64_t offset, const void *data, size_t size)
 {
 	uint64_t blk_index = offset / vol->blocksize;
 	uint32_t blk_offset = offset % vol->blocksize;
-	uint32_t blk_size = vol->blocksize - blk_offset;
+	size_t blk_size = vol->blocksize - blk_offset;
+	size_t zero_size = 0;
+	uint64_t count;
 	int ret;
 
 	while (size > 0) {
 		blk_size = blk_size > size ? size : blk_size;
 
 		if (blk_offset == 0 && blk_size == vol->blocksize) {
-			if (data == NULL || is_memory_zero(data, blk_size)) {
-				ret = vol->discard_blocks(vol, blk_index, 1);
+			/*
+			  Remember how many bytes from here on are zero, so
+			  a run of sparse blocks is only scanned once.
+			*/
+			if (data != NULL && zero_size < blk_size)
+				zero_size = find_nonzero_byte(data, size);
+
+			if (data == NULL || zero_size >= blk_size) {
+				/* discard the whole run of zero blocks at once */
+				count = (data == NULL ? size : zero_size) /
+					vol->blocksize;
+
+				ret = vol->discard_blocks(vol, blk_index,
+							  count);
+				if (ret)
+					return -1;
+
+				blk_size = count * vol->blocksize;
+				blk_index += count - 1;
 			} else {
 				ret = vol->write_block(vol, blk_index, data);
 			}
@@ -35,6 +54,7 @@ int volume_write(volume_t *vol, uint64_t offset, const void *data, size_t size)
 		if (data != NULL)
 			data = (const char *)data + blk_size;
 
+		zero_size = zero_size > blk_size ? (zero_size - blk_size) : 0;
 		size -= blk_size;
 		blk_index += 1;
 		blk_offset = 0;
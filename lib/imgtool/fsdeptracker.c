@@ -8,6 +8,7 @@
 #include "filesystem.h"
 #include "volume.h"
 #include "fstree.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +21,13 @@ typedef enum {
 	FS_DEPENDENCY_PART_MGR,
 } FS_DEP_NODE_TYPE;
 
+#define MIN_MAP_SIZE (64)
+
+typedef struct fs_dependency_edge_t {
+	struct fs_dependency_edge_t *next;
+	struct fs_dependency_node_t *depends_on;
+} fs_dependency_edge_t;
+
 typedef struct fs_dependency_node_t {
 	struct fs_dependency_node_t *next;
 	FS_DEP_NODE_TYPE type;
@@ -32,60 +40,167 @@ typedef struct fs_dependency_node_t {
 		object_t *obj;
 	} data;
 
+	/* chaining in the pointer and name hash maps */
+	struct fs_dependency_node_t *ptr_next;
+	struct fs_dependency_node_t *name_next;
+
+	/* outgoing edges, i.e. the nodes that this one depends on */
+	fs_dependency_edge_t *edges;
+
 	/* how many other nodes depend on this one? */
 	size_t dep_count;
 
+	/* order of registration, used to make the commit order stable */
+	size_t index;
+
 	char name[];
 } fs_dependency_node_t;
 
-typedef struct fs_dependency_edge_t {
-	struct fs_dependency_edge_t *next;
-	fs_dependency_node_t *node;
-	fs_dependency_node_t *depends_on;
-} fs_dependency_edge_t;
-
 typedef struct {
 	fs_dep_tracker_t base;
 
-	fs_dependency_edge_t *edges;
 	fs_dependency_node_t *nodes;
+	size_t node_count;
+
+	fs_dependency_node_t **ptr_map;
+	fs_dependency_node_t **name_map;
+	size_t map_size;
 } dep_tracker_private_t;
 
-static void fs_dep_tracker_destroy(object_t *obj)
+static size_t hash_ptr(const object_t *obj, FS_DEP_NODE_TYPE type)
 {
-	dep_tracker_private_t *dep = (dep_tracker_private_t *)obj;
-	fs_dependency_node_t *nit;
-	fs_dependency_edge_t *eit;
+	uint64_t x = (uint64_t)(uintptr_t)obj;
+	uint32_t h = (uint32_t)((x >> 4) ^ (x >> 32)) ^ (uint32_t)type;
+
+	h *= 0x9e3779b1;
+	h ^= h >> 16;
+	return h;
+}
+
+static size_t hash_name(const char *name)
+{
+	uint32_t x = 0x811c9dc5;
 
-	while (dep->edges != NULL) {
-		eit = dep->edges;
-		dep->edges = eit->next;
-		free(eit);
+	while (*name != '\0') {
+		x ^= (uint8_t)*(name++);
+		x *= 0x01000193;
 	}
 
+	return x;
+}
+
+static void map_insert(dep_tracker_private_t *dep, fs_dependency_node_t *n)
+{
+	size_t idx = hash_ptr(n->data.obj, n->type) & (dep->map_size - 1);
+
+	n->ptr_next = dep->ptr_map[idx];
+	dep->ptr_map[idx] = n;
+
+	if (n->type == FS_DEPENDENCY_FILESYSTEM) {
+		idx = hash_name(n->name) & (dep->map_size - 1);
+
+		n->name_next = dep->name_map[idx];
+		dep->name_map[idx] = n;
+	}
+}
+
+static int grow_maps(dep_tracker_private_t *dep)
+{
+	fs_dependency_node_t **ptr_map, **name_map, *it;
+	size_t size = dep->map_size ? dep->map_size * 2 : MIN_MAP_SIZE;
+
+	ptr_map = calloc(size, sizeof(ptr_map[0]));
+	name_map = calloc(size, sizeof(name_map[0]));
+
+	if (ptr_map == NULL || name_map == NULL) {
+		perror("Creating dependency entry");
+		free(ptr_map);
+		free(name_map);
+		return -1;
+	}
+
+	free(dep->ptr_map);
+	free(dep->name_map);
+	dep->ptr_map = ptr_map;
+	dep->name_map = name_map;
+	dep->map_size = size;
+
+	for (it = dep->nodes; it != NULL; it = it->next)
+		map_insert(dep, it);
+
+	return 0;
+}
+
+static void clear_graph(dep_tracker_private_t *dep)
+{
+	fs_dependency_node_t *nit;
+	fs_dependency_edge_t *eit;
+
 	while (dep->nodes != NULL) {
 		nit = dep->nodes;
 		dep->nodes = nit->next;
 
+		while (nit->edges != NULL) {
+			eit = nit->edges;
+			nit->edges = eit->next;
+			free(eit);
+		}
+
 		object_drop(nit->data.obj);
 		free(nit);
 	}
 
+	free(dep->ptr_map);
+	free(dep->name_map);
+	dep->ptr_map = NULL;
+	dep->name_map = NULL;
+	dep->map_size = 0;
+	dep->node_count = 0;
+}
+
+static void fs_dep_tracker_destroy(object_t *obj)
+{
+	dep_tracker_private_t *dep = (dep_tracker_private_t *)obj;
+
+	clear_graph(dep);
+
+	if (((fs_dep_tracker_t *)dep)->stats != NULL)
+		object_drop(((fs_dep_tracker_t *)dep)->stats);
+
 	free(dep);
 }
 
+static fs_dependency_node_t *find_node(dep_tracker_private_t *dep,
+				       const object_t *obj,
+				       FS_DEP_NODE_TYPE type)
+{
+	fs_dependency_node_t *it;
+
+	if (dep->map_size == 0)
+		return NULL;
+
+	it = dep->ptr_map[hash_ptr(obj, type) & (dep->map_size - 1)];
+
+	while (it != NULL && (it->type != type || it->data.obj != obj))
+		it = it->ptr_next;
+
+	return it;
+}
+
 static fs_dependency_node_t *get_by_ptr(dep_tracker_private_t *dep,
 					object_t *obj, FS_DEP_NODE_TYPE type,
 					const char *name)
 {
 	fs_dependency_node_t *it;
 
-	for (it = dep->nodes; it != NULL; it = it->next) {
-		if (it->type == type && it->data.obj == obj)
-			break;
-	}
+	it = find_node(dep, obj, type);
 
 	if (it == NULL) {
+		if (dep->node_count >= dep->map_size) {
+			if (grow_maps(dep))
+				return NULL;
+		}
+
 		it = calloc(1, sizeof(*it) + strlen(name) + 1);
 		if (it == NULL) {
 			perror("Creating dependency entry");
@@ -94,22 +209,24 @@ static fs_dependency_node_t *get_by_ptr(dep_tracker_private_t *dep,
 
 		it->type = type;
 		it->data.obj = object_grab(obj);
+		it->index = dep->node_count++;
 		strcpy(it->name, name);
 		it->next = dep->nodes;
 		dep->nodes = it;
+
+		map_insert(dep, it);
 	}
 
 	return it;
 }
 
-static fs_dependency_edge_t *find_edge(dep_tracker_private_t *dep,
-				       fs_dependency_node_t *node,
+static fs_dependency_edge_t *find_edge(fs_dependency_node_t *node,
 				       fs_dependency_node_t *depends_on)
 {
 	fs_dependency_edge_t *it;
 
-	for (it = dep->edges; it != NULL; it = it->next) {
-		if (it->node == node && it->depends_on == depends_on)
+	for (it = node->edges; it != NULL; it = it->next) {
+		if (it->depends_on == depends_on)
 			return it;
 	}
 
@@ -119,10 +236,9 @@ static fs_dependency_edge_t *find_edge(dep_tracker_private_t *dep,
 		return NULL;
 	}
 
-	it->node = node;
 	it->depends_on = depends_on;
-	it->next = dep->edges;
-	dep->edges = it;
+	it->next = node->edges;
+	node->edges = it;
 	return it;
 }
 
@@ -144,7 +260,7 @@ static int add_dependency(fs_dep_tracker_t *interface, object_t *child,
 		if (pit == NULL)
 			return -1;
 
-		edge = find_edge(dep, cit, pit);
+		edge = find_edge(cit, pit);
 		if (edge == NULL)
 			return -1;
 	}
@@ -192,116 +308,278 @@ static int dep_tracker_add_fs(fs_dep_tracker_t *interface,
 			      (object_t *)parent, FS_DEPENDENCY_VOLUME, "");
 }
 
-static int dep_tracker_commit(fs_dep_tracker_t *interface)
+/*
+  Among the nodes that are ready to be committed, the most recently
+  registered one is always processed first. The ready nodes are kept
+  in a binary max-heap ordered by registration index.
+*/
+static void heap_push(fs_dependency_node_t **heap, size_t *count,
+		      fs_dependency_node_t *n)
 {
-	dep_tracker_private_t *tracker = (dep_tracker_private_t *)interface;
-	fs_dependency_node_t *nit, *nprev;
-	fs_dependency_edge_t *eit, *eprev;
-	int ret;
+	size_t i = (*count)++, parent;
 
-	for (nit = tracker->nodes; nit != NULL; nit = nit->next) {
-		nit->dep_count = 0;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap[parent]->index >= n->index)
+			break;
+		heap[i] = heap[parent];
+		i = parent;
 	}
 
-	for (eit = tracker->edges; eit != NULL; eit = eit->next) {
-		eit->depends_on->dep_count += 1;
-	}
+	heap[i] = n;
+}
 
-	while (tracker->nodes != NULL) {
-		/* find a node that nobody else depends on */
-		nprev = NULL;
-		nit = tracker->nodes;
+static fs_dependency_node_t *heap_pop(fs_dependency_node_t **heap,
+				      size_t *count)
+{
+	fs_dependency_node_t *top = heap[0], *last;
+	size_t i = 0, child;
 
-		while (nit != NULL && nit->dep_count != 0) {
-			nprev = nit;
-			nit = nit->next;
-		}
+	last = heap[--(*count)];
 
-		if (nit == NULL) {
-			/* TODO: better error message! */
-			fputs("dependency cycle detected!\n", stderr);
-			return -1;
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= *count)
+			break;
+
+		if (child + 1 < *count &&
+		    heap[child + 1]->index > heap[child]->index) {
+			child += 1;
 		}
 
-		/* resolve */
-		switch (nit->type) {
-		case FS_DEPENDENCY_VOLUME:
-		case FS_DEPENDENCY_PARTITION:
-			ret = nit->data.volume->commit(nit->data.volume);
-			if (ret)
-				return -1;
-			break;
-		case FS_DEPENDENCY_FILESYSTEM:
-			ret = nit->data.filesystem->
-				build_format(nit->data.filesystem);
-			if (ret)
-				return -1;
-
-			ret = nit->data.filesystem->fstree->volume->
-				commit(nit->data.filesystem->fstree->volume);
-			if (ret)
-				return -1;
-			break;
-		case FS_DEPENDENCY_PART_MGR:
-			ret = nit->data.partmgr->commit(nit->data.partmgr);
-			if (ret)
-				return -1;
-			break;
-		default:
+		if (heap[child]->index <= last->index)
 			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = last;
+	return top;
+}
+
+static void node_description(const fs_dependency_node_t *nit,
+			     char *buffer, size_t size)
+{
+	const meta_object_t *meta = object_reflect(nit->data.obj);
+	const char *type = "volume";
+
+	switch (nit->type) {
+	case FS_DEPENDENCY_FILESYSTEM:
+		snprintf(buffer, size, "filesystem %s", nit->name);
+		return;
+	case FS_DEPENDENCY_PARTITION:
+		type = "partition";
+		break;
+	case FS_DEPENDENCY_PART_MGR:
+		type = "partition manager";
+		break;
+	case FS_DEPENDENCY_VOLUME:
+	default:
+		break;
+	}
+
+	if (meta == NULL) {
+		snprintf(buffer, size, "%s %zu", type, nit->index);
+	} else {
+		snprintf(buffer, size, "%s %zu (%s)", type, nit->index,
+			 meta->name);
+	}
+}
+
+static int do_commit_node(fs_dependency_node_t *nit)
+{
+	switch (nit->type) {
+	case FS_DEPENDENCY_VOLUME:
+	case FS_DEPENDENCY_PARTITION:
+		return nit->data.volume->commit(nit->data.volume);
+	case FS_DEPENDENCY_FILESYSTEM:
+		return nit->data.filesystem->fstree->volume->
+			commit(nit->data.filesystem->fstree->volume);
+	case FS_DEPENDENCY_PART_MGR:
+		return nit->data.partmgr->commit(nit->data.partmgr);
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int commit_node(fs_dep_tracker_t *tracker, fs_dependency_node_t *nit)
+{
+	stats_span_t span;
+	char name[128];
+
+	if (tracker->stats == NULL) {
+		if (nit->type == FS_DEPENDENCY_FILESYSTEM &&
+		    nit->data.filesystem->build_format(nit->data.filesystem)) {
+			return -1;
 		}
 
-		/* remove all outgoing edges */
-		eprev = NULL;
-		eit = tracker->edges;
-
-		while (eit != NULL) {
-			if (eit->node == nit) {
-				eit->depends_on->dep_count -= 1;
-
-				if (eprev == NULL) {
-					tracker->edges = eit->next;
-					free(eit);
-					eit = tracker->edges;
-				} else {
-					eprev->next = eit->next;
-					free(eit);
-					eit = eprev->next;
-				}
-			} else {
-				eprev = eit;
-				eit = eit->next;
-			}
+		return do_commit_node(nit);
+	}
+
+	node_description(nit, name, sizeof(name));
+
+	if (nit->type == FS_DEPENDENCY_FILESYSTEM) {
+		imgtool_stats_begin(&span);
+
+		if (nit->data.filesystem->build_format(nit->data.filesystem))
+			return -1;
+
+		if (imgtool_stats_end(tracker->stats, &span, 0,
+				      "build", nit->name)) {
+			return -1;
 		}
+	}
+
+	imgtool_stats_begin(&span);
+
+	if (do_commit_node(nit))
+		return -1;
+
+	return imgtool_stats_end(tracker->stats, &span, 0, "commit", name);
+}
+
+static int dep_tracker_commit(fs_dep_tracker_t *interface)
+{
+	dep_tracker_private_t *tracker = (dep_tracker_private_t *)interface;
+	fs_dependency_node_t **heap, *nit;
+	size_t heap_count = 0, done = 0;
+	fs_dependency_edge_t *eit;
+
+	if (tracker->nodes == NULL)
+		return 0;
+
+	heap = calloc(tracker->node_count, sizeof(heap[0]));
+	if (heap == NULL) {
+		perror("Committing filesystems");
+		return -1;
+	}
+
+	for (nit = tracker->nodes; nit != NULL; nit = nit->next)
+		nit->dep_count = 0;
+
+	for (nit = tracker->nodes; nit != NULL; nit = nit->next) {
+		for (eit = nit->edges; eit != NULL; eit = eit->next)
+			eit->depends_on->dep_count += 1;
+	}
 
-		/* remove the node from the list & destroy it */
-		if (nprev == NULL) {
-			tracker->nodes = nit->next;
-		} else {
-			nprev->next = nit->next;
+	for (nit = tracker->nodes; nit != NULL; nit = nit->next) {
+		if (nit->dep_count == 0)
+			heap_push(heap, &heap_count, nit);
+	}
+
+	while (heap_count > 0) {
+		nit = heap_pop(heap, &heap_count);
+
+		if (commit_node(interface, nit))
+			goto fail;
+
+		for (eit = nit->edges; eit != NULL; eit = eit->next) {
+			eit->depends_on->dep_count -= 1;
+
+			if (eit->depends_on->dep_count == 0)
+				heap_push(heap, &heap_count, eit->depends_on);
 		}
 
-		object_drop(nit->data.obj);
-		free(nit);
+		++done;
+	}
+
+	if (done != tracker->node_count) {
+		/* TODO: better error message! */
+		fputs("dependency cycle detected!\n", stderr);
+		goto fail;
 	}
 
+	free(heap);
+	clear_graph(tracker);
 	return 0;
+fail:
+	free(heap);
+	return -1;
 }
 
 static filesystem_t *dep_tracker_get_fs_by_name(fs_dep_tracker_t *interface,
 						const char *name)
 {
 	dep_tracker_private_t *dep = (dep_tracker_private_t *)interface;
-	fs_dependency_node_t *it;
+	fs_dependency_node_t *it, *found = NULL;
 
-	for (it = dep->nodes; it != NULL; it = it->next) {
-		if (it->type == FS_DEPENDENCY_FILESYSTEM &&
-		    strcmp(it->name, name) == 0) {
-			break;
-		}
+	if (dep->map_size == 0)
+		return NULL;
+
+	it = dep->name_map[hash_name(name) & (dep->map_size - 1)];
+
+	for (; it != NULL; it = it->name_next) {
+		if (strcmp(it->name, name) != 0)
+			continue;
+
+		if (found == NULL || it->index > found->index)
+			found = it;
 	}
 
-	return it == NULL ? NULL : object_grab(it->data.filesystem);
+	return found == NULL ? NULL : object_grab(found->data.filesystem);
+}
+
+/*
+  Partitions can be written to from several threads at once, so the walk
+  stops there. Everything below a partition is only accessed through the
+  partition manager, which does its own locking.
+ */
+static bool depends_on(fs_dependency_node_t *node,
+		       fs_dependency_node_t *target)
+{
+	fs_dependency_edge_t *it;
+
+	if (node == target)
+		return true;
+
+	if (node->type == FS_DEPENDENCY_PARTITION)
+		return false;
+
+	for (it = node->edges; it != NULL; it = it->next) {
+		if (depends_on(it->depends_on, target))
+			return true;
+	}
+
+	return false;
+}
+
+static bool common_ancestor(fs_dependency_node_t *a, fs_dependency_node_t *b)
+{
+	fs_dependency_edge_t *it;
+
+	if (depends_on(b, a))
+		return true;
+
+	if (a->type == FS_DEPENDENCY_PARTITION)
+		return false;
+
+	for (it = a->edges; it != NULL; it = it->next) {
+		if (common_ancestor(it->depends_on, b))
+			return true;
+	}
+
+	return false;
+}
+
+static bool dep_tracker_fs_overlap(fs_dep_tracker_t *interface,
+				   filesystem_t *a, filesystem_t *b)
+{
+	dep_tracker_private_t *dep = (dep_tracker_private_t *)interface;
+	fs_dependency_node_t *na, *nb;
+
+	if (a == b)
+		return true;
+
+	na = find_node(dep, (object_t *)a, FS_DEPENDENCY_FILESYSTEM);
+	nb = find_node(dep, (object_t *)b, FS_DEPENDENCY_FILESYSTEM);
+
+	if (na == NULL || nb == NULL)
+		return true;
+
+	return common_ancestor(na, nb);
 }
 
 fs_dep_tracker_t *fs_dep_tracker_create(void)
@@ -320,6 +598,7 @@ fs_dep_tracker_t *fs_dep_tracker_create(void)
 	public->add_volume_file = dep_tracker_add_volume_file;
 	public->add_fs = dep_tracker_add_fs;
 	public->get_fs_by_name = dep_tracker_get_fs_by_name;
+	public->fs_overlap = dep_tracker_fs_overlap;
 	public->commit = dep_tracker_commit;
 	((object_t *)dep)->refcount = 1;
 	((object_t *)dep)->destroy = fs_dep_tracker_destroy;
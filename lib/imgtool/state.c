@@ -11,9 +11,12 @@
 #include "filesink.h"
 #include "plugin.h"
 #include "volume.h"
+#include "stats.h"
+#include "xfrm.h"
 #include "fstree.h"
 #include "gcfg.h"
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
@@ -22,6 +25,15 @@
 #include <errno.h>
 #include <fcntl.h>
 
+/*
+  Output data is compressed in small, independent pieces, so the higher
+  levels buy little over the zstd default and cost a lot of time.
+ */
+#define OUTPUT_ZSTD_LEVEL (3)
+
+/* amount of uncompressed data per frame of a seekable zstd output */
+#define SEEKABLE_FRAME_SIZE (4 * 1024 * 1024)
+
 struct mount_group_t {
 	file_source_stackable_t base;
 
@@ -29,8 +41,32 @@ struct mount_group_t {
 	file_sink_t *sink;
 	file_source_t *source;
 	bool have_aggregate;
+
+	/* index of the first mount group in the same processing lane */
+	size_t lane;
+};
+
+struct size_report_t {
+	size_report_t *next;
+
+	/* a filesystem_t or partition_t */
+	object_t *obj;
+	bool is_fs;
+
+	char name[];
 };
 
+typedef struct {
+	mount_group_t **groups;
+	size_t count;
+	size_t lane;
+
+	imgtool_stats_t *stats;
+	unsigned int track;
+
+	int status;
+} mg_lane_t;
+
 static int mg_get_next_record(file_source_t *fs, file_source_record_t **out,
 			      istream_t **stream_out)
 {
@@ -92,6 +128,52 @@ static void mg_destroy(object_t *obj)
 
 /*****************************************************************************/
 
+static int add_size_report(imgtool_state_t *state, object_t *obj,
+			   bool is_fs, const char *name)
+{
+	size_report_t *report = calloc(1, sizeof(*report) + strlen(name) + 1);
+
+	if (report == NULL)
+		return -1;
+
+	report->obj = object_grab(obj);
+	report->is_fs = is_fs;
+	strcpy(report->name, name);
+
+	if (state->reports_last == NULL) {
+		state->reports = report;
+	} else {
+		state->reports_last->next = report;
+	}
+
+	state->reports_last = report;
+	return 0;
+}
+
+/*
+  If statistics are enabled, filesystems and partition managers get a
+  counting volume on top of their parent, so the I/O that they generate
+  can be accounted to them. The dependency tracker still refers to the
+  original parent. Volume plugins are not instrumented, they may hand
+  back their parent, which the configuration then sets properties on.
+ */
+static volume_t *instrument_parent(imgtool_state_t *state, volume_t *parent,
+				   const char *type, const char *name)
+{
+	char buffer[128];
+
+	if (state->stats == NULL)
+		return object_grab(parent);
+
+	if (name == NULL) {
+		snprintf(buffer, sizeof(buffer), "%s", type);
+	} else {
+		snprintf(buffer, sizeof(buffer), "%s %s", type, name);
+	}
+
+	return imgtool_stats_wrap_volume(state->stats, parent, buffer);
+}
+
 static object_t *cb_create_fs(const gcfg_keyword_t *kwd, gcfg_file_t *file,
 			      object_t *parent, const char *string)
 {
@@ -99,15 +181,23 @@ static object_t *cb_create_fs(const gcfg_keyword_t *kwd, gcfg_file_t *file,
 	imgtool_state_t *state = kwd->state;
 	plugin_t *plugin = kwd->plugin;
 	filesystem_t *fs;
+	volume_t *wrapper;
+
+	wrapper = instrument_parent(state, vol, kwd->name, string);
+	if (wrapper == NULL)
+		return NULL;
+
+	fs = plugin->create.filesystem(plugin, wrapper);
+	object_drop(wrapper);
 
-	fs = plugin->create.filesystem(plugin, vol);
 	if (fs == NULL) {
 		file->report_error(file, "error creating '%s' filesystem '%s'",
 				   kwd->name, string);
 		return NULL;
 	}
 
-	if (state->dep_tracker->add_fs(state->dep_tracker, fs, vol, string)) {
+	if (state->dep_tracker->add_fs(state->dep_tracker, fs, vol, string) ||
+	    add_size_report(state, (object_t *)fs, true, string)) {
 		file->report_error(file, "error registering "
 				   "%s filesystem '%s'", plugin->name, string);
 		object_drop(fs);
@@ -183,8 +273,16 @@ static object_t *cb_create_part_mgr(const gcfg_keyword_t *kwd,
 {
 	plugin_t *plugin = kwd->plugin;
 	partition_mgr_t *mgr;
+	volume_t *wrapper;
+
+	wrapper = instrument_parent(kwd->state, (volume_t *)parent,
+				    kwd->name, NULL);
+	if (wrapper == NULL)
+		return NULL;
+
+	mgr = plugin->create.part_mgr(plugin, kwd->state, wrapper);
+	object_drop(wrapper);
 
-	mgr = plugin->create.part_mgr(plugin, kwd->state, (volume_t *)parent);
 	if (mgr == NULL) {
 		file->report_error(file, "error creating %s partition manager",
 				   kwd->name);
@@ -208,7 +306,9 @@ static object_t *cb_create_partition(const gcfg_keyword_t *kwd,
 				     gcfg_file_t *file, object_t *parent)
 {
 	partition_mgr_t *mgr = (partition_mgr_t *)parent;
+	imgtool_state_t *state = kwd->state;
 	partition_t *part;
+	char name[32];
 
 	part = mgr->create_parition(mgr, 0, COMMON_PARTITION_FLAG_GROW);
 	if (part == NULL) {
@@ -216,8 +316,10 @@ static object_t *cb_create_partition(const gcfg_keyword_t *kwd,
 		return NULL;
 	}
 
-	if (kwd->state->dep_tracker->
-	    add_partition(kwd->state->dep_tracker, part, mgr)) {
+	sprintf(name, "%zu", ++state->part_count);
+
+	if (state->dep_tracker->add_partition(state->dep_tracker, part, mgr) ||
+	    add_size_report(state, (object_t *)part, false, name)) {
 		file->report_error(file, "error registering partition");
 		object_drop(part);
 		return NULL;
@@ -226,6 +328,38 @@ static object_t *cb_create_partition(const gcfg_keyword_t *kwd,
 	return (object_t *)part;
 }
 
+static object_t *cb_create_trace(const gcfg_keyword_t *kwd,
+				 gcfg_file_t *file, object_t *parent,
+				 const char *string)
+{
+	imgtool_state_t *state = kwd->state;
+	volume_t *volume;
+	int fd;
+
+	fd = open(string, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		file->report_error(file, "%s: %s", string, strerror(errno));
+		return NULL;
+	}
+
+	volume = volume_trace_create((volume_t *)parent, string, fd);
+	if (volume == NULL) {
+		file->report_error(file, "%s: %s", string,
+				   "error creating trace volume");
+		return NULL;
+	}
+
+	if (state->dep_tracker->add_volume(state->dep_tracker, volume,
+					   (volume_t *)parent)) {
+		file->report_error(file, "%s: %s", string,
+				   "error registering trace volume");
+		object_drop(volume);
+		return NULL;
+	}
+
+	return (object_t *)volume;
+}
+
 static object_t *cb_create_volumefile(const gcfg_keyword_t *kwd,
 				      gcfg_file_t *file, object_t *parent,
 				      const char *string)
@@ -362,8 +496,16 @@ static gcfg_keyword_t cfg_mount_group_bind = {
 static void state_destroy(object_t *obj)
 {
 	imgtool_state_t *state = (imgtool_state_t *)obj;
+	size_report_t *report;
 	gcfg_keyword_t *it;
 
+	while (state->reports != NULL) {
+		report = state->reports;
+		state->reports = report->next;
+		object_drop(report->obj);
+		free(report);
+	}
+
 	if (state->mg_list_last != NULL)
 		state->mg_list_last = object_drop(state->mg_list_last);
 
@@ -397,39 +539,117 @@ static void state_destroy(object_t *obj)
 	object_drop(state->out_file);
 	object_drop(state->dep_tracker);
 	object_drop(state->registry);
+
+	/* the counting volumes refer to it, so it goes last */
+	if (state->stats != NULL)
+		object_drop(state->stats);
+
+	object_drop(state->pool);
 	free(state);
 }
 
-imgtool_state_t *imgtool_state_create(const char *out_path)
+static xfrm_stream_t *create_zstd_compressor(void)
+{
+	compressor_config_t cfg;
+	xfrm_stream_t *xfrm;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.level = OUTPUT_ZSTD_LEVEL;
+
+	xfrm = compressor_stream_zstd_create(&cfg);
+	if (xfrm == NULL)
+		fputs("Error creating zstd compressor.\n", stderr);
+
+	return xfrm;
+}
+
+static volume_t *create_qcow2_zstd(const char *out_path, int fd,
+				   uint64_t max_size)
+{
+	xfrm_stream_t *xfrm;
+	volume_t *vol;
+
+	xfrm = create_zstd_compressor();
+	if (xfrm == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	vol = volume_qcow2_create(out_path, fd, max_size, xfrm);
+	object_drop(xfrm);
+	return vol;
+}
+
+static volume_t *create_output_volume(const char *out_path,
+				      IMGTOOL_OUTPUT_FORMAT format,
+				      thread_pool_t *pool)
+{
+	uint64_t max_size = 0xFFFFFFFFFFFFFFFFUL;
+	volume_t *vol;
+	int fd;
+
+	/* same block size as a regular output file */
+	if (format == IMGTOOL_OUTPUT_NULL)
+		return volume_null_create(out_path, 4096, max_size);
+
+	fd = open(out_path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		perror(out_path);
+		return NULL;
+	}
+
+	switch (format) {
+	case IMGTOOL_OUTPUT_ANDROID_SPARSE:
+		return volume_android_sparse_create(out_path, fd, max_size);
+	case IMGTOOL_OUTPUT_QCOW2:
+		return volume_qcow2_create(out_path, fd, max_size, NULL);
+	case IMGTOOL_OUTPUT_QCOW2_ZSTD:
+		return create_qcow2_zstd(out_path, fd, max_size);
+	case IMGTOOL_OUTPUT_ZSTD_SEEKABLE:
+		return volume_zstd_seekable_create(out_path, fd, max_size,
+						   SEEKABLE_FRAME_SIZE,
+						   create_zstd_compressor,
+						   pool);
+	case IMGTOOL_OUTPUT_RAW:
+	case IMGTOOL_OUTPUT_NULL:
+	default:
+		break;
+	}
+
+	vol = volume_from_fd(out_path, fd, max_size);
+	if (vol == NULL)
+		close(fd);
+
+	return vol;
+}
+
+imgtool_state_t *imgtool_state_create(const char *out_path,
+				      IMGTOOL_OUTPUT_FORMAT format,
+				      size_t num_jobs)
 {
 	imgtool_state_t *state = calloc(1, sizeof(*state));
 	object_t *obj = (object_t *)state;
-	int fd;
 
 	if (state == NULL) {
 		perror("creating state object");
 		return NULL;
 	}
 
+	state->pool = thread_pool_create(num_jobs);
+	if (state->pool == NULL)
+		goto fail_free;
+
 	state->registry = plugin_registry_create();
 	if (state->registry == NULL)
-		goto fail_free;
+		goto fail_pool;
 
 	state->dep_tracker = fs_dep_tracker_create();
 	if (state->dep_tracker == NULL)
 		goto fail_registry;
 
-	fd = open(out_path, O_RDWR | O_CREAT | O_EXCL, 0644);
-	if (fd < 0) {
-		perror(out_path);
+	state->out_file = create_output_volume(out_path, format, state->pool);
+	if (state->out_file == NULL)
 		goto fail_tracker;
-	}
-
-	state->out_file = volume_from_fd(out_path, fd, 0xFFFFFFFFFFFFFFFFUL);
-	if (state->out_file == NULL) {
-		close(fd);
-		goto fail_tracker;
-	}
 
 	if (state->dep_tracker->add_volume(state->dep_tracker,
 					   state->out_file, NULL)) {
@@ -445,6 +665,8 @@ fail_tracker:
 	object_drop(state->dep_tracker);
 fail_registry:
 	object_drop(state->registry);
+fail_pool:
+	object_drop(state->pool);
 fail_free:
 	free(state);
 	return NULL;
@@ -540,6 +762,25 @@ int imgtool_state_init_config(imgtool_state_t *state)
 		last = kwd_it;
 	}
 
+	/* volume tracing, can be inserted anywhere a volume is expected */
+	kwd_it = calloc(1, sizeof(*kwd_it));
+	if (kwd_it == NULL)
+		goto fail;
+
+	kwd_it->arg = GCFG_ARG_STRING;
+	kwd_it->name = "trace";
+	kwd_it->state = state;
+	kwd_it->handle.cb_string = cb_create_trace;
+
+	if (last == NULL) {
+		state->cfg_fs_or_volume = kwd_it;
+	} else {
+		last->next = kwd_it;
+	}
+	last = kwd_it;
+
+	kwd_it->children = state->cfg_fs_or_volume;
+
 	/* partition manager common */
 	state->cfg_part_mgr_common[0].arg = GCFG_ARG_NONE;
 	state->cfg_part_mgr_common[0].name = "partition";
@@ -642,9 +883,25 @@ fail:
 	return -1;
 }
 
+int imgtool_state_enable_stats(imgtool_state_t *state)
+{
+	if (state->stats != NULL)
+		return 0;
+
+	state->stats = imgtool_stats_create();
+	if (state->stats == NULL)
+		return -1;
+
+	state->dep_tracker->stats = object_grab(state->stats);
+	return 0;
+}
+
 int imgtool_process_config_file(imgtool_state_t *state, const char *path)
 {
 	gcfg_file_t *gcfg;
+	stats_span_t span;
+
+	imgtool_stats_begin(&span);
 
 	gcfg = open_gcfg_file(path);
 	if (gcfg == NULL)
@@ -656,20 +913,237 @@ int imgtool_process_config_file(imgtool_state_t *state, const char *path)
 	}
 
 	object_drop(gcfg);
+
+	if (state->stats != NULL)
+		return imgtool_stats_end(state->stats, &span, 0, "config", path);
+
 	return 0;
 }
 
-int imgtool_state_process(imgtool_state_t *state)
+static bool mg_overlap(imgtool_state_t *state, mount_group_t *a,
+		       mount_group_t *b)
+{
+	fs_dep_tracker_t *tracker = state->dep_tracker;
+	file_sink_bind_t *ait, *bit;
+
+	for (ait = a->sink->binds; ait != NULL; ait = ait->next) {
+		for (bit = b->sink->binds; bit != NULL; bit = bit->next) {
+			if (tracker->fs_overlap(tracker, ait->target,
+						bit->target)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void merge_lanes(mount_group_t **groups, size_t count,
+			size_t a, size_t b)
+{
+	size_t i, from, to;
+
+	from = a > b ? a : b;
+	to = a > b ? b : a;
+
+	for (i = 0; i < count; ++i) {
+		if (groups[i]->lane == from)
+			groups[i]->lane = to;
+	}
+}
+
+static int process_lane(void *arg)
 {
+	mg_lane_t *lane = arg;
 	mount_group_t *mg;
+	stats_span_t span;
+	char name[32];
+	size_t i;
 
-	for (mg = state->mg_list; mg != NULL; mg = mg->next) {
-		if (file_sink_add_data(mg->sink, mg->source))
-			return -1;
+	for (i = lane->lane; i < lane->count; ++i) {
+		mg = lane->groups[i];
+
+		if (mg->lane != lane->lane)
+			continue;
+
+		imgtool_stats_begin(&span);
+
+		if (file_sink_add_data(mg->sink, mg->source)) {
+			lane->status = -1;
+			break;
+		}
+
+		if (lane->stats == NULL)
+			continue;
+
+		sprintf(name, "mountgroup %zu", i + 1);
+
+		if (imgtool_stats_end(lane->stats, &span, lane->track,
+				      "ingest", name)) {
+			lane->status = -1;
+			break;
+		}
 	}
 
+	return lane->status;
+}
+
+static int process_mount_groups(imgtool_state_t *state)
+{
+	size_t i, j, count = 0, lane_count = 0;
+	thread_pool_group_t pool_group;
+	mount_group_t **groups, *mg;
+	mg_lane_t *lanes;
+	int ret = 0;
+
+	for (mg = state->mg_list; mg != NULL; mg = mg->next)
+		++count;
+
+	if (count == 0)
+		return 0;
+
+	groups = calloc(count, sizeof(groups[0]));
+	lanes = calloc(count, sizeof(lanes[0]));
+
+	if (groups == NULL || lanes == NULL) {
+		perror("processing mount groups");
+		free(groups);
+		free(lanes);
+		return -1;
+	}
+
+	/*
+	  Mount groups that write to overlapping filesystems are processed
+	  one after another, in the order they were specified. Everything
+	  else gets its own lane that is processed as a separate task on
+	  the thread pool. A lane owns the filesystems it writes to and the
+	  volumes below them, up to the partitions, which do their own
+	  locking. So no lock is needed while populating them.
+	 */
+	for (i = 0, mg = state->mg_list; mg != NULL; mg = mg->next, ++i) {
+		groups[i] = mg;
+		mg->lane = i;
+
+		for (j = 0; j < i; ++j) {
+			if (groups[j]->lane == mg->lane)
+				continue;
+
+			if (mg_overlap(state, groups[j], mg)) {
+				merge_lanes(groups, i + 1,
+					    groups[j]->lane, mg->lane);
+			}
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		lanes[i].groups = groups;
+		lanes[i].count = count;
+		lanes[i].lane = i;
+		lanes[i].stats = state->stats;
+
+		if (groups[i]->lane == i)
+			lane_count += 1;
+	}
+
+	if (lane_count == 1) {
+		ret = process_lane(lanes);
+		goto out;
+	}
+
+	memset(&pool_group, 0, sizeof(pool_group));
+
+	for (i = 0; i < count; ++i) {
+		if (groups[i]->lane != i)
+			continue;
+
+		/*
+		  A lane can run on any worker, or on the main thread while
+		  it waits, so each one is recorded on a track of its own.
+		 */
+		lanes[i].track = i + 1;
+
+		if (thread_pool_submit(state->pool, &pool_group,
+				       process_lane, lanes + i)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (thread_pool_wait(state->pool, &pool_group))
+		ret = -1;
+out:
+	free(groups);
+	free(lanes);
+	return ret;
+}
+
+int imgtool_state_process(imgtool_state_t *state)
+{
+	stats_span_t span;
+
+	imgtool_stats_begin(&span);
+
+	if (process_mount_groups(state))
+		return -1;
+
+	if (state->stats != NULL &&
+	    imgtool_stats_end(state->stats, &span, 0, "total", "ingest")) {
+		return -1;
+	}
+
+	imgtool_stats_begin(&span);
+
 	if (state->dep_tracker->commit(state->dep_tracker))
 		return -1;
 
+	if (state->stats != NULL &&
+	    imgtool_stats_end(state->stats, &span, 0, "total", "commit")) {
+		return -1;
+	}
+
 	return 0;
 }
+
+static uint64_t volume_size(volume_t *vol)
+{
+	size_t i, count = object_get_property_count(vol);
+	property_value_t value;
+	property_desc_t desc;
+
+	/* prefer the exact byte size, if the volume knows it */
+	for (i = 0; i < count; ++i) {
+		if (object_get_property_desc(vol, i, &desc))
+			continue;
+
+		if (strcmp(desc.name, "size") != 0)
+			continue;
+
+		if (object_get_property(vol, i, &value) == 0 &&
+		    value.type == PROPERTY_TYPE_U64_SIZE) {
+			return value.value.u64;
+		}
+	}
+
+	return vol->get_block_count(vol) * vol->blocksize;
+}
+
+void imgtool_state_print_sizes(imgtool_state_t *state)
+{
+	size_report_t *it;
+	filesystem_t *fs;
+
+	for (it = state->reports; it != NULL; it = it->next) {
+		if (it->is_fs) {
+			fs = (filesystem_t *)it->obj;
+
+			printf("filesystem  %-24s %20" PRIu64 "\n", it->name,
+			       volume_size(fs->fstree->volume));
+		} else {
+			printf("partition   %-24s %20" PRIu64 "\n", it->name,
+			       volume_size((volume_t *)it->obj));
+		}
+	}
+
+	printf("image       %-24s %20" PRIu64 "\n", "",
+	       volume_size(state->out_file));
+}
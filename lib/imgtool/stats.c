@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * stats.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "stats.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t get_time(clockid_t clk)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clk, &ts) != 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void stats_destroy(object_t *obj)
+{
+	imgtool_stats_t *stats = (imgtool_stats_t *)obj;
+	stats_volume_t *vit;
+	stats_event_t *eit;
+
+	while (stats->events != NULL) {
+		eit = stats->events;
+		stats->events = eit->next;
+		free(eit);
+	}
+
+	while (stats->volumes != NULL) {
+		vit = stats->volumes;
+		stats->volumes = vit->next;
+		free(vit);
+	}
+
+	pthread_mutex_destroy(&stats->lock);
+	free(stats);
+}
+
+imgtool_stats_t *imgtool_stats_create(void)
+{
+	imgtool_stats_t *stats = calloc(1, sizeof(*stats));
+
+	if (stats == NULL) {
+		perror("creating statistics object");
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&stats->lock, NULL) != 0) {
+		perror("creating statistics object");
+		free(stats);
+		return NULL;
+	}
+
+	stats->epoch = get_time(CLOCK_MONOTONIC);
+
+	((object_t *)stats)->refcount = 1;
+	((object_t *)stats)->destroy = stats_destroy;
+	return stats;
+}
+
+void imgtool_stats_begin(stats_span_t *span)
+{
+	span->wall = get_time(CLOCK_MONOTONIC);
+	span->cpu = get_time(CLOCK_THREAD_CPUTIME_ID);
+}
+
+int imgtool_stats_end(imgtool_stats_t *stats, const stats_span_t *span,
+		      unsigned int track, const char *category,
+		      const char *name)
+{
+	uint64_t wall = get_time(CLOCK_MONOTONIC);
+	uint64_t cpu = get_time(CLOCK_THREAD_CPUTIME_ID);
+	stats_event_t *ev;
+
+	ev = calloc(1, sizeof(*ev) + strlen(name) + 1);
+	if (ev == NULL) {
+		perror("recording statistics");
+		return -1;
+	}
+
+	ev->category = category;
+	ev->track = track;
+	ev->start = (span->wall - stats->epoch) / 1000;
+	ev->wall = (wall - span->wall) / 1000;
+	ev->cpu = (cpu - span->cpu) / 1000;
+	strcpy(ev->name, name);
+
+	pthread_mutex_lock(&stats->lock);
+	if (stats->events_last == NULL) {
+		stats->events = ev;
+	} else {
+		stats->events_last->next = ev;
+	}
+	stats->events_last = ev;
+
+	if (track > stats->max_track)
+		stats->max_track = track;
+	pthread_mutex_unlock(&stats->lock);
+	return 0;
+}
+
+volume_t *imgtool_stats_wrap_volume(imgtool_stats_t *stats, volume_t *vol,
+				    const char *name)
+{
+	stats_volume_t *sv;
+	volume_t *wrapper;
+
+	sv = calloc(1, sizeof(*sv) + strlen(name) + 1);
+	if (sv == NULL) {
+		perror("recording volume statistics");
+		return NULL;
+	}
+
+	strcpy(sv->name, name);
+
+	wrapper = volume_counting_create(vol, &sv->io);
+	if (wrapper == NULL) {
+		free(sv);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+	if (stats->volumes_last == NULL) {
+		stats->volumes = sv;
+	} else {
+		stats->volumes_last->next = sv;
+	}
+	stats->volumes_last = sv;
+	pthread_mutex_unlock(&stats->lock);
+	return wrapper;
+}
+
+/*****************************************************************************/
+
+static void print_io(FILE *fp, const char *what, uint64_t calls,
+		     uint64_t bytes)
+{
+	fprintf(fp, "    %-8s %12" PRIu64 " calls %16" PRIu64 " bytes\n",
+		what, calls, bytes);
+}
+
+void imgtool_stats_print(imgtool_stats_t *stats, FILE *fp)
+{
+	stats_volume_t *vit;
+	stats_event_t *eit;
+
+	pthread_mutex_lock(&stats->lock);
+
+	fprintf(fp, "%-8s %-32s %6s %12s %12s\n",
+		"phase", "name", "track", "wall [ms]", "cpu [ms]");
+
+	for (eit = stats->events; eit != NULL; eit = eit->next) {
+		fprintf(fp, "%-8s %-32s %6u %8" PRIu64 ".%03u %8" PRIu64
+			".%03u\n", eit->category, eit->name, eit->track,
+			eit->wall / 1000, (unsigned int)(eit->wall % 1000),
+			eit->cpu / 1000, (unsigned int)(eit->cpu % 1000));
+	}
+
+	for (vit = stats->volumes; vit != NULL; vit = vit->next) {
+		fprintf(fp, "\nvolume %s\n", vit->name);
+		print_io(fp, "read", vit->io.read_calls, vit->io.read_bytes);
+		print_io(fp, "write", vit->io.write_calls,
+			 vit->io.write_bytes);
+		print_io(fp, "move", vit->io.move_calls, vit->io.move_bytes);
+		print_io(fp, "discard", vit->io.discard_calls,
+			 vit->io.discard_bytes);
+		fprintf(fp, "    %-8s %12" PRIu64 " calls\n", "commit",
+			vit->io.commit_calls);
+	}
+
+	pthread_mutex_unlock(&stats->lock);
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (; *str != '\0'; ++str) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(fp, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(fp, "\\u%04x", (unsigned int)*str);
+		} else {
+			fputc(*str, fp);
+		}
+	}
+
+	fputc('"', fp);
+}
+
+int imgtool_stats_write_trace(imgtool_stats_t *stats, const char *path)
+{
+	uint64_t now = (get_time(CLOCK_MONOTONIC) - stats->epoch) / 1000;
+	stats_volume_t *vit;
+	stats_event_t *eit;
+	unsigned int i;
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+
+	fputs("{\"traceEvents\":[\n", fp);
+
+	for (i = 0; i <= stats->max_track; ++i) {
+		fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":1,\"tid\":%u,\"args\":{\"name\":", i);
+
+		if (i == 0) {
+			fputs("\"main\"", fp);
+		} else {
+			fprintf(fp, "\"lane %u\"", i);
+		}
+
+		fputs("}},\n", fp);
+	}
+
+	for (eit = stats->events; eit != NULL; eit = eit->next) {
+		fputs("{\"name\":", fp);
+		write_json_string(fp, eit->name);
+		fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+			"\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ","
+			"\"args\":{\"cpu_us\":%" PRIu64 "}},\n",
+			eit->category, eit->track, eit->start, eit->wall,
+			eit->cpu);
+	}
+
+	for (vit = stats->volumes; vit != NULL; vit = vit->next) {
+		fputs("{\"name\":", fp);
+		write_json_string(fp, vit->name);
+		fprintf(fp, ",\"cat\":\"volume\",\"ph\":\"C\",\"pid\":1,"
+			"\"tid\":0,\"ts\":%" PRIu64 ",\"args\":{"
+			"\"read_calls\":%" PRIu64 ",\"read_bytes\":%" PRIu64 ","
+			"\"write_calls\":%" PRIu64 ",\"write_bytes\":%" PRIu64 ","
+			"\"move_calls\":%" PRIu64 ",\"move_bytes\":%" PRIu64 ","
+			"\"discard_calls\":%" PRIu64 ","
+			"\"discard_bytes\":%" PRIu64 "}},\n", now,
+			vit->io.read_calls, vit->io.read_bytes,
+			vit->io.write_calls, vit->io.write_bytes,
+			vit->io.move_calls, vit->io.move_bytes,
+			vit->io.discard_calls, vit->io.discard_bytes);
+	}
+
+	/* the trace format does not allow a trailing comma */
+	fprintf(fp, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,"
+		"\"tid\":0,\"ts\":%" PRIu64 "}\n]}\n", now);
+
+	pthread_mutex_unlock(&stats->lock);
+
+	ret = ferror(fp);
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	if (ret != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
@@ -14,6 +14,8 @@
 
 #define MIN_BITMAP_WORDS (64)
 
+#define BITS_PER_WORD (sizeof(bitmap_word_t) * CHAR_BIT)
+
 typedef uint64_t bitmap_word_t;
 
 struct bitmap_t {
@@ -72,34 +74,42 @@ bool bitmap_is_set(bitmap_t *bitmap, size_t index)
 	return (bitmap->words[word_idx] & (1UL << word_off)) != 0;
 }
 
-int bitmap_set(bitmap_t *bitmap, size_t index)
+static int grow_to_fit(bitmap_t *bitmap, size_t word_idx)
 {
-	size_t word_idx = index / (sizeof(bitmap->words[0]) * CHAR_BIT);
-	size_t word_off = index % (sizeof(bitmap->words[0]) * CHAR_BIT);
 	size_t i, new_count;
 	bitmap_word_t *new;
 
-	if (word_idx >= bitmap->word_count) {
-		new_count = bitmap->word_count * 2;
-
-		while (word_idx >= new_count)
-			new_count *= 2;
+	if (word_idx < bitmap->word_count)
+		return 0;
 
-		new = realloc(bitmap->words,
-			      new_count * sizeof(bitmap->words[0]));
+	new_count = bitmap->word_count * 2;
 
-		if (new == NULL) {
-			perror("growing bitmap");
-			return -1;
-		}
+	while (word_idx >= new_count)
+		new_count *= 2;
 
-		for (i = bitmap->word_count; i < new_count; ++i)
-			new[i] = 0;
+	new = realloc(bitmap->words, new_count * sizeof(bitmap->words[0]));
 
-		bitmap->words = new;
-		bitmap->word_count = new_count;
+	if (new == NULL) {
+		perror("growing bitmap");
+		return -1;
 	}
 
+	for (i = bitmap->word_count; i < new_count; ++i)
+		new[i] = 0;
+
+	bitmap->words = new;
+	bitmap->word_count = new_count;
+	return 0;
+}
+
+int bitmap_set(bitmap_t *bitmap, size_t index)
+{
+	size_t word_idx = index / (sizeof(bitmap->words[0]) * CHAR_BIT);
+	size_t word_off = index % (sizeof(bitmap->words[0]) * CHAR_BIT);
+
+	if (grow_to_fit(bitmap, word_idx))
+		return -1;
+
 	bitmap->words[word_idx] |= (1UL << word_off);
 	return 0;
 }
@@ -144,8 +154,7 @@ void bitmap_shrink(bitmap_t *bitmap)
 
 size_t bitmap_msb_index(bitmap_t *bitmap)
 {
-	bitmap_word_t word, mask;
-	size_t i, index;
+	size_t i;
 
 	if (bitmap->word_count == 0)
 		return 0;
@@ -154,19 +163,124 @@ size_t bitmap_msb_index(bitmap_t *bitmap)
 	while (i > 0 && bitmap->words[i] == 0)
 		--i;
 
-	word = bitmap->words[i];
+	if (bitmap->words[i] == 0)
+		return 0;
+
+	return i * BITS_PER_WORD + (BITS_PER_WORD - 1) -
+		__builtin_clzll(bitmap->words[i]);
+}
+
+/* mask of the bits [offset, offset + count) within a single word */
+static bitmap_word_t word_mask(size_t offset, size_t count)
+{
+	bitmap_word_t mask = ~((bitmap_word_t)0);
+
+	if (count < BITS_PER_WORD)
+		mask = ((bitmap_word_t)1 << count) - 1;
 
-	if (word == 0)
+	return mask << offset;
+}
+
+int bitmap_set_range(bitmap_t *bitmap, size_t index, size_t count)
+{
+	size_t word_idx = index / BITS_PER_WORD;
+	size_t word_off = index % BITS_PER_WORD;
+	size_t diff;
+
+	if (count == 0)
 		return 0;
 
-	index = i * (sizeof(bitmap->words[0]) * CHAR_BIT);
+	if (grow_to_fit(bitmap, (index + count - 1) / BITS_PER_WORD))
+		return -1;
+
+	while (count > 0) {
+		diff = BITS_PER_WORD - word_off;
+		diff = diff > count ? count : diff;
+
+		bitmap->words[word_idx++] |= word_mask(word_off, diff);
+
+		count -= diff;
+		word_off = 0;
+	}
+
+	return 0;
+}
+
+void bitmap_clear_range(bitmap_t *bitmap, size_t index, size_t count)
+{
+	size_t word_idx = index / BITS_PER_WORD;
+	size_t word_off = index % BITS_PER_WORD;
+	size_t diff;
+
+	while (count > 0 && word_idx < bitmap->word_count) {
+		diff = BITS_PER_WORD - word_off;
+		diff = diff > count ? count : diff;
+
+		bitmap->words[word_idx++] &= ~word_mask(word_off, diff);
+
+		count -= diff;
+		word_off = 0;
+	}
+}
+
+size_t bitmap_find_next_set(bitmap_t *bitmap, size_t index)
+{
+	size_t word_idx = index / BITS_PER_WORD;
+	bitmap_word_t word;
+
+	if (word_idx >= bitmap->word_count)
+		return SIZE_MAX;
+
+	word = bitmap->words[word_idx] & word_mask(index % BITS_PER_WORD,
+						   BITS_PER_WORD);
+
+	while (word == 0) {
+		if (++word_idx >= bitmap->word_count)
+			return SIZE_MAX;
+
+		word = bitmap->words[word_idx];
+	}
+
+	return word_idx * BITS_PER_WORD + __builtin_ctzll(word);
+}
+
+size_t bitmap_find_next_clear(bitmap_t *bitmap, size_t index)
+{
+	size_t word_idx = index / BITS_PER_WORD;
+	bitmap_word_t word;
+
+	if (word_idx >= bitmap->word_count)
+		return index;
+
+	word = ~bitmap->words[word_idx] & word_mask(index % BITS_PER_WORD,
+						    BITS_PER_WORD);
+
+	while (word == 0) {
+		if (++word_idx >= bitmap->word_count)
+			return word_idx * BITS_PER_WORD;
+
+		word = ~bitmap->words[word_idx];
+	}
+
+	return word_idx * BITS_PER_WORD + __builtin_ctzll(word);
+}
+
+size_t bitmap_count_set(bitmap_t *bitmap, size_t index, size_t count)
+{
+	size_t word_idx = index / BITS_PER_WORD;
+	size_t word_off = index % BITS_PER_WORD;
+	size_t diff, total = 0;
+
+	while (count > 0 && word_idx < bitmap->word_count) {
+		diff = BITS_PER_WORD - word_off;
+		diff = diff > count ? count : diff;
 
-	mask = ~(1UL << (sizeof(bitmap->words[0]) * CHAR_BIT - 1));
+		total += __builtin_popcountll(bitmap->words[word_idx++] &
+					      word_mask(word_off, diff));
 
-	while (word != 0x01) {
-		word = (word >> 1) & mask;
-		index += 1;
+		count -= diff;
+		word_off = 0;
 	}
 
-	return index;
+	return total;
 }
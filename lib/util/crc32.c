@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * crc32.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "util.h"
+
+/* reversed representation of the IEEE 802.3 polynomial */
+#define CRC32_POLY (0xEDB88320)
+
+/*
+  Slicing-by-8 lookup tables. The first table is the classic byte-wise
+  table, table[k][i] is the CRC of byte i followed by k zero bytes. This
+  allows processing 8 input bytes per iteration with independent lookups.
+ */
+static uint32_t table[8][256];
+
+__attribute__((constructor))
+static void generate_tables(void)
+{
+	uint32_t crc;
+	size_t i, j;
+
+	for (i = 0; i < 256; ++i) {
+		crc = i;
+
+		for (j = 0; j < 8; ++j)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+
+		table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; ++i) {
+		crc = table[0][i];
+
+		for (j = 1; j < 8; ++j) {
+			crc = (crc >> 8) ^ table[0][crc & 0xFF];
+			table[j][i] = crc;
+		}
+	}
+}
+
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+	uint32_t lo, hi;
+
+	crc = ~crc;
+
+	while (size >= 8) {
+		lo = crc ^ ((uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) |
+			    ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24));
+		hi = (uint32_t)ptr[4] | ((uint32_t)ptr[5] << 8) |
+			((uint32_t)ptr[6] << 16) | ((uint32_t)ptr[7] << 24);
+
+		crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+			table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+			table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+			table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+
+		ptr += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *(ptr++)) & 0xFF];
+
+	return ~crc;
+}
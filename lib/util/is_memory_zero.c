@@ -9,33 +9,43 @@
 
 #include <stdint.h>
 
+#if defined(HAVE_X86_SIMD)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define U64THRESHOLD (128)
 
-static bool test_u8(const unsigned char *blob, size_t size)
+static size_t find_u8(const unsigned char *blob, size_t size)
 {
-	while (size--) {
-		if (*(blob++) != 0)
-			return false;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		if (blob[i] != 0)
+			break;
 	}
 
-	return true;
+	return i;
 }
 
-bool is_memory_zero(const void *blob, size_t size)
+static size_t find_generic(const void *blob, size_t size)
 {
+	const unsigned char *start = blob;
 	const uint64_t *u64ptr;
-	size_t diff;
+	size_t diff, offset;
 
 	if (size < U64THRESHOLD)
-		return test_u8(blob, size);
+		return find_u8(blob, size);
 
 	diff = (uintptr_t)blob % sizeof(uint64_t);
 
 	if (diff != 0) {
 		diff = sizeof(uint64_t) - diff;
 
-		if (!test_u8(blob, diff))
-			return false;
+		offset = find_u8(blob, diff);
+		if (offset < diff)
+			return offset;
 
 		blob = (const char *)blob + diff;
 		size -= diff;
@@ -43,12 +53,121 @@ bool is_memory_zero(const void *blob, size_t size)
 
 	u64ptr = blob;
 
-	while (size >= sizeof(uint64_t)) {
-		if (*(u64ptr++) != 0)
-			return false;
-
+	while (size >= sizeof(uint64_t) && *u64ptr == 0) {
+		++u64ptr;
 		size -= sizeof(uint64_t);
 	}
 
-	return test_u8((const unsigned char *)u64ptr, size);
+	offset = (const unsigned char *)u64ptr - start;
+
+	return offset + find_u8((const unsigned char *)u64ptr,
+				size < sizeof(uint64_t) ?
+				size : sizeof(uint64_t));
+}
+
+/*
+  The vectorized versions only skip over zero chunks and leave pin-pointing
+  the exact offset within a non-zero chunk, as well as the tail of the
+  buffer, to the generic implementation.
+ */
+#if defined(HAVE_X86_SIMD)
+__attribute__((target("sse2")))
+static size_t find_sse2(const void *blob, size_t size)
+{
+	const unsigned char *ptr = blob;
+	__m128i a, b, c, d;
+	size_t i;
+
+	for (i = 0; (size - i) >= 64; i += 64) {
+		a = _mm_loadu_si128((const void *)(ptr + i));
+		b = _mm_loadu_si128((const void *)(ptr + i + 16));
+		c = _mm_loadu_si128((const void *)(ptr + i + 32));
+		d = _mm_loadu_si128((const void *)(ptr + i + 48));
+
+		a = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+		a = _mm_cmpeq_epi8(a, _mm_setzero_si128());
+
+		if (_mm_movemask_epi8(a) != 0xFFFF)
+			break;
+	}
+
+	return i + find_generic(ptr + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const void *blob, size_t size)
+{
+	const unsigned char *ptr = blob;
+	__m256i a, b, c, d;
+	size_t i;
+
+	for (i = 0; (size - i) >= 128; i += 128) {
+		a = _mm256_loadu_si256((const void *)(ptr + i));
+		b = _mm256_loadu_si256((const void *)(ptr + i + 32));
+		c = _mm256_loadu_si256((const void *)(ptr + i + 64));
+		d = _mm256_loadu_si256((const void *)(ptr + i + 96));
+
+		a = _mm256_or_si256(_mm256_or_si256(a, b),
+				    _mm256_or_si256(c, d));
+
+		if (!_mm256_testz_si256(a, a))
+			break;
+	}
+
+	return i + find_generic(ptr + i, size - i);
+}
+
+static size_t (*find_impl)(const void *blob, size_t size) = find_generic;
+
+__attribute__((constructor))
+static void select_implementation(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		find_impl = find_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		find_impl = find_sse2;
+	}
+}
+#elif defined(__ARM_NEON)
+static size_t find_neon(const void *blob, size_t size)
+{
+	const unsigned char *ptr = blob;
+	uint8x16_t a, b, c, d;
+	uint64x2_t w;
+	size_t i;
+
+	for (i = 0; (size - i) >= 64; i += 64) {
+		a = vld1q_u8(ptr + i);
+		b = vld1q_u8(ptr + i + 16);
+		c = vld1q_u8(ptr + i + 32);
+		d = vld1q_u8(ptr + i + 48);
+
+		a = vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d));
+		w = vreinterpretq_u64_u8(a);
+
+		if ((vgetq_lane_u64(w, 0) | vgetq_lane_u64(w, 1)) != 0)
+			break;
+	}
+
+	return i + find_generic(ptr + i, size - i);
+}
+
+#define find_impl find_neon
+#else
+#define find_impl find_generic
+#endif
+
+size_t find_nonzero_byte(const void *blob, size_t size)
+{
+	if (size < U64THRESHOLD)
+		return find_u8(blob, size);
+
+	return find_impl(blob, size);
+}
+
+bool is_memory_zero(const void *blob, size_t size)
+{
+	return find_nonzero_byte(blob, size) == size;
 }
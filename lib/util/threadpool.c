@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * threadpool.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+	int (*fn)(void *arg);
+	void *arg;
+	thread_pool_group_t *group;
+} pool_task_t;
+
+/* ring buffer, the owner works on the back, thieves take from the front */
+typedef struct {
+	pool_task_t *tasks;
+	size_t first;
+	size_t count;
+	size_t capacity;
+} task_queue_t;
+
+typedef struct {
+	thread_pool_t *pool;
+	pthread_t thread;
+	size_t index;
+} pool_worker_t;
+
+struct thread_pool_t {
+	object_t base;
+
+	pthread_mutex_t lock;
+
+	/* signaled when tasks are queued or a group has finished */
+	pthread_cond_t cond;
+	bool shutdown;
+
+	pool_worker_t *workers;
+	size_t worker_count;
+
+	/* one queue per worker, followed by the shared one */
+	task_queue_t *queues;
+};
+
+static __thread pool_worker_t *current_worker;
+
+static int queue_push(task_queue_t *queue, const pool_task_t *task)
+{
+	size_t i, new_capacity;
+	pool_task_t *new;
+
+	if (queue->count == queue->capacity) {
+		new_capacity = queue->capacity ? queue->capacity * 2 : 16;
+
+		new = calloc(new_capacity, sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		for (i = 0; i < queue->count; ++i) {
+			new[i] = queue->tasks[(queue->first + i) %
+					      queue->capacity];
+		}
+
+		free(queue->tasks);
+		queue->tasks = new;
+		queue->capacity = new_capacity;
+		queue->first = 0;
+	}
+
+	queue->tasks[(queue->first + queue->count) % queue->capacity] = *task;
+	queue->count += 1;
+	return 0;
+}
+
+static bool queue_pop_back(task_queue_t *queue, pool_task_t *task)
+{
+	if (queue->count == 0)
+		return false;
+
+	queue->count -= 1;
+	*task = queue->tasks[(queue->first + queue->count) % queue->capacity];
+	return true;
+}
+
+static bool queue_pop_front(task_queue_t *queue, pool_task_t *task)
+{
+	if (queue->count == 0)
+		return false;
+
+	*task = queue->tasks[queue->first];
+	queue->first = (queue->first + 1) % queue->capacity;
+	queue->count -= 1;
+	return true;
+}
+
+static pool_worker_t *get_worker(thread_pool_t *pool)
+{
+	if (current_worker == NULL || current_worker->pool != pool)
+		return NULL;
+
+	return current_worker;
+}
+
+/* must be called with the lock held */
+static bool take_task(thread_pool_t *pool, pool_task_t *task)
+{
+	pool_worker_t *self = get_worker(pool);
+	size_t i, start;
+
+	if (self != NULL && queue_pop_back(pool->queues + self->index, task))
+		return true;
+
+	if (queue_pop_front(pool->queues + pool->worker_count, task))
+		return true;
+
+	start = self == NULL ? 0 : (self->index + 1);
+
+	for (i = 0; i < pool->worker_count; ++i) {
+		if (queue_pop_front(pool->queues +
+				    (start + i) % pool->worker_count, task)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* must be called with the lock held */
+static void finish_task(thread_pool_t *pool, thread_pool_group_t *group,
+			int ret)
+{
+	if (ret != 0 && group->status == 0)
+		group->status = ret;
+
+	group->pending -= 1;
+
+	if (group->pending == 0)
+		pthread_cond_broadcast(&pool->cond);
+}
+
+/* must be called with the lock held, which is temporarily released */
+static void run_task(thread_pool_t *pool, const pool_task_t *task)
+{
+	int ret;
+
+	pthread_mutex_unlock(&pool->lock);
+	ret = task->fn(task->arg);
+	pthread_mutex_lock(&pool->lock);
+
+	finish_task(pool, task->group, ret);
+}
+
+static void *worker_proc(void *arg)
+{
+	pool_worker_t *worker = arg;
+	thread_pool_t *pool = worker->pool;
+	pool_task_t task;
+
+	current_worker = worker;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (!pool->shutdown) {
+		if (take_task(pool, &task)) {
+			run_task(pool, &task);
+		} else {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void pool_destroy(object_t *obj)
+{
+	thread_pool_t *pool = (thread_pool_t *)obj;
+	size_t i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->worker_count; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (i = 0; i <= pool->worker_count; ++i)
+		free(pool->queues[i].tasks);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->queues);
+	free(pool->workers);
+	free(pool);
+}
+
+thread_pool_t *thread_pool_create(size_t num_threads)
+{
+	thread_pool_t *pool = calloc(1, sizeof(*pool));
+	size_t i, count;
+
+	if (pool == NULL)
+		goto fail_errno;
+
+	count = num_threads > 1 ? (num_threads - 1) : 0;
+
+	pool->workers = calloc(count > 0 ? count : 1,
+			       sizeof(pool->workers[0]));
+	pool->queues = calloc(count + 1, sizeof(pool->queues[0]));
+
+	if (pool->workers == NULL || pool->queues == NULL)
+		goto fail_errno;
+
+	if (pthread_mutex_init(&pool->lock, NULL) != 0)
+		goto fail;
+
+	if (pthread_cond_init(&pool->cond, NULL) != 0) {
+		pthread_mutex_destroy(&pool->lock);
+		goto fail;
+	}
+
+	/*
+	  If not all threads can be started, continue with fewer. Only
+	  workers use their own queue, so the extra ones stay empty. The
+	  workers wait for the lock until the final count is known.
+	 */
+	pthread_mutex_lock(&pool->lock);
+
+	for (i = 0; i < count; ++i) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+
+		if (pthread_create(&pool->workers[i].thread, NULL,
+				   worker_proc, pool->workers + i) != 0) {
+			break;
+		}
+
+		pool->worker_count += 1;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	((object_t *)pool)->refcount = 1;
+	((object_t *)pool)->destroy = pool_destroy;
+	return pool;
+fail_errno:
+	perror("creating thread pool");
+	goto out;
+fail:
+	fputs("Error initializing thread pool.\n", stderr);
+out:
+	if (pool != NULL) {
+		free(pool->workers);
+		free(pool->queues);
+		free(pool);
+	}
+	return NULL;
+}
+
+size_t thread_pool_get_thread_count(thread_pool_t *pool)
+{
+	return pool->worker_count + 1;
+}
+
+int thread_pool_submit(thread_pool_t *pool, thread_pool_group_t *group,
+		       int (*fn)(void *arg), void *arg)
+{
+	pool_worker_t *self;
+	pool_task_t task;
+	size_t index;
+	int ret;
+
+	task.fn = fn;
+	task.arg = arg;
+	task.group = group;
+
+	pthread_mutex_lock(&pool->lock);
+	self = get_worker(pool);
+	index = self == NULL ? pool->worker_count : self->index;
+
+	ret = queue_push(pool->queues + index, &task);
+	if (ret == 0) {
+		group->pending += 1;
+		pthread_cond_signal(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (ret != 0)
+		perror("submitting task to thread pool");
+
+	return ret;
+}
+
+int thread_pool_wait(thread_pool_t *pool, thread_pool_group_t *group)
+{
+	pool_task_t task;
+	int ret;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (group->pending > 0) {
+		if (take_task(pool, &task)) {
+			run_task(pool, &task);
+		} else {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+	}
+
+	ret = group->status;
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
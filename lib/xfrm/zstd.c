@@ -100,7 +100,7 @@ static xfrm_stream_t *stream_create(const compressor_config_t *cfg,
 	xfrm_zstd_t *zstd = calloc(1, sizeof(*zstd));
 	xfrm_stream_t *strm = (xfrm_stream_t *)zstd;
 	object_t *obj = (object_t *)strm;
-	(void)cfg;
+	size_t ret;
 
 	if (zstd == NULL) {
 		perror("creating zstd stream compressor");
@@ -111,6 +111,14 @@ static xfrm_stream_t *stream_create(const compressor_config_t *cfg,
 		zstd->cstrm = ZSTD_createCStream();
 		if (zstd->cstrm == NULL)
 			goto fail_strm;
+
+		ret = ZSTD_CCtx_setParameter(zstd->cstrm,
+					     ZSTD_c_compressionLevel,
+					     (int)cfg->level);
+		if (ZSTD_isError(ret)) {
+			ZSTD_freeCStream(zstd->cstrm);
+			goto fail_strm;
+		}
 	} else {
 		zstd->dstrm = ZSTD_createDStream();
 		if (zstd->dstrm == NULL)
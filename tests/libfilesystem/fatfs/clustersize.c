@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * clustersize.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "filesystem.h"
+#include "volume.h"
+#include "fstree.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#define CLUSTER_SIZE (32768)
+#define FILE_SIZE (3 * CLUSTER_SIZE + 100)
+
+#define SECTOR_SIZE (512)
+
+static uint8_t data[FILE_SIZE];
+static uint8_t buffer[FILE_SIZE];
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static uint16_t get_le16(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8);
+}
+
+static int set_cluster_size(filesystem_t *fs, uint64_t size)
+{
+	property_value_t value;
+	property_desc_t desc;
+	size_t i;
+
+	for (i = 0; i < object_get_property_count(fs); ++i) {
+		TEST_EQUAL_I(object_get_property_desc(fs, i, &desc), 0);
+
+		if (strcmp(desc.name, "clustersize") == 0)
+			break;
+	}
+
+	TEST_ASSERT(i < object_get_property_count(fs));
+
+	value.type = PROPERTY_TYPE_U64_SIZE;
+	value.value.u64 = size;
+	return object_set_property(fs, i, &value);
+}
+
+int main(void)
+{
+	uint32_t reserved, secs_per_fat, index, entry;
+	uint8_t super[SECTOR_SIZE], ent[32];
+	uint64_t fat_start, data_start;
+	filesystem_t *fs;
+	tree_node_t *n;
+	volume_t *vol;
+	size_t i;
+	int fd;
+
+	fd = open_temp_file("fat_clustersize.bin");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_from_fd("fat_clustersize.bin", dup(fd),
+			     10UL * 1024UL * 1024UL * 1024UL);
+	TEST_NOT_NULL(vol);
+
+	fs = filesystem_fatfs_create(vol);
+	TEST_NOT_NULL(fs);
+
+	/* only sane cluster sizes are accepted */
+	TEST_ASSERT(set_cluster_size(fs, 3000) != 0);
+	TEST_ASSERT(set_cluster_size(fs, 256) != 0);
+	TEST_ASSERT(set_cluster_size(fs, 131072) != 0);
+
+	TEST_EQUAL_I(set_cluster_size(fs, CLUSTER_SIZE), 0);
+	TEST_EQUAL_UI(fs->fstree->volume->blocksize, CLUSTER_SIZE);
+
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = i % 251;
+
+	n = fstree_add_file(fs->fstree, "/BIG.BIN");
+	TEST_NOT_NULL(n);
+	TEST_EQUAL_I(fstree_file_append(fs->fstree, n, data, sizeof(data)), 0);
+
+	/* cannot be changed once data has been added */
+	TEST_ASSERT(set_cluster_size(fs, 4096) != 0);
+
+	TEST_EQUAL_I(fs->build_format(fs), 0);
+	fs->fstree->volume->commit(fs->fstree->volume);
+	object_drop(fs);
+
+	vol->commit(vol);
+	object_drop(vol);
+
+	/* check the super block */
+	TEST_EQUAL_I(read_retry("fat_clustersize.bin", fd, 0,
+				super, sizeof(super)), 0);
+
+	TEST_EQUAL_UI(super[13], CLUSTER_SIZE / SECTOR_SIZE);
+	reserved = get_le16(super + 14);
+	secs_per_fat = get_le32(super + 36);
+
+	fat_start = (uint64_t)reserved * SECTOR_SIZE;
+	data_start = fat_start + 2 * (uint64_t)secs_per_fat * SECTOR_SIZE;
+
+	/* the root directory occupies the first cluster, the file the rest */
+	TEST_EQUAL_I(read_retry("fat_clustersize.bin", fd, data_start,
+				ent, sizeof(ent)), 0);
+	TEST_ASSERT(memcmp(ent, "BIG     BIN", 11) == 0);
+	TEST_EQUAL_UI(get_le32(ent + 28), FILE_SIZE);
+
+	index = get_le16(ent + 26) | ((uint32_t)get_le16(ent + 20) << 16);
+	TEST_EQUAL_UI(index, 3);
+
+	TEST_EQUAL_I(read_retry("fat_clustersize.bin", fd,
+				data_start + (index - 2) * CLUSTER_SIZE,
+				buffer, sizeof(buffer)), 0);
+	TEST_ASSERT(memcmp(buffer, data, sizeof(data)) == 0);
+
+	/* the cluster chain is contiguous, in both FATs */
+	for (i = 0; i < 4; ++i) {
+		TEST_EQUAL_I(read_retry("fat_clustersize.bin", fd,
+					fat_start + (index + i) * 4,
+					&entry, sizeof(entry)), 0);
+		entry = get_le32((uint8_t *)&entry);
+		TEST_EQUAL_UI(entry, i < 3 ? (index + i + 1) : 0x0FFFFFFF);
+
+		TEST_EQUAL_I(read_retry("fat_clustersize.bin", fd,
+					fat_start + secs_per_fat * SECTOR_SIZE +
+					(index + i) * 4,
+					&entry, sizeof(entry)), 0);
+		entry = get_le32((uint8_t *)&entry);
+		TEST_EQUAL_UI(entry, i < 3 ? (index + i + 1) : 0x0FFFFFFF);
+	}
+
+	close(fd);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * shortname.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "filesystem.h"
+#include "volume.h"
+#include "fstree.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#define FILE_COUNT (1200)
+
+#define SECTOR_SIZE (512)
+#define RESERVED_SECTORS (32)
+
+#define DIR_ENT_SIZE (32)
+#define DIR_ENT_LFN (0x0F)
+
+static uint8_t entries[(3 * FILE_COUNT + 1) * DIR_ENT_SIZE];
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+/*
+  The expected short name for the n-th generation of "long-file-name-*.txt".
+  The "~3" generation is taken by a file that is literally called that.
+ */
+static void expected_name(unsigned int index, char name[12])
+{
+	unsigned int gen = index + 1;
+	char gentext[8];
+	size_t len;
+
+	if (gen >= 3)
+		gen += 1;
+
+	len = snprintf(gentext, sizeof(gentext), "~%u", gen);
+
+	memcpy(name, "LONG-FIL", 8 - len);
+	memcpy(name + 8 - len, gentext, len);
+	memcpy(name + 8, "TXT", 3);
+	name[11] = '\0';
+}
+
+int main(void)
+{
+	uint32_t secs_per_fat, offset;
+	uint8_t super[SECTOR_SIZE];
+	const uint8_t *ent;
+	filesystem_t *fs;
+	char name[64];
+	tree_node_t *n;
+	volume_t *vol;
+	unsigned int i;
+	int fd, ret;
+
+	fd = open_temp_file("fat32_shortname.bin");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_from_fd("fat32_shortname.bin", dup(fd),
+			     10UL * 1024UL * 1024UL * 1024UL);
+	TEST_NOT_NULL(vol);
+
+	fs = filesystem_fatfs_create(vol);
+	TEST_NOT_NULL(fs);
+
+	/* a file that occupies one of the generated names */
+	n = fstree_add_file(fs->fstree, "/LONG-F~3.TXT");
+	TEST_NOT_NULL(n);
+
+	/* lots of files that share the same short name basis */
+	for (i = 0; i < FILE_COUNT; ++i) {
+		sprintf(name, "/long-file-name-%04u.txt", i);
+
+		n = fstree_add_file(fs->fstree, name);
+		TEST_NOT_NULL(n);
+	}
+
+	ret = fs->build_format(fs);
+	TEST_EQUAL_I(ret, 0);
+
+	fs->fstree->volume->commit(fs->fstree->volume);
+	object_drop(fs);
+
+	vol->commit(vol);
+	object_drop(vol);
+
+	/* the root directory is the first thing after the FATs */
+	ret = read_retry("fat32_shortname.bin", fd, 0, super, sizeof(super));
+	TEST_EQUAL_I(ret, 0);
+
+	secs_per_fat = get_le32(super + 36);
+	offset = (RESERVED_SECTORS + 2 * secs_per_fat) * SECTOR_SIZE;
+
+	ret = read_retry("fat32_shortname.bin", fd, offset,
+			 entries, sizeof(entries));
+	TEST_EQUAL_I(ret, 0);
+
+	/* the literal name comes first, without a long name entry */
+	ent = entries;
+	TEST_ASSERT(memcmp(ent, "LONG-F~3TXT", 11) == 0);
+	ent += DIR_ENT_SIZE;
+
+	/* the others skip the generation that is already taken */
+	for (i = 0; i < FILE_COUNT; ++i) {
+		TEST_EQUAL_UI(ent[11], DIR_ENT_LFN);
+		ent += DIR_ENT_SIZE;
+		TEST_EQUAL_UI(ent[11], DIR_ENT_LFN);
+		ent += DIR_ENT_SIZE;
+
+		expected_name(i, name);
+		TEST_ASSERT(memcmp(ent, name, 11) == 0);
+		ent += DIR_ENT_SIZE;
+	}
+
+	close(fd);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * android_sparse.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "util.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static uint16_t get_le16(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8);
+}
+
+static const uint8_t *check_chunk(const uint8_t *ptr, uint16_t type,
+				  uint32_t blocks, uint32_t size)
+{
+	TEST_EQUAL_UI(get_le16(ptr), type);
+	TEST_EQUAL_UI(get_le32(ptr + 4), blocks);
+	TEST_EQUAL_UI(get_le32(ptr + 8), size);
+	return ptr + 12;
+}
+
+int main(void)
+{
+	uint8_t block[4096];
+	const uint8_t *ptr;
+	struct stat sb;
+	volume_t *vol;
+	void *map;
+	size_t i, j;
+	int fd;
+
+	fd = open_temp_file("test_android_sparse.img");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_android_sparse_create("test_android_sparse.img",
+					   dup(fd), 1024 * 1024);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, sizeof(block));
+
+	/*
+	  block 0 and 1 are raw data, block 2 is a hole, blocks 3 and 4 are
+	  filled with a pattern and blocks 5 and 6 are raw data again, both
+	  partially written.
+	*/
+	for (i = 0; i < sizeof(block); ++i)
+		block[i] = i & 0xFF;
+
+	TEST_EQUAL_I(vol->write_block(vol, 0, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 1, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 6, block), 0);
+
+	memset(block, 0xAB, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 3, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 4, block), 0);
+
+	/* cut block 6 short, the rest must be padded with zeros */
+	TEST_EQUAL_I(vol->truncate(vol, 6 * 4096 + 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 7);
+
+	/*
+	  Block 5 is written and discarded again. The stale data must not
+	  show up once the first 100 bytes are written again.
+	 */
+	memset(block, 0xEE, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 5, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 5, NULL), 0);
+
+	for (i = 0; i < 100; ++i)
+		block[i] = i & 0xFF;
+
+	TEST_EQUAL_I(vol->write_partial_block(vol, 5, block, 0, 100), 0);
+
+	TEST_EQUAL_I(vol->read_block(vol, 5, block), 0);
+	for (i = 0; i < 100; ++i)
+		TEST_EQUAL_UI(block[i], i & 0xFF);
+	for (; i < 4096; ++i)
+		TEST_EQUAL_UI(block[i], 0);
+
+	/* a discarded block must not come back when growing the volume */
+	memset(block, 'A', sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 7, block), 0);
+	TEST_EQUAL_I(vol->discard_blocks(vol, 7, 1), 0);
+	TEST_EQUAL_I(vol->truncate(vol, 8 * 4096), 0);
+
+	TEST_EQUAL_I(vol->read_block(vol, 7, block), 0);
+	TEST_ASSERT(is_memory_zero(block, sizeof(block)));
+
+	TEST_EQUAL_I(vol->truncate(vol, 6 * 4096 + 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 7);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	/* the blocks are not where they were anymore */
+	TEST_ASSERT(vol->read_block(vol, 0, block) != 0);
+	TEST_ASSERT(vol->write_block(vol, 0, block) != 0);
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	/* check the result */
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, 28 + 4 * 12 + 4 * 4096 + 4);
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	TEST_ASSERT(map != MAP_FAILED);
+	ptr = map;
+
+	TEST_EQUAL_UI(get_le32(ptr), 0xed26ff3a);
+	TEST_EQUAL_UI(get_le16(ptr + 4), 1);
+	TEST_EQUAL_UI(get_le16(ptr + 6), 0);
+	TEST_EQUAL_UI(get_le16(ptr + 8), 28);
+	TEST_EQUAL_UI(get_le16(ptr + 10), 12);
+	TEST_EQUAL_UI(get_le32(ptr + 12), 4096);
+	TEST_EQUAL_UI(get_le32(ptr + 16), 7);
+	TEST_EQUAL_UI(get_le32(ptr + 20), 4);
+	ptr += 28;
+
+	ptr = check_chunk(ptr, 0xCAC1, 2, 12 + 2 * 4096);
+	for (i = 0; i < 2 * 4096; ++i)
+		TEST_EQUAL_UI(ptr[i], i & 0xFF);
+	ptr += 2 * 4096;
+
+	ptr = check_chunk(ptr, 0xCAC3, 1, 12);
+
+	ptr = check_chunk(ptr, 0xCAC2, 2, 16);
+	TEST_EQUAL_UI(get_le32(ptr), 0xABABABAB);
+	ptr += 4;
+
+	/* blocks 5 and 6 both hold 100 bytes of data */
+	ptr = check_chunk(ptr, 0xCAC1, 2, 12 + 2 * 4096);
+	for (j = 0; j < 2; ++j) {
+		for (i = 0; i < 100; ++i)
+			TEST_EQUAL_UI(ptr[i], i & 0xFF);
+		for (; i < 4096; ++i)
+			TEST_EQUAL_UI(ptr[i], 0);
+		ptr += 4096;
+	}
+
+	/* cleanup */
+	munmap(map, sb.st_size);
+	object_drop(vol);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * counting_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+
+int main(void)
+{
+	volume_io_stats_t stats;
+	volume_t *vol, *cvol;
+	uint8_t block[512];
+
+	memset(&stats, 0, sizeof(stats));
+
+	vol = volume_null_create("null", sizeof(block), 16 * sizeof(block));
+	TEST_NOT_NULL(vol);
+
+	cvol = volume_counting_create(vol, &stats);
+	TEST_NOT_NULL(cvol);
+	TEST_EQUAL_UI(((object_t *)vol)->refcount, 2);
+	object_drop(vol);
+
+	TEST_EQUAL_UI(cvol->blocksize, sizeof(block));
+	TEST_EQUAL_UI(cvol->get_max_block_count(cvol), 16);
+
+	/* everything is passed through */
+	memset(block, 0x55, sizeof(block));
+	TEST_EQUAL_I(cvol->write_block(cvol, 0, block), 0);
+	TEST_EQUAL_I(cvol->write_block(cvol, 1, block), 0);
+	TEST_EQUAL_I(cvol->write_partial_block(cvol, 2, block, 10, 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 3);
+
+	TEST_EQUAL_I(cvol->read_block(cvol, 0, block), 0);
+	TEST_EQUAL_I(cvol->read_partial_block(cvol, 1, block, 0, 20), 0);
+
+	TEST_EQUAL_I(cvol->move_block(cvol, 0, 5), 0);
+	TEST_EQUAL_I(cvol->move_block_partial(cvol, 1, 2, 0, 0, 30), 0);
+	TEST_EQUAL_UI(cvol->get_block_count(cvol), 6);
+
+	TEST_EQUAL_I(cvol->write_block(cvol, 5, NULL), 0);
+	TEST_EQUAL_I(cvol->write_partial_block(cvol, 2, NULL, 0, 8), 0);
+	TEST_EQUAL_I(cvol->discard_blocks(cvol, 1, 3), 0);
+	TEST_EQUAL_UI(cvol->get_block_count(cvol), 1);
+
+	TEST_EQUAL_I(cvol->truncate(cvol, 4 * sizeof(block)), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 4);
+
+	TEST_EQUAL_I(cvol->commit(cvol), 0);
+
+	/* check the counters */
+	TEST_EQUAL_UI(stats.read_calls, 2);
+	TEST_EQUAL_UI(stats.read_bytes, sizeof(block) + 20);
+	TEST_EQUAL_UI(stats.write_calls, 3);
+	TEST_EQUAL_UI(stats.write_bytes, 2 * sizeof(block) + 100);
+	TEST_EQUAL_UI(stats.move_calls, 2);
+	TEST_EQUAL_UI(stats.move_bytes, sizeof(block) + 30);
+	TEST_EQUAL_UI(stats.discard_calls, 3);
+	TEST_EQUAL_UI(stats.discard_bytes, 4 * sizeof(block) + 8);
+	TEST_EQUAL_UI(stats.commit_calls, 1);
+
+	object_drop(cvol);
+	return EXIT_SUCCESS;
+}
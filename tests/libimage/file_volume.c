@@ -8,6 +8,7 @@
 
 #include "test.h"
 #include "volume.h"
+#include "../../lib/image/basic/file_volume.h"
 
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -347,6 +348,62 @@ int main(void)
 		TEST_EQUAL_UI(((uint8_t *)block_buffer)[i], 0);
 	}
 
+	object_drop(vol);
+
+	/* import a sparse file with data in blocks 0 and 8 out of 16 */
+	fd = open_temp_file("testfile_sparse");
+	TEST_ASSERT(fd > 0);
+
+	TEST_EQUAL_I(ftruncate(fd, blocksz * 16), 0);
+
+	memset(block_buffer, 0x55, blocksz);
+	TEST_EQUAL_I(pwrite(fd, block_buffer, blocksz, 0), (int)blocksz);
+	TEST_EQUAL_I(pwrite(fd, block_buffer, blocksz, 8 * blocksz),
+		     (int)blocksz);
+
+	vol = volume_from_fd("testfile_sparse", fd, blocksz * 32);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 16);
+
+	/*
+	  Only the blocks with data are marked as used, plus the last one,
+	  which keeps the file size. Skipped if the filesystem the test runs
+	  on does not report the holes.
+	 */
+	if (lseek(fd, blocksz, SEEK_DATA) == (off_t)(8 * blocksz)) {
+		bitmap_t *bitmap = ((file_volume_t *)vol)->bitmap;
+
+		for (i = 0; i < 16; ++i) {
+			TEST_EQUAL_UI(bitmap_is_set(bitmap, i),
+				      (i == 0 || i == 8 || i == 15));
+		}
+	} else {
+		fputs("Filesystem does not report holes, not checking "
+		      "the used blocks of the sparse file.\n", stderr);
+	}
+
+	for (i = 0; i < 16; ++i) {
+		ret = vol->read_block(vol, i, block_buffer);
+		TEST_EQUAL_I(ret, 0);
+
+		for (j = 0; j < blocksz; ++j) {
+			TEST_EQUAL_UI(((uint8_t *)block_buffer)[j],
+				      (i == 0 || i == 8) ? 0x55 : 0);
+		}
+	}
+
+	/* discarding data must not drop the trailing hole */
+	ret = vol->discard_blocks(vol, 8, 1);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 16);
+
+	ret = vol->commit(vol);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = fstat(fd, &sb);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(sb.st_size, blocksz * 16);
+
 	/* cleanup */
 	object_drop(vol);
 	free(block_buffer);
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * file_volume_bmap.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "sha256.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define BMAP_FILE "test_file_volume.bmap"
+
+static void range_checksum(char *out, uint8_t fill, size_t size)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE], buffer[512];
+	sha256_t ctx;
+	size_t diff;
+
+	memset(buffer, fill, sizeof(buffer));
+	sha256_init(&ctx);
+
+	while (size > 0) {
+		diff = size > sizeof(buffer) ? sizeof(buffer) : size;
+		sha256_update(&ctx, buffer, diff);
+		size -= diff;
+	}
+
+	sha256_final(&ctx, digest);
+	sha256_to_hex(digest, out);
+}
+
+static char *read_text(const char *path)
+{
+	struct stat sb;
+	char *text;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	TEST_ASSERT(fd >= 0);
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+
+	text = calloc(1, sb.st_size + 1);
+	TEST_NOT_NULL(text);
+	TEST_EQUAL_I(read(fd, text, sb.st_size), (int)sb.st_size);
+
+	close(fd);
+	return text;
+}
+
+int main(void)
+{
+	char chksum[2 * SHA256_DIGEST_SIZE + 1], line[256], *text, *ptr;
+	uint8_t block[4096], digest[SHA256_DIGEST_SIZE];
+	volume_t *vol;
+	sha256_t ctx;
+	int fd, ret;
+
+	/* create a volume with data in blocks 0, 1, 5 and part of 7 */
+	fd = open_temp_file("test_file_volume_bmap.bin");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_from_fd("test_file_volume_bmap.bin", fd, 1024 * 1024);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, sizeof(block));
+
+	memset(block, 0x11, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 0, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 1, block), 0);
+
+	memset(block, 0x22, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 5, block), 0);
+
+	memset(block, 0x33, sizeof(block));
+	TEST_EQUAL_I(vol->write_partial_block(vol, 7, block, 0, 100), 0);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	/* generate the block map and check its contents */
+	unlink(BMAP_FILE);
+	ret = volume_write_bmap(vol, BMAP_FILE, NULL);
+	TEST_EQUAL_I(ret, 0);
+
+	text = read_text(BMAP_FILE);
+
+	TEST_NOT_NULL(strstr(text, "<bmap version=\"2.0\">"));
+	TEST_NOT_NULL(strstr(text, "<ImageSize> 28772 </ImageSize>"));
+	TEST_NOT_NULL(strstr(text, "<BlockSize> 4096 </BlockSize>"));
+	TEST_NOT_NULL(strstr(text, "<BlocksCount> 8 </BlocksCount>"));
+	TEST_NOT_NULL(strstr(text,
+			     "<MappedBlocksCount> 4 </MappedBlocksCount>"));
+	TEST_NOT_NULL(strstr(text, "<ChecksumType> sha256 </ChecksumType>"));
+
+	range_checksum(chksum, 0x11, 2 * 4096);
+	sprintf(line, "<Range chksum=\"%s\"> 0-1 </Range>", chksum);
+	TEST_NOT_NULL(strstr(text, line));
+
+	range_checksum(chksum, 0x22, 4096);
+	sprintf(line, "<Range chksum=\"%s\"> 5 </Range>", chksum);
+	TEST_NOT_NULL(strstr(text, line));
+
+	range_checksum(chksum, 0x33, 100);
+	sprintf(line, "<Range chksum=\"%s\"> 7 </Range>", chksum);
+	TEST_NOT_NULL(strstr(text, line));
+
+	/* verify the checksum of the file itself */
+	ptr = strstr(text, "<BmapFileChecksum> ");
+	TEST_NOT_NULL(ptr);
+	ptr += strlen("<BmapFileChecksum> ");
+
+	memcpy(chksum, ptr, 2 * SHA256_DIGEST_SIZE);
+	chksum[2 * SHA256_DIGEST_SIZE] = '\0';
+	memset(ptr, '0', 2 * SHA256_DIGEST_SIZE);
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, text, strlen(text));
+	sha256_final(&ctx, digest);
+	sha256_to_hex(digest, line);
+	TEST_STR_EQUAL(chksum, line);
+
+	/* cleanup */
+	free(text);
+	unlink(BMAP_FILE);
+	object_drop(vol);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * gptdisk.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#define SECTOR_SIZE (512)
+#define DISK_SECTORS (64 * 1024 * 1024 / SECTOR_SIZE)
+#define PART_COUNT (33)
+#define ENTRY_SIZE (128)
+#define ENTRY_COUNT (128)
+
+static const uint8_t linux_guid[16] = {
+	0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47,
+	0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4,
+};
+
+static const uint8_t swap_guid[16] = {
+	0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43,
+	0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F,
+};
+
+static uint8_t entries[ENTRY_COUNT * ENTRY_SIZE];
+static uint8_t backup[ENTRY_COUNT * ENTRY_SIZE];
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *ptr)
+{
+	return get_le32(ptr) | ((uint64_t)get_le32(ptr + 4) << 32);
+}
+
+static int set_property(void *obj, const char *name,
+			const property_value_t *value)
+{
+	property_desc_t desc;
+	size_t i;
+
+	for (i = 0; i < object_get_property_count(obj); ++i) {
+		TEST_EQUAL_I(object_get_property_desc(obj, i, &desc), 0);
+
+		if (strcmp(desc.name, name) == 0)
+			return object_set_property(obj, i, value);
+	}
+
+	return -1;
+}
+
+static void check_header(const uint8_t *hdr, uint64_t current,
+			 uint64_t backup_lba, uint64_t entries_lba)
+{
+	uint8_t temp[92];
+
+	TEST_ASSERT(memcmp(hdr, "EFI PART", 8) == 0);
+	TEST_EQUAL_UI(get_le32(hdr + 8), 0x00010000);
+	TEST_EQUAL_UI(get_le32(hdr + 12), 92);
+
+	memcpy(temp, hdr, sizeof(temp));
+	memset(temp + 16, 0, 4);
+	TEST_EQUAL_UI(get_le32(hdr + 16), crc32_ieee(0, temp, sizeof(temp)));
+
+	TEST_EQUAL_UI(get_le64(hdr + 24), current);
+	TEST_EQUAL_UI(get_le64(hdr + 32), backup_lba);
+	TEST_EQUAL_UI(get_le64(hdr + 40), 34);
+	TEST_EQUAL_UI(get_le64(hdr + 48), DISK_SECTORS - 34);
+	TEST_EQUAL_UI(get_le64(hdr + 72), entries_lba);
+	TEST_EQUAL_UI(get_le32(hdr + 80), ENTRY_COUNT);
+	TEST_EQUAL_UI(get_le32(hdr + 84), ENTRY_SIZE);
+	TEST_EQUAL_UI(get_le32(hdr + 88), crc32_ieee(0, entries,
+						     sizeof(entries)));
+}
+
+int main(void)
+{
+	uint8_t sector[SECTOR_SIZE], primary[SECTOR_SIZE];
+	volume_t *vol, *part[PART_COUNT];
+	property_value_t value;
+	partition_mgr_t *gpt;
+	const uint8_t *ent;
+	uint64_t flags;
+	int ret, fd;
+	size_t i;
+
+	/* setup temp file volume with a GPT disk on top */
+	fd = open_temp_file("test_gptdisk.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_gptdisk.bin", dup(fd),
+			     DISK_SECTORS * SECTOR_SIZE);
+	TEST_NOT_NULL(vol);
+
+	gpt = gptdisk_create(vol);
+	TEST_NOT_NULL(gpt);
+	TEST_EQUAL_UI(((object_t *)vol)->refcount, 2);
+
+	/* more partitions than MBR could ever do, the last one fills */
+	for (i = 0; i < PART_COUNT; ++i) {
+		if (i == 0) {
+			flags = COMMON_PARTITION_FLAG_GROW;
+		} else if (i == (PART_COUNT - 1)) {
+			flags = COMMON_PARTITION_FLAG_FILL;
+		} else {
+			flags = 0;
+		}
+
+		part[i] = (volume_t *)gpt->create_parition(gpt, i == 1 ?
+							   3000 : 10, flags);
+		TEST_NOT_NULL(part[i]);
+		TEST_EQUAL_UI(part[i]->blocksize, SECTOR_SIZE);
+	}
+
+	TEST_EQUAL_UI(part[0]->get_min_block_count(part[0]), 2048);
+	TEST_EQUAL_UI(part[1]->get_min_block_count(part[1]), 4096);
+
+	value.type = PROPERTY_TYPE_STRING;
+	value.value.string = "swap";
+	TEST_EQUAL_I(set_property(part[1], "name", &value), 0);
+
+	value.value.string = "this name is way too long for a GPT entry";
+	TEST_ASSERT(set_property(part[1], "name", &value) != 0);
+
+	value.type = PROPERTY_TYPE_ENUM;
+	value.value.ival = GPT_PARTITION_TYPE_LINUX_SWAP >> 20;
+	TEST_EQUAL_I(set_property(part[1], "type", &value), 0);
+
+	/* write to the partitions */
+	memset(sector, 0, sizeof(sector));
+	strcpy((char *)sector, "Hello, World!");
+	TEST_EQUAL_I(part[0]->write_block(part[0], 0, sector), 0);
+
+	memset(sector, 0, sizeof(sector));
+	strcpy((char *)sector, "A different string");
+	TEST_EQUAL_I(part[1]->write_block(part[1], 4095, sector), 0);
+
+	/* a write that causes the first partition to grow */
+	memset(sector, 0, sizeof(sector));
+	strcpy((char *)sector, "Foo");
+	TEST_EQUAL_I(part[0]->write_block(part[0], 2048, sector), 0);
+
+	TEST_EQUAL_I(part[1]->read_block(part[1], 4095, sector), 0);
+	TEST_ASSERT(strcmp((char *)sector, "A different string") == 0);
+
+	/* non-growing partitions cannot be written past the end */
+	TEST_ASSERT(part[2]->write_block(part[2], 2048, sector) != 0);
+
+	TEST_EQUAL_I(gpt->commit(gpt), 0);
+
+	object_drop(gpt);
+	for (i = 0; i < PART_COUNT; ++i)
+		object_drop(part[i]);
+	TEST_EQUAL_UI(((object_t *)vol)->refcount, 1);
+	object_drop(vol);
+
+	/* protective MBR */
+	TEST_EQUAL_I(read_retry("test_gptdisk.bin", fd, 0,
+				sector, sizeof(sector)), 0);
+	TEST_EQUAL_UI(sector[510], 0x55);
+	TEST_EQUAL_UI(sector[511], 0xAA);
+	TEST_EQUAL_UI(sector[446 + 4], 0xEE);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 8), 1);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 12), DISK_SECTORS - 1);
+
+	/* primary and backup GPT */
+	TEST_EQUAL_I(read_retry("test_gptdisk.bin", fd, 2 * SECTOR_SIZE,
+				entries, sizeof(entries)), 0);
+	TEST_EQUAL_I(read_retry("test_gptdisk.bin", fd,
+				(DISK_SECTORS - 33) * SECTOR_SIZE,
+				backup, sizeof(backup)), 0);
+	TEST_ASSERT(memcmp(entries, backup, sizeof(entries)) == 0);
+
+	TEST_EQUAL_I(read_retry("test_gptdisk.bin", fd, SECTOR_SIZE,
+				primary, sizeof(primary)), 0);
+	check_header(primary, 1, DISK_SECTORS - 1, 2);
+
+	TEST_EQUAL_I(read_retry("test_gptdisk.bin", fd,
+				(DISK_SECTORS - 1) * SECTOR_SIZE,
+				sector, sizeof(sector)), 0);
+	check_header(sector, DISK_SECTORS - 1, 1, DISK_SECTORS - 33);
+	TEST_ASSERT(memcmp(primary + 56, sector + 56, 16) == 0);
+
+	/* partition entries */
+	ret = read_retry("test_gptdisk.bin", fd, 3 * 1024 * 1024 +
+			 4095 * SECTOR_SIZE, sector, sizeof(sector));
+	TEST_EQUAL_I(ret, 0);
+	TEST_ASSERT(strcmp((char *)sector, "A different string") == 0);
+
+	for (i = 0; i < ENTRY_COUNT; ++i) {
+		ent = entries + i * ENTRY_SIZE;
+
+		if (i >= PART_COUNT) {
+			TEST_ASSERT(is_memory_zero(ent, ENTRY_SIZE));
+			continue;
+		}
+
+		if (i == 1) {
+			TEST_ASSERT(memcmp(ent, swap_guid, 16) == 0);
+			TEST_ASSERT(memcmp(ent + 56, "s\0w\0a\0p\0\0", 9) == 0);
+		} else {
+			TEST_ASSERT(memcmp(ent, linux_guid, 16) == 0);
+		}
+
+		TEST_ASSERT(!is_memory_zero(ent + 16, 16));
+		TEST_ASSERT(memcmp(ent + 16, entries + 16 +
+				   ((i + 1) % PART_COUNT) * ENTRY_SIZE,
+				   16) != 0);
+
+		switch (i) {
+		case 0:
+			TEST_EQUAL_UI(get_le64(ent + 32), 2048);
+			TEST_EQUAL_UI(get_le64(ent + 40), 6143);
+			break;
+		case 1:
+			TEST_EQUAL_UI(get_le64(ent + 32), 6144);
+			TEST_EQUAL_UI(get_le64(ent + 40), 10239);
+			break;
+		case PART_COUNT - 1:
+			TEST_EQUAL_UI(get_le64(ent + 32), 10240 + 30 * 2048);
+			TEST_EQUAL_UI(get_le64(ent + 40),
+				      (DISK_SECTORS - 2048) - 1);
+			break;
+		default:
+			TEST_EQUAL_UI(get_le64(ent + 32),
+				      10240 + (i - 2) * 2048);
+			TEST_EQUAL_UI(get_le64(ent + 40),
+				      10240 + (i - 1) * 2048 - 1);
+			break;
+		}
+	}
+
+	close(fd);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * locked_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+
+#include <pthread.h>
+
+#define NUM_THREADS (4)
+#define NUM_BLOCKS (256)
+
+static volume_t *vol;
+
+/* the threads write interleaved blocks, so they constantly collide */
+static void *populate(void *arg)
+{
+	size_t i, t = (size_t)arg;
+	uint8_t *block;
+
+	block = malloc(vol->blocksize);
+	if (block == NULL)
+		return arg;
+
+	for (i = t; i < NUM_BLOCKS; i += NUM_THREADS) {
+		memset(block, (int)(i & 0xFF), vol->blocksize);
+
+		if (vol->write_block(vol, i, block))
+			break;
+	}
+
+	free(block);
+	return i < NUM_BLOCKS ? arg : NULL;
+}
+
+static void *check(void *arg)
+{
+	size_t i, j, t = (size_t)arg;
+	uint8_t *block;
+
+	block = malloc(vol->blocksize);
+	if (block == NULL)
+		return arg;
+
+	for (i = t; i < NUM_BLOCKS; i += NUM_THREADS) {
+		if (vol->read_block(vol, i, block))
+			break;
+
+		for (j = 0; j < vol->blocksize; ++j) {
+			if (block[j] != (i & 0xFF))
+				break;
+		}
+
+		if (j < vol->blocksize)
+			break;
+	}
+
+	free(block);
+	return i < NUM_BLOCKS ? arg : NULL;
+}
+
+static void run_threads(void *(*fun)(void *))
+{
+	pthread_t thread[NUM_THREADS];
+	void *ret;
+	size_t i;
+
+	for (i = 0; i < NUM_THREADS; ++i) {
+		TEST_EQUAL_I(pthread_create(thread + i, NULL, fun,
+					    (void *)i), 0);
+	}
+
+	for (i = 0; i < NUM_THREADS; ++i) {
+		TEST_EQUAL_I(pthread_join(thread[i], &ret), 0);
+		TEST_NULL(ret);
+	}
+}
+
+int main(void)
+{
+	volume_t *file;
+	int fd;
+
+	fd = open_temp_file("test_locked_volume.bin");
+	TEST_ASSERT(fd >= 0);
+
+	file = volume_from_fd("test_locked_volume.bin", fd,
+			      NUM_BLOCKS * 4096);
+	TEST_NOT_NULL(file);
+
+	vol = volume_locked_create(file);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, file->blocksize);
+	object_drop(file);
+
+	run_threads(populate);
+	TEST_EQUAL_UI(vol->get_block_count(vol), NUM_BLOCKS);
+
+	run_threads(check);
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	object_drop(vol);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mbrdisk2.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define SECTOR_SIZE (512)
+#define DISK_SIZE (8 * 1024 * 1024)
+
+/*
+  The first partition grows past the gap it initially has and pushes
+  the second one back, while the second one is being written to.
+ */
+static const uint64_t sector_count[2] = { 10000, 2048 };
+
+static volume_t *part[2];
+
+static void fill_sector(char *sector, size_t i, uint64_t index)
+{
+	memset(sector, 0, SECTOR_SIZE);
+	snprintf(sector, SECTOR_SIZE, "partition %zu, sector %" PRIu64,
+		 i, index);
+}
+
+static void *populate(void *arg)
+{
+	size_t i = (size_t)arg;
+	char sector[SECTOR_SIZE];
+	uint64_t j;
+
+	for (j = 0; j < sector_count[i]; ++j) {
+		fill_sector(sector, i, j);
+
+		if (part[i]->write_block(part[i], j, sector))
+			return arg;
+	}
+
+	return NULL;
+}
+
+static void check_partition(size_t i)
+{
+	char sector[SECTOR_SIZE], expected[SECTOR_SIZE];
+	uint64_t j;
+
+	for (j = 0; j < sector_count[i]; ++j) {
+		fill_sector(expected, i, j);
+
+		TEST_EQUAL_I(part[i]->read_block(part[i], j, sector), 0);
+		TEST_ASSERT(memcmp(sector, expected, SECTOR_SIZE) == 0);
+	}
+}
+
+int main(void)
+{
+	pthread_t thread[2];
+	partition_mgr_t *mbr;
+	volume_t *vol;
+	void *ret;
+	size_t i;
+	int fd;
+
+	fd = open_temp_file("test_mbrdisk2.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_mbrdisk2.bin", fd, DISK_SIZE);
+	TEST_NOT_NULL(vol);
+
+	mbr = mbrdisk_create(vol);
+	TEST_NOT_NULL(mbr);
+
+	for (i = 0; i < 2; ++i) {
+		part[i] = (volume_t *)mbr->create_parition(mbr, 0,
+						COMMON_PARTITION_FLAG_GROW);
+		TEST_NOT_NULL(part[i]);
+	}
+
+	/* populate both partitions at the same time */
+	for (i = 0; i < 2; ++i) {
+		TEST_EQUAL_I(pthread_create(thread + i, NULL, populate,
+					    (void *)i), 0);
+	}
+
+	for (i = 0; i < 2; ++i) {
+		TEST_EQUAL_I(pthread_join(thread[i], &ret), 0);
+		TEST_NULL(ret);
+	}
+
+	for (i = 0; i < 2; ++i)
+		check_partition(i);
+
+	/* still intact after packing them together */
+	TEST_EQUAL_I(mbr->commit(mbr), 0);
+
+	for (i = 0; i < 2; ++i)
+		check_partition(i);
+
+	for (i = 0; i < 2; ++i)
+		object_drop(part[i]);
+
+	object_drop(mbr);
+	object_drop(vol);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * null_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+
+static uint64_t get_size(volume_t *vol)
+{
+	size_t i, count = object_get_property_count(vol);
+	property_value_t value;
+	property_desc_t desc;
+
+	for (i = 0; i < count; ++i) {
+		TEST_EQUAL_I(object_get_property_desc(vol, i, &desc), 0);
+
+		if (strcmp(desc.name, "size") == 0) {
+			TEST_EQUAL_I(object_get_property(vol, i, &value), 0);
+			TEST_EQUAL_UI(value.type, PROPERTY_TYPE_U64_SIZE);
+			return value.value.u64;
+		}
+	}
+
+	TEST_ASSERT(0);
+	return 0;
+}
+
+int main(void)
+{
+	uint8_t block[1024];
+	property_value_t value;
+	property_desc_t desc;
+	volume_t *vol;
+	size_t i;
+
+	vol = volume_null_create("null", sizeof(block), 10 * sizeof(block));
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, sizeof(block));
+	TEST_EQUAL_UI(vol->get_block_count(vol), 0);
+	TEST_EQUAL_UI(vol->get_max_block_count(vol), 10);
+	TEST_EQUAL_UI(get_size(vol), 0);
+
+	/* the file volume properties are inherited */
+	for (i = 0; i < object_get_property_count(vol); ++i) {
+		TEST_EQUAL_I(object_get_property_desc(vol, i, &desc), 0);
+		if (strcmp(desc.name, "maxsize") == 0)
+			break;
+	}
+
+	TEST_ASSERT(i < object_get_property_count(vol));
+	value.type = PROPERTY_TYPE_U64_SIZE;
+	value.value.u64 = 8 * sizeof(block);
+	TEST_EQUAL_I(object_set_property(vol, i, &value), 0);
+	TEST_EQUAL_UI(vol->get_max_block_count(vol), 8);
+
+	/* data is dropped, only the size is tracked */
+	memset(block, 0xAB, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 3, block), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 4);
+	TEST_EQUAL_UI(get_size(vol), 4 * sizeof(block));
+
+	TEST_EQUAL_I(vol->write_partial_block(vol, 5, block, 0, 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 6);
+	TEST_EQUAL_UI(get_size(vol), 5 * sizeof(block) + 100);
+
+	TEST_EQUAL_I(vol->read_block(vol, 3, block), 0);
+	for (i = 0; i < sizeof(block); ++i)
+		TEST_EQUAL_UI(block[i], 0);
+
+	TEST_ASSERT(vol->write_block(vol, 8, block) != 0);
+
+	/* moving and discarding */
+	TEST_EQUAL_I(vol->move_block(vol, 3, 6), 0);
+	TEST_EQUAL_UI(get_size(vol), 7 * sizeof(block));
+
+	TEST_EQUAL_I(vol->discard_blocks(vol, 5, 3), 0);
+	TEST_EQUAL_UI(get_size(vol), 4 * sizeof(block));
+
+	TEST_EQUAL_I(vol->truncate(vol, 2 * sizeof(block) + 10), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), 3);
+	TEST_EQUAL_UI(get_size(vol), 2 * sizeof(block) + 10);
+
+	TEST_ASSERT(vol->truncate(vol, 9 * sizeof(block)) != 0);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	object_drop(vol);
+	return EXIT_SUCCESS;
+}
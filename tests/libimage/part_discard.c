@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * part_discard.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#define SECTOR_SIZE (512)
+#define DISK_SIZE (16 * 1024 * 1024)
+#define PART_SECTORS (8192)
+#define ZERO_SECTORS (4096)
+
+static uint8_t data[PART_SECTORS * SECTOR_SIZE];
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *ptr)
+{
+	return get_le32(ptr) | ((uint64_t)get_le32(ptr + 4) << 32);
+}
+
+/*
+  Fill a growable partition, then overwrite the tail with zeros in one go,
+  like a filesystem clearing its allocation table does. The partition
+  must still cover the zeroed range after commit.
+ */
+static void populate(partition_mgr_t *mgr)
+{
+	volume_t *part;
+
+	part = (volume_t *)mgr->create_parition(mgr, 0,
+						COMMON_PARTITION_FLAG_GROW);
+	TEST_NOT_NULL(part);
+
+	memset(data, 0xAA, sizeof(data));
+	TEST_EQUAL_I(volume_write(part, 0, data, sizeof(data)), 0);
+
+	memset(data + (PART_SECTORS - ZERO_SECTORS) * SECTOR_SIZE, 0,
+	       ZERO_SECTORS * SECTOR_SIZE);
+	TEST_EQUAL_I(volume_write(part, 0, data, sizeof(data)), 0);
+
+	TEST_EQUAL_I(mgr->commit(mgr), 0);
+	object_drop(part);
+}
+
+static void test_mbr(void)
+{
+	uint8_t sector[SECTOR_SIZE];
+	partition_mgr_t *mgr;
+	volume_t *vol;
+	int fd;
+
+	fd = open_temp_file("test_part_discard1.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_part_discard1.bin", dup(fd), DISK_SIZE);
+	TEST_NOT_NULL(vol);
+
+	mgr = mbrdisk_create(vol);
+	TEST_NOT_NULL(mgr);
+
+	populate(mgr);
+
+	object_drop(mgr);
+	object_drop(vol);
+
+	TEST_EQUAL_I(read_retry("test_part_discard1.bin", fd, 0,
+				sector, sizeof(sector)), 0);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 8), 2048);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 12), PART_SECTORS);
+
+	TEST_ASSERT(lseek(fd, 0, SEEK_END) >=
+		    (2048 + PART_SECTORS) * SECTOR_SIZE);
+	close(fd);
+}
+
+static void test_gpt(void)
+{
+	uint8_t sector[SECTOR_SIZE];
+	partition_mgr_t *mgr;
+	volume_t *vol;
+	int fd;
+
+	fd = open_temp_file("test_part_discard2.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_part_discard2.bin", dup(fd), DISK_SIZE);
+	TEST_NOT_NULL(vol);
+
+	mgr = gptdisk_create(vol);
+	TEST_NOT_NULL(mgr);
+
+	populate(mgr);
+
+	object_drop(mgr);
+	object_drop(vol);
+
+	/* first entry of the partition array */
+	TEST_EQUAL_I(read_retry("test_part_discard2.bin", fd,
+				2 * SECTOR_SIZE, sector, sizeof(sector)), 0);
+	TEST_EQUAL_UI(get_le64(sector + 32), 2048);
+	TEST_EQUAL_UI(get_le64(sector + 40), 2048 + PART_SECTORS - 1);
+	close(fd);
+}
+
+int main(void)
+{
+	test_mbr();
+	test_gpt();
+
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
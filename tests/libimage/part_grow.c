@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * part_grow.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#define SECTOR_SIZE (512)
+#define DISK_SIZE (16 * 1024 * 1024)
+#define STEP_SECTORS (2048)
+#define STEP_SIZE (STEP_SECTORS * SECTOR_SIZE)
+#define NUM_STEPS (12)
+#define GROW_SECTORS (NUM_STEPS * STEP_SECTORS)
+#define NEXT_SECTORS (2048)
+#define NEXT_SIZE (NEXT_SECTORS * SECTOR_SIZE)
+
+/*
+  With the 16 MiB disk, the first partition initially gets a gap of 7 MiB
+  to grow into. Once it is used up, the second partition is moved once,
+  with a new gap of 5 MiB, so the remaining steps do not move anything.
+ */
+#define GAP_STEPS (8)
+
+static uint8_t data[NEXT_SIZE];
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *ptr)
+{
+	return get_le32(ptr) | ((uint64_t)get_le32(ptr + 4) << 32);
+}
+
+static void fill_next(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = ((i / SECTOR_SIZE) & 0xFF) ^ 0x5A;
+}
+
+/*
+  Create a growable partition followed by a fixed size one that already
+  holds data, then grow the first one step by step. The data of the second
+  partition must be moved once while growing and once more on commit,
+  when the partitions are packed together.
+ */
+static void populate(partition_mgr_t *mgr, volume_io_stats_t *stats)
+{
+	volume_t *grow, *next;
+	size_t i;
+
+	grow = (volume_t *)mgr->create_parition(mgr, 0,
+						COMMON_PARTITION_FLAG_GROW);
+	TEST_NOT_NULL(grow);
+
+	next = (volume_t *)mgr->create_parition(mgr, NEXT_SECTORS, 0);
+	TEST_NOT_NULL(next);
+
+	fill_next();
+	TEST_EQUAL_I(volume_write(next, 0, data, sizeof(data)), 0);
+
+	for (i = 0; i < NUM_STEPS; ++i) {
+		memset(data, (int)(i + 1), STEP_SIZE);
+		TEST_EQUAL_I(volume_write(grow, (uint64_t)i * STEP_SIZE,
+					  data, STEP_SIZE), 0);
+
+		if (i < GAP_STEPS)
+			TEST_EQUAL_UI(stats->move_bytes, 0);
+	}
+
+	TEST_EQUAL_UI(grow->get_block_count(grow), GROW_SECTORS);
+	TEST_EQUAL_UI(stats->move_bytes, NEXT_SIZE);
+
+	TEST_EQUAL_I(mgr->commit(mgr), 0);
+	TEST_EQUAL_UI(stats->move_bytes, 2 * NEXT_SIZE);
+
+	object_drop(next);
+	object_drop(grow);
+}
+
+static void check_data(const char *filename, int fd)
+{
+	uint8_t buffer[STEP_SIZE];
+	size_t i, j;
+
+	for (i = 0; i < NUM_STEPS; ++i) {
+		TEST_EQUAL_I(read_retry(filename, fd,
+					(2048 + i * STEP_SECTORS) * SECTOR_SIZE,
+					buffer, sizeof(buffer)), 0);
+
+		for (j = 0; j < sizeof(buffer); ++j) {
+			if (buffer[j] != (i + 1))
+				break;
+		}
+
+		TEST_EQUAL_UI(j, sizeof(buffer));
+	}
+
+	fill_next();
+	TEST_EQUAL_I(read_retry(filename, fd,
+				(2048 + GROW_SECTORS) * SECTOR_SIZE,
+				buffer, NEXT_SIZE), 0);
+	TEST_ASSERT(memcmp(buffer, data, NEXT_SIZE) == 0);
+}
+
+static void test_mbr(void)
+{
+	uint8_t sector[SECTOR_SIZE];
+	volume_io_stats_t stats;
+	partition_mgr_t *mgr;
+	volume_t *vol, *cvol;
+	int fd;
+
+	fd = open_temp_file("test_part_grow1.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_part_grow1.bin", dup(fd), DISK_SIZE);
+	TEST_NOT_NULL(vol);
+
+	memset(&stats, 0, sizeof(stats));
+	cvol = volume_counting_create(vol, &stats);
+	TEST_NOT_NULL(cvol);
+
+	mgr = mbrdisk_create(cvol);
+	TEST_NOT_NULL(mgr);
+
+	populate(mgr, &stats);
+
+	object_drop(mgr);
+	object_drop(cvol);
+	object_drop(vol);
+
+	TEST_EQUAL_I(read_retry("test_part_grow1.bin", fd, 0,
+				sector, sizeof(sector)), 0);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 8), 2048);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 12), GROW_SECTORS);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 16 + 8), 2048 + GROW_SECTORS);
+	TEST_EQUAL_UI(get_le32(sector + 446 + 16 + 12), NEXT_SECTORS);
+
+	check_data("test_part_grow1.bin", fd);
+	close(fd);
+}
+
+static void test_gpt(void)
+{
+	uint8_t sector[SECTOR_SIZE];
+	volume_io_stats_t stats;
+	partition_mgr_t *mgr;
+	volume_t *vol, *cvol;
+	int fd;
+
+	fd = open_temp_file("test_part_grow2.bin");
+	TEST_ASSERT(fd >= 0);
+
+	vol = volume_from_fd("test_part_grow2.bin", dup(fd), DISK_SIZE);
+	TEST_NOT_NULL(vol);
+
+	memset(&stats, 0, sizeof(stats));
+	cvol = volume_counting_create(vol, &stats);
+	TEST_NOT_NULL(cvol);
+
+	mgr = gptdisk_create(cvol);
+	TEST_NOT_NULL(mgr);
+
+	populate(mgr, &stats);
+
+	object_drop(mgr);
+	object_drop(cvol);
+	object_drop(vol);
+
+	/* first two entries of the partition array */
+	TEST_EQUAL_I(read_retry("test_part_grow2.bin", fd,
+				2 * SECTOR_SIZE, sector, sizeof(sector)), 0);
+	TEST_EQUAL_UI(get_le64(sector + 32), 2048);
+	TEST_EQUAL_UI(get_le64(sector + 40), 2048 + GROW_SECTORS - 1);
+	TEST_EQUAL_UI(get_le64(sector + 128 + 32), 2048 + GROW_SECTORS);
+	TEST_EQUAL_UI(get_le64(sector + 128 + 40),
+		      2048 + GROW_SECTORS + NEXT_SECTORS - 1);
+
+	check_data("test_part_grow2.bin", fd);
+	close(fd);
+}
+
+int main(void)
+{
+	test_mbr();
+	test_gpt();
+
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * qcow2.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "xfrm.h"
+#include "util.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CLUSTER_SIZE (65536)
+#define BLOCK_COUNT (66)
+#define VOLUME_SIZE (BLOCK_COUNT * 4096)
+
+#define OFFSET_MASK ((((uint64_t)1 << 56) - 1) & ~((uint64_t)511))
+#define COMPRESSED_MASK (((uint64_t)1 << 54) - 1)
+
+static uint8_t expect[VOLUME_SIZE];
+static uint8_t guest[CLUSTER_SIZE];
+
+/*
+  A dummy compressor that only strips trailing zero bytes from a cluster
+  and prefixes the remaining length, so compressed clusters can be tested
+  without depending on an actual compression library.
+ */
+static int dummy_process_data(xfrm_stream_t *stream, const void *in,
+			      uint32_t in_size, void *out, uint32_t out_size,
+			      uint32_t *in_read, uint32_t *out_written,
+			      int flush_mode)
+{
+	const uint8_t *src = in;
+	uint8_t *dst = out;
+	uint32_t len = in_size;
+	(void)stream; (void)flush_mode;
+
+	while (len > 0 && src[len - 1] == 0)
+		--len;
+
+	if (out_size < len + 4)
+		return XFRM_STREAM_ERROR;
+
+	memcpy(dst, &len, 4);
+	memcpy(dst + 4, src, len);
+
+	*in_read += in_size;
+	*out_written += len + 4;
+	return XFRM_STREAM_END;
+}
+
+static void dummy_destroy(object_t *obj)
+{
+	free(obj);
+}
+
+static xfrm_stream_t *dummy_compressor_create(void)
+{
+	xfrm_stream_t *strm = calloc(1, sizeof(*strm));
+
+	TEST_NOT_NULL(strm);
+	strm->process_data = dummy_process_data;
+	((object_t *)strm)->refcount = 1;
+	((object_t *)strm)->destroy = dummy_destroy;
+	return strm;
+}
+
+static uint64_t get_be64(const uint8_t *ptr)
+{
+	uint64_t value = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		value = (value << 8) | ptr[i];
+
+	return value;
+}
+
+static uint32_t get_be32(const uint8_t *ptr)
+{
+	return ((uint32_t)ptr[0] << 24) | (ptr[1] << 16) |
+		(ptr[2] << 8) | ptr[3];
+}
+
+static uint16_t get_be16(const uint8_t *ptr)
+{
+	return (ptr[0] << 8) | ptr[1];
+}
+
+static uint16_t get_refcount(const uint8_t *img, uint64_t cluster)
+{
+	uint64_t rc_table = get_be64(img + 48);
+	uint64_t rc_block;
+
+	rc_block = get_be64(img + rc_table + (cluster / 32768) * 8);
+	TEST_ASSERT(rc_block != 0);
+
+	return get_be16(img + rc_block + (cluster % 32768) * 2);
+}
+
+static void read_guest_cluster(const uint8_t *img, uint64_t index)
+{
+	uint64_t l1_table = get_be64(img + 40);
+	uint64_t l2_table, entry, offset;
+	uint32_t len;
+
+	memset(guest, 0, sizeof(guest));
+
+	l2_table = get_be64(img + l1_table + (index / 8192) * 8);
+	if (l2_table == 0)
+		return;
+
+	TEST_ASSERT((l2_table >> 63) != 0);
+	l2_table &= OFFSET_MASK;
+	TEST_EQUAL_UI(get_refcount(img, l2_table / CLUSTER_SIZE), 1);
+
+	entry = get_be64(img + l2_table + (index % 8192) * 8);
+	if (entry == 0)
+		return;
+
+	if (entry & ((uint64_t)1 << 62)) {
+		TEST_ASSERT((entry >> 63) == 0);
+		offset = entry & COMPRESSED_MASK;
+
+		memcpy(&len, img + offset, 4);
+		TEST_ASSERT(len <= CLUSTER_SIZE);
+		TEST_EQUAL_UI((entry >> 54) & 0xFF,
+			      ((offset + len + 3) >> 9) - (offset >> 9));
+		TEST_ASSERT(get_refcount(img, offset / CLUSTER_SIZE) >= 1);
+
+		memcpy(guest, img + offset + 4, len);
+	} else {
+		TEST_ASSERT((entry >> 63) != 0);
+		offset = entry & OFFSET_MASK;
+		TEST_EQUAL_UI(get_refcount(img, offset / CLUSTER_SIZE), 1);
+
+		memcpy(guest, img + offset, CLUSTER_SIZE);
+	}
+}
+
+static void check_image(int fd, bool compress, uint64_t clusters,
+			uint64_t l1_table)
+{
+	const uint8_t *img;
+	uint64_t count;
+	struct stat sb;
+	void *map;
+	size_t i;
+
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, clusters * CLUSTER_SIZE);
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	TEST_ASSERT(map != MAP_FAILED);
+	img = map;
+
+	TEST_EQUAL_UI(get_be32(img), 0x514649fb);
+	TEST_EQUAL_UI(get_be32(img + 4), 3);
+	TEST_EQUAL_UI(get_be64(img + 8), 0);
+	TEST_EQUAL_UI(get_be32(img + 20), 16);
+	TEST_EQUAL_UI(get_be64(img + 24), VOLUME_SIZE);
+	TEST_EQUAL_UI(get_be32(img + 32), 0);
+	TEST_EQUAL_UI(get_be32(img + 36), 1);
+	TEST_EQUAL_UI(get_be64(img + 40), l1_table);
+	TEST_EQUAL_UI(get_be32(img + 56), 1);
+	TEST_EQUAL_UI(get_be32(img + 60), 0);
+	TEST_EQUAL_UI(get_be64(img + 72), compress ? 8 : 0);
+	TEST_EQUAL_UI(get_be32(img + 96), 4);
+	TEST_EQUAL_UI(get_be32(img + 100), 112);
+	TEST_EQUAL_UI(img[104], compress ? 1 : 0);
+
+	/* every cluster in the file is referenced, there are no gaps */
+	for (i = 0; i < clusters; ++i)
+		TEST_ASSERT(get_refcount(img, i) >= 1);
+
+	/*
+	  The tables may land on clusters that held data before packing,
+	  whatever is not covered by an entry has to be zero.
+	*/
+	for (i = clusters; i < 32768; ++i)
+		TEST_EQUAL_UI(get_refcount(img, i), 0);
+
+	for (i = 1; i < CLUSTER_SIZE / 8; ++i) {
+		TEST_EQUAL_UI(get_be64(img + get_be64(img + 48) + i * 8), 0);
+		TEST_EQUAL_UI(get_be64(img + l1_table + i * 8), 0);
+	}
+
+	count = get_be64(img + l1_table) & OFFSET_MASK;
+
+	for (i = (BLOCK_COUNT + 15) / 16; i < CLUSTER_SIZE / 8; ++i)
+		TEST_EQUAL_UI(get_be64(img + count + i * 8), 0);
+
+	/* the two compressed clusters share a host cluster */
+	if (compress)
+		TEST_EQUAL_UI(get_refcount(img, 2), 2);
+
+	/* compare the guest view with what was written */
+	for (i = 0; i * CLUSTER_SIZE < VOLUME_SIZE; ++i) {
+		count = VOLUME_SIZE - i * CLUSTER_SIZE;
+		if (count > CLUSTER_SIZE)
+			count = CLUSTER_SIZE;
+
+		read_guest_cluster(img, i);
+		TEST_ASSERT(memcmp(guest, expect + i * CLUSTER_SIZE,
+				   count) == 0);
+	}
+
+	/* a cluster that was only written with zeros is left unallocated */
+	img += l1_table;
+	img = (const uint8_t *)map + (get_be64(img) & OFFSET_MASK);
+	TEST_EQUAL_UI(get_be64(img + 2 * 8), 0);
+
+	munmap(map, sb.st_size);
+}
+
+static void run_test(const char *filename, bool compress)
+{
+	xfrm_stream_t *xfrm = NULL;
+	uint8_t block[4096];
+	struct stat sb;
+	volume_t *vol;
+	size_t i;
+	int fd;
+
+	fd = open_temp_file(filename);
+	TEST_ASSERT(fd > 0);
+
+	if (compress)
+		xfrm = dummy_compressor_create();
+
+	vol = volume_qcow2_create(filename, dup(fd), 1024 * 1024 * 1024, xfrm);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, sizeof(block));
+
+	if (xfrm != NULL) {
+		TEST_EQUAL_UI(((object_t *)xfrm)->refcount, 2);
+		object_drop(xfrm);
+	}
+
+	/*
+	  cluster 0 holds data at the start and the end, so it does not
+	  compress, cluster 1 holds two blocks, one of them moved there from
+	  cluster 3, which is discarded afterwards. Cluster 2 is written but
+	  only zeros and the last cluster is partial.
+	*/
+	memset(expect, 0, sizeof(expect));
+
+	memset(block, 0x11, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 48, block), 0);
+	memcpy(expect + 17 * 4096, block, sizeof(block));
+
+	for (i = 0; i < sizeof(block); ++i)
+		block[i] = i & 0xFF;
+
+	TEST_EQUAL_I(vol->write_block(vol, 0, block), 0);
+	TEST_EQUAL_I(vol->write_block(vol, 15, block), 0);
+	memcpy(expect, block, sizeof(block));
+	memcpy(expect + 15 * 4096, block, sizeof(block));
+
+	memset(block, 0xCD, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 16, block), 0);
+	memcpy(expect + 16 * 4096, block, sizeof(block));
+
+	TEST_EQUAL_I(vol->move_block(vol, 48, 17), 0);
+
+	memset(block, 0xAB, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 64, block), 0);
+	memcpy(expect + 64 * 4096, block, sizeof(block));
+
+	for (i = 0; i < sizeof(block); ++i)
+		block[i] = i & 0xFF;
+
+	TEST_EQUAL_I(vol->write_block(vol, 65, block), 0);
+	memcpy(expect + 65 * 4096, block, 100);
+
+	memset(block, 0, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 32, block), 0);
+
+	TEST_EQUAL_I(vol->discard_blocks(vol, 48, 16), 0);
+
+	/*
+	  The data clusters go straight into the file, the one for cluster 3
+	  is released again, leaving a gap after the header.
+	*/
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, 5 * CLUSTER_SIZE);
+
+	TEST_EQUAL_I(vol->read_block(vol, 17, block), 0);
+	TEST_ASSERT(memcmp(block, expect + 17 * 4096, sizeof(block)) == 0);
+	TEST_EQUAL_I(vol->read_block(vol, 48, block), 0);
+	TEST_ASSERT(is_memory_zero(block, sizeof(block)));
+
+	TEST_EQUAL_I(vol->truncate(vol, 65 * 4096 + 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), BLOCK_COUNT);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	/*
+	  header, the packed data clusters, one L2 table, the L1 table, the
+	  refcount table and a single refcount block. With compression, the
+	  two compressible clusters share a host cluster.
+	*/
+	if (compress) {
+		check_image(fd, true, 7, 4 * CLUSTER_SIZE);
+
+		/* compressed clusters are final */
+		TEST_ASSERT(vol->write_block(vol, 48, block) != 0);
+		TEST_EQUAL_I(vol->commit(vol), 0);
+	} else {
+		check_image(fd, false, 8, 5 * CLUSTER_SIZE);
+
+		/* a new cluster takes the place of the tables */
+		memset(block, 0x22, sizeof(block));
+		TEST_EQUAL_I(vol->write_block(vol, 48, block), 0);
+		memcpy(expect + 48 * 4096, block, sizeof(block));
+
+		TEST_EQUAL_I(vol->commit(vol), 0);
+		check_image(fd, false, 9, 6 * CLUSTER_SIZE);
+	}
+
+	object_drop(vol);
+	close(fd);
+}
+
+int main(void)
+{
+	run_test("test_qcow2.img", false);
+	run_test("test_qcow2_compressed.img", true);
+
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
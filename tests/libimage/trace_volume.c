@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * trace_volume.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "volume.h"
+#include "voltrace.h"
+
+#include <unistd.h>
+
+int main(void)
+{
+	voltrace_summary_t sum;
+	volume_t *vol, *tvol;
+	uint8_t block[512];
+	FILE *fp;
+	int i, fd;
+
+	fd = open_temp_file("test_trace_volume.bin");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_null_create("null", sizeof(block), 64 * sizeof(block));
+	TEST_NOT_NULL(vol);
+
+	tvol = volume_trace_create(vol, "test_trace_volume.bin", dup(fd));
+	TEST_NOT_NULL(tvol);
+	object_drop(vol);
+
+	/* 10 sequential block writes, then 2 random partial ones */
+	memset(block, 0xAA, sizeof(block));
+
+	for (i = 0; i < 10; ++i)
+		TEST_EQUAL_I(tvol->write_block(tvol, i, block), 0);
+
+	TEST_EQUAL_I(tvol->write_partial_block(tvol, 20, block, 10, 50), 0);
+	TEST_EQUAL_I(tvol->write_partial_block(tvol, 15, NULL, 0, 100), 0);
+
+	/* a sequential and a random read */
+	TEST_EQUAL_I(tvol->read_block(tvol, 0, block), 0);
+	TEST_EQUAL_I(tvol->read_block(tvol, 5, block), 0);
+
+	/* moves, discard, failing write past the end */
+	TEST_EQUAL_I(tvol->move_block(tvol, 0, 30), 0);
+	TEST_EQUAL_I(tvol->move_block_partial(tvol, 1, 31, 0, 0, 256), 0);
+	TEST_EQUAL_I(tvol->discard_blocks(tvol, 2, 4), 0);
+	TEST_ASSERT(tvol->write_block(tvol, 100, block) != 0);
+
+	TEST_EQUAL_I(tvol->commit(tvol), 0);
+	object_drop(tvol);
+
+	/* analyze the trace */
+	fp = fdopen(fd, "rb");
+	TEST_NOT_NULL(fp);
+	rewind(fp);
+
+	TEST_EQUAL_I(voltrace_analyze(fp, "test_trace_volume.bin", &sum), 0);
+	fclose(fp);
+
+	TEST_EQUAL_UI(sum.blocksize, sizeof(block));
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_WRITE_BLOCK], 11);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_WRITE_PARTIAL], 2);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_READ_BLOCK], 2);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_MOVE_BLOCK], 1);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_MOVE_PARTIAL], 1);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_DISCARD], 1);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_COMMIT], 1);
+	TEST_EQUAL_UI(sum.count[VOLTRACE_OP_TRUNCATE], 0);
+	TEST_EQUAL_UI(sum.errors, 1);
+
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_WRITE_BLOCK], 11 * sizeof(block));
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_WRITE_PARTIAL], 150);
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_READ_BLOCK], 2 * sizeof(block));
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_MOVE_BLOCK], sizeof(block));
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_MOVE_PARTIAL], 256);
+	TEST_EQUAL_UI(sum.bytes[VOLTRACE_OP_DISCARD], 4 * sizeof(block));
+
+	TEST_EQUAL_UI(sum.seq_writes, 10);
+	TEST_EQUAL_UI(sum.random_writes, 3);
+	TEST_EQUAL_UI(sum.seq_reads, 1);
+	TEST_EQUAL_UI(sum.random_reads, 1);
+	TEST_EQUAL_UI(sum.zero_writes, 1);
+
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
@@ -13,6 +13,7 @@ static char dummy_buffer[31] = "AAABBBCCCDDDEEEFFFGGGHHHIIIJJJ";
 
 static int discard_sequence[10];
 static int num_discarded = 0;
+static int num_discard_calls = 0;
 
 static int compare_ints(const void *lhs, const void *rhs)
 {
@@ -44,6 +45,8 @@ static int dummy_discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
 {
 	(void)vol;
 
+	++num_discard_calls;
+
 	while (index < 10 && count > 0) {
 		discard_sequence[num_discarded++] = index;
 
@@ -68,6 +71,34 @@ static volume_t dummy = {
 	.discard_blocks = dummy_discard_blocks,
 };
 
+static uint64_t huge_discarded = 0;
+static uint64_t huge_end = 0;
+
+static int huge_discard_blocks(volume_t *vol, uint64_t index, uint64_t count)
+{
+	(void)vol;
+
+	if (index != huge_end)
+		return -1;
+
+	huge_discarded += count;
+	huge_end = index + count;
+	return 0;
+}
+
+static volume_t huge = {
+	.base = {
+		.refcount = 1,
+		.destroy = NULL,
+	},
+
+	.blocksize = 4096,
+
+	.write_block = dummy_write_block,
+	.write_partial_block = dummy_write_partial_block,
+	.discard_blocks = huge_discard_blocks,
+};
+
 int main(void)
 {
 	int ret;
@@ -87,6 +118,7 @@ int main(void)
 	TEST_EQUAL_I(ret, 0);
 
 	TEST_EQUAL_I(num_discarded, 3);
+	TEST_EQUAL_I(num_discard_calls, 1);
 	qsort(discard_sequence, 3, sizeof(discard_sequence[0]), compare_ints);
 	TEST_EQUAL_I(discard_sequence[0], 2);
 	TEST_EQUAL_I(discard_sequence[1], 3);
@@ -104,5 +136,18 @@ int main(void)
 	ret = volume_write(&dummy, 28, "WWW", 3);
 	TEST_ASSERT(ret != 0);
 
+	/* discarding runs of 4 GiB or more */
+	ret = volume_write(&huge, 0, NULL, 0x100000000);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(huge_discarded, 0x100000000 / 4096);
+	TEST_EQUAL_UI(huge_end, 0x100000000 / 4096);
+
+	huge_discarded = 0;
+	huge_end = 1;
+	ret = volume_write(&huge, 4096, NULL, 0x110000000);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(huge_discarded, 0x110000000 / 4096);
+	TEST_EQUAL_UI(huge_end, 1 + 0x110000000 / 4096);
+
 	return EXIT_SUCCESS;
 }
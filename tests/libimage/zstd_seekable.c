@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * zstd_seekable.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "threadpool.h"
+#include "volume.h"
+#include "xfrm.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define BLOCK_COUNT (40)
+#define VOLUME_SIZE (BLOCK_COUNT * 4096)
+
+static uint8_t expect[VOLUME_SIZE];
+
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t compress_count;
+
+/*
+  A dummy compressor that stores the data as is, prefixed with its length,
+  so the frame layout can be tested without an actual zstd library.
+ */
+static int dummy_process_data(xfrm_stream_t *stream, const void *in,
+			      uint32_t in_size, void *out, uint32_t out_size,
+			      uint32_t *in_read, uint32_t *out_written,
+			      int flush_mode)
+{
+	(void)stream;
+
+	pthread_mutex_lock(&count_lock);
+	compress_count += 1;
+	pthread_mutex_unlock(&count_lock);
+
+	if (flush_mode != XFRM_STREAM_FLUSH_FULL || out_size < in_size + 4)
+		return XFRM_STREAM_ERROR;
+
+	memcpy(out, &in_size, 4);
+	memcpy((uint8_t *)out + 4, in, in_size);
+
+	*in_read += in_size;
+	*out_written += in_size + 4;
+	return XFRM_STREAM_END;
+}
+
+static void dummy_destroy(object_t *obj)
+{
+	free(obj);
+}
+
+static xfrm_stream_t *dummy_compressor_create(void)
+{
+	xfrm_stream_t *strm = calloc(1, sizeof(*strm));
+
+	if (strm != NULL) {
+		strm->process_data = dummy_process_data;
+		((object_t *)strm)->refcount = 1;
+		((object_t *)strm)->destroy = dummy_destroy;
+	}
+
+	return strm;
+}
+
+static uint32_t get_le32(const uint8_t *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+		((uint32_t)ptr[3] << 24);
+}
+
+static void run_test(const char *filename, uint32_t frame_size,
+		     thread_pool_t *pool)
+{
+	uint32_t i, count, csize, dsize, total;
+	const uint8_t *ptr, *table;
+	uint8_t block[4096];
+	struct stat sb;
+	volume_t *vol;
+	void *map;
+	int fd;
+
+	fd = open_temp_file(filename);
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_zstd_seekable_create(filename, dup(fd), 1024 * 1024,
+					  frame_size,
+					  dummy_compressor_create, pool);
+	TEST_NOT_NULL(vol);
+	TEST_EQUAL_UI(vol->blocksize, sizeof(block));
+
+	/* every other block gets written, the last one partially */
+	memset(expect, 0, sizeof(expect));
+
+	for (i = 0; i < BLOCK_COUNT; i += 2) {
+		memset(block, i + 1, sizeof(block));
+		TEST_EQUAL_I(vol->write_block(vol, i, block), 0);
+		memcpy(expect + i * 4096, block, sizeof(block));
+	}
+
+	memset(block, 0xAA, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, BLOCK_COUNT - 1, block), 0);
+	TEST_EQUAL_I(vol->truncate(vol, VOLUME_SIZE - 4096 + 100), 0);
+	TEST_EQUAL_UI(vol->get_block_count(vol), BLOCK_COUNT);
+	memcpy(expect + VOLUME_SIZE - 4096, block, 100);
+
+	/* the original file must not be touched before commit */
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, 0);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+
+	/* locate the seek table through the footer */
+	count = (VOLUME_SIZE + frame_size - 1) / frame_size;
+
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, VOLUME_SIZE + count * 4 +
+		      8 + count * 8 + 9);
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	TEST_ASSERT(map != MAP_FAILED);
+
+	ptr = (const uint8_t *)map + sb.st_size - 9;
+	TEST_EQUAL_UI(get_le32(ptr), count);
+	TEST_EQUAL_UI(ptr[4], 0);
+	TEST_EQUAL_UI(get_le32(ptr + 5), 0x8F92EAB1);
+
+	table = ptr - count * 8;
+	TEST_EQUAL_UI(get_le32(table - 8), 0x184D2A5E);
+	TEST_EQUAL_UI(get_le32(table - 4), count * 8 + 9);
+
+	/* the frames are stored back to back, in order */
+	ptr = map;
+	total = 0;
+
+	for (i = 0; i < count; ++i) {
+		csize = get_le32(table + i * 8);
+		dsize = get_le32(table + i * 8 + 4);
+
+		TEST_EQUAL_UI(dsize, i < (count - 1) ? frame_size :
+			      VOLUME_SIZE - (count - 1) * frame_size);
+		TEST_EQUAL_UI(csize, dsize + 4);
+		TEST_EQUAL_UI(get_le32(ptr), dsize);
+		TEST_ASSERT(memcmp(ptr + 4, expect + total, dsize) == 0);
+
+		ptr += csize;
+		total += dsize;
+	}
+
+	TEST_EQUAL_UI(total, VOLUME_SIZE);
+	TEST_ASSERT(ptr == table - 8);
+
+	munmap(map, sb.st_size);
+	object_drop(vol);
+	close(fd);
+}
+
+static size_t get_compress_count(void)
+{
+	size_t ret;
+
+	pthread_mutex_lock(&count_lock);
+	ret = compress_count;
+	pthread_mutex_unlock(&count_lock);
+	return ret;
+}
+
+/*
+  Frames are compressed in the background once the writes have moved on
+  past them. A frame that is written to again afterwards has to be
+  compressed again on commit, all others are taken from the cache.
+ */
+static void test_ahead(thread_pool_t *pool)
+{
+	uint8_t block[4096];
+	const uint8_t *ptr;
+	struct stat sb;
+	volume_t *vol;
+	size_t i, j;
+	void *map;
+	int fd;
+
+	fd = open_temp_file("test_zstd_seekable5.img");
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_zstd_seekable_create("test_zstd_seekable5.img", dup(fd),
+					  1024 * 1024, 4096,
+					  dummy_compressor_create, pool);
+	TEST_NOT_NULL(vol);
+
+	pthread_mutex_lock(&count_lock);
+	compress_count = 0;
+	pthread_mutex_unlock(&count_lock);
+
+	for (i = 0; i < 20; ++i) {
+		memset(block, i + 1, sizeof(block));
+		TEST_EQUAL_I(vol->write_block(vol, i, block), 0);
+	}
+
+	/* the last frame is not done yet, it could still be appended to */
+	for (i = 0; i < 1000 && get_compress_count() < 19; ++i)
+		usleep(10000);
+
+	TEST_EQUAL_UI(get_compress_count(), 19);
+
+	memset(block, 0x77, sizeof(block));
+	TEST_EQUAL_I(vol->write_block(vol, 3, block), 0);
+
+	TEST_EQUAL_I(vol->commit(vol), 0);
+	TEST_EQUAL_UI(get_compress_count(), 21);
+
+	TEST_EQUAL_I(fstat(fd, &sb), 0);
+	TEST_EQUAL_UI(sb.st_size, 20 * (4096 + 4) + 8 + 20 * 8 + 9);
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	TEST_ASSERT(map != MAP_FAILED);
+	ptr = map;
+
+	for (i = 0; i < 20; ++i) {
+		TEST_EQUAL_UI(get_le32(ptr), 4096);
+
+		for (j = 0; j < 4096; ++j)
+			TEST_EQUAL_UI(ptr[4 + j], i == 3 ? 0x77 : (i + 1));
+
+		ptr += 4096 + 4;
+	}
+
+	munmap(map, sb.st_size);
+	object_drop(vol);
+	close(fd);
+}
+
+int main(void)
+{
+	thread_pool_t *pool;
+
+	/* one frame per block, and frames that don't divide the volume */
+	run_test("test_zstd_seekable1.img", 4096, NULL);
+	run_test("test_zstd_seekable2.img", 3 * 4096, NULL);
+
+	/* same thing, with frames compressed out of order */
+	pool = thread_pool_create(4);
+	TEST_NOT_NULL(pool);
+
+	run_test("test_zstd_seekable3.img", 4096, pool);
+	run_test("test_zstd_seekable4.img", 3 * 4096, pool);
+	test_ahead(pool);
+
+	object_drop(pool);
+
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
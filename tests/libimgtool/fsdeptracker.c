@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * fsdeptracker.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+#include "fsdeptracker.h"
+#include "filesystem.h"
+#include "fstree.h"
+#include "volume.h"
+#include "util.h"
+
+static filesystem_t *create_tar(fs_dep_tracker_t *tracker, const char *name)
+{
+	filesystem_t *fs;
+	volume_t *vol;
+	int fd, ret;
+
+	fd = open_temp_file(name);
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_from_fd(name, fd, 131072);
+	TEST_NOT_NULL(vol);
+
+	ret = tracker->add_volume(tracker, vol, NULL);
+	TEST_EQUAL_I(ret, 0);
+
+	fs = filesystem_tar_create(vol);
+	TEST_NOT_NULL(fs);
+
+	ret = tracker->add_fs(tracker, fs, vol, name);
+	TEST_EQUAL_I(ret, 0);
+
+	object_drop(vol);
+	return fs;
+}
+
+static filesystem_t *create_nested(fs_dep_tracker_t *tracker,
+				   filesystem_t *parent, const char *path,
+				   const char *name)
+{
+	filesystem_t *fs;
+	tree_node_t *node;
+	volume_t *vol;
+	int ret;
+
+	node = fstree_add_file(parent->fstree, path);
+	TEST_NOT_NULL(node);
+
+	vol = fstree_file_volume_create(parent->fstree, node,
+					512, 0, 131072);
+	TEST_NOT_NULL(vol);
+
+	ret = tracker->add_volume_file(tracker, vol, parent);
+	TEST_EQUAL_I(ret, 0);
+
+	fs = filesystem_cpio_create(vol);
+	TEST_NOT_NULL(fs);
+
+	ret = tracker->add_fs(tracker, fs, vol, name);
+	TEST_EQUAL_I(ret, 0);
+
+	object_drop(vol);
+	return fs;
+}
+
+/*
+  Create a disk with two partitions and three filesystems, the first two
+  on the same partition, the last one on the other partition.
+ */
+static void create_partitioned(fs_dep_tracker_t *tracker, const char *name,
+			       filesystem_t *out[3])
+{
+	partition_t *part[2];
+	partition_mgr_t *mgr;
+	volume_t *vol;
+	int fd, ret;
+	size_t i;
+
+	fd = open_temp_file(name);
+	TEST_ASSERT(fd > 0);
+
+	vol = volume_from_fd(name, fd, 16 * 1024 * 1024);
+	TEST_NOT_NULL(vol);
+
+	ret = tracker->add_volume(tracker, vol, NULL);
+	TEST_EQUAL_I(ret, 0);
+
+	mgr = mbrdisk_create(vol);
+	TEST_NOT_NULL(mgr);
+
+	ret = tracker->add_partition_mgr(tracker, mgr, vol);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < 2; ++i) {
+		part[i] = mgr->create_parition(mgr, 0,
+					       COMMON_PARTITION_FLAG_GROW);
+		TEST_NOT_NULL(part[i]);
+
+		ret = tracker->add_partition(tracker, part[i], mgr);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	for (i = 0; i < 3; ++i) {
+		volume_t *pvol = (volume_t *)part[i < 2 ? 0 : 1];
+
+		out[i] = filesystem_cpio_create(pvol);
+		TEST_NOT_NULL(out[i]);
+
+		ret = tracker->add_fs(tracker, out[i], pvol, "part");
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	object_drop(part[0]);
+	object_drop(part[1]);
+	object_drop(mgr);
+	object_drop(vol);
+}
+
+int main(void)
+{
+	filesystem_t *a, *b, *a1, *a2, *b1, *unknown, *p[3];
+	fs_dep_tracker_t *tracker;
+
+	tracker = fs_dep_tracker_create();
+	TEST_NOT_NULL(tracker);
+
+	a = create_tar(tracker, "test_deptracker_a.tar");
+	b = create_tar(tracker, "test_deptracker_b.tar");
+
+	a1 = create_nested(tracker, a, "/a1.cpio", "a1");
+	a2 = create_nested(tracker, a, "/a2.cpio", "a2");
+	b1 = create_nested(tracker, b, "/b1.cpio", "b1");
+
+	/* same filesystem */
+	TEST_ASSERT(tracker->fs_overlap(tracker, a, a));
+	TEST_ASSERT(tracker->fs_overlap(tracker, a1, a1));
+
+	/* parent and nested child */
+	TEST_ASSERT(tracker->fs_overlap(tracker, a, a1));
+	TEST_ASSERT(tracker->fs_overlap(tracker, a2, a));
+
+	/* siblings stored in the same parent filesystem */
+	TEST_ASSERT(tracker->fs_overlap(tracker, a1, a2));
+
+	/* filesystems on independent volumes */
+	TEST_ASSERT(!tracker->fs_overlap(tracker, a, b));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, a1, b));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, a2, b1));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, b1, a));
+
+	/* filesystems on a common volume, or on separate partitions */
+	create_partitioned(tracker, "test_deptracker_p.bin", p);
+
+	TEST_ASSERT(tracker->fs_overlap(tracker, p[0], p[1]));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, p[0], p[2]));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, p[2], p[1]));
+	TEST_ASSERT(!tracker->fs_overlap(tracker, p[2], a));
+
+	/* unknown filesystems are never considered independent */
+	unknown = filesystem_cpio_create(a->fstree->volume);
+	TEST_NOT_NULL(unknown);
+	TEST_ASSERT(tracker->fs_overlap(tracker, unknown, b));
+
+	object_drop(unknown);
+	object_drop(p[2]);
+	object_drop(p[1]);
+	object_drop(p[0]);
+	object_drop(b1);
+	object_drop(a2);
+	object_drop(a1);
+	object_drop(b);
+	object_drop(a);
+	object_drop(tracker);
+	cleanup_temp_files();
+	return EXIT_SUCCESS;
+}
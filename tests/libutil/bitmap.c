@@ -125,6 +125,49 @@ int main(void)
 		TEST_ASSERT(!bitmap_is_set(bitmap, i));
 	}
 
+	/* set a range that crosses word boundaries */
+	TEST_EQUAL_I(bitmap_set_range(bitmap, 60, 200), 0);
+	TEST_EQUAL_UI(bitmap_msb_index(bitmap), 259);
+	TEST_EQUAL_UI(bitmap_count_set(bitmap, 0, 32768), 200);
+	TEST_EQUAL_UI(bitmap_count_set(bitmap, 61, 3), 3);
+	TEST_EQUAL_UI(bitmap_count_set(bitmap, 250, 100), 10);
+
+	for (i = 0; i < 32768; ++i) {
+		TEST_EQUAL_I(bitmap_is_set(bitmap, i), (i >= 60 && i < 260));
+	}
+
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 0), 60);
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 100), 100);
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 260), SIZE_MAX);
+	TEST_EQUAL_UI(bitmap_find_next_clear(bitmap, 0), 0);
+	TEST_EQUAL_UI(bitmap_find_next_clear(bitmap, 60), 260);
+
+	/* punch a hole into it */
+	bitmap_clear_range(bitmap, 64, 128);
+	TEST_EQUAL_UI(bitmap_msb_index(bitmap), 259);
+	TEST_EQUAL_UI(bitmap_count_set(bitmap, 0, 32768), 72);
+
+	for (i = 0; i < 32768; ++i) {
+		TEST_EQUAL_I(bitmap_is_set(bitmap, i),
+			     (i >= 60 && i < 64) || (i >= 192 && i < 260));
+	}
+
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 61), 61);
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 64), 192);
+	TEST_EQUAL_UI(bitmap_find_next_clear(bitmap, 60), 64);
+	TEST_EQUAL_UI(bitmap_find_next_clear(bitmap, 192), 260);
+
+	/* grow the bitmap with a range, clear everything past the end */
+	TEST_EQUAL_I(bitmap_set_range(bitmap, 65530, 70), 0);
+	TEST_EQUAL_UI(bitmap_msb_index(bitmap), 65599);
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 260), 65530);
+	TEST_EQUAL_UI(bitmap_find_next_clear(bitmap, 65530), 65600);
+
+	bitmap_clear_range(bitmap, 0, SIZE_MAX);
+	TEST_EQUAL_UI(bitmap_msb_index(bitmap), 0);
+	TEST_EQUAL_UI(bitmap_find_next_set(bitmap, 0), SIZE_MAX);
+	TEST_EQUAL_UI(bitmap_count_set(bitmap, 0, SIZE_MAX), 0);
+
 	object_drop(bitmap);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * crc32.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "util.h"
+
+static const struct {
+	const char *input;
+	uint32_t crc;
+} vectors[] = {
+	{ "", 0x00000000 },
+	{ "a", 0xE8B7BE43 },
+	{ "123456789", 0xCBF43926 },
+	{ "The quick brown fox jumps over the lazy dog", 0x414FA339 },
+};
+
+static uint8_t buffer[1031];
+
+static uint32_t crc32_bitwise(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i, j;
+
+	for (i = 0; i < size; ++i) {
+		crc ^= data[i];
+
+		for (j = 0; j < 8; ++j)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+	}
+
+	return ~crc;
+}
+
+int main(void)
+{
+	uint32_t crc, ref;
+	size_t i;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+		crc = crc32_ieee(0, vectors[i].input,
+				 strlen(vectors[i].input));
+
+		if (crc != vectors[i].crc) {
+			fprintf(stderr, "Test vector %zu: expected 0x%08X, "
+				"got 0x%08X\n", i, (unsigned int)vectors[i].crc,
+				(unsigned int)crc);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* compare against the naive implementation, at every alignment */
+	for (i = 0; i < sizeof(buffer); ++i)
+		buffer[i] = (i * 7919) ^ (i >> 3);
+
+	for (i = 0; i < sizeof(buffer); ++i) {
+		ref = crc32_bitwise(buffer + i, sizeof(buffer) - i);
+		crc = crc32_ieee(0, buffer + i, sizeof(buffer) - i);
+		TEST_EQUAL_UI(crc, ref);
+
+		/* must be possible to split the computation */
+		ref = crc32_bitwise(buffer, sizeof(buffer));
+		crc = crc32_ieee(0, buffer, i);
+		crc = crc32_ieee(crc, buffer + i, sizeof(buffer) - i);
+		TEST_EQUAL_UI(crc, ref);
+	}
+
+	return EXIT_SUCCESS;
+}
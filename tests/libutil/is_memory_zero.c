@@ -12,7 +12,7 @@
 int main(void)
 {
 	unsigned char temp[1024];
-	size_t i, j;
+	size_t i, j, k;
 
 	memset(temp, 0, sizeof(temp));
 
@@ -28,5 +28,31 @@ int main(void)
 		}
 	}
 
+	/* find the first non-zero byte, at all possible alignments */
+	for (i = 0; i < 16; ++i) {
+		for (j = i; j < sizeof(temp); ++j) {
+			TEST_EQUAL_UI(find_nonzero_byte(temp + i,
+							sizeof(temp) - i),
+				      sizeof(temp) - i);
+
+			temp[j] = 0x80;
+
+			TEST_EQUAL_UI(find_nonzero_byte(temp + i,
+							sizeof(temp) - i),
+				      j - i);
+
+			for (k = j + 1; k < sizeof(temp); k += 37)
+				temp[k] = 1;
+
+			TEST_EQUAL_UI(find_nonzero_byte(temp + i,
+							sizeof(temp) - i),
+				      j - i);
+			TEST_EQUAL_UI(find_nonzero_byte(temp + i, j - i),
+				      j - i);
+
+			memset(temp, 0, sizeof(temp));
+		}
+	}
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * sha256.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "sha256.h"
+
+static const struct {
+	const char *input;
+	size_t repeat;
+	const char *digest;
+} vectors[] = {
+	{
+		"", 1,
+		"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+	}, {
+		"abc", 1,
+		"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+	}, {
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+	}, {
+		"a", 1000000,
+		"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+	}, {
+		"0123456701234567012345670123456701234567012345670123456701234567",
+		10,
+		"594847328451bdfa85056225462cc1d867d877fb388df0ce35f25ab5562bfbb5",
+	},
+};
+
+int main(void)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char str[2 * SHA256_DIGEST_SIZE + 1];
+	sha256_t ctx;
+	size_t i, j;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+		sha256_init(&ctx);
+
+		for (j = 0; j < vectors[i].repeat; ++j) {
+			sha256_update(&ctx, vectors[i].input,
+				      strlen(vectors[i].input));
+		}
+
+		sha256_final(&ctx, digest);
+		sha256_to_hex(digest, str);
+
+		if (strcmp(str, vectors[i].digest) != 0) {
+			fprintf(stderr, "Test vector %zu: expected %s, got %s\n",
+				i, vectors[i].digest, str);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * threadpool.c
+ *
+ * Copyright (C) 2021 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "test.h"
+#include "threadpool.h"
+
+#define TASK_COUNT (1000)
+#define OUTER_COUNT (10)
+
+typedef struct {
+	thread_pool_t *pool;
+	size_t index;
+} outer_task_t;
+
+static int done[OUTER_COUNT * TASK_COUNT];
+static outer_task_t outer[OUTER_COUNT];
+
+static int inner_task(void *arg)
+{
+	int *ptr = arg;
+
+	__atomic_add_fetch(ptr, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int failing_task(void *arg)
+{
+	(void)arg;
+	return -1;
+}
+
+/* submits more tasks and waits for them, from within a task */
+static int outer_task(void *arg)
+{
+	outer_task_t *task = arg;
+	thread_pool_group_t group;
+	int ret = 0;
+	size_t i;
+
+	memset(&group, 0, sizeof(group));
+
+	for (i = 0; i < TASK_COUNT; ++i) {
+		ret = thread_pool_submit(task->pool, &group, inner_task,
+					 done + task->index * TASK_COUNT + i);
+		if (ret != 0)
+			break;
+	}
+
+	/* the group is on the stack, so always wait for it */
+	if (thread_pool_wait(task->pool, &group))
+		ret = -1;
+
+	return ret;
+}
+
+static void run_test(size_t num_threads)
+{
+	thread_pool_group_t group;
+	thread_pool_t *pool;
+	size_t i;
+
+	pool = thread_pool_create(num_threads);
+	TEST_NOT_NULL(pool);
+	TEST_ASSERT(thread_pool_get_thread_count(pool) >= 1);
+	TEST_ASSERT(thread_pool_get_thread_count(pool) <=
+		    (num_threads > 1 ? num_threads : 1));
+
+	/* nested tasks */
+	memset(done, 0, sizeof(done));
+	memset(&group, 0, sizeof(group));
+
+	for (i = 0; i < OUTER_COUNT; ++i) {
+		outer[i].pool = pool;
+		outer[i].index = i;
+		TEST_EQUAL_I(thread_pool_submit(pool, &group, outer_task,
+						outer + i), 0);
+	}
+
+	TEST_EQUAL_I(thread_pool_wait(pool, &group), 0);
+	TEST_EQUAL_UI(group.pending, 0);
+
+	for (i = 0; i < OUTER_COUNT * TASK_COUNT; ++i)
+		TEST_EQUAL_I(done[i], 1);
+
+	/* a failing task fails the group */
+	memset(&group, 0, sizeof(group));
+
+	for (i = 0; i < TASK_COUNT; ++i) {
+		TEST_EQUAL_I(thread_pool_submit(pool, &group,
+						i == (TASK_COUNT / 2) ?
+						failing_task : inner_task,
+						done + i), 0);
+	}
+
+	TEST_EQUAL_I(thread_pool_wait(pool, &group), -1);
+	TEST_EQUAL_UI(group.pending, 0);
+
+	object_drop(pool);
+}
+
+int main(void)
+{
+	run_test(0);
+	run_test(1);
+	run_test(4);
+	return EXIT_SUCCESS;
+}